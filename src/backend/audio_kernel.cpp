@@ -0,0 +1,684 @@
+#include "audio_kernel.h"
+#include "config.h"
+#include "math_util.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NUKED_HAVE_SSE2 1
+#else
+#define NUKED_HAVE_SSE2 0
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define NUKED_HAVE_NEON 1
+#else
+#define NUKED_HAVE_NEON 0
+#endif
+
+// Scalar kernels. These define the exact results every other implementation has to match; the vector kernels also use
+// them for the samples that don't fill a whole vector.
+
+void AUDIO_NormalizeS16Scalar(int16_t* dest, const int32_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = (int16_t)Clamp<int32_t>(src[i] >> 15, INT16_MIN, INT16_MAX);
+    }
+}
+
+void AUDIO_NormalizeS32Scalar(int32_t* dest, const int32_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = (int32_t)Clamp<int64_t>((int64_t)src[i] * 2, INT32_MIN, INT32_MAX);
+    }
+}
+
+void AUDIO_NormalizeF32Scalar(float* dest, const int32_t* src, size_t count)
+{
+    constexpr float DIV_REC = 1.0f / 536870912.0f;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = (float)src[i] * DIV_REC;
+    }
+}
+
+void AUDIO_GainS16Scalar(int16_t* samples, size_t count, float gain)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Anything past +-65536 saturates anyway, clamping first keeps the conversion in range
+        const float scaled = Clamp((float)samples[i] * gain, -65536.0f, 65536.0f);
+        samples[i]         = (int16_t)Clamp<int32_t>((int32_t)scaled, INT16_MIN, INT16_MAX);
+    }
+}
+
+void AUDIO_GainS32Scalar(int32_t* samples, size_t count, float gain)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float scaled = (float)samples[i] * gain;
+        if (scaled >= 2147483648.0f)
+        {
+            samples[i] = INT32_MAX;
+        }
+        else if (scaled <= -2147483648.0f)
+        {
+            samples[i] = INT32_MIN;
+        }
+        else
+        {
+            samples[i] = (int32_t)scaled;
+        }
+    }
+}
+
+void AUDIO_GainF32Scalar(float* samples, size_t count, float gain)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        samples[i] = samples[i] * gain;
+    }
+}
+
+void AUDIO_MixS16Scalar(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        int32_t sum = 0;
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            sum += srcs[k][i];
+        }
+        dest[i] = (int16_t)Clamp<int32_t>(sum, INT16_MIN, INT16_MAX);
+    }
+}
+
+void AUDIO_MixS32Scalar(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        int64_t sum = 0;
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            sum += srcs[k][i];
+        }
+        dest[i] = (int32_t)Clamp<int64_t>(sum, INT32_MIN, INT32_MAX);
+    }
+}
+
+void AUDIO_MixF32Scalar(float* dest, const float* const* srcs, size_t src_count, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Summed from zero in source order, which the vector kernels replicate exactly
+        float sum = 0.0f;
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            sum += srcs[k][i];
+        }
+        dest[i] = sum;
+    }
+}
+
+// Adds up the partial sums of AUDIO_ResampleScalar in the order the vector kernels reduce them.
+static float AUDIO_ReduceResampleSums(const float* sums)
+{
+    const float x0 = sums[0] + sums[4];
+    const float x1 = sums[1] + sums[5];
+    const float x2 = sums[2] + sums[6];
+    const float x3 = sums[3] + sums[7];
+    return (x0 + x2) + (x1 + x3);
+}
+
+void AUDIO_ResampleScalar(float*       dest,
+                          const float* left,
+                          const float* right,
+                          const float* filter,
+                          const float* next_filter,
+                          float        frac,
+                          size_t       taps)
+{
+    float sum_l[AUDIO_RESAMPLE_TAP_ALIGN]{};
+    float sum_r[AUDIO_RESAMPLE_TAP_ALIGN]{};
+    for (size_t i = 0; i < taps; i += AUDIO_RESAMPLE_TAP_ALIGN)
+    {
+        for (size_t j = 0; j < AUDIO_RESAMPLE_TAP_ALIGN; ++j)
+        {
+            const float a    = filter[i + j];
+            const float coef = a + (next_filter[i + j] - a) * frac;
+            sum_l[j] += left[i + j] * coef;
+            sum_r[j] += right[i + j] * coef;
+        }
+    }
+    dest[0] = AUDIO_ReduceResampleSums(sum_l);
+    dest[1] = AUDIO_ReduceResampleSums(sum_r);
+}
+
+// Used by the vector kernels to offset every source by the samples they already processed.
+template <typename T>
+static void AUDIO_OffsetSources(const T** out, const T* const* srcs, size_t src_count, size_t offset)
+{
+    for (size_t k = 0; k < src_count; ++k)
+    {
+        out[k] = srcs[k] + offset;
+    }
+}
+
+static constexpr audio_kernels_t AUDIO_KERNELS_SCALAR = {
+    .normalize_s16 = AUDIO_NormalizeS16Scalar,
+    .normalize_s32 = AUDIO_NormalizeS32Scalar,
+    .normalize_f32 = AUDIO_NormalizeF32Scalar,
+    .gain_s16      = AUDIO_GainS16Scalar,
+    .gain_s32      = AUDIO_GainS32Scalar,
+    .gain_f32      = AUDIO_GainF32Scalar,
+    .mix_s16       = AUDIO_MixS16Scalar,
+    .mix_s32       = AUDIO_MixS32Scalar,
+    .mix_f32       = AUDIO_MixF32Scalar,
+    .resample      = AUDIO_ResampleScalar,
+};
+
+#if NUKED_HAVE_SSE2
+static void AUDIO_NormalizeS16SSE2(int16_t* dest, const int32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(src + i)), 15);
+        const __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(src + i + 4)), 15);
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi32(a, b));
+    }
+    AUDIO_NormalizeS16Scalar(dest + i, src + i, count - i);
+}
+
+// x * 2, saturated
+static inline __m128i AUDIO_SatDoubleSSE2(__m128i x)
+{
+    const __m128i doubled  = _mm_slli_epi32(x, 1);
+    const __m128i overflow = _mm_srai_epi32(_mm_xor_si128(x, doubled), 31);
+    const __m128i limit    = _mm_xor_si128(_mm_srai_epi32(x, 31), _mm_set1_epi32(INT32_MAX));
+    return _mm_or_si128(_mm_and_si128(overflow, limit), _mm_andnot_si128(overflow, doubled));
+}
+
+static void AUDIO_NormalizeS32SSE2(int32_t* dest, const int32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dest + i), AUDIO_SatDoubleSSE2(x));
+    }
+    AUDIO_NormalizeS32Scalar(dest + i, src + i, count - i);
+}
+
+static void AUDIO_NormalizeF32SSE2(float* dest, const int32_t* src, size_t count)
+{
+    const __m128 div_rec = _mm_set1_ps(1.0f / 536870912.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(x), div_rec));
+    }
+    AUDIO_NormalizeF32Scalar(dest + i, src + i, count - i);
+}
+
+// Sign extends the low/high four int16 of `v` to int32.
+static inline __m128i AUDIO_WidenLoSSE2(__m128i v)
+{
+    return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
+
+static inline __m128i AUDIO_WidenHiSSE2(__m128i v)
+{
+    return _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+}
+
+static inline __m128i AUDIO_ScaleS16SSE2(__m128i x, __m128 gain)
+{
+    __m128 scaled = _mm_mul_ps(_mm_cvtepi32_ps(x), gain);
+    scaled        = _mm_min_ps(_mm_max_ps(scaled, _mm_set1_ps(-65536.0f)), _mm_set1_ps(65536.0f));
+    return _mm_cvttps_epi32(scaled);
+}
+
+static void AUDIO_GainS16SSE2(int16_t* samples, size_t count, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i v  = _mm_loadu_si128((const __m128i*)(samples + i));
+        const __m128i lo = AUDIO_ScaleS16SSE2(AUDIO_WidenLoSSE2(v), g);
+        const __m128i hi = AUDIO_ScaleS16SSE2(AUDIO_WidenHiSSE2(v), g);
+        _mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi32(lo, hi));
+    }
+    AUDIO_GainS16Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_GainS32SSE2(int32_t* samples, size_t count, float gain)
+{
+    const __m128  g     = _mm_set1_ps(gain);
+    const __m128  limit = _mm_set1_ps(2147483648.0f);
+    const __m128i max   = _mm_set1_epi32(INT32_MAX);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 scaled = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(samples + i))), g);
+        // cvttps already produces INT32_MIN for anything out of range, which is only wrong for positive values
+        const __m128i result = _mm_cvttps_epi32(scaled);
+        const __m128i big    = _mm_castps_si128(_mm_cmpge_ps(scaled, limit));
+        _mm_storeu_si128((__m128i*)(samples + i), _mm_or_si128(_mm_andnot_si128(big, result), _mm_and_si128(big, max)));
+    }
+    AUDIO_GainS32Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_GainF32SSE2(float* samples, size_t count, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+    }
+    AUDIO_GainF32Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_MixS16SSE2(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(srcs[k] + i));
+            lo              = _mm_add_epi32(lo, AUDIO_WidenLoSSE2(v));
+            hi              = _mm_add_epi32(hi, AUDIO_WidenHiSSE2(v));
+        }
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_packs_epi32(lo, hi));
+    }
+
+    const int16_t* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixS16Scalar(dest + i, rest, src_count, count - i);
+}
+
+// SSE2 has no 64-bit compares, so instead of widening, each int32 is split into its signed high half and unsigned low
+// half. Both sums fit in int32 for up to AUDIO_MAX_MIX_SOURCES sources, and the high half of the total tells whether
+// it's in range.
+static void AUDIO_MixS32SSE2(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count)
+{
+    const __m128i low_mask = _mm_set1_epi32(0xffff);
+    const __m128i hi_max   = _mm_set1_epi32(INT16_MAX);
+    const __m128i hi_min   = _mm_set1_epi32(INT16_MIN);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i hi = _mm_setzero_si128();
+        __m128i lo = _mm_setzero_si128();
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(srcs[k] + i));
+            hi              = _mm_add_epi32(hi, _mm_srai_epi32(v, 16));
+            lo              = _mm_add_epi32(lo, _mm_and_si128(v, low_mask));
+        }
+        hi = _mm_add_epi32(hi, _mm_srai_epi32(lo, 16));
+        lo = _mm_and_si128(lo, low_mask);
+
+        const __m128i sum   = _mm_or_si128(_mm_slli_epi32(hi, 16), lo);
+        const __m128i over  = _mm_cmpgt_epi32(hi, hi_max);
+        const __m128i under = _mm_cmplt_epi32(hi, hi_min);
+        const __m128i clip  = _mm_or_si128(_mm_and_si128(over, _mm_set1_epi32(INT32_MAX)),
+                                          _mm_and_si128(under, _mm_set1_epi32(INT32_MIN)));
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_or_si128(_mm_andnot_si128(_mm_or_si128(over, under), sum), clip));
+    }
+
+    const int32_t* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixS32Scalar(dest + i, rest, src_count, count - i);
+}
+
+static void AUDIO_MixF32SSE2(float* dest, const float* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            sum = _mm_add_ps(sum, _mm_loadu_ps(srcs[k] + i));
+        }
+        _mm_storeu_ps(dest + i, sum);
+    }
+
+    const float* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixF32Scalar(dest + i, rest, src_count, count - i);
+}
+
+// Reduces the two accumulators of a channel to one sample, see AUDIO_ReduceResampleSums.
+static inline float AUDIO_ReduceResampleSSE2(__m128 lo, __m128 hi)
+{
+    const __m128 x = _mm_add_ps(lo, hi);
+    const __m128 y = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_add_ss(y, _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+static void AUDIO_ResampleSSE2(float*       dest,
+                               const float* left,
+                               const float* right,
+                               const float* filter,
+                               const float* next_filter,
+                               float        frac,
+                               size_t       taps)
+{
+    const __m128 f = _mm_set1_ps(frac);
+
+    __m128 l0 = _mm_setzero_ps();
+    __m128 l1 = _mm_setzero_ps();
+    __m128 r0 = _mm_setzero_ps();
+    __m128 r1 = _mm_setzero_ps();
+    for (size_t i = 0; i < taps; i += 8)
+    {
+        const __m128 a0 = _mm_loadu_ps(filter + i);
+        const __m128 a1 = _mm_loadu_ps(filter + i + 4);
+        const __m128 c0 = _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(next_filter + i), a0), f));
+        const __m128 c1 = _mm_add_ps(a1, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(next_filter + i + 4), a1), f));
+
+        l0 = _mm_add_ps(l0, _mm_mul_ps(_mm_loadu_ps(left + i), c0));
+        l1 = _mm_add_ps(l1, _mm_mul_ps(_mm_loadu_ps(left + i + 4), c1));
+        r0 = _mm_add_ps(r0, _mm_mul_ps(_mm_loadu_ps(right + i), c0));
+        r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_loadu_ps(right + i + 4), c1));
+    }
+    dest[0] = AUDIO_ReduceResampleSSE2(l0, l1);
+    dest[1] = AUDIO_ReduceResampleSSE2(r0, r1);
+}
+
+static constexpr audio_kernels_t AUDIO_KERNELS_SSE2 = {
+    .normalize_s16 = AUDIO_NormalizeS16SSE2,
+    .normalize_s32 = AUDIO_NormalizeS32SSE2,
+    .normalize_f32 = AUDIO_NormalizeF32SSE2,
+    .gain_s16      = AUDIO_GainS16SSE2,
+    .gain_s32      = AUDIO_GainS32SSE2,
+    .gain_f32      = AUDIO_GainF32SSE2,
+    .mix_s16       = AUDIO_MixS16SSE2,
+    .mix_s32       = AUDIO_MixS32SSE2,
+    .mix_f32       = AUDIO_MixF32SSE2,
+    .resample      = AUDIO_ResampleSSE2,
+};
+#endif
+
+#if NUKED_HAVE_NEON
+static void AUDIO_NormalizeS16NEON(int16_t* dest, const int32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const int16x4_t a = vqmovn_s32(vshrq_n_s32(vld1q_s32(src + i), 15));
+        const int16x4_t b = vqmovn_s32(vshrq_n_s32(vld1q_s32(src + i + 4), 15));
+        vst1q_s16(dest + i, vcombine_s16(a, b));
+    }
+    AUDIO_NormalizeS16Scalar(dest + i, src + i, count - i);
+}
+
+static void AUDIO_NormalizeS32NEON(int32_t* dest, const int32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_s32(dest + i, vqshlq_n_s32(vld1q_s32(src + i), 1));
+    }
+    AUDIO_NormalizeS32Scalar(dest + i, src + i, count - i);
+}
+
+static void AUDIO_NormalizeF32NEON(float* dest, const int32_t* src, size_t count)
+{
+    const float32x4_t div_rec = vdupq_n_f32(1.0f / 536870912.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_f32(dest + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(src + i)), div_rec));
+    }
+    AUDIO_NormalizeF32Scalar(dest + i, src + i, count - i);
+}
+
+static inline int16x4_t AUDIO_ScaleS16NEON(int16x4_t x, float32x4_t gain)
+{
+    float32x4_t scaled = vmulq_f32(vcvtq_f32_s32(vmovl_s16(x)), gain);
+    scaled             = vminq_f32(vmaxq_f32(scaled, vdupq_n_f32(-65536.0f)), vdupq_n_f32(65536.0f));
+    return vqmovn_s32(vcvtq_s32_f32(scaled));
+}
+
+static void AUDIO_GainS16NEON(int16_t* samples, size_t count, float gain)
+{
+    const float32x4_t g = vdupq_n_f32(gain);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const int16x8_t v = vld1q_s16(samples + i);
+        vst1q_s16(samples + i,
+                  vcombine_s16(AUDIO_ScaleS16NEON(vget_low_s16(v), g), AUDIO_ScaleS16NEON(vget_high_s16(v), g)));
+    }
+    AUDIO_GainS16Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_GainS32NEON(int32_t* samples, size_t count, float gain)
+{
+    const float32x4_t g = vdupq_n_f32(gain);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        // vcvtq saturates, matching the scalar kernel
+        vst1q_s32(samples + i, vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(samples + i)), g)));
+    }
+    AUDIO_GainS32Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_GainF32NEON(float* samples, size_t count, float gain)
+{
+    const float32x4_t g = vdupq_n_f32(gain);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), g));
+    }
+    AUDIO_GainF32Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_MixS16NEON(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        int32x4_t lo = vdupq_n_s32(0);
+        int32x4_t hi = vdupq_n_s32(0);
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            const int16x8_t v = vld1q_s16(srcs[k] + i);
+            lo                = vaddw_s16(lo, vget_low_s16(v));
+            hi                = vaddw_s16(hi, vget_high_s16(v));
+        }
+        vst1q_s16(dest + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+
+    const int16_t* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixS16Scalar(dest + i, rest, src_count, count - i);
+}
+
+static void AUDIO_MixS32NEON(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        int64x2_t lo = vdupq_n_s64(0);
+        int64x2_t hi = vdupq_n_s64(0);
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            const int32x4_t v = vld1q_s32(srcs[k] + i);
+            lo                = vaddw_s32(lo, vget_low_s32(v));
+            hi                = vaddw_s32(hi, vget_high_s32(v));
+        }
+        vst1q_s32(dest + i, vcombine_s32(vqmovn_s64(lo), vqmovn_s64(hi)));
+    }
+
+    const int32_t* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixS32Scalar(dest + i, rest, src_count, count - i);
+}
+
+static void AUDIO_MixF32NEON(float* dest, const float* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            sum = vaddq_f32(sum, vld1q_f32(srcs[k] + i));
+        }
+        vst1q_f32(dest + i, sum);
+    }
+
+    const float* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixF32Scalar(dest + i, rest, src_count, count - i);
+}
+
+// Reduces the two accumulators of a channel to one sample, see AUDIO_ReduceResampleSums.
+static inline float AUDIO_ReduceResampleNEON(float32x4_t lo, float32x4_t hi)
+{
+    const float32x4_t x = vaddq_f32(lo, hi);
+    const float32x2_t y = vadd_f32(vget_low_f32(x), vget_high_f32(x));
+    return vget_lane_f32(y, 0) + vget_lane_f32(y, 1);
+}
+
+static void AUDIO_ResampleNEON(float*       dest,
+                               const float* left,
+                               const float* right,
+                               const float* filter,
+                               const float* next_filter,
+                               float        frac,
+                               size_t       taps)
+{
+    const float32x4_t f = vdupq_n_f32(frac);
+
+    float32x4_t l0 = vdupq_n_f32(0.0f);
+    float32x4_t l1 = vdupq_n_f32(0.0f);
+    float32x4_t r0 = vdupq_n_f32(0.0f);
+    float32x4_t r1 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < taps; i += 8)
+    {
+        // Multiplies and adds are kept separate, a fused vfmaq would round differently from the scalar kernel
+        const float32x4_t a0 = vld1q_f32(filter + i);
+        const float32x4_t a1 = vld1q_f32(filter + i + 4);
+        const float32x4_t c0 = vaddq_f32(a0, vmulq_f32(vsubq_f32(vld1q_f32(next_filter + i), a0), f));
+        const float32x4_t c1 = vaddq_f32(a1, vmulq_f32(vsubq_f32(vld1q_f32(next_filter + i + 4), a1), f));
+
+        l0 = vaddq_f32(l0, vmulq_f32(vld1q_f32(left + i), c0));
+        l1 = vaddq_f32(l1, vmulq_f32(vld1q_f32(left + i + 4), c1));
+        r0 = vaddq_f32(r0, vmulq_f32(vld1q_f32(right + i), c0));
+        r1 = vaddq_f32(r1, vmulq_f32(vld1q_f32(right + i + 4), c1));
+    }
+    dest[0] = AUDIO_ReduceResampleNEON(l0, l1);
+    dest[1] = AUDIO_ReduceResampleNEON(r0, r1);
+}
+
+static constexpr audio_kernels_t AUDIO_KERNELS_NEON = {
+    .normalize_s16 = AUDIO_NormalizeS16NEON,
+    .normalize_s32 = AUDIO_NormalizeS32NEON,
+    .normalize_f32 = AUDIO_NormalizeF32NEON,
+    .gain_s16      = AUDIO_GainS16NEON,
+    .gain_s32      = AUDIO_GainS32NEON,
+    .gain_f32      = AUDIO_GainF32NEON,
+    .mix_s16       = AUDIO_MixS16NEON,
+    .mix_s32       = AUDIO_MixS32NEON,
+    .mix_f32       = AUDIO_MixF32NEON,
+    .resample      = AUDIO_ResampleNEON,
+};
+#endif
+
+#if NUKED_ENABLE_AVX2
+// audio_kernel_avx2.cpp
+extern const audio_kernels_t AUDIO_KERNELS_AVX2;
+
+// pcm_voice.cpp
+bool PCM_CpuHasAVX2();
+#endif
+
+AudioKernel AUDIO_DetectKernel()
+{
+#if NUKED_ENABLE_AVX2
+    if (PCM_CpuHasAVX2())
+        return AudioKernel::AVX2;
+#endif
+#if NUKED_HAVE_SSE2
+    return AudioKernel::SSE2;
+#elif NUKED_HAVE_NEON
+    return AudioKernel::NEON;
+#else
+    return AudioKernel::Scalar;
+#endif
+}
+
+const audio_kernels_t* AUDIO_GetKernels(AudioKernel kernel)
+{
+    switch (kernel)
+    {
+    case AudioKernel::Scalar:
+        return &AUDIO_KERNELS_SCALAR;
+    case AudioKernel::SSE2:
+#if NUKED_HAVE_SSE2
+        return &AUDIO_KERNELS_SSE2;
+#else
+        return nullptr;
+#endif
+    case AudioKernel::AVX2:
+#if NUKED_ENABLE_AVX2
+        if (PCM_CpuHasAVX2())
+            return &AUDIO_KERNELS_AVX2;
+#endif
+        return nullptr;
+    case AudioKernel::NEON:
+#if NUKED_HAVE_NEON
+        return &AUDIO_KERNELS_NEON;
+#else
+        return nullptr;
+#endif
+    }
+    return nullptr;
+}
+
+const audio_kernels_t& AUDIO_Kernels()
+{
+    static const audio_kernels_t* kernels = AUDIO_GetKernels(AUDIO_DetectKernel());
+    return *kernels;
+}
+
+const char* AUDIO_KernelName(AudioKernel kernel)
+{
+    switch (kernel)
+    {
+    case AudioKernel::Scalar:
+        return "scalar";
+    case AudioKernel::SSE2:
+        return "sse2";
+    case AudioKernel::AVX2:
+        return "avx2";
+    case AudioKernel::NEON:
+        return "neon";
+    }
+    return "unknown";
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Bulk versions of the per-frame helpers in audio.h, used wherever whole buffers of audio are converted or mixed.
+// Every kernel works on interleaved samples, so `count` is twice the number of frames.
+//
+// All implementations of a kernel produce bit-identical output.
+
+// Converts raw emulator output to an output format, like Normalize.
+typedef void (*audio_normalize_s16_kernel)(int16_t* dest, const int32_t* src, size_t count);
+typedef void (*audio_normalize_s32_kernel)(int32_t* dest, const int32_t* src, size_t count);
+typedef void (*audio_normalize_f32_kernel)(float* dest, const int32_t* src, size_t count);
+
+// Scales samples in place, like Scale.
+typedef void (*audio_gain_s16_kernel)(int16_t* samples, size_t count, float gain);
+typedef void (*audio_gain_s32_kernel)(int32_t* samples, size_t count, float gain);
+typedef void (*audio_gain_f32_kernel)(float* samples, size_t count, float gain);
+
+// Writes the sum of `src_count` buffers to `dest`. Integer samples are summed in a wider type and saturated once at the
+// end, so the result doesn't depend on the order of the sources. `src_count` may be zero, which writes silence, and
+// must not be more than AUDIO_MAX_MIX_SOURCES.
+typedef void (*audio_mix_s16_kernel)(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count);
+typedef void (*audio_mix_s32_kernel)(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count);
+typedef void (*audio_mix_f32_kernel)(float* dest, const float* const* srcs, size_t src_count, size_t count);
+
+// One source per emulator instance. Also bounds the sums so that they fit the intermediate types.
+constexpr size_t AUDIO_MAX_MIX_SOURCES = 16;
+
+// Computes one output frame of AudioResampler. `left` and `right` hold `taps` input samples each, and the filter
+// applied to them is interpolated between `filter` and `next_filter` by `frac`. Each channel is summed in
+// AUDIO_RESAMPLE_TAP_ALIGN interleaved partial sums that are combined pairwise at the end, which is the order a vector
+// of that many floats adds them in. `taps` must be a multiple of AUDIO_RESAMPLE_TAP_ALIGN.
+typedef void (*audio_resample_kernel)(float*       dest,
+                                      const float* left,
+                                      const float* right,
+                                      const float* filter,
+                                      const float* next_filter,
+                                      float        frac,
+                                      size_t       taps);
+
+constexpr size_t AUDIO_RESAMPLE_TAP_ALIGN = 8;
+
+struct audio_kernels_t
+{
+    audio_normalize_s16_kernel normalize_s16;
+    audio_normalize_s32_kernel normalize_s32;
+    audio_normalize_f32_kernel normalize_f32;
+    audio_gain_s16_kernel      gain_s16;
+    audio_gain_s32_kernel      gain_s32;
+    audio_gain_f32_kernel      gain_f32;
+    audio_mix_s16_kernel       mix_s16;
+    audio_mix_s32_kernel       mix_s32;
+    audio_mix_f32_kernel       mix_f32;
+    audio_resample_kernel      resample;
+};
+
+enum class AudioKernel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON,
+};
+
+// Returns the fastest kernels the cpu running this process supports.
+AudioKernel AUDIO_DetectKernel();
+
+// Returns null if `kernel` isn't available in this build or on this cpu.
+const audio_kernels_t* AUDIO_GetKernels(AudioKernel kernel);
+
+// Returns the kernels picked by AUDIO_DetectKernel. The choice is made on the first call.
+const audio_kernels_t& AUDIO_Kernels();
+
+const char* AUDIO_KernelName(AudioKernel kernel);
+
+// Typed wrappers so templated callers can pick the kernel for their sample type.
+inline void AUDIO_Normalize(int16_t* dest, const int32_t* src, size_t count)
+{
+    AUDIO_Kernels().normalize_s16(dest, src, count);
+}
+
+inline void AUDIO_Normalize(int32_t* dest, const int32_t* src, size_t count)
+{
+    AUDIO_Kernels().normalize_s32(dest, src, count);
+}
+
+inline void AUDIO_Normalize(float* dest, const int32_t* src, size_t count)
+{
+    AUDIO_Kernels().normalize_f32(dest, src, count);
+}
+
+inline void AUDIO_Gain(int16_t* samples, size_t count, float gain)
+{
+    AUDIO_Kernels().gain_s16(samples, count, gain);
+}
+
+inline void AUDIO_Gain(int32_t* samples, size_t count, float gain)
+{
+    AUDIO_Kernels().gain_s32(samples, count, gain);
+}
+
+inline void AUDIO_Gain(float* samples, size_t count, float gain)
+{
+    AUDIO_Kernels().gain_f32(samples, count, gain);
+}
+
+inline void AUDIO_Mix(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count)
+{
+    AUDIO_Kernels().mix_s16(dest, srcs, src_count, count);
+}
+
+inline void AUDIO_Mix(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count)
+{
+    AUDIO_Kernels().mix_s32(dest, srcs, src_count, count);
+}
+
+inline void AUDIO_Mix(float* dest, const float* const* srcs, size_t src_count, size_t count)
+{
+    AUDIO_Kernels().mix_f32(dest, srcs, src_count, count);
+}
+
+inline void AUDIO_Resample(float*       dest,
+                           const float* left,
+                           const float* right,
+                           const float* filter,
+                           const float* next_filter,
+                           float        frac,
+                           size_t       taps)
+{
+    AUDIO_Kernels().resample(dest, left, right, filter, next_filter, frac, taps);
+}
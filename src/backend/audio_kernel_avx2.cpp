@@ -0,0 +1,252 @@
+// Compiled with AVX2 enabled. Only reached through AUDIO_GetKernels after checking that the cpu supports it.
+
+#include "audio_kernel.h"
+#include <immintrin.h>
+
+// audio_kernel.cpp
+void AUDIO_NormalizeS16Scalar(int16_t* dest, const int32_t* src, size_t count);
+void AUDIO_NormalizeS32Scalar(int32_t* dest, const int32_t* src, size_t count);
+void AUDIO_NormalizeF32Scalar(float* dest, const int32_t* src, size_t count);
+void AUDIO_GainS16Scalar(int16_t* samples, size_t count, float gain);
+void AUDIO_GainS32Scalar(int32_t* samples, size_t count, float gain);
+void AUDIO_GainF32Scalar(float* samples, size_t count, float gain);
+void AUDIO_MixS16Scalar(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count);
+void AUDIO_MixS32Scalar(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count);
+void AUDIO_MixF32Scalar(float* dest, const float* const* srcs, size_t src_count, size_t count);
+
+template <typename T>
+static void AUDIO_OffsetSources(const T** out, const T* const* srcs, size_t src_count, size_t offset)
+{
+    for (size_t k = 0; k < src_count; ++k)
+    {
+        out[k] = srcs[k] + offset;
+    }
+}
+
+// _mm256_packs_epi32 packs within each 128-bit lane; this puts the result back in order.
+static inline __m256i AUDIO_PackS16AVX2(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+// Sign extends the low/high eight int16 of `v` to int32.
+static inline __m256i AUDIO_WidenLoAVX2(__m256i v)
+{
+    return _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+}
+
+static inline __m256i AUDIO_WidenHiAVX2(__m256i v)
+{
+    return _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+}
+
+static void AUDIO_NormalizeS16AVX2(int16_t* dest, const int32_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i a = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(src + i)), 15);
+        const __m256i b = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(src + i + 8)), 15);
+        _mm256_storeu_si256((__m256i*)(dest + i), AUDIO_PackS16AVX2(a, b));
+    }
+    AUDIO_NormalizeS16Scalar(dest + i, src + i, count - i);
+}
+
+static void AUDIO_NormalizeS32AVX2(int32_t* dest, const int32_t* src, size_t count)
+{
+    const __m256i max = _mm256_set1_epi32(INT32_MAX);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i x        = _mm256_loadu_si256((const __m256i*)(src + i));
+        const __m256i doubled  = _mm256_slli_epi32(x, 1);
+        const __m256i overflow = _mm256_srai_epi32(_mm256_xor_si256(x, doubled), 31);
+        const __m256i limit    = _mm256_xor_si256(_mm256_srai_epi32(x, 31), max);
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_blendv_epi8(doubled, limit, overflow));
+    }
+    AUDIO_NormalizeS32Scalar(dest + i, src + i, count - i);
+}
+
+static void AUDIO_NormalizeF32AVX2(float* dest, const int32_t* src, size_t count)
+{
+    const __m256 div_rec = _mm256_set1_ps(1.0f / 536870912.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_ps(dest + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), div_rec));
+    }
+    AUDIO_NormalizeF32Scalar(dest + i, src + i, count - i);
+}
+
+static inline __m256i AUDIO_ScaleS16AVX2(__m256i x, __m256 gain)
+{
+    __m256 scaled = _mm256_mul_ps(_mm256_cvtepi32_ps(x), gain);
+    scaled        = _mm256_min_ps(_mm256_max_ps(scaled, _mm256_set1_ps(-65536.0f)), _mm256_set1_ps(65536.0f));
+    return _mm256_cvttps_epi32(scaled);
+}
+
+static void AUDIO_GainS16AVX2(int16_t* samples, size_t count, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i v  = _mm256_loadu_si256((const __m256i*)(samples + i));
+        const __m256i lo = AUDIO_ScaleS16AVX2(AUDIO_WidenLoAVX2(v), g);
+        const __m256i hi = AUDIO_ScaleS16AVX2(AUDIO_WidenHiAVX2(v), g);
+        _mm256_storeu_si256((__m256i*)(samples + i), AUDIO_PackS16AVX2(lo, hi));
+    }
+    AUDIO_GainS16Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_GainS32AVX2(int32_t* samples, size_t count, float gain)
+{
+    const __m256  g     = _mm256_set1_ps(gain);
+    const __m256  limit = _mm256_set1_ps(2147483648.0f);
+    const __m256i max   = _mm256_set1_epi32(INT32_MAX);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256 scaled = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(samples + i))), g);
+        // cvttps already produces INT32_MIN for anything out of range, which is only wrong for positive values
+        const __m256i result = _mm256_cvttps_epi32(scaled);
+        const __m256i big    = _mm256_castps_si256(_mm256_cmp_ps(scaled, limit, _CMP_GE_OQ));
+        _mm256_storeu_si256((__m256i*)(samples + i), _mm256_blendv_epi8(result, max, big));
+    }
+    AUDIO_GainS32Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_GainF32AVX2(float* samples, size_t count, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g));
+    }
+    AUDIO_GainF32Scalar(samples + i, count - i, gain);
+}
+
+static void AUDIO_MixS16AVX2(int16_t* dest, const int16_t* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            const __m256i v = _mm256_loadu_si256((const __m256i*)(srcs[k] + i));
+            lo              = _mm256_add_epi32(lo, AUDIO_WidenLoAVX2(v));
+            hi              = _mm256_add_epi32(hi, AUDIO_WidenHiAVX2(v));
+        }
+        _mm256_storeu_si256((__m256i*)(dest + i), AUDIO_PackS16AVX2(lo, hi));
+    }
+
+    const int16_t* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixS16Scalar(dest + i, rest, src_count, count - i);
+}
+
+static void AUDIO_MixS32AVX2(int32_t* dest, const int32_t* const* srcs, size_t src_count, size_t count)
+{
+    const __m256i max = _mm256_set1_epi64x(INT32_MAX);
+    const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+    // picks the low dword of each qword, in order
+    const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            const __m256i v = _mm256_loadu_si256((const __m256i*)(srcs[k] + i));
+            lo              = _mm256_add_epi64(lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+            hi              = _mm256_add_epi64(hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+        }
+
+        lo = _mm256_blendv_epi8(lo, max, _mm256_cmpgt_epi64(lo, max));
+        lo = _mm256_blendv_epi8(lo, min, _mm256_cmpgt_epi64(min, lo));
+        hi = _mm256_blendv_epi8(hi, max, _mm256_cmpgt_epi64(hi, max));
+        hi = _mm256_blendv_epi8(hi, min, _mm256_cmpgt_epi64(min, hi));
+
+        const __m128i lo32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(lo, pack));
+        const __m128i hi32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(hi, pack));
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_set_m128i(hi32, lo32));
+    }
+
+    const int32_t* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixS32Scalar(dest + i, rest, src_count, count - i);
+}
+
+static void AUDIO_MixF32AVX2(float* dest, const float* const* srcs, size_t src_count, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (size_t k = 0; k < src_count; ++k)
+        {
+            sum = _mm256_add_ps(sum, _mm256_loadu_ps(srcs[k] + i));
+        }
+        _mm256_storeu_ps(dest + i, sum);
+    }
+
+    const float* rest[AUDIO_MAX_MIX_SOURCES];
+    AUDIO_OffsetSources(rest, srcs, src_count, i);
+    AUDIO_MixF32Scalar(dest + i, rest, src_count, count - i);
+}
+
+// Reduces the accumulator of a channel to one sample in the same order as AUDIO_ResampleScalar.
+static inline float AUDIO_ReduceResampleAVX2(__m256 sums)
+{
+    const __m128 x = _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1));
+    const __m128 y = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_add_ss(y, _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+static void AUDIO_ResampleAVX2(float*       dest,
+                               const float* left,
+                               const float* right,
+                               const float* filter,
+                               const float* next_filter,
+                               float        frac,
+                               size_t       taps)
+{
+    const __m256 f = _mm256_set1_ps(frac);
+
+    __m256 l = _mm256_setzero_ps();
+    __m256 r = _mm256_setzero_ps();
+    for (size_t i = 0; i < taps; i += 8)
+    {
+        const __m256 a = _mm256_loadu_ps(filter + i);
+        const __m256 c = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(next_filter + i), a), f));
+
+        l = _mm256_add_ps(l, _mm256_mul_ps(_mm256_loadu_ps(left + i), c));
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_loadu_ps(right + i), c));
+    }
+    dest[0] = AUDIO_ReduceResampleAVX2(l);
+    dest[1] = AUDIO_ReduceResampleAVX2(r);
+}
+
+extern const audio_kernels_t AUDIO_KERNELS_AVX2 = {
+    .normalize_s16 = AUDIO_NormalizeS16AVX2,
+    .normalize_s32 = AUDIO_NormalizeS32AVX2,
+    .normalize_f32 = AUDIO_NormalizeF32AVX2,
+    .gain_s16      = AUDIO_GainS16AVX2,
+    .gain_s32      = AUDIO_GainS32AVX2,
+    .gain_f32      = AUDIO_GainF32AVX2,
+    .mix_s16       = AUDIO_MixS16AVX2,
+    .mix_s32       = AUDIO_MixS32AVX2,
+    .mix_f32       = AUDIO_MixF32AVX2,
+    .resample      = AUDIO_ResampleAVX2,
+};
@@ -6,4 +6,8 @@ void Cfg_WriteVersionInfo(FILE* file)
     fprintf(file, "Source: %s\n", NUKED_SOURCE);
     fprintf(file, "Configuration:\n");
     fprintf(file, "  NUKED_ENABLE_ASIO=%d\n", NUKED_ENABLE_ASIO);
+    fprintf(file, "  NUKED_ENABLE_COREAUDIO=%d\n", NUKED_ENABLE_COREAUDIO);
+    fprintf(file, "  NUKED_ENABLE_AVX2=%d\n", NUKED_ENABLE_AVX2);
+    fprintf(file, "  NUKED_ENABLE_PROFILING=%d\n", NUKED_ENABLE_PROFILING);
+    fprintf(file, "  NUKED_ENABLE_PC_PROFILING=%d\n", NUKED_ENABLE_PC_PROFILING);
 }
@@ -42,6 +42,127 @@
 #include <span>
 #include <vector>
 
+// Used until roms are loaded. Not const so that it's zero-filled at startup instead of taking up space in the binary.
+static SharedRomImage g_blank_rom_image;
+
+static std::span<uint8_t> EMU_MapBuffer(SharedRomImage& image, RomLocation location)
+{
+    switch (location)
+    {
+    case RomLocation::ROM1:
+        return image.rom1;
+    case RomLocation::ROM2:
+        return image.rom2;
+    case RomLocation::WAVEROM1:
+        return image.waverom1;
+    case RomLocation::WAVEROM2:
+        return image.waverom2;
+    case RomLocation::WAVEROM3:
+        return image.waverom3;
+    case RomLocation::WAVEROM_CARD:
+        return image.waverom_card;
+    case RomLocation::WAVEROM_EXP:
+        return image.waverom_exp;
+    case RomLocation::SMROM:
+        return image.smrom;
+    }
+    fprintf(stderr, "FATAL: MapBuffer called with invalid location %d\n", (int)location);
+    std::abort();
+}
+
+std::span<const uint8_t> EMU_GetRomData(const SharedRomImage& image, RomLocation location)
+{
+    if (image.mappings[(size_t)location].file)
+    {
+        return image.mappings[(size_t)location].data;
+    }
+    // Only used for reading
+    return EMU_MapBuffer(const_cast<SharedRomImage&>(image), location);
+}
+
+size_t EMU_GetRomBufferSize(RomLocation location)
+{
+    return EMU_MapBuffer(g_blank_rom_image, location).size();
+}
+
+// Loads `source` into the image for `location`. If `map` holds a file, `source` must be its data, and the image will
+// point at it directly when the emulator can't read past its end.
+static bool EMU_LoadRom(SharedRomImage&          image,
+                        RomLocation              location,
+                        std::span<const uint8_t> source,
+                        const MappedRange&       map)
+{
+    auto buffer = EMU_MapBuffer(image, location);
+
+    if (buffer.size() < source.size())
+    {
+        fprintf(stderr,
+                "FATAL: rom for %s is too large; max size is %d bytes\n",
+                ToCString(location),
+                (int)buffer.size());
+        return false;
+    }
+
+    if (location == RomLocation::ROM2)
+    {
+        if (!std::has_single_bit(source.size()))
+        {
+            fprintf(stderr, "FATAL: %s requires a power-of-2 size\n", ToCString(location));
+            return false;
+        }
+        image.rom2_mask = (int)source.size() - 1;
+    }
+
+    image.loaded[(size_t)location] = true;
+
+    // Reads from rom2 are masked with rom2_mask, every other location may be read up to the size of its buffer
+    if (map.file && (location == RomLocation::ROM2 || source.size() == buffer.size()))
+    {
+        image.mappings[(size_t)location] = map;
+        return true;
+    }
+
+    std::copy(source.begin(), source.end(), buffer.begin());
+
+    return true;
+}
+
+std::shared_ptr<SharedRomImage> EMU_CreateRomImage(Romset romset, const AllRomsetInfo& all_info)
+{
+    std::shared_ptr<SharedRomImage> image;
+    try
+    {
+        image = std::make_shared<SharedRomImage>();
+    }
+    catch (const std::bad_alloc&)
+    {
+        fprintf(stderr, "FATAL: Failed to allocate rom image\n");
+        return nullptr;
+    }
+
+    image->romset = romset;
+
+    const RomsetInfo& info = all_info.romsets[(size_t)romset];
+
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        // rom_data or rom_maps should be populated at this point
+        // if neither is, then there isn't a rom for this location
+        const std::span<const uint8_t> source = info.GetRomData((RomLocation)i);
+        if (source.empty())
+        {
+            continue;
+        }
+
+        if (!EMU_LoadRom(*image, (RomLocation)i, source, info.rom_maps[i]))
+        {
+            return nullptr;
+        }
+    }
+
+    return image;
+}
+
 Emulator::~Emulator()
 {
     SaveNVRAM();
@@ -58,6 +179,11 @@ bool Emulator::Init(const EMU_Options& options)
         m_timer = std::make_unique<mcu_timer_t>();
         m_lcd   = std::make_unique<lcd_t>();
         m_pcm   = std::make_unique<pcm_t>();
+
+        if (options.sample_block_size)
+        {
+            m_sample_block = std::make_unique<AudioFrame<int32_t>[]>(options.sample_block_size);
+        }
     }
     catch (const std::bad_alloc&)
     {
@@ -66,9 +192,13 @@ bool Emulator::Init(const EMU_Options& options)
         m_timer.reset();
         m_lcd.reset();
         m_pcm.reset();
+        m_sample_block.reset();
         return false;
     }
 
+    m_rom_image = std::shared_ptr<const SharedRomImage>(std::shared_ptr<void>(), &g_blank_rom_image);
+    AttachRomImage();
+
     MCU_Init(*m_mcu, *m_sm, *m_pcm, *m_timer, *m_lcd);
     SM_Init(*m_sm, *m_mcu);
     PCM_Init(*m_pcm, *m_mcu);
@@ -76,9 +206,39 @@ bool Emulator::Init(const EMU_Options& options)
     LCD_Init(*m_lcd, *m_mcu);
     m_lcd->backend = options.lcd_backend;
 
+    PROF_Reset(m_mcu->profile);
+
     return true;
 }
 
+EMU_Profile Emulator::GetProfile() const
+{
+    EMU_Profile result;
+    result.enabled = NUKED_ENABLE_PROFILING;
+
+    const mcu_profile_t& profile = m_mcu->profile;
+
+    const uint64_t elapsed_ticks = PROF_ReadTicks() - profile.start_ticks;
+    result.elapsed_ns            = PROF_ReadNS() - profile.start_ns;
+
+    const double ns_per_tick = elapsed_ticks ? (double)result.elapsed_ns / (double)elapsed_ticks : 0.0;
+
+    for (size_t i = 0; i < PROFILE_STAGE_COUNT; ++i)
+    {
+        result.stages[i].name  = PROF_StageName((ProfileStage)i);
+        result.stages[i].ns    = (uint64_t)((double)profile.stages[i].ticks * ns_per_tick);
+        result.stages[i].calls = profile.stages[i].calls;
+    }
+
+    return result;
+}
+
+void Emulator::ResetProfile()
+{
+    PROF_Reset(m_mcu->profile);
+    PROF_ResetPC(m_mcu->pc_profile);
+}
+
 void Emulator::Reset()
 {
     MCU_Reset(*m_mcu);
@@ -97,8 +257,50 @@ void Emulator::StopLCD()
 
 void Emulator::SetSampleCallback(mcu_sample_callback callback, void* userdata)
 {
+    MCU_FlushSampleBlock(*m_mcu);
     m_mcu->callback_userdata = userdata;
     m_mcu->sample_callback = callback;
+    m_mcu->sample_block = nullptr;
+    m_mcu->sample_block_size = 0;
+}
+
+bool Emulator::SetSampleBlockCallback(mcu_sample_block_callback callback, void* userdata)
+{
+    if (!m_sample_block)
+    {
+        return false;
+    }
+
+    MCU_FlushSampleBlock(*m_mcu);
+    m_mcu->callback_userdata = userdata;
+    m_mcu->sample_block_callback = callback;
+    m_mcu->sample_block = m_sample_block.get();
+    m_mcu->sample_block_size = m_options.sample_block_size;
+    return true;
+}
+
+void Emulator::FlushSamples()
+{
+    MCU_FlushSampleBlock(*m_mcu);
+}
+
+void Emulator::SetFastForward(bool enabled)
+{
+    if (enabled == m_mcu->fast_forward)
+    {
+        return;
+    }
+
+    if (enabled)
+    {
+        MCU_FlushSampleBlock(*m_mcu);
+    }
+    else if (m_lcd->backend)
+    {
+        LCD_Publish(*m_lcd);
+    }
+
+    m_mcu->fast_forward = enabled;
 }
 
 bool Emulator::LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocationSet* loaded)
@@ -108,32 +310,31 @@ bool Emulator::LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocatio
         loaded->fill(false);
     }
 
-    MCU_SetRomset(GetMCU(), romset);
-
-    const RomsetInfo& info = all_info.romsets[(size_t)romset];
-
-    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    std::shared_ptr<const SharedRomImage> image = EMU_CreateRomImage(romset, all_info);
+    if (!image)
     {
-        const RomLocation location = (RomLocation)i;
+        return false;
+    }
 
-        // rom_data should be populated at this point
-        // if it isn't, then there isn't a rom for this location
-        if (info.rom_data[i].empty())
-        {
-            continue;
-        }
+    if (loaded)
+    {
+        *loaded = image->loaded;
+    }
 
-        if (!LoadRom(location, info.rom_data[i]))
-        {
-            return false;
-        }
+    return LoadRoms(std::move(image));
+}
 
-        if (loaded)
-        {
-            (*loaded)[i] = true;
-        }
+bool Emulator::LoadRoms(std::shared_ptr<const SharedRomImage> image)
+{
+    if (!image)
+    {
+        return false;
     }
 
+    m_rom_image = std::move(image);
+    MCU_SetRomset(GetMCU(), m_rom_image->romset);
+    AttachRomImage();
+
     if (m_mcu->is_jv880)
     {
         LoadNVRAM();
@@ -144,17 +345,72 @@ bool Emulator::LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocatio
     return true;
 }
 
-void Emulator::PostMIDI(uint8_t byte)
+void Emulator::AttachRomImage()
 {
-    MCU_PostUART(*m_mcu, byte);
+    const SharedRomImage& image = *m_rom_image;
+
+    m_mcu->rom1 = EMU_GetRomData(image, RomLocation::ROM1).data();
+    m_mcu->rom2 = EMU_GetRomData(image, RomLocation::ROM2).data();
+    m_mcu->rom2_mask = image.rom2_mask;
+    m_sm->rom = EMU_GetRomData(image, RomLocation::SMROM).data();
+    m_pcm->waverom1 = EMU_GetRomData(image, RomLocation::WAVEROM1).data();
+    m_pcm->waverom2 = EMU_GetRomData(image, RomLocation::WAVEROM2).data();
+    m_pcm->waverom3 = EMU_GetRomData(image, RomLocation::WAVEROM3).data();
+    m_pcm->waverom_card = EMU_GetRomData(image, RomLocation::WAVEROM_CARD).data();
+    m_pcm->waverom_exp = EMU_GetRomData(image, RomLocation::WAVEROM_EXP).data();
+    PCM_UpdateWaveBanks(*m_pcm, m_mcu->family);
 }
 
-void Emulator::PostMIDI(std::span<const uint8_t> data)
+size_t Emulator::GetMemoryUsage() const
 {
-    for (uint8_t byte : data)
+    if (!m_mcu)
+    {
+        return 0;
+    }
+
+    size_t bytes = sizeof(mcu_t) + sizeof(submcu_t) + sizeof(mcu_timer_t) + sizeof(lcd_t) + sizeof(pcm_t);
+    if (m_mcu->nvram)
+    {
+        bytes += NVRAM_SIZE;
+    }
+    if (m_mcu->cardram)
     {
-        PostMIDI(byte);
+        bytes += CARDRAM_SIZE;
     }
+    if (m_lcd->buffer)
+    {
+        bytes += m_lcd->width * m_lcd->height * sizeof(uint32_t);
+    }
+    if (m_sample_block)
+    {
+        bytes += m_options.sample_block_size * sizeof(AudioFrame<int32_t>);
+    }
+    return bytes;
+}
+
+bool Emulator::PostMIDI(uint8_t byte)
+{
+    return MCU_PostUART(*m_mcu, byte);
+}
+
+bool Emulator::PostMIDI(std::span<const uint8_t> data)
+{
+    return MCU_PostUART(*m_mcu, data);
+}
+
+size_t Emulator::GetMIDIQueueSpace() const
+{
+    return MCU_GetUARTSpace(*m_mcu);
+}
+
+bool Emulator::IsMIDIIdle() const
+{
+    return MCU_IsUARTIdle(*m_mcu);
+}
+
+uint64_t Emulator::GetDroppedMIDIBytes() const
+{
+    return m_mcu->uart_dropped.load(std::memory_order_relaxed);
 }
 
 constexpr uint8_t GM_RESET_SEQ[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
@@ -181,6 +437,21 @@ void Emulator::Step()
     MCU_Step(*m_mcu);
 }
 
+void Emulator::StepCycles(uint64_t cycle_count)
+{
+    MCU_StepUntilCycles(*m_mcu, m_mcu->cycles + cycle_count);
+}
+
+void Emulator::StepUntilCycles(uint64_t target_cycles)
+{
+    MCU_StepUntilCycles(*m_mcu, target_cycles);
+}
+
+void Emulator::StepUntilFrames(uint64_t frame_count)
+{
+    MCU_StepUntilFrames(*m_mcu, m_mcu->frames_posted + frame_count);
+}
+
 void Emulator::SaveNVRAM()
 {
     // emulator was constructed, but never init
@@ -192,7 +463,7 @@ void Emulator::SaveNVRAM()
     if (!m_options.nvram_filename.empty() && m_mcu->is_jv880)
     {
         std::ofstream file(m_options.nvram_filename, std::ios::binary);
-        file.write((const char*)m_mcu->nvram, NVRAM_SIZE);
+        file.write((const char*)m_mcu->nvram.get(), NVRAM_SIZE);
     }
 }
 
@@ -201,60 +472,6 @@ void Emulator::LoadNVRAM()
     if (!m_options.nvram_filename.empty() && m_mcu->is_jv880)
     {
         std::ifstream file(m_options.nvram_filename, std::ios::binary);
-        file.read((char*)m_mcu->nvram, NVRAM_SIZE);
-    }
-}
-
-std::span<uint8_t> Emulator::MapBuffer(RomLocation location)
-{
-    switch (location)
-    {
-    case RomLocation::ROM1:
-        return GetMCU().rom1;
-    case RomLocation::ROM2:
-        return GetMCU().rom2;
-    case RomLocation::WAVEROM1:
-        return GetPCM().waverom1;
-    case RomLocation::WAVEROM2:
-        return GetPCM().waverom2;
-    case RomLocation::WAVEROM3:
-        return GetPCM().waverom3;
-    case RomLocation::WAVEROM_CARD:
-        return GetPCM().waverom_card;
-    case RomLocation::WAVEROM_EXP:
-        return GetPCM().waverom_exp;
-    case RomLocation::SMROM:
-        return m_sm->rom;
-    }
-    fprintf(stderr, "FATAL: MapBuffer called with invalid location %d\n", (int)location);
-    std::abort();
-}
-
-bool Emulator::LoadRom(RomLocation location, std::span<const uint8_t> source)
-{
-    auto buffer = MapBuffer(location);
-
-    if (buffer.size() < source.size())
-    {
-        fprintf(stderr,
-                "FATAL: rom for %s is too large; max size is %d bytes\n",
-                ToCString(location),
-                (int)buffer.size());
-        return false;
+        file.read((char*)m_mcu->nvram.get(), NVRAM_SIZE);
     }
-
-    if (location == RomLocation::ROM2)
-    {
-        if (!std::has_single_bit(source.size()))
-        {
-            fprintf(stderr, "FATAL: %s requires a power-of-2 size\n", ToCString(location));
-            return false;
-        }
-        GetMCU().rom2_mask = (int)source.size() - 1;
-    }
-
-    std::copy(source.begin(), source.end(), buffer.begin());
-
-    return true;
 }
-
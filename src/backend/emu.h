@@ -43,6 +43,7 @@
 #include <filesystem>
 #include <memory>
 #include <span>
+#include <vector>
 
 struct EMU_Options
 {
@@ -52,6 +53,71 @@ struct EMU_Options
 
     // If not empty, nvram will be saved to and loaded from here. JV-880 only.
     std::filesystem::path nvram_filename;
+
+    // If nonzero, the emulator allocates a buffer of this many frames so that `SetSampleBlockCallback` can be used.
+    size_t sample_block_size = 0;
+};
+
+// Every rom an emulator reads, laid out the way the emulator addresses them. Nothing writes to an image once it has
+// been built, so any number of emulator instances can share one. Locations the romset doesn't use are left zeroed.
+struct SharedRomImage
+{
+    Romset romset = Romset::MK2;
+
+    uint8_t rom1[ROM1_SIZE]{};
+    uint8_t rom2[ROM2_SIZE]{};
+    uint8_t smrom[ROMSM_SIZE]{};
+    uint8_t waverom1[PCM_WAVEROM1_SIZE]{};
+    uint8_t waverom2[PCM_WAVEROM2_SIZE]{};
+    uint8_t waverom3[PCM_WAVEROM3_SIZE]{};
+    uint8_t waverom_card[PCM_WAVEROM_CARD_SIZE]{};
+    uint8_t waverom_exp[PCM_WAVEROM_EXP_SIZE]{};
+
+    int rom2_mask = ROM2_SIZE - 1;
+
+    // Locations that have data in this image.
+    RomLocationSet loaded{};
+
+    // Roms read straight from a mapped file instead of the buffers above. The image keeps these mappings alive.
+    MappedRange mappings[ROMLOCATION_COUNT]{};
+};
+
+// Returns the memory the emulator reads the rom for `location` from. This is either a mapped file or the image's own
+// buffer for that location.
+std::span<const uint8_t> EMU_GetRomData(const SharedRomImage& image, RomLocation location);
+
+// Returns how many bytes of the rom for `location` the emulator may read. Smaller roms are zero-padded in a rom image,
+// except for ROM2, which is mirrored.
+size_t EMU_GetRomBufferSize(RomLocation location);
+
+// Builds a rom image for `romset` from the buffers referenced by `all_info`. If the slot for a rom in `all_info` has
+// a non-empty `rom_data` or `rom_maps`, it will be loaded even if the romset doesn't require it. Mapped roms that
+// exactly fit their location are shared with `all_info` instead of copied; the image holds its own reference to
+// them, so it doesn't depend on `all_info` afterwards.
+//
+// Returns null and prints the reason to stderr if a rom doesn't fit or memory runs out.
+std::shared_ptr<SharedRomImage> EMU_CreateRomImage(Romset romset, const AllRomsetInfo& all_info);
+
+// Version of the format written by `Emulator::SaveState`. States with a different version are rejected.
+constexpr uint32_t EMU_STATE_VERSION = 3;
+
+// Time spent in one part of the emulator's step function since the last `Emulator::ResetProfile`.
+struct EMU_ProfileStage
+{
+    const char* name  = "";
+    uint64_t    ns    = 0;
+    uint64_t    calls = 0;
+};
+
+struct EMU_Profile
+{
+    // False if the backend was built without NUKED_ENABLE_PROFILING, in which case everything else is zero.
+    bool enabled = false;
+
+    EMU_ProfileStage stages[PROFILE_STAGE_COUNT];
+
+    // Wall time since the last reset, including time the emulator wasn't running
+    uint64_t elapsed_ns = 0;
 };
 
 enum class EMU_SystemReset {
@@ -82,8 +148,24 @@ public:
 
     void StopLCD();
 
+    // Frames will be passed to `callback` one at a time as soon as they are produced. Any frames buffered for a block
+    // callback are flushed first.
     void SetSampleCallback(mcu_sample_callback callback, void* userdata);
 
+    // Frames will be passed to `callback` in blocks of `EMU_Options::sample_block_size` frames. Returns false if the
+    // emulator was initialized without a block size.
+    bool SetSampleBlockCallback(mcu_sample_block_callback callback, void* userdata);
+
+    // Passes any frames buffered for the block callback to it immediately, even if the block isn't full. Call this
+    // before reading state that depends on how many frames the callback has received.
+    void FlushSamples();
+
+    // While enabled, the emulator runs exactly as usual but its output goes nowhere: frames are counted in
+    // `mcu_t::frames_posted` without being built or passed to any callback, and the LCD isn't published. Meant for
+    // warming up or seeking when the audio would be thrown away anyway. Frames buffered for the block callback are
+    // delivered before it's enabled, and the LCD is published when it's disabled.
+    void SetFastForward(bool enabled);
+
     // Loads roms from buffers referenced by `all_info`. If the slot for a rom in `all_info` has a non-empty `rom_data`,
     // it will be loaded even if the romset doesn't require it.
     //
@@ -95,15 +177,79 @@ public:
     //
     // It is recommended to check if the romset has all the necessary roms by first calling
     // `IsCompleteRomset(all_info, romset)`.
+    //
+    // This builds a rom image for this instance alone. When running several instances, build one with
+    // `EMU_CreateRomImage` and pass it to the overload below instead.
     bool LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocationSet* loaded = nullptr);
 
-    void PostMIDI(uint8_t data_byte);
-    void PostMIDI(std::span<const uint8_t> data);
+    // Makes the emulator read its roms from `image` instead of a private copy. The emulator keeps a reference to the
+    // image, so several emulators can be pointed at the same one to share it. `image` must not be modified afterwards.
+    bool LoadRoms(std::shared_ptr<const SharedRomImage> image);
+
+    // Queues midi bytes for the emulator. These may be called from a thread other than the one running the emulator,
+    // but only from one thread at a time. `data` is queued as a whole or not at all: if the queue doesn't have room
+    // for it, it is dropped, counted in `GetDroppedMIDIBytes` and false is returned.
+    bool PostMIDI(uint8_t data_byte);
+    bool PostMIDI(std::span<const uint8_t> data);
+
+    // Number of midi bytes that can be posted right now without being dropped. Only meaningful on the posting thread.
+    size_t GetMIDIQueueSpace() const;
+
+    // True once the firmware has read every posted midi byte. Only meaningful on the emulation thread.
+    bool IsMIDIIdle() const;
+
+    // Number of midi bytes dropped so far because the queue was full.
+    uint64_t GetDroppedMIDIBytes() const;
 
     void PostSystemReset(EMU_SystemReset reset);
 
     void Step();
 
+    // Steps the emulator until at least `cycle_count` cycles have elapsed. Each step advances the emulator by
+    // `MCU_CYCLES_PER_STEP` cycles, so this may overshoot by up to one step.
+    void StepCycles(uint64_t cycle_count);
+
+    // Steps the emulator until its cycle counter reaches `target_cycles`. Does nothing if it is already there.
+    void StepUntilCycles(uint64_t target_cycles);
+
+    // Steps the emulator until at least `frame_count` more frames have been passed to the sample callback. A single
+    // step can produce more than one frame, so this may overshoot by one frame.
+    void StepUntilFrames(uint64_t frame_count);
+
+    // Serializes all mutable emulator state into `out`, replacing its contents. Roms are not included; the state can
+    // only be loaded into an emulator running the same romset. Any frames buffered for the block callback are flushed
+    // first.
+    bool SaveState(std::vector<uint8_t>& out);
+
+    // Restores state written by `SaveState`. Returns false without changing anything if `state` is malformed, has a
+    // different version or was saved with a different romset. The roms loaded in this emulator should be the same
+    // ones the state was saved with, but this can't be checked.
+    bool LoadState(std::span<const uint8_t> state);
+
+    // Makes this emulator an exact copy of `other` as it is right now: `other`'s rom image is shared and all of its
+    // mutable state is copied over, including the nvram contents. Options passed to `Init`, callbacks and
+    // `pcm_t::disable_oversampling` are left as they are. Frames `other` has buffered for its block callback are not
+    // copied. Both emulators must have been initialized.
+    bool CloneFrom(const Emulator& other);
+
+    // Hashes the same state `SaveState` stores, without serializing it. Emulators that would save the same state have
+    // the same hash, so comparing hashes taken along a render finds where two builds start to differ. Not meant to
+    // resist collisions on purpose.
+    uint64_t HashState() const;
+
+    // Time spent in each part of the step function since `Init` or the last `ResetProfile`. Only the thread running
+    // the emulator may call these.
+    EMU_Profile GetProfile() const;
+    // Also resets the instruction counts returned by `GetPCProfile`.
+    void ResetProfile();
+
+    // Instructions run since `Init` or the last `ResetProfile`. Empty unless built with NUKED_ENABLE_PC_PROFILING.
+    const pc_profile_t& GetPCProfile() const { return m_mcu->pc_profile; }
+
+    // Bytes of emulator state this instance has allocated. Only the nvram and card ram of the JV-880 depend on the
+    // romset, so this is final once roms are loaded. Roms aren't counted since instances share them.
+    size_t GetMemoryUsage() const;
+
     mcu_t& GetMCU() { return *m_mcu; }
     pcm_t& GetPCM() { return *m_pcm; }
     lcd_t& GetLCD() { return *m_lcd; }
@@ -112,16 +258,19 @@ private:
     void SaveNVRAM();
     void LoadNVRAM();
 
-    std::span<uint8_t> MapBuffer(RomLocation location);
-
-    bool LoadRom(RomLocation location, std::span<const uint8_t> source);
+    // Points the rom pointers in the emulator state at `m_rom_image`.
+    void AttachRomImage();
 
 private:
+    std::shared_ptr<const SharedRomImage> m_rom_image;
+
     std::unique_ptr<mcu_t>       m_mcu;
     std::unique_ptr<submcu_t>    m_sm;
     std::unique_ptr<mcu_timer_t> m_timer;
     std::unique_ptr<lcd_t>       m_lcd;
     std::unique_ptr<pcm_t>       m_pcm;
     EMU_Options                  m_options;
+
+    std::unique_ptr<AudioFrame<int32_t>[]> m_sample_block;
 };
 
@@ -0,0 +1,430 @@
+#include "emu.h"
+#include <atomic>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// Serialization for Emulator::SaveState/LoadState. The state is a header followed by every mutable field of the
+// emulator in a fixed order, each stored as its in-memory bytes. Pointers, rom contents and anything derived from the
+// romset are not stored; they come from the emulator the state is loaded into.
+//
+// Bump EMU_STATE_VERSION whenever a field is added, removed or reordered below.
+
+static constexpr char EMU_STATE_MAGIC[8] = {'N', 'S', 'C', '5', '5', 'S', 'T', 'A'};
+
+struct EMU_StateHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t romset;
+};
+
+struct EMU_StateWriter
+{
+    std::vector<uint8_t>& out;
+
+    template <typename T>
+    void Field(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const uint8_t* bytes = (const uint8_t*)&value;
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    void Bytes(std::span<const uint8_t> values)
+    {
+        out.insert(out.end(), values.begin(), values.end());
+    }
+
+    template <typename T>
+    void Field(const std::atomic<T>& value)
+    {
+        Field(value.load(std::memory_order_relaxed));
+    }
+};
+
+struct EMU_StateSizer
+{
+    size_t size = 0;
+
+    template <typename T>
+    void Field(const T&)
+    {
+        size += sizeof(T);
+    }
+
+    void Bytes(std::span<const uint8_t> values)
+    {
+        size += values.size();
+    }
+
+    template <typename T>
+    void Field(const std::atomic<T>&)
+    {
+        size += sizeof(T);
+    }
+};
+
+// 64-bit FNV-1a over the bytes EMU_StateWriter would write, after the header
+struct EMU_StateHasher
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    void Bytes(std::span<const uint8_t> values)
+    {
+        for (uint8_t byte : values)
+        {
+            hash = (hash ^ byte) * 0x100000001b3;
+        }
+    }
+
+    template <typename T>
+    void Field(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Bytes(std::span((const uint8_t*)&value, sizeof(T)));
+    }
+
+    template <typename T>
+    void Field(const std::atomic<T>& value)
+    {
+        Field(value.load(std::memory_order_relaxed));
+    }
+};
+
+// Callers check the size up front with EMU_StateSizer, so this never runs out of input.
+struct EMU_StateReader
+{
+    std::span<const uint8_t> in;
+
+    template <typename T>
+    void Field(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        memcpy(&value, in.data(), sizeof(T));
+        in = in.subspan(sizeof(T));
+    }
+
+    void Bytes(std::span<uint8_t> values)
+    {
+        memcpy(values.data(), in.data(), values.size());
+        in = in.subspan(values.size());
+    }
+
+    template <typename T>
+    void Field(std::atomic<T>& value)
+    {
+        T loaded;
+        Field(loaded);
+        value.store(loaded, std::memory_order_relaxed);
+    }
+};
+
+template <typename Archive, typename MCU>
+static void EMU_VisitMCU(Archive& ar, MCU& mcu)
+{
+    ar.Field(mcu.r);
+    ar.Field(mcu.pc);
+    ar.Field(mcu.sr);
+    ar.Field(mcu.cp);
+    ar.Field(mcu.dp);
+    ar.Field(mcu.ep);
+    ar.Field(mcu.tp);
+    ar.Field(mcu.br);
+    ar.Field(mcu.sleep);
+    ar.Field(mcu.ex_ignore);
+    ar.Field(mcu.exception_pending);
+    ar.Field(mcu.interrupt_pending);
+    ar.Field(mcu.interrupt_raise_count);
+    ar.Field(mcu.trapa_pending);
+    ar.Field(mcu.cycles);
+    ar.Field(mcu.ram);
+    ar.Field(mcu.sram);
+    // Only allocated for the romsets that have them, which the header check guarantees match
+    if (mcu.nvram)
+    {
+        ar.Bytes(std::span(mcu.nvram.get(), NVRAM_SIZE));
+    }
+    if (mcu.cardram)
+    {
+        ar.Bytes(std::span(mcu.cardram.get(), CARDRAM_SIZE));
+    }
+    ar.Field(mcu.dev_register);
+    ar.Field(mcu.ad_val);
+    ar.Field(mcu.ad_nibble);
+    ar.Field(mcu.sw_pos);
+    ar.Field(mcu.io_sd);
+    ar.Field(mcu.uart_write_ptr);
+    ar.Field(mcu.uart_read_ptr);
+    ar.Field(mcu.uart_buffer);
+    ar.Field(mcu.uart_rx_byte);
+    ar.Field(mcu.uart_rx_delay);
+    ar.Field(mcu.uart_tx_delay);
+    ar.Field(mcu.ga_int);
+    ar.Field(mcu.ga_int_enable);
+    ar.Field(mcu.ga_int_trigger);
+    ar.Field(mcu.ga_lcd_counter);
+    ar.Field(mcu.button_pressed);
+    ar.Field(mcu.p0_data);
+    ar.Field(mcu.p1_data);
+    ar.Field(mcu.adf_rd);
+    ar.Field(mcu.analog_end_time);
+    ar.Field(mcu.ssr_rd);
+    ar.Field(mcu.operand_type);
+    ar.Field(mcu.operand_ea);
+    ar.Field(mcu.operand_ep);
+    ar.Field(mcu.operand_size);
+    ar.Field(mcu.operand_reg);
+    ar.Field(mcu.operand_status);
+    ar.Field(mcu.operand_data);
+    ar.Field(mcu.opcode_extended);
+    ar.Field(mcu.frames_posted);
+}
+
+template <typename Archive, typename SM>
+static void EMU_VisitSM(Archive& ar, SM& sm)
+{
+    ar.Field(sm.pc);
+    ar.Field(sm.a);
+    ar.Field(sm.x);
+    ar.Field(sm.y);
+    ar.Field(sm.s);
+    ar.Field(sm.sr);
+    ar.Field(sm.cycles);
+    ar.Field(sm.sleep);
+    ar.Field(sm.ram);
+    ar.Field(sm.shared_ram);
+    ar.Field(sm.access);
+    ar.Field(sm.p0_dir);
+    ar.Field(sm.p1_dir);
+    ar.Field(sm.device_mode);
+    ar.Field(sm.cts);
+    ar.Field(sm.timer_cycles);
+    ar.Field(sm.timer_prescaler);
+    ar.Field(sm.timer_counter);
+    ar.Field(sm.uart_rx_gotbyte);
+}
+
+template <typename Archive, typename Timer>
+static void EMU_VisitTimer(Archive& ar, Timer& timer)
+{
+    ar.Field(timer.tcr);
+    ar.Field(timer.tcsr);
+    ar.Field(timer.tcora);
+    ar.Field(timer.tcorb);
+    ar.Field(timer.tcnt);
+    ar.Field(timer.status_rd);
+    ar.Field(timer.cycles);
+    ar.Field(timer.tempreg);
+    for (auto& frt : timer.frt)
+    {
+        ar.Field(frt.tcr);
+        ar.Field(frt.tcsr);
+        ar.Field(frt.frc);
+        ar.Field(frt.ocra);
+        ar.Field(frt.ocrb);
+        ar.Field(frt.icr);
+        ar.Field(frt.status_rd);
+    }
+}
+
+template <typename Archive, typename PCM>
+static void EMU_VisitPCM(Archive& ar, PCM& pcm)
+{
+    ar.Field(pcm.ram1);
+    ar.Field(pcm.ram2);
+    ar.Field(pcm.select_channel);
+    ar.Field(pcm.voice_mask);
+    ar.Field(pcm.voice_mask_pending);
+    ar.Field(pcm.voice_mask_updating);
+    ar.Field(pcm.write_latch);
+    ar.Field(pcm.wave_read_address);
+    ar.Field(pcm.wave_byte_latch);
+    ar.Field(pcm.read_latch);
+    ar.Field(pcm.config_reg_3c);
+    ar.Field(pcm.config_reg_3d);
+    ar.Field(pcm.irq_channel);
+    ar.Field(pcm.irq_assert);
+    ar.Field(pcm.config.noise_mask);
+    ar.Field(pcm.config.orval);
+    ar.Field(pcm.config.write_mask);
+    ar.Field(pcm.config.dac_mask);
+    ar.Field(pcm.config.oversampling);
+    ar.Field(pcm.config.reg_slots);
+    ar.Field(pcm.nfs);
+    ar.Field(pcm.tv_counter);
+    ar.Field(pcm.cycles);
+    ar.Field(pcm.eram);
+    ar.Field(pcm.accum_l);
+    ar.Field(pcm.accum_r);
+    ar.Field(pcm.rcsum);
+}
+
+template <typename Archive, typename LCD>
+static void EMU_VisitLCD(Archive& ar, LCD& lcd)
+{
+    ar.Field(lcd.LCD_DL);
+    ar.Field(lcd.LCD_N);
+    ar.Field(lcd.LCD_F);
+    ar.Field(lcd.LCD_D);
+    ar.Field(lcd.LCD_C);
+    ar.Field(lcd.LCD_B);
+    ar.Field(lcd.LCD_ID);
+    ar.Field(lcd.LCD_S);
+    ar.Field(lcd.LCD_DD_RAM);
+    ar.Field(lcd.LCD_AC);
+    ar.Field(lcd.LCD_CG_RAM);
+    ar.Field(lcd.LCD_RAM_MODE);
+    ar.Field(lcd.LCD_Data);
+    ar.Field(lcd.LCD_CG);
+    ar.Field(lcd.enable);
+}
+
+template <typename Archive, typename MCU, typename SM, typename Timer, typename PCM, typename LCD>
+static void EMU_VisitState(Archive& ar, MCU& mcu, SM& sm, Timer& timer, PCM& pcm, LCD& lcd)
+{
+    EMU_VisitMCU(ar, mcu);
+    EMU_VisitSM(ar, sm);
+    EMU_VisitTimer(ar, timer);
+    EMU_VisitPCM(ar, pcm);
+    EMU_VisitLCD(ar, lcd);
+}
+
+template <typename MCU, typename SM, typename Timer, typename PCM, typename LCD>
+static void EMU_WriteState(std::vector<uint8_t>& out, MCU& mcu, SM& sm, Timer& timer, PCM& pcm, LCD& lcd)
+{
+    EMU_StateHeader header{};
+    memcpy(header.magic, EMU_STATE_MAGIC, sizeof(header.magic));
+    header.version = EMU_STATE_VERSION;
+    header.romset = (uint32_t)mcu.romset;
+
+    out.clear();
+
+    EMU_StateWriter writer{out};
+    writer.Field(header);
+
+    // A sub mcu that ran ahead is stored the way it would be in step with the mcu. The copy is synced rather than `sm`
+    // so that saving doesn't change how the emulator runs; the replay stays within the sub mcu's own state.
+    submcu_t synced_sm = sm;
+    SM_Sync(synced_sm);
+
+    EMU_VisitState(writer, mcu, synced_sm, timer, pcm, lcd);
+}
+
+bool Emulator::SaveState(std::vector<uint8_t>& out)
+{
+    // Frames waiting for the block callback were produced before this point, so they don't belong to the state
+    MCU_FlushSampleBlock(*m_mcu);
+
+    EMU_WriteState(out, *m_mcu, *m_sm, *m_timer, *m_pcm, *m_lcd);
+
+    return true;
+}
+
+uint64_t Emulator::HashState() const
+{
+    // Synced the same way EMU_WriteState does, so that a sub mcu running ahead doesn't change the hash
+    submcu_t synced_sm = *m_sm;
+    SM_Sync(synced_sm);
+
+    EMU_StateHasher hasher;
+    EMU_VisitState(hasher,
+                   std::as_const(*m_mcu),
+                   std::as_const(synced_sm),
+                   std::as_const(*m_timer),
+                   std::as_const(*m_pcm),
+                   std::as_const(*m_lcd));
+    return hasher.hash;
+}
+
+bool Emulator::CloneFrom(const Emulator& other)
+{
+    if (!m_mcu || !other.m_mcu)
+    {
+        return false;
+    }
+
+    if (m_rom_image != other.m_rom_image)
+    {
+        m_rom_image = other.m_rom_image;
+        MCU_SetRomset(*m_mcu, m_rom_image->romset);
+        AttachRomImage();
+        MCU_PatchROM(*m_mcu);
+    }
+
+    // Our own frames were produced before the clone and still belong to our callback
+    MCU_FlushSampleBlock(*m_mcu);
+
+    // Going through the serialized form keeps the list of fields in one place. The state is small compared to the
+    // roms, which are shared rather than copied.
+    std::vector<uint8_t> state;
+    EMU_WriteState(state,
+                   std::as_const(*other.m_mcu),
+                   std::as_const(*other.m_sm),
+                   std::as_const(*other.m_timer),
+                   std::as_const(*other.m_pcm),
+                   *other.m_lcd);
+
+    return LoadState(state);
+}
+
+bool Emulator::LoadState(std::span<const uint8_t> state)
+{
+    EMU_StateHeader header;
+    if (state.size() < sizeof(header))
+    {
+        fprintf(stderr, "ERROR: State is truncated\n");
+        return false;
+    }
+
+    memcpy(&header, state.data(), sizeof(header));
+
+    if (memcmp(header.magic, EMU_STATE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "ERROR: Not an emulator state\n");
+        return false;
+    }
+
+    if (header.version != EMU_STATE_VERSION)
+    {
+        fprintf(stderr,
+                "ERROR: State has version %u, this build supports version %u\n",
+                header.version,
+                EMU_STATE_VERSION);
+        return false;
+    }
+
+    if (header.romset != (uint32_t)m_mcu->romset)
+    {
+        fprintf(stderr,
+                "ERROR: State was saved with romset %s but the emulator is running %s\n",
+                header.romset < ROMSET_COUNT ? RomsetName((Romset)header.romset) : "unknown",
+                RomsetName(m_mcu->romset));
+        return false;
+    }
+
+    EMU_StateSizer sizer;
+    EMU_VisitState(sizer, *m_mcu, *m_sm, *m_timer, *m_pcm, *m_lcd);
+
+    std::span<const uint8_t> body = state.subspan(sizeof(header));
+    if (body.size() != sizer.size)
+    {
+        fprintf(stderr, "ERROR: State has size %zu, expected %zu\n", body.size(), sizer.size);
+        return false;
+    }
+
+    MCU_FlushSampleBlock(*m_mcu);
+
+    EMU_StateReader reader{body};
+    EMU_VisitState(reader, *m_mcu, *m_sm, *m_timer, *m_pcm, *m_lcd);
+    LCD_Publish(*m_lcd);
+
+    SM_ResetSchedule(*m_sm);
+
+    // The memory map and decode cache only depend on the romset and roms, which the header check guarantees are the
+    // same, so they can stay as they are. The wave banks also depend on config_reg_3d.
+    PCM_UpdateWaveBanks(*m_pcm, m_mcu->family);
+
+    return true;
+}
@@ -36,6 +36,8 @@
 #include "lcd_back.h"
 #include "lcd_font.h"
 #include <cstring>
+#include <iterator>
+#include <new>
 
 void LCD_Enable(lcd_t& lcd, uint32_t enable)
 {
@@ -44,13 +46,15 @@ void LCD_Enable(lcd_t& lcd, uint32_t enable)
 
 void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
 {
-    // No point taking a lock and updating LCD state if there's no one to observe it.
+    // No point updating LCD state if there's no one to observe it.
     if (!lcd.backend)
     {
         return;
     }
 
-    std::scoped_lock lock(lcd.mutex);
+    // set when the write changes something LCD_Render draws
+    bool dirty = false;
+
     if (address == 0)
     {
         if ((data & 0xe0) == 0x20)
@@ -64,16 +68,19 @@ void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
             lcd.LCD_D = (data & 0x4) != 0;
             lcd.LCD_C = (data & 0x2) != 0;
             lcd.LCD_B = (data & 0x1) != 0;
+            dirty = true;
         }
         else if ((data & 0xff) == 0x01)
         {
             lcd.LCD_DD_RAM = 0;
             lcd.LCD_ID = 1;
             memset(lcd.LCD_Data, 0x20, sizeof(lcd.LCD_Data));
+            dirty = true;
         }
         else if ((data & 0xff) == 0x02)
         {
             lcd.LCD_DD_RAM = 0;
+            dirty |= lcd.LCD_C != 0;
         }
         else if ((data & 0xfc) == 0x04)
         {
@@ -89,6 +96,7 @@ void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
         {
             lcd.LCD_DD_RAM = (data & 0x7f);
             lcd.LCD_RAM_MODE = 1;
+            dirty |= lcd.LCD_C != 0;
         }
         else
         {
@@ -99,6 +107,7 @@ void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
     {
         if (!lcd.LCD_RAM_MODE)
         {
+            dirty |= lcd.LCD_CG[lcd.LCD_CG_RAM] != (data & 0x1f);
             lcd.LCD_CG[lcd.LCD_CG_RAM] = data & 0x1f;
             if (lcd.LCD_ID)
             {
@@ -112,24 +121,32 @@ void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
         }
         else
         {
+            uint8_t* target = nullptr;
             if (lcd.LCD_N)
             {
                 if (lcd.LCD_DD_RAM & 0x40)
                 {
                     if ((lcd.LCD_DD_RAM & 0x3f) < 40)
-                        lcd.LCD_Data[(lcd.LCD_DD_RAM & 0x3f) + 40] = data;
+                        target = &lcd.LCD_Data[(lcd.LCD_DD_RAM & 0x3f) + 40];
                 }
                 else
                 {
                     if ((lcd.LCD_DD_RAM & 0x3f) < 40)
-                        lcd.LCD_Data[lcd.LCD_DD_RAM & 0x3f] = data;
+                        target = &lcd.LCD_Data[lcd.LCD_DD_RAM & 0x3f];
                 }
             }
             else
             {
                 if (lcd.LCD_DD_RAM < 80)
-                    lcd.LCD_Data[lcd.LCD_DD_RAM] = data;
+                    target = &lcd.LCD_Data[lcd.LCD_DD_RAM];
+            }
+            if (target)
+            {
+                dirty |= *target != data;
+                *target = data;
             }
+            // the cursor follows the address
+            dirty |= lcd.LCD_C != 0;
             if (lcd.LCD_ID)
             {
                 lcd.LCD_DD_RAM++;
@@ -141,6 +158,13 @@ void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
             lcd.LCD_DD_RAM &= 0x7f;
         }
     }
+
+    // Emulator::SetFastForward publishes once it's done
+    if (dirty && !lcd.mcu->fast_forward)
+    {
+        LCD_Publish(lcd);
+    }
+
     //fprintf(stderr, "%i %.2x ", address, data);
     // if (data >= 0x20 && data <= 'z')
     //     fprintf(stderr, "%c\n", data);
@@ -148,6 +172,19 @@ void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data)
     //    fprintf(stderr, "\n");
 }
 
+void LCD_Publish(lcd_t& lcd)
+{
+    lcd_frame_t& frame = lcd.frames[lcd.frame_write];
+    frame.LCD_C = lcd.LCD_C;
+    frame.LCD_DD_RAM = lcd.LCD_DD_RAM;
+    memcpy(frame.LCD_Data, lcd.LCD_Data, sizeof(frame.LCD_Data));
+    memcpy(frame.LCD_CG, lcd.LCD_CG, sizeof(frame.LCD_CG));
+
+    // swap the frame we just wrote with the ready one, which LCD_Render hasn't picked up yet or is done with
+    const uint8_t ready = lcd.frame_ready.exchange(lcd.frame_write | LCD_FRAME_FRESH, std::memory_order_acq_rel);
+    lcd.frame_write = (uint8_t)(ready & ~LCD_FRAME_FRESH);
+}
+
 void LCD_Init(lcd_t& lcd, mcu_t& mcu)
 {
     lcd.mcu = &mcu;
@@ -174,6 +211,18 @@ bool LCD_Start(lcd_t& lcd)
 
     if (lcd.backend)
     {
+        try
+        {
+            lcd.buffer = std::make_unique<uint32_t[]>(lcd.width * lcd.height);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return false;
+        }
+
+        // Whatever was shown before is gone
+        lcd.rendered = false;
+
         if (!lcd.backend->Start(lcd))
         {
             success = false;
@@ -191,9 +240,15 @@ void LCD_Stop(lcd_t& lcd)
     }
 }
 
-void LCD_FontRenderStandard(lcd_t& lcd, uint8_t* LCD_CG, int32_t x, int32_t y, uint8_t ch, bool overlay = false)
+static inline uint32_t& LCD_Pixel(lcd_t& lcd, size_t row, size_t column)
+{
+    return lcd.buffer[row * lcd.width + column];
+}
+
+// Each of these returns the area it drew to.
+lcd_rect_t LCD_FontRenderStandard(lcd_t& lcd, const uint8_t* LCD_CG, int32_t x, int32_t y, uint8_t ch, bool overlay = false)
 {
-    uint8_t* f;
+    const uint8_t* f;
     if (ch >= 16)
         f = &lcd_font[ch - 16][0];
     else
@@ -218,18 +273,19 @@ void LCD_FontRenderStandard(lcd_t& lcd, uint8_t* LCD_CG, int32_t x, int32_t y, u
                 for (int jj = 0; jj < 5; jj++)
                 {
                     if (overlay)
-                        lcd.buffer[xx+ii][yy+jj] &= col;
+                        LCD_Pixel(lcd, xx+ii, yy+jj) &= col;
                     else
-                        lcd.buffer[xx+ii][yy+jj] = col;
+                        LCD_Pixel(lcd, xx+ii, yy+jj) = col;
                 }
             }
         }
     }
+    return lcd_rect_t{.left = y, .top = x, .width = 4 * 6 + 5, .height = 6 * 6 + 5};
 }
 
-void LCD_FontRenderLevel(lcd_t& lcd, uint8_t* LCD_CG, int32_t x, int32_t y, uint8_t ch, uint8_t width = 5)
+lcd_rect_t LCD_FontRenderLevel(lcd_t& lcd, const uint8_t* LCD_CG, int32_t x, int32_t y, uint8_t ch, uint8_t width = 5)
 {
-    uint8_t* f;
+    const uint8_t* f;
     if (ch >= 16)
         f = &lcd_font[ch - 16][0];
     else
@@ -253,11 +309,12 @@ void LCD_FontRenderLevel(lcd_t& lcd, uint8_t* LCD_CG, int32_t x, int32_t y, uint
             {
                 for (int jj = 0; jj < 24; jj++)
                 {
-                    lcd.buffer[xx+ii][yy+jj] = col;
+                    LCD_Pixel(lcd, xx+ii, yy+jj) = col;
                 }
             }
         }
     }
+    return lcd_rect_t{.left = y, .top = x, .width = (width - 1) * 26 + 24, .height = 7 * 11 + 9};
 }
 
 static const uint8_t LR[2][12][11] =
@@ -298,9 +355,9 @@ static const int LR_xy[2][2] = {
 };
 
 
-void LCD_FontRenderLR(lcd_t& lcd, uint8_t* LCD_CG, uint8_t ch)
+lcd_rect_t LCD_FontRenderLR(lcd_t& lcd, const uint8_t* LCD_CG, uint8_t ch)
 {
-    uint8_t* f;
+    const uint8_t* f;
     if (ch >= 16)
         f = &lcd_font[ch - 16][0];
     else
@@ -321,10 +378,12 @@ void LCD_FontRenderLR(lcd_t& lcd, uint8_t* LCD_CG, uint8_t ch)
             for (int j = 0; j < 11; j++)
             {
                 if (LR[letter][i][j])
-                    lcd.buffer[i+LR_xy[letter][0]][j+LR_xy[letter][1]] = col;
+                    LCD_Pixel(lcd, i+LR_xy[letter][0], j+LR_xy[letter][1]) = col;
             }
         }
     }
+    // both letters share a column
+    return lcd_rect_t{.left = LR_xy[0][1], .top = LR_xy[0][0], .width = 11, .height = LR_xy[1][0] - LR_xy[0][0] + 12};
 }
 
 void LCD_Render(lcd_t& lcd)
@@ -336,44 +395,87 @@ void LCD_Render(lcd_t& lcd)
 
     if (!lcd.mcu->is_cm300 && !lcd.mcu->is_st && !lcd.mcu->is_scb55)
     {
-        if (!lcd.mutex.try_lock())
+        const bool enable = lcd.enable || lcd.mcu->is_jv880;
+
+        // pick up the latest frame the emulator published, if there is one
+        if (lcd.frame_ready.load(std::memory_order_relaxed) & LCD_FRAME_FRESH)
+        {
+            const uint8_t ready = lcd.frame_ready.exchange(lcd.frame_read, std::memory_order_acq_rel);
+            lcd.frame_read = (uint8_t)(ready & ~LCD_FRAME_FRESH);
+        }
+        else if (lcd.rendered && enable == lcd.rendered_enable)
         {
-            // if the MCU is currently updating something, just drop the frame
+            // nothing to do, the backend is still showing the last frame
             return;
         }
 
-        // This is the only shared mutable state we need to complete rendering. Since rendering is relatively expensive,
-        // we'll quickly take a copy, release the lock, and use it for this frame.
-        uint32_t LCD_C      = lcd.LCD_C;
-        uint32_t LCD_DD_RAM = lcd.LCD_DD_RAM;
+        const lcd_frame_t& frame = lcd.frames[lcd.frame_read];
+        const uint32_t LCD_C = frame.LCD_C;
+        const uint32_t LCD_DD_RAM = frame.LCD_DD_RAM;
+        const uint8_t* LCD_CG = frame.LCD_CG;
+        const uint8_t* LCD_Data = frame.LCD_Data;
 
-        uint8_t LCD_CG[sizeof(lcd.LCD_CG)];
-        memcpy(LCD_CG, lcd.LCD_CG, sizeof(LCD_CG));
+        // Anything that affects the whole screen means starting over from the background. Otherwise only characters
+        // that changed since the last frame are drawn again.
+        const bool full = !lcd.rendered || enable != lcd.rendered_enable;
 
-        uint8_t LCD_Data[sizeof(lcd.LCD_Data)];
-        memcpy(LCD_Data, lcd.LCD_Data, sizeof(LCD_Data));
+        bool cg_changed[8];
+        for (int i = 0; i < 8; i++)
+        {
+            cg_changed[i] = memcmp(&LCD_CG[i * 8], &lcd.rendered_cg[i * 8], 8) != 0;
+        }
+
+        int cursor = -1;
+        if (lcd.mcu->is_jv880)
+        {
+            int j = LCD_DD_RAM % 0x40;
+            int i = LCD_DD_RAM / 0x40;
+            if (i < 2 && j < 24 && LCD_C)
+                cursor = i * 40 + j;
+        }
 
-        lcd.mutex.unlock();
+        auto changed = [&](int index) {
+            const uint8_t ch = LCD_Data[index];
+            return full || ch != lcd.rendered_data[index] || (ch < 16 && cg_changed[ch & 7]) || index == cursor ||
+                   index == lcd.rendered_cursor;
+        };
 
-        if (!lcd.enable && !lcd.mcu->is_jv880)
+        // Everything drawn this frame, for the backend. A full redraw is reported as one rect covering the screen.
+        lcd_rect_t dirty[64];
+        size_t dirty_count = 0;
+        auto drawn = [&](const lcd_rect_t& rect) {
+            if (!full && dirty_count < std::size(dirty))
+                dirty[dirty_count++] = rect;
+        };
+
+        if (full)
         {
-            memset(lcd.buffer, 0, sizeof(lcd.buffer));
+            dirty[dirty_count++] = lcd_rect_t{.left = 0, .top = 0, .width = (int)lcd.width, .height = (int)lcd.height};
+        }
+
+        if (!enable)
+        {
+            if (full)
+                memset(lcd.buffer.get(), 0, lcd.width * lcd.height * sizeof(uint32_t));
         }
         else
         {
-            if (lcd.mcu->is_jv880)
+            if (full)
             {
-                for (size_t i = 0; i < lcd.height; i++) {
-                    for (size_t j = 0; j < lcd.width; j++) {
-                        lcd.buffer[i][j] = 0xFF03be51;
+                if (lcd.mcu->is_jv880)
+                {
+                    for (size_t i = 0; i < lcd.height; i++) {
+                        for (size_t j = 0; j < lcd.width; j++) {
+                            LCD_Pixel(lcd, i, j) = 0xFF03be51;
+                        }
                     }
                 }
-            }
-            else
-            {
-                for (size_t i = 0; i < lcd.height; i++) {
-                    for (size_t j = 0; j < lcd.width; j++) {
-                        lcd.buffer[i][j] = back_palette[back_data[i * lcd.width + j]];
+                else
+                {
+                    for (size_t i = 0; i < lcd.height; i++) {
+                        for (size_t j = 0; j < lcd.width; j++) {
+                            LCD_Pixel(lcd, i, j) = back_palette[back_data[i * lcd.width + j]];
+                        }
                     }
                 }
             }
@@ -385,73 +487,66 @@ void LCD_Render(lcd_t& lcd)
                     for (int j = 0; j < 24; j++)
                     {
                         uint8_t ch = LCD_Data[i * 40 + j];
-                        LCD_FontRenderStandard(lcd, LCD_CG, 4 + i * 50, 4 + j * 34, ch);
+                        if (changed(i * 40 + j))
+                            drawn(LCD_FontRenderStandard(lcd, LCD_CG, 4 + i * 50, 4 + j * 34, ch));
                     }
                 }
                 
-                // cursor
-                int j = LCD_DD_RAM % 0x40;
-                int i = LCD_DD_RAM / 0x40;
-                if (i < 2 && j < 24 && LCD_C)
+                // cursor, its cell was just redrawn above
+                if (cursor != -1)
+                {
+                    int j = cursor % 40;
+                    int i = cursor / 40;
                     LCD_FontRenderStandard(lcd, LCD_CG, 4 + i * 50, 4 + j * 34, '_', true);
+                }
             }
             else
             {
-                for (int i = 0; i < 3; i++)
-                {
-                    uint8_t ch = LCD_Data[0 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 11, 34 + i * 35, ch);
-                }
-                for (int i = 0; i < 16; i++)
-                {
-                    uint8_t ch = LCD_Data[3 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 11, 153 + i * 35, ch);
-                }
-                for (int i = 0; i < 3; i++)
-                {
-                    uint8_t ch = LCD_Data[40 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 75, 34 + i * 35, ch);
-                }
-                for (int i = 0; i < 3; i++)
-                {
-                    uint8_t ch = LCD_Data[43 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 75, 153 + i * 35, ch);
-                }
-                for (int i = 0; i < 3; i++)
-                {
-                    uint8_t ch = LCD_Data[49 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 139, 34 + i * 35, ch);
-                }
-                for (int i = 0; i < 3; i++)
-                {
-                    uint8_t ch = LCD_Data[46 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 139, 153 + i * 35, ch);
-                }
-                for (int i = 0; i < 3; i++)
+                // { first LCD_Data index, count, x, first y }
+                static const int rows[8][4] = {
+                    { 0,  3,  11, 34 },
+                    { 3,  16, 11, 153 },
+                    { 40, 3,  75, 34 },
+                    { 43, 3,  75, 153 },
+                    { 49, 3, 139, 34 },
+                    { 46, 3, 139, 153 },
+                    { 52, 3, 203, 34 },
+                    { 55, 3, 203, 153 },
+                };
+                for (const auto& row : rows)
                 {
-                    uint8_t ch = LCD_Data[52 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 203, 34 + i * 35, ch);
-                }
-                for (int i = 0; i < 3; i++)
-                {
-                    uint8_t ch = LCD_Data[55 + i];
-                    LCD_FontRenderStandard(lcd, LCD_CG, 203, 153 + i * 35, ch);
+                    for (int i = 0; i < row[1]; i++)
+                    {
+                        uint8_t ch = LCD_Data[row[0] + i];
+                        if (changed(row[0] + i))
+                            drawn(LCD_FontRenderStandard(lcd, LCD_CG, row[2], row[3] + i * 35, ch));
+                    }
                 }
 
-                LCD_FontRenderLR(lcd, LCD_CG, LCD_Data[58]);
+                if (changed(58))
+                    drawn(LCD_FontRenderLR(lcd, LCD_CG, LCD_Data[58]));
 
                 for (int i = 0; i < 2; i++)
                 {
                     for (int j = 0; j < 4; j++)
                     {
                         uint8_t ch = LCD_Data[20 + j + i * 40];
-                        LCD_FontRenderLevel(lcd, LCD_CG, 71 + i * 88, 293 + j * 130, ch, j == 3 ? 1 : 5);
+                        if (changed(20 + j + i * 40))
+                            drawn(LCD_FontRenderLevel(lcd, LCD_CG, 71 + i * 88, 293 + j * 130, ch, j == 3 ? 1 : 5));
                     }
                 }
             }
         }
 
-        lcd.backend->Render();
+        lcd.rendered = true;
+        lcd.rendered_enable = enable;
+        lcd.rendered_cursor = cursor;
+        memcpy(lcd.rendered_data, LCD_Data, sizeof(lcd.rendered_data));
+        memcpy(lcd.rendered_cg, LCD_CG, sizeof(lcd.rendered_cg));
+
+        if (dirty_count)
+        {
+            lcd.backend->Render(std::span<const lcd_rect_t>(dirty, dirty_count));
+        }
     }
 }
-
@@ -35,13 +35,19 @@
 
 #include <atomic>
 #include <cstdint>
-#include <mutex>
+#include <memory>
+#include <span>
 
 struct mcu_t;
 struct lcd_t;
 
-static const int lcd_width_max = 1024;
-static const int lcd_height_max = 1024;
+// A region of `lcd_t::buffer`, in pixels.
+struct lcd_rect_t {
+    int left = 0;
+    int top = 0;
+    int width = 0;
+    int height = 0;
+};
 
 class LCD_Backend
 {
@@ -55,10 +61,21 @@ public:
     // started again.
     virtual void Stop() = 0;
 
-    // Called on LCD_Render. The backend should display a frame to the user.
-    virtual void Render() = 0;
+    // Called on LCD_Render. The backend should display a frame to the user. Only the pixels in `dirty` have changed
+    // since the previous call.
+    virtual void Render(std::span<const lcd_rect_t> dirty) = 0;
+};
+
+// Everything LCD_Render needs from the emulator side.
+struct lcd_frame_t {
+    uint32_t LCD_C = 0;
+    uint32_t LCD_DD_RAM = 0;
+    uint8_t LCD_Data[80]{};
+    uint8_t LCD_CG[64]{};
 };
 
+constexpr uint8_t LCD_FRAME_FRESH = 0x80;
+
 struct lcd_t {
     mcu_t* mcu = nullptr;
 
@@ -78,9 +95,24 @@ struct lcd_t {
     // updated by MCU via LCD_Enable
     std::atomic<uint8_t> enable = 0;
 
-    uint32_t buffer[lcd_height_max][lcd_width_max]{};
-
-    std::mutex mutex;
+    // `height` rows of `width` pixels. Only allocated by LCD_Start when there is a backend to display it.
+    std::unique_ptr<uint32_t[]> buffer;
+
+    // The emulator thread hands the visible part of the state above to LCD_Render through a triple buffer, so neither
+    // side ever waits for the other. `frame_write` belongs to the emulator, `frame_read` to LCD_Render, and
+    // `frame_ready` holds the third index plus LCD_FRAME_FRESH when it is newer than `frame_read`.
+    lcd_frame_t frames[3]{};
+    uint8_t frame_write = 0;
+    uint8_t frame_read = 1;
+    std::atomic<uint8_t> frame_ready = 2;
+
+    // What `buffer` currently shows, so LCD_Render only has to redraw the characters that changed. Only touched by
+    // LCD_Render.
+    bool    rendered = false;
+    bool    rendered_enable = false;
+    int     rendered_cursor = -1;
+    uint8_t rendered_data[80]{};
+    uint8_t rendered_cg[64]{};
 
     LCD_Backend* backend = nullptr;
 };
@@ -92,3 +124,6 @@ void LCD_Stop(lcd_t& lcd);
 void LCD_Write(lcd_t& lcd, uint32_t address, uint8_t data);
 void LCD_Enable(lcd_t& lcd, uint32_t enable);
 void LCD_Render(lcd_t& lcd);
+
+// Makes the current state visible to LCD_Render. LCD_Write does this itself; call it after changing the state directly.
+void LCD_Publish(lcd_t& lcd);
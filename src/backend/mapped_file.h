@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+// A read-only view of a file's contents through the OS page cache. Nothing is copied, and processes mapping the same
+// file share its pages.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    // moveable
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    // noncopyable
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps all of `filename`. Returns false if it can't be opened or mapped, or if it's empty.
+    bool Open(const std::filesystem::path& filename);
+    void Close();
+
+    std::span<const uint8_t> GetData() const
+    {
+        return {m_data, m_size};
+    }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t         m_size = 0;
+#ifdef _WIN32
+    void* m_mapping = nullptr;
+#endif
+};
+
+// A range of bytes inside a mapped file. Holds a reference to the file so that the range stays valid.
+struct MappedRange
+{
+    std::shared_ptr<const MappedFile> file;
+    std::span<const uint8_t>          data;
+};
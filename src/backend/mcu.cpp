@@ -37,7 +37,9 @@
 #include "mcu_timer.h"
 #include "pcm.h"
 #include "submcu.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 
 void MCU_ErrorTrap(mcu_t& mcu)
 {
@@ -405,7 +407,103 @@ void MCU_UpdateAnalog(mcu_t& mcu, uint64_t cycles)
         mcu.analog_end_time = 0;
 }
 
-uint8_t MCU_Read(mcu_t& mcu, uint32_t address)
+// Returns a pointer to the rom2 byte at `address` the same way MCU_ReadUnmapped computes it, or null if rom2 is too
+// small to back a whole block contiguously.
+static const uint8_t* MCU_MapROM2(mcu_t& mcu, uint32_t address)
+{
+    if (!mcu.rom2 || (mcu.rom2_mask & (MCU_MAP_BLOCK_SIZE - 1)) != MCU_MAP_BLOCK_SIZE - 1)
+        return nullptr;
+    uint32_t address_rom = address & 0x3ffff;
+    if (address & 0x80000 && !mcu.is_jv880)
+        address_rom |= 0x40000;
+    return &mcu.rom2[address_rom & mcu.rom2_mask];
+}
+
+void MCU_BuildMemoryMap(mcu_t& mcu)
+{
+    for (int i = 0; i < MCU_MAP_SIZE; ++i)
+    {
+        const uint32_t address = (uint32_t)i << MCU_MAP_BLOCK_BITS;
+        const uint8_t page = (address >> 16) & 0xf;
+        const uint32_t offset = address & 0xffff;
+
+        // Only plain memory is mapped here. Everything else, including the on-chip RAM which can be disabled at
+        // runtime through RAME, stays on the slow path.
+        const uint8_t* read = nullptr;
+        uint8_t* write = nullptr;
+        switch (page)
+        {
+        case 0:
+            if (offset < 0x8000)
+                read = mcu.rom1 ? &mcu.rom1[offset] : nullptr;
+            else if (offset < 0xe000)
+            {
+                read = &mcu.sram[offset & 0x7fff];
+                write = &mcu.sram[offset & 0x7fff];
+            }
+            break;
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+            read = MCU_MapROM2(mcu, address);
+            break;
+        case 8:
+        case 9:
+            if (!mcu.is_jv880)
+                read = MCU_MapROM2(mcu, address);
+            break;
+        case 14:
+        case 15:
+            if (!mcu.is_jv880)
+                read = MCU_MapROM2(mcu, address);
+            else
+            {
+                read = &mcu.cardram[offset & 0x7fff];
+                if (page == 14)
+                    write = &mcu.cardram[offset & 0x7fff];
+            }
+            break;
+        case 10:
+        case 11:
+            if (!mcu.is_mk1)
+            {
+                read = &mcu.sram[offset & 0x7fff];
+                if (page == 10)
+                    write = &mcu.sram[offset & 0x7fff];
+            }
+            break;
+        case 12:
+        case 13:
+            if (mcu.is_jv880)
+            {
+                read = &mcu.nvram[offset & 0x7fff];
+                if (page == 12)
+                    write = &mcu.nvram[offset & 0x7fff];
+            }
+            break;
+        case 5:
+            if (mcu.is_mk1)
+            {
+                read = &mcu.sram[offset & 0x7fff];
+                write = &mcu.sram[offset & 0x7fff];
+            }
+            break;
+        default:
+            break;
+        }
+        mcu.read_map[i] = read;
+        mcu.write_map[i] = write;
+        mcu.code_cacheable[i] = read && ((read >= mcu.rom1 && read < mcu.rom1 + ROM1_SIZE) ||
+                                         (read >= mcu.rom2 && read < mcu.rom2 + ROM2_SIZE));
+    }
+
+    // Rom contents or their mapping may have changed
+    for (mcu_decoded_general_t& entry : mcu.decode_cache)
+        entry = mcu_decoded_general_t{};
+}
+
+uint8_t MCU_ReadUnmapped(mcu_t& mcu, uint32_t address)
 {
     uint32_t address_rom = address & 0x3ffff;
     if (address & 0x80000 && !mcu.is_jv880)
@@ -607,7 +705,7 @@ uint32_t MCU_Read32(mcu_t& mcu, uint32_t address)
     return (b0 << 24) + (b1 << 16) + (b2 << 8) + b3;
 }
 
-void MCU_Write(mcu_t& mcu, uint32_t address, uint8_t value)
+void MCU_WriteUnmapped(mcu_t& mcu, uint32_t address, uint8_t value)
 {
     uint8_t page = (address >> 16) & 0xf;
     address &= 0xffff;
@@ -754,6 +852,8 @@ void MCU_ReadInstruction(mcu_t& mcu)
 {
     uint8_t operand = MCU_ReadCodeAdvance(mcu);
 
+    PROF_CountMCUInstruction(mcu.pc_profile, mcu.cp, (uint16_t)(mcu.pc - 1), operand);
+
     MCU_Operand_Table[operand](mcu, operand);
 
     if (mcu.sr & STATUS_T)
@@ -768,12 +868,19 @@ void MCU_DefaultSampleCallback(void* userdata, const AudioFrame<int32_t>& frame)
     (void)frame;
 }
 
+void MCU_DefaultSampleBlockCallback(void* userdata, std::span<const AudioFrame<int32_t>> frames)
+{
+    (void)userdata;
+    (void)frames;
+}
+
 void MCU_Init(mcu_t& mcu, submcu_t& sm, pcm_t& pcm, mcu_timer_t& timer, lcd_t& lcd)
 {
     mcu.sm = &sm;
     mcu.pcm = &pcm;
     mcu.timer = &timer;
     mcu.lcd = &lcd;
+    MCU_BuildMemoryMap(mcu);
 }
 
 void MCU_Deinit(mcu_t& mcu)
@@ -816,17 +923,46 @@ void MCU_Reset(mcu_t& mcu)
     }
 }
 
-void MCU_PostUART(mcu_t& mcu, uint8_t data)
+bool MCU_PostUART(mcu_t& mcu, uint8_t data)
+{
+    return MCU_PostUART(mcu, std::span<const uint8_t>(&data, 1));
+}
+
+bool MCU_PostUART(mcu_t& mcu, std::span<const uint8_t> data)
 {
-    mcu.uart_buffer[mcu.uart_write_ptr] = data;
-    mcu.uart_write_ptr = (mcu.uart_write_ptr + 1) % uart_buffer_size;
+    if (data.size() > MCU_GetUARTSpace(mcu))
+    {
+        // Dropping the whole message keeps the stream parseable; a partial sysex would garble what follows
+        mcu.uart_dropped.fetch_add(data.size(), std::memory_order_relaxed);
+        return false;
+    }
+
+    const uint32_t write_ptr = mcu.uart_write_ptr.load(std::memory_order_relaxed);
+    const size_t first = std::min(data.size(), (size_t)(uart_buffer_size - write_ptr));
+    memcpy(&mcu.uart_buffer[write_ptr], data.data(), first);
+    memcpy(&mcu.uart_buffer[0], data.data() + first, data.size() - first);
+
+    mcu.uart_write_ptr.store((uint32_t)((write_ptr + data.size()) % uart_buffer_size), std::memory_order_release);
+    return true;
+}
+
+bool MCU_IsUARTIdle(const mcu_t& mcu)
+{
+    if (MCU_HasUART(mcu))
+        return false;
+
+    // The sub mcu receives midi on the mk2 and hands it on to the mcu
+    if (mcu.family == RomsetFamily::MK2)
+        return !mcu.sm->uart_rx_gotbyte && !mcu.sm->replaying;
+
+    return (mcu.dev_register[DEV_SSR] & 0x40) == 0;
 }
 
 void MCU_UpdateUART_RX(mcu_t& mcu)
 {
     if ((mcu.dev_register[DEV_SCR] & 16) == 0) // RX disabled
         return;
-    if (mcu.uart_write_ptr == mcu.uart_read_ptr) // no byte
+    if (!MCU_HasUART(mcu)) // no byte
         return;
 
     if (mcu.dev_register[DEV_SSR] & 0x40)
@@ -835,8 +971,7 @@ void MCU_UpdateUART_RX(mcu_t& mcu)
     if (mcu.cycles < mcu.uart_rx_delay)
         return;
 
-    mcu.uart_rx_byte = mcu.uart_buffer[mcu.uart_read_ptr];
-    mcu.uart_read_ptr = (mcu.uart_read_ptr + 1) % uart_buffer_size;
+    mcu.uart_rx_byte = MCU_PopUART(mcu);
     mcu.dev_register[DEV_SSR] |= 0x40;
     MCU_Interrupt_SetRequest(mcu, INTERRUPT_SOURCE_UART_RX, (mcu.dev_register[DEV_SCR] & 0x40) != 0);
 }
@@ -859,36 +994,78 @@ void MCU_UpdateUART_TX(mcu_t& mcu)
     // fprintf(stderr, "tx:%x\n", mcu.dev_register[DEV_TDR]);
 }
 
-void MCU_Step(mcu_t& mcu)
+// Calls `fn.template operator()<Family>()` with the family of the loaded romset. The romset only changes when roms
+// are loaded, so callers should dispatch once and run as much work as possible inside `fn`.
+template <typename Fn>
+static void MCU_DispatchFamily(RomsetFamily family, Fn&& fn)
+{
+    switch (family)
+    {
+    case RomsetFamily::MK2:
+        fn.template operator()<RomsetFamily::MK2>();
+        break;
+    case RomsetFamily::MK1:
+        fn.template operator()<RomsetFamily::MK1>();
+        break;
+    case RomsetFamily::SCB55:
+        fn.template operator()<RomsetFamily::SCB55>();
+        break;
+    case RomsetFamily::JV880:
+        fn.template operator()<RomsetFamily::JV880>();
+        break;
+    }
+}
+
+template <RomsetFamily Family>
+static inline void MCU_Step(mcu_t& mcu)
 {
     if (!mcu.ex_ignore)
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::Interrupts);
         MCU_Interrupt_Handle(mcu);
+    }
     else
         mcu.ex_ignore = 0;
 
     if (!mcu.sleep)
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::Instructions);
         MCU_ReadInstruction(mcu);
+    }
 
-    mcu.cycles += 12; // FIXME: assume 12 cycles per instruction
+    mcu.cycles += MCU_CYCLES_PER_STEP; // FIXME: assume 12 cycles per instruction
 
     // if (mcu.cycles % 24000000 == 0)
     //     fprintf(stderr, "seconds: %i\n", (int)(mcu.cycles / 24000000));
 
-    PCM_Update(*mcu.pcm, mcu.cycles);
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::PCM);
+        PCM_Update<Family>(*mcu.pcm, mcu.cycles);
+    }
 
-    TIMER_Clock(*mcu.timer, mcu.cycles);
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::Timers);
+        TIMER_Clock<Family>(*mcu.timer, mcu.cycles);
+    }
 
-    if (!mcu.is_mk1 && !mcu.is_jv880 && !mcu.is_scb55)
+    if constexpr (Family == RomsetFamily::MK2)
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::SubMCU);
         SM_Update(*mcu.sm, mcu.cycles);
+    }
     else
     {
+        PROF_Scope scope(mcu.profile, ProfileStage::UART);
         MCU_UpdateUART_RX(mcu);
         MCU_UpdateUART_TX(mcu);
     }
 
-    MCU_UpdateAnalog(mcu, mcu.cycles);
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::Analog);
+        MCU_UpdateAnalog(mcu, mcu.cycles);
+    }
 
-    if (mcu.is_mk1)
+    if constexpr (Family == RomsetFamily::MK1)
     {
         if (mcu.ga_lcd_counter)
         {
@@ -902,9 +1079,154 @@ void MCU_Step(mcu_t& mcu)
     }
 }
 
+void MCU_Step(mcu_t& mcu)
+{
+    MCU_DispatchFamily(mcu.family, [&]<RomsetFamily Family>() {
+        MCU_Step<Family>(mcu);
+    });
+}
+
+// Returns the highest cycle count the mcu can reach while asleep before the timers, the analog unit, the uart or the
+// gate array lcd counter need to run step by step. Returns `mcu.cycles` or less when the next step must run normally.
+template <RomsetFamily Family>
+static uint64_t MCU_GetSleepHorizon(const mcu_t& mcu)
+{
+    uint64_t horizon = TIMER_GetSleepHorizon<Family>(*mcu.timer);
+
+    if (mcu.dev_register[DEV_ADCSR] & 0x20)
+    {
+        // MCU_UpdateAnalog starts the conversion on the next step
+        if (mcu.analog_end_time == 0)
+            return 0;
+        horizon = std::min(horizon, mcu.analog_end_time);
+    }
+
+    if constexpr (Family != RomsetFamily::MK2)
+    {
+        if ((mcu.dev_register[DEV_SCR] & 16) != 0 && MCU_HasUART(mcu) &&
+            (mcu.dev_register[DEV_SSR] & 0x40) == 0)
+        {
+            if (mcu.uart_rx_delay == 0)
+                return 0;
+            horizon = std::min(horizon, mcu.uart_rx_delay - 1);
+        }
+
+        if ((mcu.dev_register[DEV_SCR] & 32) != 0 && (mcu.dev_register[DEV_SSR] & 0x80) == 0)
+        {
+            if (mcu.uart_tx_delay == 0)
+                return 0;
+            horizon = std::min(horizon, mcu.uart_tx_delay - 1);
+        }
+    }
+
+    if constexpr (Family == RomsetFamily::MK1)
+    {
+        if (mcu.ga_lcd_counter > 0)
+            horizon = std::min(horizon, mcu.cycles + (uint64_t)(mcu.ga_lcd_counter - 1) * MCU_CYCLES_PER_STEP);
+    }
+
+    return horizon;
+}
+
+// Advances a sleeping mcu without running the interrupt check, the timers or the analog unit on every step. The pcm
+// and the sub mcu still run step by step so that samples come out at the same time and any interrupt request they
+// raise is seen by the next `MCU_Step`. Stops at the same point the `MCU_StepUntil*` loops would.
+template <RomsetFamily Family>
+static void MCU_SleepFastForward(mcu_t& mcu, uint64_t cycle_limit, uint64_t frame_limit)
+{
+    const uint64_t horizon = MCU_GetSleepHorizon<Family>(mcu);
+    const uint64_t start_cycles = mcu.cycles;
+    const uint32_t raise_count = mcu.interrupt_raise_count;
+    const uint32_t uart_write_ptr = mcu.uart_write_ptr.load(std::memory_order_relaxed);
+
+    while (mcu.cycles < cycle_limit && mcu.frames_posted < frame_limit
+        && mcu.cycles + MCU_CYCLES_PER_STEP <= horizon)
+    {
+        mcu.cycles += MCU_CYCLES_PER_STEP;
+
+        {
+            PROF_Scope scope(mcu.profile, ProfileStage::PCM);
+            PCM_Update<Family>(*mcu.pcm, mcu.cycles);
+        }
+
+        if constexpr (Family == RomsetFamily::MK2)
+        {
+            PROF_Scope scope(mcu.profile, ProfileStage::SubMCU);
+            SM_Update(*mcu.sm, mcu.cycles);
+        }
+
+        if (mcu.interrupt_raise_count != raise_count)
+            break;
+
+        // Midi posted from another thread; let MCU_UpdateUART_RX pick it up at the normal time
+        if constexpr (Family != RomsetFamily::MK2)
+        {
+            if (mcu.uart_write_ptr.load(std::memory_order_relaxed) != uart_write_ptr)
+                break;
+        }
+    }
+
+    if (mcu.cycles == start_cycles)
+        return;
+
+    // Neither of these can raise an interrupt before the horizon, so running them once is the same as running them
+    // on every step.
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::Timers);
+        TIMER_Clock<Family>(*mcu.timer, mcu.cycles);
+    }
+    {
+        PROF_Scope scope(mcu.profile, ProfileStage::Analog);
+        MCU_UpdateAnalog(mcu, mcu.cycles);
+    }
+
+    if constexpr (Family == RomsetFamily::MK1)
+    {
+        if (mcu.ga_lcd_counter > 0)
+            mcu.ga_lcd_counter -= (int)((mcu.cycles - start_cycles) / MCU_CYCLES_PER_STEP);
+    }
+}
+
+// Runs one step, then fast-forwards if the cpu was asleep for the whole step and nothing could have woken it.
+template <RomsetFamily Family>
+static inline void MCU_StepOrSleep(mcu_t& mcu, uint64_t cycle_limit, uint64_t frame_limit)
+{
+    const bool was_asleep = mcu.sleep && !mcu.ex_ignore;
+    const uint32_t raise_count = mcu.interrupt_raise_count;
+    const uint16_t pc = mcu.pc;
+
+    MCU_Step<Family>(mcu);
+
+    // The interrupt check at the start of the step saw every pending request and left the cpu asleep. Since the cpu
+    // didn't run, the interrupt mask and priorities can't have changed either.
+    if (was_asleep && mcu.sleep && mcu.pc == pc && mcu.interrupt_raise_count == raise_count)
+        MCU_SleepFastForward<Family>(mcu, cycle_limit, frame_limit);
+}
+
+void MCU_StepUntilCycles(mcu_t& mcu, uint64_t target_cycles)
+{
+    MCU_DispatchFamily(mcu.family, [&]<RomsetFamily Family>() {
+        while (mcu.cycles < target_cycles)
+        {
+            MCU_StepOrSleep<Family>(mcu, target_cycles, UINT64_MAX);
+        }
+    });
+}
+
+void MCU_StepUntilFrames(mcu_t& mcu, uint64_t target_frames)
+{
+    MCU_DispatchFamily(mcu.family, [&]<RomsetFamily Family>() {
+        while (mcu.frames_posted < target_frames)
+        {
+            MCU_StepOrSleep<Family>(mcu, UINT64_MAX, target_frames);
+        }
+    });
+}
+
 void MCU_PatchROM(mcu_t& mcu)
 {
-    (void)mcu;
+    // Roms are loaded at this point so rom2_mask is final
+    MCU_BuildMemoryMap(mcu);
     //rom2[0x1333] = 0x11;
     //rom2[0x1334] = 0x19;
     //rom1[0x622d] = 0x19;
@@ -943,11 +1265,31 @@ void MCU_WriteP1(mcu_t& mcu, uint8_t data)
     mcu.p1_data = data;
 }
 
-void MCU_PostSample(mcu_t& mcu, const AudioFrame<int32_t>& frame)
+void MCU_DeliverSample(mcu_t& mcu, const AudioFrame<int32_t>& frame)
 {
+    if (mcu.sample_block_size)
+    {
+        mcu.sample_block[mcu.sample_block_len] = frame;
+        ++mcu.sample_block_len;
+        if (mcu.sample_block_len == mcu.sample_block_size)
+        {
+            MCU_FlushSampleBlock(mcu);
+        }
+        return;
+    }
+
     mcu.sample_callback(mcu.callback_userdata, frame);
 }
 
+void MCU_FlushSampleBlock(mcu_t& mcu)
+{
+    if (mcu.sample_block_len)
+    {
+        mcu.sample_block_callback(mcu.callback_userdata, std::span(mcu.sample_block, mcu.sample_block_len));
+        mcu.sample_block_len = 0;
+    }
+}
+
 void MCU_GA_SetGAInt(mcu_t& mcu, int line, int value)
 {
     // guesswork
@@ -1007,4 +1349,21 @@ void MCU_SetRomset(mcu_t& mcu, Romset romset)
         mcu.is_scb55 = true;
         break;
     }
+
+    mcu.family = GetRomsetFamily(romset);
+
+    if (mcu.is_jv880)
+    {
+        if (!mcu.nvram)
+            mcu.nvram = std::make_unique<uint8_t[]>(NVRAM_SIZE);
+        if (!mcu.cardram)
+            mcu.cardram = std::make_unique<uint8_t[]>(CARDRAM_SIZE);
+    }
+    else
+    {
+        mcu.nvram.reset();
+        mcu.cardram.reset();
+    }
+
+    MCU_BuildMemoryMap(mcu);
 }
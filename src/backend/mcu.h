@@ -35,9 +35,13 @@
 
 #include "audio.h"
 #include "mcu_interrupt.h"
+#include "pc_profile.h"
+#include "profile.h"
 #include "rom.h"
 #include <atomic>
 #include <cstdint>
+#include <memory>
+#include <span>
 
 struct submcu_t;
 struct pcm_t;
@@ -189,10 +193,49 @@ static const int ROMSM_SIZE = 0x1000;
 
 static const uint32_t uart_buffer_size = 8192;
 
+// The 20-bit address space is split into 4KB blocks for the memory map.
+static const int MCU_MAP_BLOCK_BITS = 12;
+static const int MCU_MAP_BLOCK_SIZE = 1 << MCU_MAP_BLOCK_BITS;
+static const int MCU_MAP_SIZE = 0x100000 >> MCU_MAP_BLOCK_BITS;
+
+// Everything about a general-format instruction that can be determined from its bytes alone. Instructions executed
+// from rom are decoded once and cached in `mcu_t::decode_cache`.
+struct mcu_decoded_general_t {
+    // Address of the operand byte, or UINT32_MAX if this entry is empty.
+    uint32_t address = UINT32_MAX;
+    // Displacement, immediate data or absolute address depending on `type`.
+    uint16_t value = 0;
+    // Number of bytes between the operand byte and the end of the opcode.
+    uint8_t length = 0;
+    uint8_t type = 0;
+    uint8_t increase = 0;
+    uint8_t siz = 0;
+    uint8_t reg = 0;
+    // For absolute addressing: 0 if `value` is the low byte of an address in page 0 with br as the high byte, 1 if
+    // `value` is a 16 bit address in page dp.
+    uint8_t absolute_dp = 0;
+    uint8_t opcode = 0;
+    uint8_t opcode_reg = 0;
+    uint8_t opcode_extended = 0;
+};
+
+static const int MCU_DECODE_CACHE_SIZE = 4096;
+
+// Number of cycles each call to `MCU_Step` advances the emulator by.
+constexpr uint64_t MCU_CYCLES_PER_STEP = 12;
+
 typedef void(*mcu_sample_callback)(void* userdata, const AudioFrame<int32_t>& frame);
 
 void MCU_DefaultSampleCallback(void* userdata, const AudioFrame<int32_t>& frame);
 
+typedef void(*mcu_sample_block_callback)(void* userdata, std::span<const AudioFrame<int32_t>> frames);
+
+void MCU_DefaultSampleBlockCallback(void* userdata, std::span<const AudioFrame<int32_t>> frames);
+
+// Fields are grouped by how often they're touched rather than by what they belong to. The registers and everything
+// `MCU_Step` touches on every instruction come first so they share a few cache lines, the memory map and the buffers
+// it points at follow, and large or rarely used state goes last. Fields written by other threads get cache lines of
+// their own so the emulator thread doesn't lose its copy of its own state whenever they change.
 struct mcu_t {
     uint16_t r[8]{};
     uint16_t pc = 0;
@@ -200,17 +243,54 @@ struct mcu_t {
     uint8_t cp = 0, dp = 0, ep = 0, tp = 0, br = 0;
     uint8_t sleep = 0;
     uint8_t ex_ignore = 0;
+    uint8_t opcode_extended = 0;
+
+    // Scratch space of the instruction being decoded
+    uint32_t operand_type = 0;
+    uint16_t operand_ea = 0;
+    uint8_t operand_ep = 0;
+    uint8_t operand_size = 0;
+    uint8_t operand_reg = 0;
+    uint8_t operand_status = 0;
+    uint16_t operand_data = 0;
+
     int32_t exception_pending = 0;
-    uint8_t interrupt_pending[INTERRUPT_SOURCE_MAX]{};
-    uint8_t trapa_pending[16]{};
+    // Incremented every time an interrupt request goes from clear to set. Lets the sleep fast-forward notice that
+    // something may have woken the cpu.
+    uint32_t interrupt_raise_count = 0;
     uint64_t cycles = 0;
+    // Bit `i` is set while interrupt source `i` requests service, and while TRAPA #i waits to be taken. Kept as masks
+    // so that `MCU_Interrupt_Handle` can tell that nothing is pending with a single test.
+    uint32_t interrupt_pending = 0;
+    uint16_t trapa_pending = 0;
 
-    uint8_t rom1[ROM1_SIZE]{};
-    uint8_t rom2[ROM2_SIZE]{};
-    uint8_t ram[RAM_SIZE]{};
-    uint8_t sram[SRAM_SIZE]{};
-    uint8_t nvram[NVRAM_SIZE]{};
-    uint8_t cardram[CARDRAM_SIZE]{};
+    RomsetFamily family = RomsetFamily::MK2;
+    int rom2_mask = ROM2_SIZE - 1;
+
+    submcu_t* sm = nullptr;
+    pcm_t* pcm = nullptr;
+    mcu_timer_t* timer = nullptr;
+    lcd_t* lcd = nullptr;
+
+    // Read-only, sized ROM1_SIZE and ROM2_SIZE. Owned by the emulator's rom image.
+    const uint8_t* rom1 = nullptr;
+    const uint8_t* rom2 = nullptr;
+
+    void* callback_userdata = nullptr;
+    mcu_sample_callback sample_callback = MCU_DefaultSampleCallback;
+
+    // Block delivery: when `sample_block_size` is nonzero, frames are collected in `sample_block` and passed to
+    // `sample_block_callback` once `sample_block_size` of them are available, instead of going to `sample_callback`.
+    mcu_sample_block_callback sample_block_callback = MCU_DefaultSampleBlockCallback;
+    AudioFrame<int32_t>* sample_block = nullptr;
+    size_t sample_block_size = 0;
+    size_t sample_block_len = 0;
+
+    // Number of frames produced by the emulator so far, including any still waiting in `sample_block`.
+    uint64_t frames_posted = 0;
+
+    // Set by `Emulator::SetFastForward`. Frames are only counted, and the LCD isn't published.
+    bool fast_forward = false;
 
     uint8_t dev_register[0x80]{};
 
@@ -219,20 +299,22 @@ struct mcu_t {
     uint8_t sw_pos = 3;
     uint8_t io_sd = 0;
 
-    submcu_t* sm = nullptr;
-    pcm_t* pcm = nullptr;
-    mcu_timer_t* timer = nullptr;
-    lcd_t* lcd = nullptr;
+    uint8_t p0_data = 0;
+    uint8_t p1_data = 0;
+
+    int adf_rd = 0;
+    int ssr_rd = 0;
 
-    uint32_t uart_write_ptr = 0;
-    uint32_t uart_read_ptr = 0;
-    uint8_t uart_buffer[uart_buffer_size]{};
+    uint64_t analog_end_time = 0;
 
     uint8_t uart_rx_byte = 0;
     uint64_t uart_rx_delay = 0;
     uint64_t uart_tx_delay = 0;
 
-    Romset romset = Romset::MK2;
+    int ga_int[8]{};
+    int ga_int_enable = 0;
+    int ga_int_trigger = 0;
+    int ga_lcd_counter = 0;
 
     int is_mk1 = 0; // 0 - SC-55mkII, SC-55ST. 1 - SC-55, CM-300/SCC-1
     int is_cm300 = 0; // 0 - SC-55, 1 - CM-300/SCC-1
@@ -241,48 +323,88 @@ struct mcu_t {
     int is_scb55 = 0; // 0 - sub mcu (e.g SC-55mk2), 1 - no sub mcu (e.g SCB-55)
     int is_sc155 = 0; // 0 - SC-55(MK2), 1 - SC-155(MK2)
 
-    int rom2_mask = ROM2_SIZE - 1;
-
-    int ga_int[8]{};
-    int ga_int_enable = 0;
-    int ga_int_trigger = 0;
-    int ga_lcd_counter = 0;
-
-    std::atomic<uint32_t> button_pressed;
-
-    uint8_t p0_data = 0;
-    uint8_t p1_data = 0;
-
-    int adf_rd = 0;
+    // One entry per 4KB block. A non-null entry points directly at the memory backing that block. Null entries are
+    // MMIO or unmapped and go through `MCU_ReadUnmapped`/`MCU_WriteUnmapped`. Rebuilt by `MCU_BuildMemoryMap`.
+    const uint8_t* read_map[MCU_MAP_SIZE]{};
+    uint8_t* write_map[MCU_MAP_SIZE]{};
+    // Nonzero for blocks backed by rom, which can't change while the emulator is running.
+    uint8_t code_cacheable[MCU_MAP_SIZE]{};
 
-    uint64_t analog_end_time = 0;
+    uint8_t ram[RAM_SIZE]{};
 
-    int ssr_rd = 0;
+    // Direct-mapped cache of decoded instructions. Only instructions that lie entirely within rom are cached. Cleared
+    // by `MCU_BuildMemoryMap`.
+    mcu_decoded_general_t decode_cache[MCU_DECODE_CACHE_SIZE]{};
+
+    // Set by the frontend from its own thread.
+    alignas(64) std::atomic<uint32_t> button_pressed;
+
+    // Single producer, single consumer queue of incoming midi bytes. The producer (MCU_PostUART) may run on another
+    // thread than the emulator; the emulator consumes with MCU_PopUART. Each side owns one index and keeps it on its
+    // own cache line. The queue is empty when both indices are equal, so it holds at most `uart_buffer_size - 1`
+    // bytes.
+    alignas(64) std::atomic<uint32_t> uart_write_ptr = 0;
+    // Bytes the producer had to drop because the queue was full.
+    std::atomic<uint64_t> uart_dropped = 0;
+    alignas(64) std::atomic<uint32_t> uart_read_ptr = 0;
+    alignas(64) uint8_t uart_buffer[uart_buffer_size]{};
+
+    // Mostly reached through `read_map`/`write_map`, which don't care where they live.
+    alignas(64) uint8_t sram[SRAM_SIZE]{};
+    // Allocated by MCU_SetRomset for the JV-880 and null for every other romset
+    std::unique_ptr<uint8_t[]> nvram;
+    std::unique_ptr<uint8_t[]> cardram;
 
-    uint32_t operand_type = 0;
-    uint16_t operand_ea = 0;
-    uint8_t operand_ep = 0;
-    uint8_t operand_size = 0;
-    uint8_t operand_reg = 0;
-    uint8_t operand_status = 0;
-    uint16_t operand_data = 0;
-    uint8_t opcode_extended = 0;
+    Romset romset = Romset::MK2;
 
-    void* callback_userdata = nullptr;
-    mcu_sample_callback sample_callback = MCU_DefaultSampleCallback;
+    // Time spent in each part of `MCU_Step`. Only collected when built with NUKED_ENABLE_PROFILING, and not part of
+    // the saved state.
+    mcu_profile_t profile;
+    // Instructions run by the mcu and sub mcu. Only collected when built with NUKED_ENABLE_PC_PROFILING, and not part
+    // of the saved state.
+    pc_profile_t pc_profile;
 };
 
 void MCU_Init(mcu_t& mcu, submcu_t& sm, pcm_t& pcm, mcu_timer_t& timer, lcd_t& lcd);
 void MCU_Reset(mcu_t& mcu);
 void MCU_PatchROM(mcu_t& mcu);
 void MCU_Step(mcu_t& mcu);
+// Decodes and executes one instruction, without the interrupt handling and peripherals `MCU_Step` does around it.
+void MCU_ReadInstruction(mcu_t& mcu);
+// Runs `MCU_Step` until `mcu.cycles >= target_cycles`.
+void MCU_StepUntilCycles(mcu_t& mcu, uint64_t target_cycles);
+// Runs `MCU_Step` until `mcu.frames_posted >= target_frames`.
+void MCU_StepUntilFrames(mcu_t& mcu, uint64_t target_frames);
 
 void MCU_ErrorTrap(mcu_t& mcu);
 
-uint8_t MCU_Read(mcu_t& mcu, uint32_t address);
+// Must be called whenever the romset or rom2_mask changes.
+void MCU_BuildMemoryMap(mcu_t& mcu);
+
+uint8_t MCU_ReadUnmapped(mcu_t& mcu, uint32_t address);
+void MCU_WriteUnmapped(mcu_t& mcu, uint32_t address, uint8_t value);
+
+inline uint8_t MCU_Read(mcu_t& mcu, uint32_t address)
+{
+    const uint8_t* block = mcu.read_map[(address >> MCU_MAP_BLOCK_BITS) & (MCU_MAP_SIZE - 1)];
+    if (block)
+        return block[address & (MCU_MAP_BLOCK_SIZE - 1)];
+    return MCU_ReadUnmapped(mcu, address);
+}
+
+inline void MCU_Write(mcu_t& mcu, uint32_t address, uint8_t value)
+{
+    uint8_t* block = mcu.write_map[(address >> MCU_MAP_BLOCK_BITS) & (MCU_MAP_SIZE - 1)];
+    if (block)
+    {
+        block[address & (MCU_MAP_BLOCK_SIZE - 1)] = value;
+        return;
+    }
+    MCU_WriteUnmapped(mcu, address, value);
+}
+
 uint16_t MCU_Read16(mcu_t& mcu, uint32_t address);
 uint32_t MCU_Read32(mcu_t& mcu, uint32_t address);
-void MCU_Write(mcu_t& mcu, uint32_t address, uint8_t value);
 void MCU_Write16(mcu_t& mcu, uint32_t address, uint16_t value);
 
 inline uint32_t MCU_GetAddress(uint8_t page, uint16_t address) {
@@ -524,7 +646,48 @@ void MCU_GA_SetGAInt(mcu_t& mcu, int line, int value);
 
 void MCU_EncoderTrigger(mcu_t& mcu, int dir);
 
-void MCU_PostSample(mcu_t& mcu, const AudioFrame<int32_t>& frame);
-void MCU_PostUART(mcu_t& mcu, uint8_t data);
+// Passes a frame to the sample callback or the block buffer. Use MCU_PostSample.
+void MCU_DeliverSample(mcu_t& mcu, const AudioFrame<int32_t>& frame);
+
+inline void MCU_PostSample(mcu_t& mcu, const AudioFrame<int32_t>& frame)
+{
+    ++mcu.frames_posted;
+    if (!mcu.fast_forward)
+        MCU_DeliverSample(mcu, frame);
+}
+
+// Passes any frames waiting in `sample_block` to `sample_block_callback`.
+void MCU_FlushSampleBlock(mcu_t& mcu);
+// Queues midi bytes for the emulator, all or nothing. If they don't fit, nothing is queued, `uart_dropped` is
+// incremented by their count and this returns false. Only one thread may post at a time.
+bool MCU_PostUART(mcu_t& mcu, uint8_t data);
+bool MCU_PostUART(mcu_t& mcu, std::span<const uint8_t> data);
+
+// Returns how many bytes MCU_PostUART can queue right now. Only meaningful on the posting thread.
+inline size_t MCU_GetUARTSpace(const mcu_t& mcu)
+{
+    const uint32_t write_ptr = mcu.uart_write_ptr.load(std::memory_order_relaxed);
+    const uint32_t read_ptr = mcu.uart_read_ptr.load(std::memory_order_acquire);
+    return uart_buffer_size - 1 - (write_ptr - read_ptr + uart_buffer_size) % uart_buffer_size;
+}
+
+// Returns true if the emulator has midi bytes waiting. Only called on the emulation thread.
+inline bool MCU_HasUART(const mcu_t& mcu)
+{
+    return mcu.uart_write_ptr.load(std::memory_order_acquire) != mcu.uart_read_ptr.load(std::memory_order_relaxed);
+}
+
+// Returns true once the firmware has taken every queued midi byte out of the uart receive register, i.e. it's ready for
+// more. Only called on the emulation thread.
+bool MCU_IsUARTIdle(const mcu_t& mcu);
+
+// Takes the next byte out of the queue. MCU_HasUART must have returned true first.
+inline uint8_t MCU_PopUART(mcu_t& mcu)
+{
+    const uint32_t read_ptr = mcu.uart_read_ptr.load(std::memory_order_relaxed);
+    const uint8_t data = mcu.uart_buffer[read_ptr];
+    mcu.uart_read_ptr.store((read_ptr + 1) % uart_buffer_size, std::memory_order_release);
+    return data;
+}
 
 void MCU_SetRomset(mcu_t& mcu, Romset romset);
@@ -33,6 +33,9 @@
  */
 #include "mcu_interrupt.h"
 #include "mcu.h"
+#include <bit>
+
+static_assert(INTERRUPT_SOURCE_MAX <= 32, "interrupt_pending has one bit per source");
 
 void MCU_Interrupt_Start(mcu_t& mcu, int32_t mask)
 {
@@ -50,7 +53,17 @@ void MCU_Interrupt_Start(mcu_t& mcu, int32_t mask)
 
 void MCU_Interrupt_SetRequest(mcu_t& mcu, uint32_t interrupt, uint32_t value)
 {
-    mcu.interrupt_pending[interrupt] = value;
+    const uint32_t bit = 1u << interrupt;
+    if (value)
+    {
+        if ((mcu.interrupt_pending & bit) == 0)
+            ++mcu.interrupt_raise_count;
+        mcu.interrupt_pending |= bit;
+    }
+    else
+    {
+        mcu.interrupt_pending &= ~bit;
+    }
 }
 
 void MCU_Interrupt_Exception(mcu_t& mcu, uint32_t exception)
@@ -66,7 +79,7 @@ void MCU_Interrupt_Exception(mcu_t& mcu, uint32_t exception)
 
 void MCU_Interrupt_TRAPA(mcu_t& mcu, uint32_t vector)
 {
-    mcu.trapa_pending[vector] = 1;
+    mcu.trapa_pending |= (uint16_t)(1u << vector);
 }
 
 void MCU_Interrupt_StartVector(mcu_t& mcu, uint32_t vector, int32_t mask)
@@ -96,15 +109,16 @@ void MCU_Interrupt_Handle(mcu_t& mcu)
         return;
     }
 #endif
-    uint32_t i;
-    for (i = 0; i < 16; i++)
+    // Nearly every instruction gets here with nothing to do
+    if ((mcu.trapa_pending | mcu.interrupt_pending) == 0 && mcu.exception_pending < 0)
+        return;
+
+    if (mcu.trapa_pending)
     {
-        if (mcu.trapa_pending[i])
-        {
-            mcu.trapa_pending[i] = 0;
-            MCU_Interrupt_StartVector(mcu, VECTOR_TRAPA_0 + i, -1);
-            return;
-        }
+        const uint32_t i = (uint32_t)std::countr_zero(mcu.trapa_pending);
+        mcu.trapa_pending &= (uint16_t)(mcu.trapa_pending - 1);
+        MCU_Interrupt_StartVector(mcu, VECTOR_TRAPA_0 + i, -1);
+        return;
     }
     if (mcu.exception_pending >= 0)
     {
@@ -124,19 +138,22 @@ void MCU_Interrupt_Handle(mcu_t& mcu)
         mcu.exception_pending = -1;
         return;
     }
-    if (mcu.interrupt_pending[INTERRUPT_SOURCE_NMI])
+    if (mcu.interrupt_pending & (1u << INTERRUPT_SOURCE_NMI))
     {
         // mcu.interrupt_pending[INTERRUPT_SOURCE_NMI] = 0;
         MCU_Interrupt_StartVector(mcu, VECTOR_NMI, 7);
         return;
     }
     uint32_t mask = (mcu.sr >> 8) & 7;
-    for (i = INTERRUPT_SOURCE_NMI + 1; i < INTERRUPT_SOURCE_MAX; i++)
+    // Sources are checked from the lowest index up
+    uint32_t pending = mcu.interrupt_pending;
+    while (pending)
     {
+        const uint32_t i = (uint32_t)std::countr_zero(pending);
+        pending &= pending - 1;
+
         int32_t vector = -1;
         int32_t level = 0;
-        if (!mcu.interrupt_pending[i])
-            continue;
         switch (i)
         {
             case INTERRUPT_SOURCE_IRQ0:
@@ -561,22 +561,16 @@ void MCU_Operand_Write(mcu_t& mcu, uint32_t data)
     }
 }
 
-void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
+// Reads the bytes of a general-format instruction following `operand`, without touching any cpu state other than pc.
+static void MCU_Operand_DecodeGeneral(mcu_t& mcu, uint8_t operand, mcu_decoded_general_t& decoded)
 {
     uint32_t type = GENERAL_DIRECT;
-    uint32_t disp = 0;
+    uint32_t value = 0;
     uint32_t increase = INCREASE_NONE;
-    uint32_t absolute = 0;
-    (void)absolute; // unused
+    uint32_t absolute_dp = 0;
     uint32_t reg = 0;
     uint32_t siz = OPERAND_BYTE;
-    uint32_t data = 0;
-    uint32_t addr = 0;
-    uint32_t addrpage = 0;
-    uint32_t ea = 0;
-    uint32_t ep = 0;
     uint8_t opcode;
-    uint8_t opcode_reg;
     if (operand & 0x08)
         siz = OPERAND_WORD;
     else
@@ -592,13 +586,13 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
         break;
     case 0xe0:
         type = GENERAL_INDIRECT;
-        disp = (int8_t)MCU_ReadCodeAdvance(mcu);
+        value = (int8_t)MCU_ReadCodeAdvance(mcu);
         break;
     case 0xf0:
         type = GENERAL_INDIRECT;
-        disp = MCU_ReadCodeAdvance(mcu);
-        disp <<= 8;
-        disp |= MCU_ReadCodeAdvance(mcu);
+        value = MCU_ReadCodeAdvance(mcu);
+        value <<= 8;
+        value |= MCU_ReadCodeAdvance(mcu);
         break;
     case 0xb0:
         type = GENERAL_INDIRECT;
@@ -612,18 +606,17 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
         if (reg == 5)
         {
             type = GENERAL_ABSOLUTE;
-            addr = mcu.br << 8;
-            addr |= MCU_ReadCodeAdvance(mcu);
-            addrpage = 0;
+            value = MCU_ReadCodeAdvance(mcu);
+            absolute_dp = 0;
         }
         else if (reg == 4)
         {
             type = GENERAL_IMMEDIATE;
-            data = MCU_ReadCodeAdvance(mcu);
+            value = MCU_ReadCodeAdvance(mcu);
             if (siz)
             {
-                data <<= 8;
-                data |= MCU_ReadCodeAdvance(mcu);
+                value <<= 8;
+                value |= MCU_ReadCodeAdvance(mcu);
             }
         }
         break;
@@ -631,15 +624,42 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
         if (reg == 5)
         {
             type = GENERAL_ABSOLUTE;
-            addr = MCU_ReadCodeAdvance(mcu) << 8;
-            addr |= MCU_ReadCodeAdvance(mcu);
-            addrpage = mcu.dp;
+            value = MCU_ReadCodeAdvance(mcu) << 8;
+            value |= MCU_ReadCodeAdvance(mcu);
+            absolute_dp = 1;
         }
         break;
     }
+
+    opcode = MCU_ReadCodeAdvance(mcu);
+    decoded.opcode_extended = opcode == 0x00;
+    if (decoded.opcode_extended)
+    {
+        opcode = MCU_ReadCodeAdvance(mcu);
+    }
+
+    decoded.value = (uint16_t)value;
+    decoded.type = (uint8_t)type;
+    decoded.increase = (uint8_t)increase;
+    decoded.siz = (uint8_t)siz;
+    decoded.reg = (uint8_t)reg;
+    decoded.absolute_dp = (uint8_t)absolute_dp;
+    decoded.opcode = opcode >> 3;
+    decoded.opcode_reg = opcode & 0x07;
+}
+
+// Performs the register-dependent part of operand decoding and runs the opcode.
+static void MCU_Operand_ExecuteGeneral(mcu_t& mcu, const mcu_decoded_general_t& decoded, bool cached)
+{
+    const uint32_t type = decoded.type;
+    const uint32_t reg = decoded.reg;
+    const uint32_t siz = decoded.siz;
+    uint32_t data = 0;
+    uint32_t ea = 0;
+    uint32_t ep = 0;
     if (type == GENERAL_INDIRECT)
     {
-        if (increase == INCREASE_DECREASE)
+        if (decoded.increase == INCREASE_DECREASE)
         {
             if (siz || reg == 7)
             {
@@ -650,8 +670,8 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
                 mcu.r[reg] -= 1;
             }
         }
-        ea = mcu.r[reg] + disp;
-        if (increase == INCREASE_INCREASE)
+        ea = mcu.r[reg] + decoded.value;
+        if (decoded.increase == INCREASE_INCREASE)
         {
             if (siz || reg == 7)
             {
@@ -669,19 +689,23 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
     }
     else if (type == GENERAL_ABSOLUTE)
     {
-        ea = addr & 0xffff;
-
-        ep = addrpage & 0xff;
+        if (decoded.absolute_dp)
+        {
+            ea = decoded.value;
+            ep = mcu.dp;
+        }
+        else
+        {
+            ea = ((mcu.br << 8) | decoded.value) & 0xffff;
+            ep = 0;
+        }
     }
-
-    opcode = MCU_ReadCodeAdvance(mcu);
-    mcu.opcode_extended = opcode == 0x00;
-    if (mcu.opcode_extended)
+    else if (type == GENERAL_IMMEDIATE)
     {
-        opcode = MCU_ReadCodeAdvance(mcu);
+        data = decoded.value;
     }
-    opcode_reg = opcode & 0x07;
-    opcode >>= 3;
+
+    mcu.opcode_extended = decoded.opcode_extended;
 
     mcu.operand_type = type;
     mcu.operand_ea = ea;
@@ -691,7 +715,49 @@ void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
     mcu.operand_data = data;
     mcu.operand_status = 0;
 
-    MCU_Opcode_Table[opcode](mcu, opcode, opcode_reg);
+    PROF_CountMCUOpcode(mcu.pc_profile, decoded.opcode, cached);
+
+    MCU_Opcode_Table[decoded.opcode](mcu, decoded.opcode, decoded.opcode_reg);
+}
+
+static inline uint32_t MCU_DecodeCacheIndex(uint32_t address)
+{
+    return (address ^ (address >> 12)) & (MCU_DECODE_CACHE_SIZE - 1);
+}
+
+static inline bool MCU_IsCodeCacheable(const mcu_t& mcu, uint32_t address)
+{
+    return mcu.code_cacheable[(address >> MCU_MAP_BLOCK_BITS) & (MCU_MAP_SIZE - 1)];
+}
+
+void MCU_Operand_General(mcu_t& mcu, uint8_t operand)
+{
+    const uint16_t operand_pc = mcu.pc - 1;
+    const uint32_t address = MCU_GetAddress(mcu.cp, operand_pc);
+
+    mcu_decoded_general_t& entry = mcu.decode_cache[MCU_DecodeCacheIndex(address)];
+    if (entry.address == address)
+    {
+        mcu.pc += entry.length;
+        MCU_Operand_ExecuteGeneral(mcu, entry, true);
+        return;
+    }
+
+    mcu_decoded_general_t decoded;
+    MCU_Operand_DecodeGeneral(mcu, operand, decoded);
+
+    const uint16_t last_pc = mcu.pc - 1;
+    decoded.address = address;
+    decoded.length = (uint8_t)(last_pc - operand_pc);
+
+    // Instructions are at most a few bytes so checking both ends is enough to know every byte came from rom.
+    if (last_pc >= operand_pc && MCU_IsCodeCacheable(mcu, address) &&
+        MCU_IsCodeCacheable(mcu, MCU_GetAddress(mcu.cp, last_pc)))
+    {
+        entry = decoded;
+    }
+
+    MCU_Operand_ExecuteGeneral(mcu, decoded, false);
 }
 
 void MCU_SetStatusCommon(mcu_t& mcu, uint32_t val, uint32_t siz)
@@ -33,6 +33,7 @@
  */
 #include "mcu_timer.h"
 #include "mcu.h"
+#include <algorithm>
 #include <cstdint>
 
 enum {
@@ -225,81 +226,255 @@ constexpr uint64_t TIMER_STEP_TABLE_MK1[8] = {
     0, 7, 63, 1023, 0, 3, 3, 3
 };
 
-void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles)
+// Number of ticks of a counter that steps when `!(cycle & step_mask)` over the timer cycles [start, end)
+static inline uint64_t TIMER_CountTicks(uint64_t start, uint64_t end, uint64_t step_mask)
 {
-    const bool mk1 = timer.mcu->is_mk1;
-    const auto& FRT_STEP_TABLE = mk1 ? FRT_STEP_TABLE_MK1 : FRT_STEP_TABLE_GENERIC;
-    const auto& TIMER_STEP_TABLE = mk1 ? TIMER_STEP_TABLE_MK1 : TIMER_STEP_TABLE_GENERIC;
+    const uint64_t period = step_mask + 1;
+    return (end + step_mask) / period - (start + step_mask) / period;
+}
+
+static inline void TIMER_FRT_Request(mcu_timer_t& timer, uint32_t i)
+{
+    const frt_t *ftimer = &timer.frt[i];
+    if ((ftimer->tcr & 0x10) != 0 && (ftimer->tcsr & 0x10) != 0)
+        MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_FOVI + i * 4, 1);
+    if ((ftimer->tcr & 0x20) != 0 && (ftimer->tcsr & 0x20) != 0)
+        MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_OCIA + i * 4, 1);
+    if ((ftimer->tcr & 0x40) != 0 && (ftimer->tcsr & 0x40) != 0)
+        MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_OCIB + i * 4, 1);
+}
+
+static inline void TIMER_FRT_Tick(mcu_timer_t& timer, uint32_t i)
+{
+    frt_t *ftimer = &timer.frt[i];
 
-    while (timer.cycles*2 < cycles) // FIXME
+    uint32_t value = ftimer->frc;
+    uint32_t matcha = value == ftimer->ocra;
+    uint32_t matchb = value == ftimer->ocrb;
+    if ((ftimer->tcsr & 1) != 0 && matcha) // CCLRA
+        value = 0;
+    else
+        value++;
+    uint32_t of = (value >> 16) & 1;
+    value &= 0xffff;
+    ftimer->frc = value;
+
+    // flags
+    if (of)
+        ftimer->tcsr |= 0x10;
+    if (matcha)
+        ftimer->tcsr |= 0x20;
+    if (matchb)
+        ftimer->tcsr |= 0x40;
+    TIMER_FRT_Request(timer, i);
+}
+
+// Runs `ticks` ticks of FRT `i`. Ticks where the counter isn't at a compare value or about to overflow only
+// increment it, so those are done in one go.
+static inline void TIMER_FRT_Advance(mcu_timer_t& timer, uint32_t i, uint64_t ticks)
+{
+    frt_t *ftimer = &timer.frt[i];
+
+    while (ticks)
     {
-        for (int i = 0; i < 3; i++)
+        const uint32_t frc = ftimer->frc;
+        const uint32_t distance = std::min({
+            (ftimer->ocra - frc) & 0xffff,
+            (ftimer->ocrb - frc) & 0xffff,
+            (0xffff - frc) & 0xffff,
+        });
+
+        if (distance >= ticks)
         {
-            frt_t *ftimer = &timer.frt[i];
-
-            const bool frt_step = !(timer.cycles & FRT_STEP_TABLE[ftimer->tcr & 3]);
-
-            if (frt_step)
-            {
-                uint32_t value = ftimer->frc;
-                uint32_t matcha = value == ftimer->ocra;
-                uint32_t matchb = value == ftimer->ocrb;
-                if ((ftimer->tcsr & 1) != 0 && matcha) // CCLRA
-                    value = 0;
-                else
-                    value++;
-                uint32_t of = (value >> 16) & 1;
-                value &= 0xffff;
-                ftimer->frc = value;
-
-                // flags
-                if (of)
-                    ftimer->tcsr |= 0x10;
-                if (matcha)
-                    ftimer->tcsr |= 0x20;
-                if (matchb)
-                    ftimer->tcsr |= 0x40;
-                if ((ftimer->tcr & 0x10) != 0 && (ftimer->tcsr & 0x10) != 0)
-                    MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_FOVI + i * 4, 1);
-                if ((ftimer->tcr & 0x20) != 0 && (ftimer->tcsr & 0x20) != 0)
-                    MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_OCIA + i * 4, 1);
-                if ((ftimer->tcr & 0x40) != 0 && (ftimer->tcsr & 0x40) != 0)
-                    MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_FRT0_OCIB + i * 4, 1);
-            }
+            ftimer->frc = (uint16_t)(frc + ticks);
+            TIMER_FRT_Request(timer, i);
+            return;
         }
 
-        const bool timer_step = !(timer.cycles & TIMER_STEP_TABLE[timer.tcr & 7]);
+        ftimer->frc = (uint16_t)(frc + distance);
+        ticks -= distance;
+
+        TIMER_FRT_Tick(timer, i);
+        ticks--;
+    }
+}
+
+static inline void TIMER_TMR_Request(mcu_timer_t& timer)
+{
+    if ((timer.tcr & 0x20) != 0 && (timer.tcsr & 0x20) != 0)
+        MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_OVI, 1);
+    if ((timer.tcr & 0x40) != 0 && (timer.tcsr & 0x40) != 0)
+        MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_CMIA, 1);
+    if ((timer.tcr & 0x80) != 0 && (timer.tcsr & 0x80) != 0)
+        MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_CMIB, 1);
+}
+
+static inline void TIMER_TMR_Tick(mcu_timer_t& timer)
+{
+    uint32_t value = timer.tcnt;
+    uint32_t matcha = value == timer.tcora;
+    uint32_t matchb = value == timer.tcorb;
+    if ((timer.tcr & 24) == 8 && matcha)
+        value = 0;
+    else if ((timer.tcr & 24) == 16 && matchb)
+        value = 0;
+    else
+        value++;
+    uint32_t of = (value >> 8) & 1;
+    value &= 0xff;
+    timer.tcnt = value;
+
+    // flags
+    if (of)
+        timer.tcsr |= 0x20;
+    if (matcha)
+        timer.tcsr |= 0x40;
+    if (matchb)
+        timer.tcsr |= 0x80;
+    TIMER_TMR_Request(timer);
+}
+
+// Same as TIMER_FRT_Advance for the 8-bit timer
+static inline void TIMER_TMR_Advance(mcu_timer_t& timer, uint64_t ticks)
+{
+    while (ticks)
+    {
+        const uint32_t tcnt = timer.tcnt;
+        const uint32_t distance = std::min({
+            (timer.tcora - tcnt) & 0xff,
+            (timer.tcorb - tcnt) & 0xff,
+            (0xff - tcnt) & 0xff,
+        });
 
-        if (timer_step)
+        if (distance >= ticks)
         {
-            uint32_t value = timer.tcnt;
-            uint32_t matcha = value == timer.tcora;
-            uint32_t matchb = value == timer.tcorb;
-            if ((timer.tcr & 24) == 8 && matcha)
-                value = 0;
-            else if ((timer.tcr & 24) == 16 && matchb)
-                value = 0;
-            else
-                value++;
-            uint32_t of = (value >> 8) & 1;
-            value &= 0xff;
-            timer.tcnt = value;
-
-            // flags
-            if (of)
-                timer.tcsr |= 0x20;
-            if (matcha)
-                timer.tcsr |= 0x40;
-            if (matchb)
-                timer.tcsr |= 0x80;
-            if ((timer.tcr & 0x20) != 0 && (timer.tcsr & 0x20) != 0)
-                MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_OVI, 1);
-            if ((timer.tcr & 0x40) != 0 && (timer.tcsr & 0x40) != 0)
-                MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_CMIA, 1);
-            if ((timer.tcr & 0x80) != 0 && (timer.tcsr & 0x80) != 0)
-                MCU_Interrupt_SetRequest(*timer.mcu, INTERRUPT_SOURCE_TIMER_CMIB, 1);
+            timer.tcnt = (uint8_t)(tcnt + ticks);
+            TIMER_TMR_Request(timer);
+            return;
         }
 
-        timer.cycles++;
+        timer.tcnt = (uint8_t)(tcnt + distance);
+        ticks -= distance;
+
+        TIMER_TMR_Tick(timer);
+        ticks--;
+    }
+}
+
+template <RomsetFamily Family>
+void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles)
+{
+    constexpr bool mk1 = Family == RomsetFamily::MK1;
+    const auto& FRT_STEP_TABLE = mk1 ? FRT_STEP_TABLE_MK1 : FRT_STEP_TABLE_GENERIC;
+    const auto& TIMER_STEP_TABLE = mk1 ? TIMER_STEP_TABLE_MK1 : TIMER_STEP_TABLE_GENERIC;
+
+    // Timer cycle `n` runs once the mcu passes cycle `n * 2`. FIXME
+    const uint64_t end = (cycles + 1) / 2;
+    if (timer.cycles >= end)
+        return;
+
+    // The counters don't affect each other, so each one is advanced over the whole range instead of interleaving
+    // them cycle by cycle.
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        const uint64_t step_mask = FRT_STEP_TABLE[timer.frt[i].tcr & 3];
+        TIMER_FRT_Advance(timer, i, TIMER_CountTicks(timer.cycles, end, step_mask));
+    }
+
+    TIMER_TMR_Advance(timer, TIMER_CountTicks(timer.cycles, end, TIMER_STEP_TABLE[timer.tcr & 7]));
+
+    timer.cycles = end;
+}
+
+template <RomsetFamily Family>
+uint64_t TIMER_GetSleepHorizon(const mcu_timer_t& timer)
+{
+    constexpr bool mk1 = Family == RomsetFamily::MK1;
+    const auto& FRT_STEP_TABLE = mk1 ? FRT_STEP_TABLE_MK1 : FRT_STEP_TABLE_GENERIC;
+    const auto& TIMER_STEP_TABLE = mk1 ? TIMER_STEP_TABLE_MK1 : TIMER_STEP_TABLE_GENERIC;
+
+    const mcu_t& mcu = *timer.mcu;
+
+    // In timer cycles. A counter that is `distance` ticks away from a value can't reach it before
+    // `distance * (step_mask + 1)` timer cycles have passed.
+    uint64_t horizon = UINT64_MAX;
+    auto add_target = [&](uint32_t distance, uint64_t step_mask) {
+        horizon = std::min(horizon, timer.cycles + distance * (step_mask + 1));
+    };
+
+    // A set flag keeps requesting its interrupt on every tick, which only matters if the request isn't pending yet.
+    auto add_flag = [&](bool enabled, bool flag_set, uint32_t source, uint32_t distance, uint64_t step_mask) {
+        if (!enabled)
+            return;
+        if (!flag_set)
+            add_target(distance, step_mask);
+        else if ((mcu.interrupt_pending & (1u << source)) == 0)
+            add_target(0, step_mask);
+    };
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        const frt_t& ftimer = timer.frt[i];
+        const uint64_t step_mask = FRT_STEP_TABLE[ftimer.tcr & 3];
+
+        add_flag((ftimer.tcr & 0x10) != 0, (ftimer.tcsr & 0x10) != 0, INTERRUPT_SOURCE_FRT0_FOVI + i * 4,
+                 (0xffff - ftimer.frc) & 0xffff, step_mask);
+        add_flag((ftimer.tcr & 0x20) != 0, (ftimer.tcsr & 0x20) != 0, INTERRUPT_SOURCE_FRT0_OCIA + i * 4,
+                 (ftimer.ocra - ftimer.frc) & 0xffff, step_mask);
+        add_flag((ftimer.tcr & 0x40) != 0, (ftimer.tcsr & 0x40) != 0, INTERRUPT_SOURCE_FRT0_OCIB + i * 4,
+                 (ftimer.ocrb - ftimer.frc) & 0xffff, step_mask);
+
+        // Clearing on compare match changes where the counter goes next
+        if (ftimer.tcsr & 1)
+            add_target((ftimer.ocra - ftimer.frc) & 0xffff, step_mask);
+    }
+
+    const uint64_t step_mask = TIMER_STEP_TABLE[timer.tcr & 7];
+
+    add_flag((timer.tcr & 0x20) != 0, (timer.tcsr & 0x20) != 0, INTERRUPT_SOURCE_TIMER_OVI,
+             (0xff - timer.tcnt) & 0xff, step_mask);
+    add_flag((timer.tcr & 0x40) != 0, (timer.tcsr & 0x40) != 0, INTERRUPT_SOURCE_TIMER_CMIA,
+             (timer.tcora - timer.tcnt) & 0xff, step_mask);
+    add_flag((timer.tcr & 0x80) != 0, (timer.tcsr & 0x80) != 0, INTERRUPT_SOURCE_TIMER_CMIB,
+             (timer.tcorb - timer.tcnt) & 0xff, step_mask);
+
+    if ((timer.tcr & 24) == 8)
+        add_target((timer.tcora - timer.tcnt) & 0xff, step_mask);
+    else if ((timer.tcr & 24) == 16)
+        add_target((timer.tcorb - timer.tcnt) & 0xff, step_mask);
+
+    if (horizon == UINT64_MAX)
+        return UINT64_MAX;
+
+    // TIMER_Clock runs timer cycle `n` once the mcu passes cycle `n * 2`
+    return horizon * 2;
+}
+
+template uint64_t TIMER_GetSleepHorizon<RomsetFamily::MK2>(const mcu_timer_t& timer);
+template uint64_t TIMER_GetSleepHorizon<RomsetFamily::MK1>(const mcu_timer_t& timer);
+template uint64_t TIMER_GetSleepHorizon<RomsetFamily::SCB55>(const mcu_timer_t& timer);
+template uint64_t TIMER_GetSleepHorizon<RomsetFamily::JV880>(const mcu_timer_t& timer);
+
+template void TIMER_Clock<RomsetFamily::MK2>(mcu_timer_t& timer, uint64_t cycles);
+template void TIMER_Clock<RomsetFamily::MK1>(mcu_timer_t& timer, uint64_t cycles);
+template void TIMER_Clock<RomsetFamily::SCB55>(mcu_timer_t& timer, uint64_t cycles);
+template void TIMER_Clock<RomsetFamily::JV880>(mcu_timer_t& timer, uint64_t cycles);
+
+void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles)
+{
+    switch (timer.mcu->family)
+    {
+    case RomsetFamily::MK2:
+        TIMER_Clock<RomsetFamily::MK2>(timer, cycles);
+        break;
+    case RomsetFamily::MK1:
+        TIMER_Clock<RomsetFamily::MK1>(timer, cycles);
+        break;
+    case RomsetFamily::SCB55:
+        TIMER_Clock<RomsetFamily::SCB55>(timer, cycles);
+        break;
+    case RomsetFamily::JV880:
+        TIMER_Clock<RomsetFamily::JV880>(timer, cycles);
+        break;
     }
 }
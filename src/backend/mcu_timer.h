@@ -33,6 +33,7 @@
  */
 #pragma once
 
+#include "rom.h"
 #include <cstdint>
 
 struct mcu_t;
@@ -67,6 +68,13 @@ void TIMER_Init(mcu_timer_t& timer, mcu_t& mcu);
 void TIMER_Write(mcu_timer_t& timer, uint32_t address, uint8_t data);
 uint8_t TIMER_Read(mcu_timer_t& timer, uint32_t address);
 void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles);
+// Same as TIMER_Clock, specialized for the romset family. Instantiated for every family in mcu_timer.cpp.
+template <RomsetFamily Family>
+void TIMER_Clock(mcu_timer_t& timer, uint64_t cycles);
+// Returns the highest mcu cycle count `TIMER_Clock` can be run to without raising a new interrupt request, or
+// UINT64_MAX if no enabled timer interrupt can fire. This is a lower bound, not the exact time of the next interrupt.
+template <RomsetFamily Family>
+uint64_t TIMER_GetSleepHorizon(const mcu_timer_t& timer);
 
 void TIMER2_Write(mcu_timer_t& timer, uint32_t address, uint8_t data);
 uint8_t TIMER_Read2(mcu_timer_t& timer, uint32_t address);
@@ -0,0 +1,231 @@
+#include "pc_profile.h"
+
+#include <algorithm>
+#include <vector>
+
+#if NUKED_ENABLE_PC_PROFILING
+
+struct PROF_AddressCount
+{
+    // (page << 16) | pc for the mcu, pc for the sub mcu
+    uint32_t address = 0;
+    uint64_t count   = 0;
+};
+
+static void PROF_AppendRan(std::vector<PROF_AddressCount>& out, uint32_t base, std::span<const uint64_t> counts)
+{
+    for (size_t pc = 0; pc < counts.size(); ++pc)
+    {
+        if (counts[pc])
+        {
+            out.push_back({.address = base | (uint32_t)pc, .count = counts[pc]});
+        }
+    }
+}
+
+// Sums `table` of every profile and returns the addresses that ran, in address order.
+static std::vector<PROF_AddressCount> PROF_SumAddresses(std::span<const pc_profile_t* const> profiles,
+                                                        auto                                  table,
+                                                        uint32_t                              base)
+{
+    std::vector<PROF_AddressCount> result;
+    std::vector<uint64_t>          sums(0x10000);
+
+    bool any = false;
+    for (const pc_profile_t* profile : profiles)
+    {
+        if (const uint64_t* counts = table(*profile))
+        {
+            for (size_t pc = 0; pc < sums.size(); ++pc)
+            {
+                sums[pc] += counts[pc];
+            }
+            any = true;
+        }
+    }
+
+    if (any)
+    {
+        PROF_AppendRan(result, base, sums);
+    }
+    return result;
+}
+
+static std::vector<PROF_AddressCount> PROF_SumMCUAddresses(std::span<const pc_profile_t* const> profiles)
+{
+    std::vector<PROF_AddressCount> result;
+    for (uint32_t page = 0; page < 256; ++page)
+    {
+        const std::vector<PROF_AddressCount> ran = PROF_SumAddresses(
+            profiles, [page](const pc_profile_t& p) { return p.mcu_pages[page].get(); }, page << 16);
+        result.insert(result.end(), ran.begin(), ran.end());
+    }
+    return result;
+}
+
+static std::vector<PROF_AddressCount> PROF_SumSMAddresses(std::span<const pc_profile_t* const> profiles)
+{
+    return PROF_SumAddresses(profiles, [](const pc_profile_t& p) { return p.sm_addresses.get(); }, 0);
+}
+
+// Sums a fixed size array of counters across every profile.
+template <size_t N>
+static std::vector<PROF_AddressCount> PROF_SumHandlers(std::span<const pc_profile_t* const> profiles,
+                                                       uint64_t (pc_profile_t::*counters)[N])
+{
+    std::vector<PROF_AddressCount> result(N);
+    for (size_t i = 0; i < N; ++i)
+    {
+        result[i].address = (uint32_t)i;
+        for (const pc_profile_t* profile : profiles)
+        {
+            result[i].count += (profile->*counters)[i];
+        }
+    }
+    return result;
+}
+
+static uint64_t PROF_Total(std::span<const PROF_AddressCount> counts)
+{
+    uint64_t total = 0;
+    for (const PROF_AddressCount& entry : counts)
+    {
+        total += entry.count;
+    }
+    return total;
+}
+
+static void PROF_LabelMCUAddress(char (&label)[16], uint32_t address)
+{
+    snprintf(label, sizeof(label), "%02x:%04x", address >> 16, address & 0xffff);
+}
+
+static void PROF_LabelSMAddress(char (&label)[16], uint32_t address)
+{
+    snprintf(label, sizeof(label), "%04x", address);
+}
+
+static void PROF_LabelHandler(char (&label)[16], uint32_t index)
+{
+    snprintf(label, sizeof(label), "0x%02x", index);
+}
+
+// Prints the `limit` largest entries of `counts`, naming each one with `make_label`.
+static void PROF_PrintTop(FILE*                          output,
+                          const char*                    title,
+                          std::vector<PROF_AddressCount> counts,
+                          size_t                         limit,
+                          void (*make_label)(char (&)[16], uint32_t))
+{
+    const uint64_t total = PROF_Total(counts);
+    if (total == 0)
+    {
+        return;
+    }
+
+    limit = std::min(limit, counts.size());
+    std::partial_sort(counts.begin(),
+                      counts.begin() + (ptrdiff_t)limit,
+                      counts.end(),
+                      [](const PROF_AddressCount& a, const PROF_AddressCount& b) { return a.count > b.count; });
+
+    fprintf(output, "%s (%llu total)\n", title, (unsigned long long)total);
+    for (size_t i = 0; i < limit && counts[i].count != 0; ++i)
+    {
+        char label[16];
+        make_label(label, counts[i].address);
+        fprintf(output,
+                "    %-8s %14llu %5.1f%%\n",
+                label,
+                (unsigned long long)counts[i].count,
+                100.0 * (double)counts[i].count / (double)total);
+    }
+}
+
+bool PROF_WritePCProfile(const std::filesystem::path& filename, std::span<const pc_profile_t* const> profiles)
+{
+    FILE* output = fopen(filename.string().c_str(), "w");
+    if (!output)
+    {
+        return false;
+    }
+
+    for (const PROF_AddressCount& entry : PROF_SumMCUAddresses(profiles))
+    {
+        const uint32_t page = entry.address >> 16;
+        fprintf(output,
+                "mcu;page_%02x;%02x:%04x %llu\n",
+                page,
+                page,
+                entry.address & 0xffff,
+                (unsigned long long)entry.count);
+    }
+
+    for (const PROF_AddressCount& entry : PROF_SumSMAddresses(profiles))
+    {
+        fprintf(output, "submcu;%04x %llu\n", entry.address, (unsigned long long)entry.count);
+    }
+
+    return fclose(output) == 0;
+}
+
+void PROF_PrintPCSummary(FILE* output, std::span<const pc_profile_t* const> profiles)
+{
+    constexpr size_t TOP_ADDRESSES = 20;
+
+    PROF_PrintTop(output,
+                  "Hottest mcu addresses",
+                  PROF_SumMCUAddresses(profiles),
+                  TOP_ADDRESSES,
+                  PROF_LabelMCUAddress);
+    PROF_PrintTop(output,
+                  "MCU_Operand_Table handlers",
+                  PROF_SumHandlers(profiles, &pc_profile_t::mcu_operands),
+                  256,
+                  PROF_LabelHandler);
+    PROF_PrintTop(output,
+                  "MCU_Opcode_Table handlers",
+                  PROF_SumHandlers(profiles, &pc_profile_t::mcu_opcodes),
+                  32,
+                  PROF_LabelHandler);
+
+    uint64_t hits   = 0;
+    uint64_t misses = 0;
+    for (const pc_profile_t* profile : profiles)
+    {
+        hits += profile->decode_cache_hits;
+        misses += profile->decode_cache_misses;
+    }
+    if (hits + misses != 0)
+    {
+        fprintf(output, "Decode cache hit rate %5.1f%%\n", 100.0 * (double)hits / (double)(hits + misses));
+    }
+
+    PROF_PrintTop(output,
+                  "Hottest sub mcu addresses",
+                  PROF_SumSMAddresses(profiles),
+                  TOP_ADDRESSES,
+                  PROF_LabelSMAddress);
+    PROF_PrintTop(output,
+                  "SM_Opcode_Table handlers",
+                  PROF_SumHandlers(profiles, &pc_profile_t::sm_opcodes),
+                  256,
+                  PROF_LabelHandler);
+}
+
+#else
+
+bool PROF_WritePCProfile(const std::filesystem::path& filename, std::span<const pc_profile_t* const> profiles)
+{
+    (void)filename;
+    (void)profiles;
+    return false;
+}
+
+void PROF_PrintPCSummary(FILE* output, std::span<const pc_profile_t* const> profiles)
+{
+    (void)output;
+    (void)profiles;
+}
+
+#endif
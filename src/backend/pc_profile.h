@@ -0,0 +1,91 @@
+#pragma once
+
+#include "config.h"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+// Counts of the firmware instructions run by one emulator, to find the routines that dominate a render. Only
+// collected when built with NUKED_ENABLE_PC_PROFILING; otherwise this is empty and every counting function compiles
+// to nothing.
+struct pc_profile_t
+{
+#if NUKED_ENABLE_PC_PROFILING
+    // Instructions run at each mcu address, one table of 64K per code page. A page's table is allocated the first
+    // time code runs in it.
+    std::unique_ptr<uint64_t[]> mcu_pages[256];
+    // Runs of each entry in `MCU_Operand_Table`, indexed by the first byte of the instruction
+    uint64_t mcu_operands[256]{};
+    // Runs of each entry in `MCU_Opcode_Table`, which only general instructions go through
+    uint64_t mcu_opcodes[32]{};
+    uint64_t decode_cache_hits   = 0;
+    uint64_t decode_cache_misses = 0;
+
+    // Instructions run at each sub mcu address, allocated with the first one. Includes instructions run ahead of the
+    // mcu and later rolled back.
+    std::unique_ptr<uint64_t[]> sm_addresses;
+    // Runs of each entry in `SM_Opcode_Table`
+    uint64_t sm_opcodes[256]{};
+#endif
+};
+
+inline void PROF_ResetPC(pc_profile_t& profile)
+{
+    profile = pc_profile_t{};
+}
+
+inline void PROF_CountMCUInstruction(pc_profile_t& profile, uint8_t page, uint16_t pc, uint8_t operand)
+{
+#if NUKED_ENABLE_PC_PROFILING
+    std::unique_ptr<uint64_t[]>& counts = profile.mcu_pages[page];
+    if (!counts)
+    {
+        counts = std::make_unique<uint64_t[]>(0x10000);
+    }
+    ++counts[pc];
+    ++profile.mcu_operands[operand];
+#else
+    (void)profile;
+    (void)page;
+    (void)pc;
+    (void)operand;
+#endif
+}
+
+inline void PROF_CountMCUOpcode(pc_profile_t& profile, uint8_t opcode, bool decode_cache_hit)
+{
+#if NUKED_ENABLE_PC_PROFILING
+    ++profile.mcu_opcodes[opcode];
+    ++(decode_cache_hit ? profile.decode_cache_hits : profile.decode_cache_misses);
+#else
+    (void)profile;
+    (void)opcode;
+    (void)decode_cache_hit;
+#endif
+}
+
+inline void PROF_CountSMInstruction(pc_profile_t& profile, uint16_t pc, uint8_t opcode)
+{
+#if NUKED_ENABLE_PC_PROFILING
+    if (!profile.sm_addresses)
+    {
+        profile.sm_addresses = std::make_unique<uint64_t[]>(0x10000);
+    }
+    ++profile.sm_addresses[pc];
+    ++profile.sm_opcodes[opcode];
+#else
+    (void)profile;
+    (void)pc;
+    (void)opcode;
+#endif
+}
+
+// Writes the counts of every profile in `profiles` summed together as folded stacks, one address per line, e.g.
+// `mcu;page_02;02:1a3c 1234`. The file can be passed straight to flamegraph.pl or loaded into speedscope. Returns
+// false if the file can't be written or the backend was built without NUKED_ENABLE_PC_PROFILING.
+bool PROF_WritePCProfile(const std::filesystem::path& filename, std::span<const pc_profile_t* const> profiles);
+
+// Prints the hottest addresses and opcode handlers of `profiles` summed together to `output`.
+void PROF_PrintPCSummary(FILE* output, std::span<const pc_profile_t* const> profiles);
@@ -38,40 +38,43 @@
 #include <cstdio>
 #include <cstring>
 
-uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
+// Backs every bank without a rom. A mask of 0 keeps every address on this byte.
+static const uint8_t PCM_EMPTY_WAVE_BANK = 0;
+
+void PCM_UpdateWaveBanks(pcm_t& pcm, RomsetFamily family)
 {
-    int bank;
-    if (pcm.config_reg_3d & 0x20)
-        bank = (address >> 21) & 7;
+    pcm.wave_bank_shift = (pcm.config_reg_3d & 0x20) ? 21 : 19;
+
+    for (PCM_WaveBank& bank : pcm.wave_banks)
+    {
+        bank = {&PCM_EMPTY_WAVE_BANK, 0};
+    }
+
+    if (family == RomsetFamily::MK1)
+        pcm.wave_banks[0] = {pcm.waverom1, 0xfffff};
     else
-        bank = (address >> 19) & 7;
-    switch (bank)
+        pcm.wave_banks[0] = {pcm.waverom1, 0x1fffff};
+
+    if (family != RomsetFamily::JV880)
     {
-        case 0:
-            if (pcm.mcu->is_mk1)
-                return pcm.waverom1[address & 0xfffff];
-            else
-                return pcm.waverom1[address & 0x1fffff];
-        case 1:
-            if (!pcm.mcu->is_jv880)
-                return pcm.waverom2[address & 0xfffff];
-            else
-                return pcm.waverom2[address & 0x1fffff];
-        case 2:
-            if (pcm.mcu->is_jv880)
-                return pcm.waverom_card[address & 0x1fffff];
-            else
-                return pcm.waverom3[address & 0xfffff];
-        case 3:
-        case 4:
-        case 5:
-        case 6:
-            if (pcm.mcu->is_jv880)
-                return pcm.waverom_exp[(address & 0x1fffff) + (bank - 3) * 0x200000];
-        default:
-            break;
+        pcm.wave_banks[1] = {pcm.waverom2, 0xfffff};
+        pcm.wave_banks[2] = {pcm.waverom3, 0xfffff};
+    }
+    else
+    {
+        pcm.wave_banks[1] = {pcm.waverom2, 0x1fffff};
+        pcm.wave_banks[2] = {pcm.waverom_card, 0x1fffff};
+        for (size_t bank = 3; bank <= 6; ++bank)
+        {
+            pcm.wave_banks[bank] = {pcm.waverom_exp + (bank - 3) * 0x200000, 0x1fffff};
+        }
     }
-    return 0;
+}
+
+static inline uint8_t PCM_ReadROM(const pcm_t& pcm, uint32_t address)
+{
+    const PCM_WaveBank& bank = pcm.wave_banks[(address >> pcm.wave_bank_shift) & (PCM_WAVE_BANK_COUNT - 1)];
+    return bank.data[address & bank.mask];
 }
 
 void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
@@ -128,6 +131,7 @@ void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
     {
         pcm.config_reg_3d = data;
         pcm.config.reg_slots = (data & 31) + 1;
+        PCM_UpdateWaveBanks(pcm, pcm.mcu->family);
     }
     else if (address == 0x3e)
     {
@@ -268,6 +272,7 @@ uint8_t PCM_Read(pcm_t& pcm, uint32_t address)
 void PCM_Init(pcm_t& pcm, mcu_t& mcu)
 {
     pcm.mcu = &mcu;
+    pcm.voice_kernel = PCM_DetectVoiceKernel();
 }
 
 // Sign-extends a 20-bit signed integer to a 32-bit signed integer.
@@ -583,8 +588,115 @@ void PCM_GetConfig(PCM_Config& config, uint8_t config_byte)
     }
 }
 
+// Adds the output of `slot` to the running mix. The reverb/chorus returns computed at the start of the sample are
+// mixed in along the way at fixed slots, so this has to run for every slot in order, active or not.
+static inline void PCM_MixSlot(pcm_t& pcm, int slot, int sampl, int sampr, int rc0, int rc1, const int* rcadd,
+                               const int* rcadd2)
+{
+    // mix reverb/chorus?
+    int slot2 = (slot == pcm.config.reg_slots - 1) ? 31 : slot + 1;
+    switch (slot2)
+    {
+        // 17, 18 - reverb
+
+        case 17:
+            pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[0] >> 1, rcadd[0] & 1);
+            break;
+        case 18:
+            pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[1] >> 1, rcadd[1] & 1);
+            break;
+        case 21:
+            pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[2] >> 1, rcadd[2] & 1);
+            break;
+        case 22:
+            pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[3] >> 1, rcadd[3] & 1);
+            break;
+        case 23:
+            pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[4] >> 1, rcadd[4] & 1);
+            break;
+        case 31:
+            pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[5] >> 1, rcadd[5] & 1);
+            break;
+    }
+
+    int suml = addclip20(pcm.ram1[31][1], sampl >> 6, (sampl >> 5) & 1);
+    int sumr = addclip20(pcm.ram1[31][3], sampr >> 6, (sampr >> 5) & 1);
+
+    switch (slot2)
+    {
+        case 17:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[0] >> 1, rcadd2[0] & 1);
+            break;
+        case 18:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[1] >> 1, rcadd2[1] & 1);
+            break;
+        case 21:
+            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[2] >> 1, rcadd2[2] & 1);
+            break;
+        case 22:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[3] >> 1, rcadd2[3] & 1);
+            break;
+        case 23:
+            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[4] >> 1, rcadd2[4] & 1);
+            break;
+        case 31:
+            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[5] >> 1, rcadd2[5] & 1);
+            break;
+    }
+
+    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rc0 >> 1, rc0 & 1);
+    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rc1 >> 1, rc1 & 1);
+
+    if (slot != pcm.config.reg_slots - 1)
+    {
+        pcm.ram1[31][1] = suml;
+        pcm.ram1[31][3] = sumr;
+    }
+    else
+    {
+        pcm.accum_l = suml;
+        pcm.accum_r = sumr;
+    }
+}
+
+// Runs the voice kernel over the `lanes` voices queued in `batch`, then stores their filter state and mixes slots
+// [first, last) in order. Slots without a lane are idle and mix silence.
+static void PCM_RunVoices(pcm_t& pcm, pcm_voice_batch_t& batch, pcm_voice_kernel kernel, bool mk1, int lanes,
+                          const int* slot_lane, int first, int last, const int* rcadd, const int* rcadd2)
+{
+    if (lanes)
+        kernel(batch, 0, lanes, mk1);
+
+    for (int slot = first; slot < last; slot++)
+    {
+        const int lane = slot_lane[slot];
+        if (lane < 0)
+        {
+            PCM_MixSlot(pcm, slot, 0, 0, 0, 0, rcadd, rcadd2);
+            continue;
+        }
+
+        uint32_t *ram1 = pcm.ram1[slot];
+        ram1[1] = (uint32_t)batch.out_reg1[lane];
+        ram1[3] = (uint32_t)batch.out_reg3[lane];
+
+        PCM_MixSlot(pcm, slot, batch.out_l[lane], batch.out_r[lane], batch.out_reverb[lane], batch.out_chorus[lane],
+                    rcadd, rcadd2);
+
+        if (batch.clear[lane])
+        {
+            ram1[1] = 0;
+            ram1[3] = 0;
+        }
+    }
+}
+
+template <RomsetFamily Family>
 void PCM_Update(pcm_t& pcm, uint64_t cycles)
 {
+    const pcm_voice_kernel voice_kernel = PCM_GetVoiceKernel(pcm.voice_kernel);
+    pcm_voice_batch_t batch;
+
     while (pcm.cycles < cycles)
     {
         const int voice_active = pcm.voice_mask & pcm.voice_mask_pending;
@@ -1100,13 +1212,47 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
         pcm.rcsum[0] = 0;
         pcm.rcsum[1] = 0;
 
+        int lanes = 0;
+        int mixed = 0;
+        int slot_lane[32];
+
         for (int slot = 0; slot < pcm.config.reg_slots; slot++)
         {
+            if (slot == 31)
+            {
+                // Slot 31 shares ram1[31][1] and ram1[31][3] with the mix, so everything before it has to be mixed by
+                // the time it reads them.
+                PCM_RunVoices(pcm, batch, voice_kernel, Family == RomsetFamily::MK1, lanes, slot_lane, mixed, slot,
+                              rcadd, rcadd2);
+                lanes = 0;
+                mixed = slot;
+            }
+
             uint32_t *ram1 = pcm.ram1[slot];
             uint16_t *ram2 = pcm.ram2[slot];
             int okey = (ram2[7] & 0x20) != 0;
             int key = (voice_active >> slot) & 1;
 
+            // Slot 31's filter state is the running mix, which the full path turns into its output, so it always takes
+            // the full path.
+            if (!key && pcm.nfs && slot != 31 && pcm.skip_idle_voices)
+            {
+                // Idle voice: nothing it computes reaches the output. This does the same state updates the full path
+                // below ends up doing for a voice that isn't keyed.
+                calc_tv(pcm, 2, ram2[5], &ram2[11], 0, NULL);
+
+                ram1[1] = 0;
+                ram1[3] = 0;
+                ram1[5] = 0;
+
+                ram2[8] = 0;
+                ram2[9] = 0;
+                ram2[10] = 0;
+
+                slot_lane[slot] = -1;
+                continue;
+            }
+
             int active = okey && key;
             int kon = key && !okey;
 
@@ -1343,87 +1489,29 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
             if (sub_phase_of >= 4)
                 reference = addclip20(reference, shifted >> 1, shifted & 1);
 
-            // interpolation
-
-            int test = ram1[5];
+            // interpolation, filter, volume and pan happen in the voice kernel
 
-            int step0 = multi(interp_lut[0][interp_ratio] << 6, samp0) >> 8;
-            select_nibble = nibble_cmp2 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step0 =  (step0 << 1) >> shift;
+            const int lane = lanes++;
+            slot_lane[slot] = lane;
 
-            test = addclip20(test, step0 >> 1, step0 & 1);
-
-
-            int step1 = multi(interp_lut[1][interp_ratio] << 6, samp1) >> 8;
-            select_nibble = nibble_cmp3 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step1 = (step1 << 1) >> shift;
-
-            test = addclip20(test, step1 >> 1, step1 & 1);
-
-            int step2 = multi(interp_lut[2][interp_ratio] << 6, samp2) >> 8;
-            select_nibble = nibble_cmp4 ? old_nibble : newnibble;
-            shift = (10 - select_nibble) & 15;
-            step2 = (step2 << 1) >> shift;
-
-            int reg1 = ram1[1];
-            int reg3 = ram1[3];
-            int reg2_6 = (ram2[6] >> 8) & 127;
-
-            test = addclip20(test, step2 >> 1, step2 & 1);
+            batch.test[lane] = (int32_t)ram1[5];
+            batch.samp[0][lane] = samp0;
+            batch.samp[1][lane] = samp1;
+            batch.samp[2][lane] = samp2;
+            batch.coef[0][lane] = interp_lut[0][interp_ratio] << 6;
+            batch.coef[1][lane] = interp_lut[1][interp_ratio] << 6;
+            batch.coef[2][lane] = interp_lut[2][interp_ratio] << 6;
+            batch.shift[0][lane] = (10 - (nibble_cmp2 ? old_nibble : newnibble)) & 15;
+            batch.shift[1][lane] = (10 - (nibble_cmp3 ? old_nibble : newnibble)) & 15;
+            batch.shift[2][lane] = (10 - (nibble_cmp4 ? old_nibble : newnibble)) & 15;
+            batch.reg1[lane] = (int32_t)ram1[1];
+            batch.reg3[lane] = (int32_t)ram1[3];
 
             int filter = ram2[11];
-            int v3;
-
-            if (pcm.mcu->is_mk1)
-            {
-                int mult1 = multi(reg1, filter >> 8); // 8
-                int mult2 = multi(reg1, (filter >> 1) & 127); // 9
-                int mult3 = multi(reg1, reg2_6); // 10
-
-                int v2 = addclip20(reg3, mult1 >> 6, (mult1 >> 5) & 1); // 9
-                int v1 = addclip20(v2, mult2 >> 13, (mult2 >> 12) & 1); // 10
-                int subvar = addclip20(v1, (mult3 >> 6), (mult3 >> 5) & 1); // 11
-
-                ram1[3] = v1;
-
-                v3 = addclip20(test, subvar ^ 0xfffff, 1); // 12
-
-                int mult4 = multi(v3, filter >> 8);
-                int mult5 = multi(v3, (filter >> 1) & 127);
-                int v4 = addclip20(reg1, mult4 >> 6, (mult4 >> 5) & 1); // 14
-                int v5 = addclip20(v4, mult5 >> 13, (mult5 >> 12) & 1); // 15
-
-                ram1[1] = v5;
-            }
-            else
-            {
-                // hack: use 32-bit math to avoid overflow
-                int mult1 = reg1 * (int8_t)(filter >> 8); // 8
-                int mult2 = reg1 * (int8_t)((filter >> 1) & 127); // 9
-                int mult3 = reg1 * (int8_t)reg2_6; // 10
-
-                int v2 = reg3 + (mult1 >> 6) + ((mult1 >> 5) & 1); // 9
-                int v1 = v2 + (mult2 >> 13) + ((mult2 >> 12) & 1); // 10
-                int subvar = v1 + (mult3 >> 6) + ((mult3 >> 5) & 1); // 11
-
-                ram1[3] = v1;
-
-                int tests = test;
-                tests <<= 12;
-                tests >>= 12;
-
-                v3 = tests - subvar; // 12
-
-                int mult4 = v3 * (int8_t)(filter >> 8);
-                int mult5 = v3 * (int8_t)((filter >> 1) & 127);
-                int v4 = reg1 + (mult4 >> 6) + ((mult4 >> 5) & 1); // 14
-                int v5 = v4 + (mult5 >> 13) + ((mult5 >> 12) & 1); // 15
-
-                ram1[1] = v5;
-            }
-
+            batch.filter_hi[lane] = (int8_t)(filter >> 8);
+            batch.filter_lo[lane] = (filter >> 1) & 127;
+            batch.resonance[lane] = (ram2[6] >> 8) & 127;
+            batch.use_v3[lane] = ram2[6] & 2;
 
             ram1[5] = reference;
 
@@ -1434,7 +1522,7 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
                     ram2[8] |= 0x4000;
                 pcm.irq_assert = 1;
                 pcm.irq_channel = slot;
-                if (pcm.mcu->is_jv880)
+                if constexpr (Family == RomsetFamily::JV880)
                     MCU_GA_SetGAInt(*pcm.mcu, 5, 1);
                 else
                     MCU_Interrupt_SetRequest(*pcm.mcu, INTERRUPT_SOURCE_IRQ0, 1);
@@ -1447,95 +1535,19 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
             calc_tv(pcm, 1, ram2[4], &ram2[10], active, &volmul2);
             calc_tv(pcm, 2, ram2[5], &ram2[11], active, NULL);
 
-            // if (volmul1 && volmul2)
-            //     volmul1 += 0;
-
-            int sample = (ram2[6] & 2) == 0 ? ram1[3] : v3;
-            //sample = test;
-
-            int multiv1 = multi(sample, volmul1 >> 8);
-            int multiv2 = multi(sample, (volmul1 >> 1) & 127);
-
-            int sample2 = addclip20(multiv1 >> 6, multiv2 >> 13, ((multiv2 >> 12) | (multiv1 >> 5)) & 1);
-
-            int multiv3 = multi(sample2, volmul2 >> 8);
-            int multiv4 = multi(sample2, (volmul2 >> 1) & 127);
-
-            int sample3 = addclip20(multiv3 >> 6, multiv4 >> 13, ((multiv4 >> 12) | (multiv3 >> 5)) & 1);
+            batch.vol1_hi[lane] = (int8_t)(volmul1 >> 8);
+            batch.vol1_lo[lane] = (int8_t)((volmul1 >> 1) & 127);
+            batch.vol2_hi[lane] = (int8_t)(volmul2 >> 8);
+            batch.vol2_lo[lane] = (int8_t)((volmul2 >> 1) & 127);
 
             int pan = active ? ram2[1] : 0;
             int rc = active ? ram2[2] : 0;
 
-            int sampl = multi(sample3, (pan >> 8) & 255);
-            int sampr = multi(sample3, (pan >> 0) & 255);
-
-            int rc0 = multi(sample3, (rc >> 8) & 255) >> 5; // reverb
-            int rc1 = multi(sample3, (rc >> 0) & 255) >> 5; // chorus
-            
-            // mix reverb/chorus?
-            int slot2 = (slot == pcm.config.reg_slots - 1) ? 31 : slot + 1;
-            switch (slot2)
-            {
-                // 17, 18 - reverb
-
-                case 17:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[0] >> 1, rcadd[0] & 1);
-                    break;
-                case 18:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[1] >> 1, rcadd[1] & 1);
-                    break;
-                case 21:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[2] >> 1, rcadd[2] & 1);
-                    break;
-                case 22:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[3] >> 1, rcadd[3] & 1);
-                    break;
-                case 23:
-                    pcm.ram1[31][1] = addclip20(pcm.ram1[31][1], rcadd[4] >> 1, rcadd[4] & 1);
-                    break;
-                case 31:
-                    pcm.ram1[31][3] = addclip20(pcm.ram1[31][3], rcadd[5] >> 1, rcadd[5] & 1);
-                    break;
-            }
-
-            int suml = addclip20(pcm.ram1[31][1], sampl >> 6, (sampl >> 5) & 1);
-            int sumr = addclip20(pcm.ram1[31][3], sampr >> 6, (sampr >> 5) & 1);
-
-            switch (slot2)
-            {
-                case 17:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[0] >> 1, rcadd2[0] & 1);
-                    break;
-                case 18:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[1] >> 1, rcadd2[1] & 1);
-                    break;
-                case 21:
-                    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[2] >> 1, rcadd2[2] & 1);
-                    break;
-                case 22:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[3] >> 1, rcadd2[3] & 1);
-                    break;
-                case 23:
-                    pcm.rcsum[0] = addclip20(pcm.rcsum[0], rcadd2[4] >> 1, rcadd2[4] & 1);
-                    break;
-                case 31:
-                    pcm.rcsum[1] = addclip20(pcm.rcsum[1], rcadd2[5] >> 1, rcadd2[5] & 1);
-                    break;
-            }
-
-            pcm.rcsum[0] = addclip20(pcm.rcsum[0], rc0 >> 1, rc0 & 1);
-            pcm.rcsum[1] = addclip20(pcm.rcsum[1], rc1 >> 1, rc1 & 1);
-
-            if (slot != pcm.config.reg_slots - 1)
-            {
-                pcm.ram1[31][1] = suml;
-                pcm.ram1[31][3] = sumr;
-            }
-            else
-            {
-                pcm.accum_l = suml;
-                pcm.accum_r = sumr;
-            }
+            batch.pan_l[lane] = (int8_t)((pan >> 8) & 255);
+            batch.pan_r[lane] = (int8_t)((pan >> 0) & 255);
+            batch.reverb[lane] = (int8_t)((rc >> 8) & 255);
+            batch.chorus[lane] = (int8_t)((rc >> 0) & 255);
+            batch.clear[lane] = !active && pcm.nfs;
 
             if (key && pcm.nfs)
             {
@@ -1549,11 +1561,7 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
             if (!active)
             {
                 if (pcm.nfs)
-                {
-                    ram1[1] = 0;
-                    ram1[3] = 0;
                     ram1[5] = 0;
-                }
 
                 ram2[8] = 0;
                 ram2[9] = 0;
@@ -1561,6 +1569,9 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
             }
         }
 
+        PCM_RunVoices(pcm, batch, voice_kernel, Family == RomsetFamily::MK1, lanes, slot_lane, mixed,
+                      pcm.config.reg_slots, rcadd, rcadd2);
+
         if (pcm.nfs)
         {
             pcm.ram2[31][7] |= 0x20;
@@ -1570,7 +1581,34 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
 
         int new_cycles = (pcm.config.reg_slots + 1) * 25;
 
-        pcm.cycles += pcm.mcu->is_jv880 ? (new_cycles * 25) / 29 : new_cycles;
+        if constexpr (Family == RomsetFamily::JV880)
+            pcm.cycles += (new_cycles * 25) / 29;
+        else
+            pcm.cycles += new_cycles;
+    }
+}
+
+template void PCM_Update<RomsetFamily::MK2>(pcm_t& pcm, uint64_t cycles);
+template void PCM_Update<RomsetFamily::MK1>(pcm_t& pcm, uint64_t cycles);
+template void PCM_Update<RomsetFamily::SCB55>(pcm_t& pcm, uint64_t cycles);
+template void PCM_Update<RomsetFamily::JV880>(pcm_t& pcm, uint64_t cycles);
+
+void PCM_Update(pcm_t& pcm, uint64_t cycles)
+{
+    switch (pcm.mcu->family)
+    {
+    case RomsetFamily::MK2:
+        PCM_Update<RomsetFamily::MK2>(pcm, cycles);
+        break;
+    case RomsetFamily::MK1:
+        PCM_Update<RomsetFamily::MK1>(pcm, cycles);
+        break;
+    case RomsetFamily::SCB55:
+        PCM_Update<RomsetFamily::SCB55>(pcm, cycles);
+        break;
+    case RomsetFamily::JV880:
+        PCM_Update<RomsetFamily::JV880>(pcm, cycles);
+        break;
     }
 }
 
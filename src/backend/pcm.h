@@ -33,6 +33,8 @@
  */
 #pragma once
 
+#include "pcm_voice.h"
+#include "rom.h"
 #include <cstdint>
 
 struct mcu_t;
@@ -52,9 +54,34 @@ struct PCM_Config
     int reg_slots = 1;
 };
 
+constexpr size_t PCM_WAVEROM1_SIZE     = 0x200000;
+constexpr size_t PCM_WAVEROM2_SIZE     = 0x200000;
+constexpr size_t PCM_WAVEROM3_SIZE     = 0x100000;
+constexpr size_t PCM_WAVEROM_CARD_SIZE = 0x200000;
+constexpr size_t PCM_WAVEROM_EXP_SIZE  = 0x800000;
+
+// Wave rom addresses select one of these banks with their top bits. `data[address & mask]` is the byte at `address`.
+struct PCM_WaveBank
+{
+    const uint8_t* data = nullptr;
+    uint32_t       mask = 0;
+};
+
+constexpr size_t PCM_WAVE_BANK_COUNT = 8;
+
+// The scalars `PCM_Update` reads on every sample come first, followed by the voice ram it walks through and then the
+// effect ram, which is only touched a few times per sample.
 struct pcm_t {
-    uint32_t ram1[32][8]{};
-    uint16_t ram2[32][16]{};
+    uint32_t tv_counter = 0;
+    uint32_t nfs = 0;
+    PCM_Config config{};
+
+    int accum_l = 0;
+    int accum_r = 0;
+    int rcsum[2]{};
+
+    uint64_t cycles = 0;
+
     uint32_t select_channel = 0;
     uint32_t voice_mask = 0;
     uint32_t voice_mask_pending = 0;
@@ -67,34 +94,44 @@ struct pcm_t {
     uint8_t config_reg_3d = 0;
     uint32_t irq_channel = 0;
     uint32_t irq_assert = 0;
-    PCM_Config config{};
 
-    uint32_t nfs = 0;
+    mcu_t* mcu = nullptr;
 
-    uint32_t tv_counter = 0;
+    // Read-only, sized PCM_WAVEROM*_SIZE. Owned by the emulator's rom image.
+    const uint8_t* waverom1 = nullptr;
+    const uint8_t* waverom2 = nullptr;
+    const uint8_t* waverom3 = nullptr;
+    const uint8_t* waverom_card = nullptr;
+    const uint8_t* waverom_exp = nullptr;
 
-    uint64_t cycles = 0;
+    // Built by PCM_UpdateWaveBanks from the roms, the romset and config_reg_3d. The bank of an address is
+    // `(address >> wave_bank_shift) & 7`.
+    PCM_WaveBank wave_banks[PCM_WAVE_BANK_COUNT]{};
+    uint32_t wave_bank_shift = 19;
 
-    uint16_t eram[0x4000]{};
+    bool disable_oversampling = false;
 
-    int accum_l = 0;
-    int accum_r = 0;
-    int rcsum[2]{};
+    // Kernel used for the voice arithmetic, picked by PCM_Init for the cpu we're running on.
+    PCM_VoiceKernel voice_kernel = PCM_VoiceKernel::Scalar;
 
-    mcu_t* mcu = nullptr;
+    // Voices that aren't keyed skip the voice arithmetic, since nothing they compute reaches the output. Only turned
+    // off by tests that compare against the full path.
+    bool skip_idle_voices = true;
 
-    uint8_t waverom1[0x200000]{};
-    uint8_t waverom2[0x200000]{};
-    uint8_t waverom3[0x100000]{};
-    uint8_t waverom_card[0x200000]{};
-    uint8_t waverom_exp[0x800000]{};
+    alignas(64) uint32_t ram1[32][8]{};
+    uint16_t ram2[32][16]{};
 
-    bool disable_oversampling = false;
+    uint16_t eram[0x4000]{};
 };
 
 void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data);
 uint8_t PCM_Read(pcm_t& pcm, uint32_t address);
 void PCM_Init(pcm_t& pcm, mcu_t& mcu);
 void PCM_Update(pcm_t& pcm, uint64_t cycles);
+// Same as PCM_Update, specialized for the romset family. Instantiated for every family in pcm.cpp.
+template <RomsetFamily Family>
+void PCM_Update(pcm_t& pcm, uint64_t cycles);
 uint32_t PCM_GetOutputFrequency(const pcm_t& pcm);
+// Must be called whenever the wave roms or the romset change, and after config_reg_3d is restored from a state.
+void PCM_UpdateWaveBanks(pcm_t& pcm, RomsetFamily family);
 void PCM_GetConfig(PCM_Config& config, uint8_t config_byte);
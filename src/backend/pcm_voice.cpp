@@ -0,0 +1,162 @@
+#include "pcm_voice.h"
+#include "pcm_voice_kernel.h"
+#include "config.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define NUKED_HAVE_NEON 1
+#else
+#define NUKED_HAVE_NEON 0
+#endif
+
+#if NUKED_ENABLE_AVX2 && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+struct pcm_voice_scalar_t
+{
+    using type = int32_t;
+    static constexpr int LANES = 1;
+
+    static type load(const int32_t* p) { return *p; }
+    static void store(int32_t* p, type v) { *p = v; }
+    static type set1(int32_t v) { return v; }
+
+    static type add(type a, type b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+    static type sub(type a, type b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+    static type mul(type a, type b) { return (int32_t)((uint32_t)a * (uint32_t)b); }
+    static type and_(type a, type b) { return a & b; }
+    static type or_(type a, type b) { return a | b; }
+    static type xor_(type a, type b) { return a ^ b; }
+
+    template <int N>
+    static type sll(type a) { return (int32_t)((uint32_t)a << N); }
+    template <int N>
+    static type sra(type a) { return a >> N; }
+    static type srav(type a, type n) { return a >> n; }
+
+    static type select(type cond, type a, type b) { return cond ? a : b; }
+};
+
+static void PCM_VoiceKernelScalar(pcm_voice_batch_t& batch, int begin, int end, bool mk1)
+{
+    PCM_VoiceVectors<pcm_voice_scalar_t>(batch, begin, end, mk1);
+}
+
+// Used by the vector kernels for the voices that don't fill a whole vector.
+void PCM_VoiceKernelTail(pcm_voice_batch_t& batch, int begin, int end, bool mk1)
+{
+    PCM_VoiceKernelScalar(batch, begin, end, mk1);
+}
+
+#if NUKED_HAVE_NEON
+struct pcm_voice_neon_t
+{
+    using type = int32x4_t;
+    static constexpr int LANES = 4;
+
+    static type load(const int32_t* p) { return vld1q_s32(p); }
+    static void store(int32_t* p, type v) { vst1q_s32(p, v); }
+    static type set1(int32_t v) { return vdupq_n_s32(v); }
+
+    static type add(type a, type b) { return vaddq_s32(a, b); }
+    static type sub(type a, type b) { return vsubq_s32(a, b); }
+    static type mul(type a, type b) { return vmulq_s32(a, b); }
+    static type and_(type a, type b) { return vandq_s32(a, b); }
+    static type or_(type a, type b) { return vorrq_s32(a, b); }
+    static type xor_(type a, type b) { return veorq_s32(a, b); }
+
+    template <int N>
+    static type sll(type a) { return vshlq_n_s32(a, N); }
+    template <int N>
+    static type sra(type a) { return vshrq_n_s32(a, N); }
+    // vshl with a negative count is an arithmetic right shift
+    static type srav(type a, type n) { return vshlq_s32(a, vnegq_s32(n)); }
+
+    static type select(type cond, type a, type b) { return vbslq_s32(vtstq_s32(cond, cond), a, b); }
+};
+
+static void PCM_VoiceKernelNEON(pcm_voice_batch_t& batch, int begin, int end, bool mk1)
+{
+    const int i = PCM_VoiceVectors<pcm_voice_neon_t>(batch, begin, end, mk1);
+    PCM_VoiceKernelTail(batch, i, end, mk1);
+}
+#endif
+
+#if NUKED_ENABLE_AVX2
+// pcm_voice_avx2.cpp
+void PCM_VoiceKernelAVX2(pcm_voice_batch_t& batch, int begin, int end, bool mk1);
+
+// Also used by audio_kernel.cpp.
+bool PCM_CpuHasAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // the os has to save ymm registers too
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+PCM_VoiceKernel PCM_DetectVoiceKernel()
+{
+#if NUKED_ENABLE_AVX2
+    if (PCM_CpuHasAVX2())
+        return PCM_VoiceKernel::AVX2;
+#endif
+#if NUKED_HAVE_NEON
+    return PCM_VoiceKernel::NEON;
+#else
+    return PCM_VoiceKernel::Scalar;
+#endif
+}
+
+pcm_voice_kernel PCM_GetVoiceKernel(PCM_VoiceKernel kernel)
+{
+    switch (kernel)
+    {
+    case PCM_VoiceKernel::Scalar:
+        return PCM_VoiceKernelScalar;
+    case PCM_VoiceKernel::AVX2:
+#if NUKED_ENABLE_AVX2
+        if (PCM_CpuHasAVX2())
+            return PCM_VoiceKernelAVX2;
+#endif
+        return nullptr;
+    case PCM_VoiceKernel::NEON:
+#if NUKED_HAVE_NEON
+        return PCM_VoiceKernelNEON;
+#else
+        return nullptr;
+#endif
+    }
+    return nullptr;
+}
+
+const char* PCM_VoiceKernelName(PCM_VoiceKernel kernel)
+{
+    switch (kernel)
+    {
+    case PCM_VoiceKernel::Scalar:
+        return "scalar";
+    case PCM_VoiceKernel::AVX2:
+        return "avx2";
+    case PCM_VoiceKernel::NEON:
+        return "neon";
+    }
+    return "unknown";
+}
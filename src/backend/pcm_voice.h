@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+// The arithmetic half of a pcm voice: interpolation, filter, volume and pan. PCM_Update runs the address generator,
+// the dpcm decode and the envelopes for each keyed voice, stores what this half needs in a `pcm_voice_batch_t` and
+// then runs a voice kernel over all of them at once.
+//
+// All inputs are already in the form the arithmetic consumes them, e.g. the int8 multipliers have been truncated the
+// same way `multi` does it, so a kernel only has to do 32-bit integer math.
+
+constexpr int PCM_VOICE_BATCH_SIZE = 32;
+
+struct pcm_voice_batch_t {
+    // Inputs
+    alignas(32) int32_t test[PCM_VOICE_BATCH_SIZE];   // ram1[5] before this sample's dpcm update
+    alignas(32) int32_t samp[3][PCM_VOICE_BATCH_SIZE];  // signed 8-bit samples
+    alignas(32) int32_t coef[3][PCM_VOICE_BATCH_SIZE];  // interp_lut[n][interp_ratio] << 6
+    alignas(32) int32_t shift[3][PCM_VOICE_BATCH_SIZE]; // (10 - nibble) & 15
+    alignas(32) int32_t reg1[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t reg3[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t filter_hi[PCM_VOICE_BATCH_SIZE]; // (int8_t)(ram2[11] >> 8)
+    alignas(32) int32_t filter_lo[PCM_VOICE_BATCH_SIZE]; // (ram2[11] >> 1) & 127
+    alignas(32) int32_t resonance[PCM_VOICE_BATCH_SIZE]; // (ram2[6] >> 8) & 127
+    alignas(32) int32_t use_v3[PCM_VOICE_BATCH_SIZE];    // ram2[6] & 2
+    alignas(32) int32_t vol1_hi[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t vol1_lo[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t vol2_hi[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t vol2_lo[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t pan_l[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t pan_r[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t reverb[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t chorus[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t clear[PCM_VOICE_BATCH_SIZE];     // nonzero to zero ram1[1]/ram1[3] once mixed, not read by kernels
+
+    // Outputs
+    alignas(32) int32_t out_reg1[PCM_VOICE_BATCH_SIZE];  // new ram1[1]
+    alignas(32) int32_t out_reg3[PCM_VOICE_BATCH_SIZE];  // new ram1[3]
+    alignas(32) int32_t out_l[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t out_r[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t out_reverb[PCM_VOICE_BATCH_SIZE];
+    alignas(32) int32_t out_chorus[PCM_VOICE_BATCH_SIZE];
+};
+
+// Processes voices [begin, end) of `batch`. `mk1` selects the SC-55 filter, which saturates differently.
+typedef void(*pcm_voice_kernel)(pcm_voice_batch_t& batch, int begin, int end, bool mk1);
+
+enum class PCM_VoiceKernel
+{
+    Scalar,
+    AVX2,
+    NEON,
+};
+
+// Returns the fastest kernel the cpu running this process supports.
+PCM_VoiceKernel PCM_DetectVoiceKernel();
+
+// Returns null if `kernel` isn't available in this build or on this cpu.
+pcm_voice_kernel PCM_GetVoiceKernel(PCM_VoiceKernel kernel);
+
+const char* PCM_VoiceKernelName(PCM_VoiceKernel kernel);
@@ -0,0 +1,43 @@
+// Compiled with AVX2 enabled. Only reached through PCM_GetVoiceKernel after checking that the cpu supports it.
+
+#include "pcm_voice.h"
+#include "pcm_voice_kernel.h"
+#include <immintrin.h>
+
+struct pcm_voice_avx2_t
+{
+    using type = __m256i;
+    static constexpr int LANES = 8;
+
+    static type load(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(int32_t* p, type v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static type set1(int32_t v) { return _mm256_set1_epi32(v); }
+
+    static type add(type a, type b) { return _mm256_add_epi32(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_epi32(a, b); }
+    static type mul(type a, type b) { return _mm256_mullo_epi32(a, b); }
+    static type and_(type a, type b) { return _mm256_and_si256(a, b); }
+    static type or_(type a, type b) { return _mm256_or_si256(a, b); }
+    static type xor_(type a, type b) { return _mm256_xor_si256(a, b); }
+
+    template <int N>
+    static type sll(type a) { return _mm256_slli_epi32(a, N); }
+    template <int N>
+    static type sra(type a) { return _mm256_srai_epi32(a, N); }
+    static type srav(type a, type n) { return _mm256_srav_epi32(a, n); }
+
+    static type select(type cond, type a, type b)
+    {
+        const type is_zero = _mm256_cmpeq_epi32(cond, _mm256_setzero_si256());
+        return _mm256_blendv_epi8(a, b, is_zero);
+    }
+};
+
+// pcm_voice.cpp
+void PCM_VoiceKernelTail(pcm_voice_batch_t& batch, int begin, int end, bool mk1);
+
+void PCM_VoiceKernelAVX2(pcm_voice_batch_t& batch, int begin, int end, bool mk1)
+{
+    const int i = PCM_VoiceVectors<pcm_voice_avx2_t>(batch, begin, end, mk1);
+    PCM_VoiceKernelTail(batch, i, end, mk1);
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+// Kernel body shared by every pcm_voice_kernel implementation. Not part of the public headers: each translation unit
+// that includes this instantiates it for its own vector type, possibly with different codegen flags, so everything here
+// has internal linkage.
+//
+// A vector type `V` provides:
+//
+//   using type = ...;               // LANES x int32
+//   static constexpr int LANES;
+//   type load(const int32_t*); void store(int32_t*, type);
+//   type set1(int32_t);
+//   type add(type, type); type sub(type, type); type mul(type, type);     // wrapping 32-bit
+//   type and_(type, type); type or_(type, type); type xor_(type, type);
+//   template <int N> type sll(type); template <int N> type sra(type);
+//   type srav(type value, type count);                                       // arithmetic, count in [0, 31]
+//   type select(type cond, type a, type b);                                  // cond != 0 ? a : b
+
+#include "pcm_voice.h"
+#include <cstdint>
+
+template <class V>
+static inline typename V::type PCM_VoiceSx20(typename V::type x)
+{
+    return V::template sra<12>(V::template sll<12>(x));
+}
+
+// addclip20(a, b, cin)
+template <class V>
+static inline typename V::type PCM_VoiceAddClip20(typename V::type a, typename V::type b, typename V::type cin)
+{
+    return V::add(V::add(PCM_VoiceSx20<V>(a), PCM_VoiceSx20<V>(b)), cin);
+}
+
+// a + (m >> N) + ((m >> (N - 1)) & 1), the rounding shift used all over the filter
+template <class V, int N>
+static inline typename V::type PCM_VoiceAddRounded(typename V::type a, typename V::type m)
+{
+    const typename V::type one = V::set1(1);
+    return V::add(V::add(a, V::template sra<N>(m)), V::and_(V::template sra<N - 1>(m), one));
+}
+
+// addclip20(a, m >> N, (m >> (N - 1)) & 1)
+template <class V, int N>
+static inline typename V::type PCM_VoiceAddClipRounded(typename V::type a, typename V::type m)
+{
+    const typename V::type one = V::set1(1);
+    return PCM_VoiceAddClip20<V>(a, V::template sra<N>(m), V::and_(V::template sra<N - 1>(m), one));
+}
+
+// Processes V::LANES voices starting at `i`.
+template <class V, bool Mk1>
+static inline void PCM_VoiceLanes(pcm_voice_batch_t& batch, int i)
+{
+    using T = typename V::type;
+
+    const T one = V::set1(1);
+
+    // interpolation
+    T test = V::load(batch.test + i);
+    for (int k = 0; k < 3; ++k)
+    {
+        // coef is at most 4095 << 6 and samp fits in 8 bits so multi() is a plain multiply here
+        T step = V::template sra<8>(V::mul(V::load(batch.coef[k] + i), V::load(batch.samp[k] + i)));
+        step = V::srav(V::template sll<1>(step), V::load(batch.shift[k] + i));
+        test = PCM_VoiceAddClip20<V>(test, V::template sra<1>(step), V::and_(step, one));
+    }
+
+    // filter
+    const T reg1 = V::load(batch.reg1 + i);
+    const T reg3 = V::load(batch.reg3 + i);
+    const T filter_hi = V::load(batch.filter_hi + i);
+    const T filter_lo = V::load(batch.filter_lo + i);
+    const T resonance = V::load(batch.resonance + i);
+
+    T v1, v3, v5;
+    if constexpr (Mk1)
+    {
+        const T reg1s = PCM_VoiceSx20<V>(reg1);
+        const T mult1 = V::mul(reg1s, filter_hi);
+        const T mult2 = V::mul(reg1s, filter_lo);
+        const T mult3 = V::mul(reg1s, resonance);
+
+        const T v2 = PCM_VoiceAddClipRounded<V, 6>(reg3, mult1);
+        v1 = PCM_VoiceAddClipRounded<V, 13>(v2, mult2);
+        const T subvar = PCM_VoiceAddClipRounded<V, 6>(v1, mult3);
+
+        v3 = PCM_VoiceAddClip20<V>(test, V::xor_(subvar, V::set1(0xfffff)), one);
+
+        const T v3s = PCM_VoiceSx20<V>(v3);
+        const T mult4 = V::mul(v3s, filter_hi);
+        const T mult5 = V::mul(v3s, filter_lo);
+        const T v4 = PCM_VoiceAddClipRounded<V, 6>(reg1, mult4);
+        v5 = PCM_VoiceAddClipRounded<V, 13>(v4, mult5);
+    }
+    else
+    {
+        // 32-bit math, see PCM_Update
+        const T mult1 = V::mul(reg1, filter_hi);
+        const T mult2 = V::mul(reg1, filter_lo);
+        const T mult3 = V::mul(reg1, resonance);
+
+        const T v2 = PCM_VoiceAddRounded<V, 6>(reg3, mult1);
+        v1 = PCM_VoiceAddRounded<V, 13>(v2, mult2);
+        const T subvar = PCM_VoiceAddRounded<V, 6>(v1, mult3);
+
+        v3 = V::sub(PCM_VoiceSx20<V>(test), subvar);
+
+        const T mult4 = V::mul(v3, filter_hi);
+        const T mult5 = V::mul(v3, filter_lo);
+        const T v4 = PCM_VoiceAddRounded<V, 6>(reg1, mult4);
+        v5 = PCM_VoiceAddRounded<V, 13>(v4, mult5);
+    }
+
+    V::store(batch.out_reg1 + i, v5);
+    V::store(batch.out_reg3 + i, v1);
+
+    // volume
+    const T sample = PCM_VoiceSx20<V>(V::select(V::load(batch.use_v3 + i), v3, v1));
+
+    const T multiv1 = V::mul(sample, V::load(batch.vol1_hi + i));
+    const T multiv2 = V::mul(sample, V::load(batch.vol1_lo + i));
+    const T sample2 = PCM_VoiceSx20<V>(PCM_VoiceAddClip20<V>(
+        V::template sra<6>(multiv1),
+        V::template sra<13>(multiv2),
+        V::and_(V::or_(V::template sra<12>(multiv2), V::template sra<5>(multiv1)), one)));
+
+    const T multiv3 = V::mul(sample2, V::load(batch.vol2_hi + i));
+    const T multiv4 = V::mul(sample2, V::load(batch.vol2_lo + i));
+    const T sample3 = PCM_VoiceSx20<V>(PCM_VoiceAddClip20<V>(
+        V::template sra<6>(multiv3),
+        V::template sra<13>(multiv4),
+        V::and_(V::or_(V::template sra<12>(multiv4), V::template sra<5>(multiv3)), one)));
+
+    // pan and reverb/chorus sends
+    V::store(batch.out_l + i, V::mul(sample3, V::load(batch.pan_l + i)));
+    V::store(batch.out_r + i, V::mul(sample3, V::load(batch.pan_r + i)));
+    V::store(batch.out_reverb + i, V::template sra<5>(V::mul(sample3, V::load(batch.reverb + i))));
+    V::store(batch.out_chorus + i, V::template sra<5>(V::mul(sample3, V::load(batch.chorus + i))));
+}
+
+// Processes as many whole vectors as fit in [begin, end) and returns where it stopped.
+template <class V>
+static inline int PCM_VoiceVectors(pcm_voice_batch_t& batch, int begin, int end, bool mk1)
+{
+    int i = begin;
+    if (mk1)
+    {
+        for (; i + V::LANES <= end; i += V::LANES)
+            PCM_VoiceLanes<V, true>(batch, i);
+    }
+    else
+    {
+        for (; i + V::LANES <= end; i += V::LANES)
+            PCM_VoiceLanes<V, false>(batch, i);
+    }
+    return i;
+}
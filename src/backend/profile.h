@@ -0,0 +1,132 @@
+#pragma once
+
+#include "config.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#if NUKED_ENABLE_PROFILING && (defined(__x86_64__) || defined(_M_X64))
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Parts of `MCU_Step` that are timed when built with NUKED_ENABLE_PROFILING.
+enum class ProfileStage : uint8_t
+{
+    Interrupts,
+    Instructions,
+    PCM,
+    Timers,
+    SubMCU,
+    UART,
+    Analog,
+    Count,
+};
+
+constexpr size_t PROFILE_STAGE_COUNT = (size_t)ProfileStage::Count;
+
+inline const char* PROF_StageName(ProfileStage stage)
+{
+    switch (stage)
+    {
+    case ProfileStage::Interrupts:
+        return "interrupts";
+    case ProfileStage::Instructions:
+        return "instructions";
+    case ProfileStage::PCM:
+        return "pcm";
+    case ProfileStage::Timers:
+        return "timers";
+    case ProfileStage::SubMCU:
+        return "submcu";
+    case ProfileStage::UART:
+        return "uart";
+    case ProfileStage::Analog:
+        return "analog";
+    case ProfileStage::Count:
+        break;
+    }
+    return "unknown";
+}
+
+// Wall clock in nanoseconds, used to calibrate `PROF_ReadTicks`.
+inline uint64_t PROF_ReadNS()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// A cheap timestamp in unspecified units. Reading the OS clock twice per stage would cost more than most stages.
+inline uint64_t PROF_ReadTicks()
+{
+#if NUKED_ENABLE_PROFILING && (defined(__x86_64__) || defined(_M_X64))
+    return __rdtsc();
+#elif NUKED_ENABLE_PROFILING && defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return PROF_ReadNS();
+#endif
+}
+
+struct profile_counter_t
+{
+    uint64_t ticks = 0;
+    uint64_t calls = 0;
+};
+
+struct mcu_profile_t
+{
+    profile_counter_t stages[PROFILE_STAGE_COUNT]{};
+
+    // Clock readings when the counters were last reset, to convert ticks to nanoseconds
+    uint64_t start_ticks = 0;
+    uint64_t start_ns    = 0;
+};
+
+inline void PROF_Reset(mcu_profile_t& profile)
+{
+    profile             = mcu_profile_t{};
+    profile.start_ticks = PROF_ReadTicks();
+    profile.start_ns    = PROF_ReadNS();
+}
+
+// Adds the time until the end of the enclosing scope to `stage`. Does nothing unless built with
+// NUKED_ENABLE_PROFILING.
+#if NUKED_ENABLE_PROFILING
+class PROF_Scope
+{
+public:
+    PROF_Scope(mcu_profile_t& profile, ProfileStage stage)
+        : m_counter(profile.stages[(size_t)stage])
+        , m_start(PROF_ReadTicks())
+    {
+    }
+
+    ~PROF_Scope()
+    {
+        m_counter.ticks += PROF_ReadTicks() - m_start;
+        ++m_counter.calls;
+    }
+
+    PROF_Scope(const PROF_Scope&)            = delete;
+    PROF_Scope& operator=(const PROF_Scope&) = delete;
+
+private:
+    profile_counter_t& m_counter;
+    uint64_t           m_start;
+};
+#else
+class PROF_Scope
+{
+public:
+    PROF_Scope(mcu_profile_t&, ProfileStage)
+    {
+    }
+};
+#endif
@@ -0,0 +1,211 @@
+#include "resampler.h"
+#include "audio_kernel.h"
+#include "math_util.h"
+#include <cmath>
+#include <numbers>
+#include <numeric>
+
+// Phases the filter is tabulated at. Interpolating linearly between them is accurate to well below 16-bit resolution.
+static constexpr size_t RESAMPLE_FILTER_PHASES = 256;
+// Filter length at or above the input rate. Downsampling stretches the filter by the ratio, which keeps the transition
+// band the same width relative to the output rate.
+static constexpr size_t RESAMPLE_BASE_TAPS = 64;
+// Passband edge as a fraction of the output's Nyquist frequency. The transition band ends right below Nyquist, so
+// everything up to 20khz is kept at 44.1khz.
+static constexpr double RESAMPLE_CUTOFF = 0.9;
+// About 90db of stopband attenuation.
+static constexpr double RESAMPLE_KAISER_BETA = 9.0;
+
+static double RESAMPLE_BesselI0(double x)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64 && term > sum * 1e-12; ++k)
+    {
+        const double t = x / (2.0 * k);
+        term *= t * t;
+        sum += term;
+    }
+    return sum;
+}
+
+template <typename T>
+static T RESAMPLE_FromFloat(float sample)
+{
+    if constexpr (std::is_same_v<T, int16_t>)
+    {
+        return (int16_t)Clamp<float>(std::nearbyint(sample), INT16_MIN, INT16_MAX);
+    }
+    else if constexpr (std::is_same_v<T, int32_t>)
+    {
+        return (int32_t)Clamp<double>(std::nearbyint((double)sample), INT32_MIN, INT32_MAX);
+    }
+    else
+    {
+        return sample;
+    }
+}
+
+bool AudioResampler::Init(uint32_t in_rate, uint32_t out_rate)
+{
+    if (in_rate < MIN_RATE || in_rate > MAX_RATE || out_rate < MIN_RATE || out_rate > MAX_RATE)
+    {
+        return false;
+    }
+
+    m_in_rate  = in_rate;
+    m_out_rate = out_rate;
+
+    const uint32_t gcd = std::gcd(in_rate, out_rate);
+    m_in_step          = in_rate / gcd;
+    m_out_step         = out_rate / gcd;
+
+    m_taps = 0;
+    m_table.clear();
+
+    if (in_rate != out_rate)
+    {
+        const double ratio = Min(1.0, (double)out_rate / (double)in_rate);
+
+        m_taps = (size_t)std::ceil((double)RESAMPLE_BASE_TAPS / ratio);
+        m_taps = (m_taps + AUDIO_RESAMPLE_TAP_ALIGN - 1) / AUDIO_RESAMPLE_TAP_ALIGN * AUDIO_RESAMPLE_TAP_ALIGN;
+
+        // In cycles per input sample
+        const double cutoff  = 0.5 * ratio * RESAMPLE_CUTOFF;
+        const double half    = (double)(m_taps / 2);
+        const double i0_beta = RESAMPLE_BesselI0(RESAMPLE_KAISER_BETA);
+
+        m_table.resize((RESAMPLE_FILTER_PHASES + 1) * m_taps);
+        for (size_t phase = 0; phase <= RESAMPLE_FILTER_PHASES; ++phase)
+        {
+            for (size_t tap = 0; tap < m_taps; ++tap)
+            {
+                // Distance from the output frame to the input sample under this tap
+                const double distance = (double)tap - half + 1.0 - (double)phase / RESAMPLE_FILTER_PHASES;
+
+                const double x      = distance / half;
+                const double window = x * x < 1.0 ? RESAMPLE_BesselI0(RESAMPLE_KAISER_BETA * std::sqrt(1.0 - x * x)) /
+                                                        i0_beta
+                                                  : 0.0;
+
+                const double arg  = 2.0 * cutoff * distance * std::numbers::pi;
+                const double sinc = arg == 0.0 ? 1.0 : std::sin(arg) / arg;
+
+                m_table[phase * m_taps + tap] = (float)(2.0 * cutoff * sinc * window);
+            }
+        }
+    }
+
+    Reset();
+    return true;
+}
+
+void AudioResampler::Reset()
+{
+    // Zeros stand in for the input before the stream, so the first output frame lines up with the first input frame
+    const size_t lead = m_taps != 0 ? m_taps / 2 - 1 : 0;
+    m_left.assign(lead, 0.0f);
+    m_right.assign(lead, 0.0f);
+    m_index      = lead;
+    m_frac       = 0;
+    m_frames_in  = 0;
+    m_frames_out = 0;
+}
+
+template <typename T>
+void AudioResampler::Push(std::span<const AudioFrame<T>> in)
+{
+    for (const AudioFrame<T>& frame : in)
+    {
+        m_left.push_back((float)frame.left);
+        m_right.push_back((float)frame.right);
+    }
+    m_frames_in += in.size();
+}
+
+template <typename T>
+std::span<const AudioFrame<T>> AudioResampler::Drain(uint64_t frame_limit)
+{
+    const size_t half = m_taps / 2;
+
+    size_t max_frames = 0;
+    if (m_index + half < m_left.size())
+    {
+        max_frames = (m_left.size() - m_index) * m_out_step / m_in_step + 2;
+    }
+    m_output.resize(max_frames * sizeof(AudioFrame<T>));
+
+    AudioFrame<T>* out      = (AudioFrame<T>*)m_output.data();
+    size_t         produced = 0;
+    while (m_index + half < m_left.size() && m_frames_out < frame_limit)
+    {
+        const uint64_t phase = (uint64_t)m_frac * RESAMPLE_FILTER_PHASES;
+        const size_t   row   = (size_t)(phase / m_out_step);
+        const float    frac  = (float)(phase % m_out_step) / (float)m_out_step;
+
+        const size_t first = m_index + 1 - half;
+
+        float result[2];
+        AUDIO_Resample(result,
+                       &m_left[first],
+                       &m_right[first],
+                       &m_table[row * m_taps],
+                       &m_table[(row + 1) * m_taps],
+                       frac,
+                       m_taps);
+        out[produced].left  = RESAMPLE_FromFloat<T>(result[0]);
+        out[produced].right = RESAMPLE_FromFloat<T>(result[1]);
+        ++produced;
+        ++m_frames_out;
+
+        m_frac += m_in_step;
+        m_index += m_frac / m_out_step;
+        m_frac %= m_out_step;
+    }
+
+    // Drop the input no future output frame reaches
+    const size_t consumed = Min(m_index + 1 - half, m_left.size());
+    m_left.erase(m_left.begin(), m_left.begin() + (std::ptrdiff_t)consumed);
+    m_right.erase(m_right.begin(), m_right.begin() + (std::ptrdiff_t)consumed);
+    m_index -= consumed;
+
+    return std::span(out, produced);
+}
+
+template <typename T>
+std::span<const AudioFrame<T>> AudioResampler::Process(std::span<const AudioFrame<T>> in)
+{
+    if (m_taps == 0)
+    {
+        return in;
+    }
+
+    Push(in);
+    return Drain<T>(UINT64_MAX);
+}
+
+template <typename T>
+std::span<const AudioFrame<T>> AudioResampler::Flush()
+{
+    if (m_taps == 0)
+    {
+        return {};
+    }
+
+    // Stop at the output frame that would start after the input ended
+    const uint64_t total_frames = (m_frames_in * m_out_step + m_in_step - 1) / m_in_step;
+
+    m_left.resize(m_left.size() + m_taps / 2, 0.0f);
+    m_right.resize(m_right.size() + m_taps / 2, 0.0f);
+    const std::span<const AudioFrame<T>> out = Drain<T>(total_frames);
+
+    Reset();
+    return out;
+}
+
+template std::span<const AudioFrame<int16_t>> AudioResampler::Process(std::span<const AudioFrame<int16_t>> in);
+template std::span<const AudioFrame<int32_t>> AudioResampler::Process(std::span<const AudioFrame<int32_t>> in);
+template std::span<const AudioFrame<float>>   AudioResampler::Process(std::span<const AudioFrame<float>> in);
+template std::span<const AudioFrame<int16_t>> AudioResampler::Flush();
+template std::span<const AudioFrame<int32_t>> AudioResampler::Flush();
+template std::span<const AudioFrame<float>>   AudioResampler::Flush();
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "audio.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Converts stereo audio from the emulator's frequency to a conventional one with a Kaiser windowed sinc filter. The
+// filter is tabulated at a fixed number of phases and interpolated between them, so every pair of rates gets the same
+// quality and table size. Samples are filtered as floats by AUDIO_Resample.
+class AudioResampler
+{
+public:
+    // Rates outside of this range are rejected by Init.
+    static constexpr uint32_t MIN_RATE = 8000;
+    static constexpr uint32_t MAX_RATE = 768000;
+
+    // Prepares to convert from `in_rate` to `out_rate`. Returns false if either rate is out of range. Equal rates make
+    // the resampler pass audio through unchanged.
+    bool Init(uint32_t in_rate, uint32_t out_rate);
+
+    uint32_t GetInputRate() const
+    {
+        return m_in_rate;
+    }
+
+    uint32_t GetOutputRate() const
+    {
+        return m_out_rate;
+    }
+
+    // Returns the output for `in`. The span is valid until the next call. Output is centered on the input, so the
+    // last few milliseconds are held back until more input arrives or Flush is called.
+    template <typename T>
+    std::span<const AudioFrame<T>> Process(std::span<const AudioFrame<T>> in);
+
+    // Returns the output that was held back, so that the total output covers as much time as the input did, and
+    // readies the resampler for a new stream. The span is valid until the next call.
+    template <typename T>
+    std::span<const AudioFrame<T>> Flush();
+
+    // Forgets the current stream without producing the rest of its output.
+    void Reset();
+
+private:
+    template <typename T>
+    void Push(std::span<const AudioFrame<T>> in);
+
+    // Filters every output frame the history has enough input for into m_output, stopping once the stream has
+    // produced `frame_limit` frames.
+    template <typename T>
+    std::span<const AudioFrame<T>> Drain(uint64_t frame_limit);
+
+private:
+    uint32_t m_in_rate  = 0;
+    uint32_t m_out_rate = 0;
+
+    // Rates divided by their gcd, so the phase can be tracked exactly
+    uint32_t m_in_step  = 1;
+    uint32_t m_out_step = 1;
+
+    // RESAMPLE_FILTER_PHASES + 1 rows of m_taps coefficients; the last row is the first one shifted by a sample. Empty
+    // when passing audio through.
+    size_t             m_taps = 0;
+    std::vector<float> m_table;
+
+    // Planar input history. m_index is the sample at or before the time of the next output frame, and
+    // m_frac / m_out_step is how far past it that time is.
+    std::vector<float> m_left;
+    std::vector<float> m_right;
+    size_t             m_index = 0;
+    uint32_t           m_frac  = 0;
+
+    // Frame counts of the current stream, used by Flush to end the output at the same time as the input.
+    uint64_t m_frames_in  = 0;
+    uint64_t m_frames_out = 0;
+
+    // Holds the result of the last Process or Flush, as AudioFrame<T> of its sample type
+    std::vector<uint8_t> m_output;
+};
@@ -0,0 +1,178 @@
+#include "ringbuffer.h"
+
+#include <bit>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static size_t GB_GetMappingGranularity()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
+
+bool GenericBuffer::InitMirrored(size_t size_bytes)
+{
+    Free();
+
+    size_bytes = std::max(size_bytes, GB_GetMappingGranularity());
+    if (!std::has_single_bit(size_bytes))
+    {
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE,
+                                        NULL,
+                                        PAGE_READWRITE,
+                                        (DWORD)((uint64_t)size_bytes >> 32),
+                                        (DWORD)size_bytes,
+                                        NULL);
+    if (!mapping)
+    {
+        return false;
+    }
+
+    // There's no way to reserve address space and map into it without newer APIs, so find a free range and map both
+    // views into it. Another thread can take the range in between, in which case try again somewhere else.
+    for (int attempt = 0; attempt < 16; ++attempt)
+    {
+        void* range = VirtualAlloc(NULL, 2 * size_bytes, MEM_RESERVE, PAGE_NOACCESS);
+        if (!range)
+        {
+            break;
+        }
+        VirtualFree(range, 0, MEM_RELEASE);
+
+        void* first = MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size_bytes, range);
+        if (!first)
+        {
+            continue;
+        }
+
+        void* second = MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size_bytes, (uint8_t*)range + size_bytes);
+        if (!second)
+        {
+            UnmapViewOfFile(first);
+            continue;
+        }
+
+        m_buffer      = first;
+        m_buffer_size = size_bytes;
+        m_mapping     = mapping;
+        m_mirrored    = true;
+        return true;
+    }
+
+    CloseHandle(mapping);
+    return false;
+}
+
+void GenericBuffer::FreeMirrored()
+{
+    UnmapViewOfFile((uint8_t*)m_buffer + m_buffer_size);
+    UnmapViewOfFile(m_buffer);
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+}
+#else
+static int GB_CreateSharedMemory(size_t size_bytes)
+{
+#if defined(__linux__)
+    const int fd = memfd_create("nuked-sc55-ringbuffer", MFD_CLOEXEC);
+#else
+    // Only used to get a descriptor; the name is removed before anyone else could care about it
+    char name[64];
+    snprintf(name, sizeof(name), "/nuked-sc55-ring-%ld-%p", (long)getpid(), (void*)&name);
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1)
+    {
+        shm_unlink(name);
+    }
+#endif
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (ftruncate(fd, (off_t)size_bytes) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool GenericBuffer::InitMirrored(size_t size_bytes)
+{
+    Free();
+
+    size_bytes = std::max(size_bytes, (size_t)sysconf(_SC_PAGESIZE));
+    if (!std::has_single_bit(size_bytes))
+    {
+        return false;
+    }
+
+    const int fd = GB_CreateSharedMemory(size_bytes);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    // Reserve the whole range first so that nothing else can be mapped into it, then replace both halves with the
+    // same memory
+    uint8_t* range = (uint8_t*)mmap(nullptr, 2 * size_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (range == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    const int flags = MAP_SHARED | MAP_FIXED;
+    if (mmap(range, size_bytes, PROT_READ | PROT_WRITE, flags, fd, 0) == MAP_FAILED ||
+        mmap(range + size_bytes, size_bytes, PROT_READ | PROT_WRITE, flags, fd, 0) == MAP_FAILED)
+    {
+        munmap(range, 2 * size_bytes);
+        close(fd);
+        return false;
+    }
+
+    // The mappings keep the memory alive
+    close(fd);
+
+    m_buffer      = range;
+    m_buffer_size = size_bytes;
+    m_mirrored    = true;
+    return true;
+}
+
+void GenericBuffer::FreeMirrored()
+{
+    munmap(m_buffer, 2 * m_buffer_size);
+}
+#endif
+
+bool GenericBuffer::IsMirroringSupported()
+{
+    static const bool supported = [] {
+        GenericBuffer probe;
+        if (!probe.InitMirrored(1))
+        {
+            return false;
+        }
+
+        // Writes through one half have to show up in the other
+        uint8_t* data = (uint8_t*)probe.DataFirst();
+        data[0]       = 0x5a;
+        return data[probe.GetByteLength()] == 0x5a;
+    }();
+    return supported;
+}
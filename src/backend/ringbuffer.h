@@ -33,8 +33,10 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstring>
 #include <memory>
 #include <span>
 
@@ -78,15 +80,36 @@ public:
         return true;
     }
 
+    // Like `Init`, but maps the same memory a second time right after the buffer, so that the `size_bytes` past
+    // `DataLast()` are the start of the buffer again. A view of a mirrored buffer can hand out spans that run past the
+    // end without splitting or copying them. `size_bytes` must be a power of 2 and is rounded up to the OS mapping
+    // granularity, so check `GetByteLength()` afterwards.
+    //
+    // Returns false if the OS can't mirror memory, in which case the buffer is left empty.
+    bool InitMirrored(size_t size_bytes);
+
+    // True if `InitMirrored` works on this system. Checked once by mapping a small buffer.
+    static bool IsMirroringSupported();
+
+    bool IsMirrored() const
+    {
+        return m_mirrored;
+    }
+
     void Free()
     {
-        if (m_alloc_base)
+        if (m_mirrored)
+        {
+            FreeMirrored();
+        }
+        else if (m_alloc_base)
         {
             free(m_alloc_base);
         }
         m_buffer      = nullptr;
         m_buffer_size = 0;
         m_alloc_base  = nullptr;
+        m_mirrored    = false;
     }
 
     void* DataFirst()
@@ -114,10 +137,18 @@ public:
         return m_buffer_size;
     }
 
+private:
+    void FreeMirrored();
+
 private:
     void*  m_buffer      = nullptr;
     size_t m_buffer_size = 0;
     void*  m_alloc_base  = nullptr;
+
+    // The memory is mapped twice; `m_alloc_base` is unused and `m_mapping` is the OS handle to the shared memory, if
+    // the OS needs one kept around
+    bool  m_mirrored = false;
+    void* m_mapping  = nullptr;
 };
 
 class RingbufferView
@@ -127,6 +158,7 @@ public:
 
     explicit RingbufferView(GenericBuffer& buffer)
         : m_buffer((uint8_t*)buffer.DataFirst(), (uint8_t*)buffer.DataLast())
+        , m_mirrored(buffer.IsMirrored())
     {
         m_read_head  = 0;
         m_write_head = 0;
@@ -137,6 +169,7 @@ public:
         m_read_head  = rhs.m_read_head.load();
         m_write_head = rhs.m_write_head.load();
         m_buffer     = rhs.m_buffer;
+        m_mirrored   = rhs.m_mirrored;
     }
 
     RingbufferView& operator=(const RingbufferView& rhs)
@@ -144,6 +177,7 @@ public:
         m_read_head  = rhs.m_read_head.load();
         m_write_head = rhs.m_write_head.load();
         m_buffer     = rhs.m_buffer;
+        m_mirrored   = rhs.m_mirrored;
         return *this;
     }
 
@@ -152,6 +186,7 @@ public:
         m_read_head  = rhs.m_read_head.load();
         m_write_head = rhs.m_write_head.load();
         m_buffer     = rhs.m_buffer;
+        m_mirrored   = rhs.m_mirrored;
     }
 
     RingbufferView& operator=(RingbufferView&& rhs) noexcept
@@ -159,6 +194,7 @@ public:
         m_read_head  = rhs.m_read_head.load();
         m_write_head = rhs.m_write_head.load();
         m_buffer     = rhs.m_buffer;
+        m_mirrored   = rhs.m_mirrored;
         return *this;
     }
 
@@ -176,13 +212,39 @@ public:
         m_read_head = Mask2(m_read_head + sizeof(ElemT));
     }
 
+    // Copies as many elements of `values` as fit and returns how many were copied. Wraps around the end of the
+    // buffer as needed; elements must evenly divide the buffer size.
+    template <typename ElemT>
+    size_t Write(std::span<const ElemT> values)
+    {
+        assert(m_buffer.size() % sizeof(ElemT) == 0);
+        const size_t count = std::min(values.size(), GetWritableElements<ElemT>());
+        CopyIn(Mask(m_write_head), values.data(), count * sizeof(ElemT));
+        m_write_head = Mask2(m_write_head + count * sizeof(ElemT));
+        return count;
+    }
+
+    // Copies as many elements into `values` as are readable and returns how many were copied. Wraps around the end of
+    // the buffer as needed; elements must evenly divide the buffer size.
+    template <typename ElemT>
+    size_t Read(std::span<ElemT> values)
+    {
+        assert(m_buffer.size() % sizeof(ElemT) == 0);
+        const size_t count = std::min(values.size(), GetReadableElements<ElemT>());
+        CopyOut(Mask(m_read_head), values.data(), count * sizeof(ElemT));
+        m_read_head = Mask2(m_read_head + count * sizeof(ElemT));
+        return count;
+    }
+
+    // Without a mirrored buffer, `count` must evenly divide the buffer and every write must have the same `count`, so
+    // that spans never run past the end of the buffer. A mirrored buffer takes any `count` that fits.
     template <typename ElemT>
     std::span<ElemT> UncheckedPrepareWrite(size_t count)
     {
         // count must be an integer divisor of the buffer size
-        assert((m_buffer.size() / sizeof(ElemT)) % count == 0);
+        assert(m_mirrored || (m_buffer.size() / sizeof(ElemT)) % count == 0);
         // write must start at the end of a prior `count`-long write
-        assert((m_write_head / sizeof(ElemT)) % count == 0);
+        assert(m_mirrored || (m_write_head / sizeof(ElemT)) % count == 0);
         // must have space for `count` elements
         assert(GetWritableElements<ElemT>() >= count);
         return {(ElemT*)GetWritePtr(), count};
@@ -191,17 +253,18 @@ public:
     template <typename ElemT>
     void UncheckedFinishWrite(size_t count)
     {
-        assert(m_write_head % count == 0);
+        assert(m_mirrored || m_write_head % count == 0);
         m_write_head = Mask2(m_write_head + count * sizeof(ElemT));
     }
 
+    // Same constraints on `count` as `UncheckedPrepareWrite`.
     template <typename ElemT>
     std::span<ElemT> UncheckedPrepareRead(size_t count)
     {
         // count must be an integer divisor of the buffer size
-        assert((m_buffer.size() / sizeof(ElemT)) % count == 0);
+        assert(m_mirrored || (m_buffer.size() / sizeof(ElemT)) % count == 0);
         // read must start at the end of a prior `count`-long read
-        assert((m_read_head / sizeof(ElemT)) % count == 0);
+        assert(m_mirrored || (m_read_head / sizeof(ElemT)) % count == 0);
         // must have `count` elements
         assert(GetReadableElements<ElemT>() >= count);
         return {(ElemT*)GetReadPtr(), count};
@@ -210,13 +273,14 @@ public:
     template <typename ElemT>
     void UncheckedFinishRead(size_t count)
     {
-        assert(m_read_head % count == 0);
+        assert(m_mirrored || m_read_head % count == 0);
         m_read_head = Mask2(m_read_head + count * sizeof(ElemT));
     }
 
     size_t GetReadableBytes() const
     {
-        return Mask(m_write_head - m_read_head);
+        // Heads wrap at twice the buffer size so that a full buffer can be told apart from an empty one
+        return Mask2(m_write_head - m_read_head);
     }
 
     size_t GetWritableBytes() const
@@ -236,7 +300,32 @@ public:
         return GetWritableBytes() / sizeof(ElemT);
     }
 
+    size_t GetByteLength() const
+    {
+        return m_buffer.size();
+    }
+
+    // True if spans of any length can be prepared, see `GenericBuffer::InitMirrored`.
+    bool IsMirrored() const
+    {
+        return m_mirrored;
+    }
+
 private:
+    void CopyIn(size_t offset, const void* src, size_t size)
+    {
+        const size_t first = std::min(size, m_buffer.size() - offset);
+        memcpy(m_buffer.data() + offset, src, first);
+        memcpy(m_buffer.data(), (const uint8_t*)src + first, size - first);
+    }
+
+    void CopyOut(size_t offset, void* dst, size_t size) const
+    {
+        const size_t first = std::min(size, m_buffer.size() - offset);
+        memcpy(dst, m_buffer.data() + offset, first);
+        memcpy((uint8_t*)dst + first, m_buffer.data(), size - first);
+    }
+
     uint8_t* GetWritePtr()
     {
         return m_buffer.data() + Mask(m_write_head);
@@ -259,6 +348,7 @@ private:
 
 private:
     std::span<uint8_t>  m_buffer;
+    bool                m_mirrored   = false;
     std::atomic<size_t> m_read_head  = 0;
     std::atomic<size_t> m_write_head = 0;
 };
@@ -24,6 +24,21 @@ bool ParseRomsetName(std::string_view name, Romset& romset);
 
 std::span<const char*> GetParsableRomsetNames();
 
+// Groups romsets by the hardware differences the emulator core cares about. The core specializes its inner loop for
+// each of these.
+enum class RomsetFamily {
+    // SC-55mk2, SC-55st, SC-155mk2: main MCU with a sub MCU handling MIDI input
+    MK2,
+    // SC-55, SC-155, CM-300/SCC-1
+    MK1,
+    // SCB-55, RLP-3237: no sub MCU
+    SCB55,
+    // JV-880
+    JV880,
+};
+
+RomsetFamily GetRomsetFamily(Romset romset);
+
 // Symbolic name for the various roms used by the emulator.
 enum class RomLocation
 {
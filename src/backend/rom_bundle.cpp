@@ -0,0 +1,255 @@
+#include "rom_bundle.h"
+#include "emu.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+extern "C"
+{
+#include "sha/sha.h"
+}
+
+static constexpr char ROM_BUNDLE_MAGIC[8] = {'N', 'S', 'C', '5', '5', 'R', 'O', 'M'};
+
+// Covers the page size of every supported platform, and the 64K allocation granularity on Windows.
+static constexpr uint64_t ROM_BUNDLE_ALIGNMENT = 0x10000;
+
+// Fields are stored as their in-memory bytes, like emulator states.
+struct RomBundleSection
+{
+    // Both are 0 if the romset doesn't have this rom.
+    uint64_t offset;
+    uint64_t size;
+    uint8_t  source_digest[SHA256HashSize];
+};
+
+struct RomBundleHeader
+{
+    char             magic[8];
+    uint32_t         version;
+    uint32_t         romset;
+    RomBundleSection sections[ROMLOCATION_COUNT];
+};
+
+static_assert(sizeof(RomBundleHeader) == 16 + ROMLOCATION_COUNT * sizeof(RomBundleSection), "header has padding");
+
+static uint64_t RomBundleAlign(uint64_t offset)
+{
+    return (offset + ROM_BUNDLE_ALIGNMENT - 1) & ~(ROM_BUNDLE_ALIGNMENT - 1);
+}
+
+static bool HashRomFile(const std::filesystem::path& filename, uint8_t (&digest)[SHA256HashSize])
+{
+    MappedFile file;
+    if (!file.Open(filename))
+    {
+        return false;
+    }
+
+    const std::span<const uint8_t> data = file.GetData();
+
+    SHA256Context ctx;
+    SHA256Reset(&ctx);
+    SHA256Input(&ctx, data.data(), (unsigned int)data.size());
+    SHA256Result(&ctx, digest);
+    return true;
+}
+
+bool WriteRomBundle(const std::filesystem::path& filename, Romset romset, const AllRomsetInfo& all_info)
+{
+    const RomsetInfo& info = all_info.romsets[(size_t)romset];
+
+    RomBundleHeader header{};
+    memcpy(header.magic, ROM_BUNDLE_MAGIC, sizeof(ROM_BUNDLE_MAGIC));
+    header.version = ROM_BUNDLE_VERSION;
+    header.romset  = (uint32_t)romset;
+
+    uint64_t offset = RomBundleAlign(sizeof(RomBundleHeader));
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        const RomLocation              location = (RomLocation)i;
+        const std::span<const uint8_t> data     = info.GetRomData(location);
+        if (data.empty())
+        {
+            continue;
+        }
+
+        RomBundleSection& section = header.sections[i];
+        if (!HashRomFile(info.rom_paths[i], section.source_digest))
+        {
+            fprintf(stderr, "Failed to read rom `%s`\n", info.rom_paths[i].generic_string().c_str());
+            return false;
+        }
+
+        if (!IsKnownRomDigest(romset, location, section.source_digest))
+        {
+            fprintf(stderr,
+                    "`%s` is not a known %s rom for %s\n",
+                    info.rom_paths[i].generic_string().c_str(),
+                    ToCString(location),
+                    RomsetName(romset));
+            return false;
+        }
+
+        const size_t buffer_size = EMU_GetRomBufferSize(location);
+        if (data.size() > buffer_size)
+        {
+            fprintf(stderr, "Rom for %s is too large; max size is %d bytes\n", ToCString(location), (int)buffer_size);
+            return false;
+        }
+
+        // ROM2 reads are masked by its size, so padding it would change what the emulator sees
+        section.offset = offset;
+        section.size   = location == RomLocation::ROM2 ? data.size() : buffer_size;
+        offset         = RomBundleAlign(offset + section.size);
+    }
+
+    // Written under a temporary name so that a partial bundle is never picked up
+    std::filesystem::path temp_filename = filename;
+    temp_filename += ".tmp";
+
+    {
+        std::ofstream output(temp_filename, std::ios::binary | std::ios::trunc);
+        if (!output)
+        {
+            fprintf(stderr, "Failed to open `%s` for writing\n", temp_filename.generic_string().c_str());
+            return false;
+        }
+
+        output.write((const char*)&header, sizeof(header));
+
+        const std::vector<char> zeros(ROM_BUNDLE_ALIGNMENT, 0);
+        uint64_t                position = sizeof(header);
+        auto pad_to = [&](uint64_t target) {
+            while (position < target)
+            {
+                const uint64_t count = std::min<uint64_t>(target - position, zeros.size());
+                output.write(zeros.data(), (std::streamsize)count);
+                position += count;
+            }
+        };
+
+        for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+        {
+            const RomBundleSection& section = header.sections[i];
+            if (section.size == 0)
+            {
+                continue;
+            }
+
+            const std::span<const uint8_t> data = info.GetRomData((RomLocation)i);
+            pad_to(section.offset);
+            output.write((const char*)data.data(), (std::streamsize)data.size());
+            position += data.size();
+            pad_to(section.offset + section.size);
+        }
+
+        if (!output.good())
+        {
+            fprintf(stderr, "Failed to write `%s`\n", temp_filename.generic_string().c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_filename, filename, ec);
+    if (ec)
+    {
+        fprintf(stderr, "Failed to write `%s`: %s\n", filename.generic_string().c_str(), ec.message().c_str());
+        std::filesystem::remove(temp_filename, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool LoadRomBundle(const std::filesystem::path& filename, AllRomsetInfo& all_info, Romset& romset)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(filename))
+    {
+        fprintf(stderr, "Failed to map rom bundle `%s`\n", filename.generic_string().c_str());
+        return false;
+    }
+
+    const std::span<const uint8_t> data = file->GetData();
+
+    RomBundleHeader header;
+    if (data.size() < sizeof(header))
+    {
+        fprintf(stderr, "`%s` is not a rom bundle\n", filename.generic_string().c_str());
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (memcmp(header.magic, ROM_BUNDLE_MAGIC, sizeof(ROM_BUNDLE_MAGIC)) != 0)
+    {
+        fprintf(stderr, "`%s` is not a rom bundle\n", filename.generic_string().c_str());
+        return false;
+    }
+
+    if (header.version != ROM_BUNDLE_VERSION)
+    {
+        fprintf(stderr,
+                "Rom bundle `%s` has version %u, expected %u; recreate it with nuked-sc55-bundle\n",
+                filename.generic_string().c_str(),
+                header.version,
+                ROM_BUNDLE_VERSION);
+        return false;
+    }
+
+    if (header.romset >= ROMSET_COUNT)
+    {
+        fprintf(stderr, "Rom bundle `%s` has an invalid romset\n", filename.generic_string().c_str());
+        return false;
+    }
+
+    // Validate everything before touching `all_info` so that a bad bundle doesn't leave a partial romset behind
+    const Romset bundle_romset = (Romset)header.romset;
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        const RomBundleSection& section = header.sections[i];
+        if (section.size == 0)
+        {
+            continue;
+        }
+
+        if (section.offset % ROM_BUNDLE_ALIGNMENT != 0 || section.offset > data.size() ||
+            section.size > data.size() - section.offset)
+        {
+            fprintf(stderr,
+                    "Rom bundle `%s` is truncated or corrupt at %s\n",
+                    filename.generic_string().c_str(),
+                    ToCString((RomLocation)i));
+            return false;
+        }
+
+        if (!IsKnownRomDigest(bundle_romset, (RomLocation)i, section.source_digest))
+        {
+            fprintf(stderr,
+                    "Rom bundle `%s` has an unknown %s rom\n",
+                    filename.generic_string().c_str(),
+                    ToCString((RomLocation)i));
+            return false;
+        }
+    }
+
+    RomsetInfo& info = all_info.romsets[(size_t)bundle_romset];
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        const RomBundleSection& section = header.sections[i];
+        if (section.size == 0)
+        {
+            continue;
+        }
+
+        info.rom_paths[i]     = filename;
+        info.rom_data[i]      = {};
+        info.rom_maps[i].file = file;
+        info.rom_maps[i].data = data.subspan((size_t)section.offset, (size_t)section.size);
+    }
+
+    romset = bundle_romset;
+    return true;
+}
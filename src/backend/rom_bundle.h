@@ -0,0 +1,23 @@
+#pragma once
+
+#include "rom_io.h"
+#include <filesystem>
+
+// A rom bundle holds every rom of one romset in a single file, in the form a rom image uses them: waveroms are already
+// unscrambled and roms are zero-padded to the size the emulator reads. Each rom starts on a page boundary so that a
+// mapped bundle can be used as-is. The header records the SHA-256 of the rom file each section was built from.
+
+// Version of the bundle format. Bundles with a different version are rejected.
+constexpr uint32_t ROM_BUNDLE_VERSION = 1;
+
+// Writes the roms of `romset` to a bundle at `filename`. `LoadRomset` must have been called for `romset` first. Each
+// rom's `rom_paths` entry is hashed to identify it, and must be a known dump.
+//
+// Returns false and prints the reason to stderr on failure.
+bool WriteRomBundle(const std::filesystem::path& filename, Romset romset, const AllRomsetInfo& all_info);
+
+// Maps the bundle at `filename` and points `rom_maps` for the romset it contains at its sections. `rom_paths` for those
+// roms are set to `filename`, and the romset is written to `romset`. Calling `LoadRomset` afterwards is not required.
+//
+// Returns false and prints the reason to stderr on failure.
+bool LoadRomBundle(const std::filesystem::path& filename, AllRomsetInfo& all_info, Romset& romset);
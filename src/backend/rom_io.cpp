@@ -1,6 +1,14 @@
 #include "rom_io.h"
 #include "cast.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <map>
+#include <thread>
 
 extern "C"
 {
@@ -454,9 +462,183 @@ static constexpr KnownHash ROM_HASHES[] = {
 // clang-format on
 
 
+// Every known rom is a power of two in size, from the 4KB sub mcu rom up. Files that aren't can be rejected without
+// reading them.
+constexpr uintmax_t ROM_MIN_SIZE = 4 * 1024;
+constexpr uintmax_t ROM_MAX_SIZE = 4 * 1024 * 1024;
+
+static bool IsPossibleRomSize(uintmax_t size)
+{
+    return size >= ROM_MIN_SIZE && size <= ROM_MAX_SIZE && std::has_single_bit(size);
+}
+
+struct RomHashCacheEntry
+{
+    SHA256Digest digest;
+    uintmax_t    size;
+    // Raw `last_write_time`, only comparable on the machine that wrote it
+    int64_t      mtime;
+};
+
+// Indexed by canonical path
+using RomHashCache = std::map<std::string, RomHashCacheEntry>;
+
+// Cache files hold one line per file: the digest in hex, the size, the modification time and the path.
+static void LoadRomHashCache(const std::filesystem::path& filename, RomHashCache& cache)
+{
+    std::ifstream input(filename);
+
+    std::string line;
+    while (std::getline(input, line))
+    {
+        char     hex[2 * SHA256HashSize + 1];
+        uint64_t size       = 0;
+        int64_t  mtime      = 0;
+        int      path_start = 0;
+        if (sscanf(line.c_str(), "%64s %" SCNu64 " %" SCNd64 " %n", hex, &size, &mtime, &path_start) != 3 ||
+            path_start == 0 || strlen(hex) != 2 * SHA256HashSize ||
+            strspn(hex, "0123456789abcdef") != 2 * SHA256HashSize)
+        {
+            // Lines this version doesn't understand are dropped when the cache is written back
+            continue;
+        }
+
+        RomHashCacheEntry entry;
+        for (size_t i = 0; i < SHA256HashSize; ++i)
+        {
+            entry.digest[i] = (uint8_t)((HexValue(hex[2 * i]) << 4) | HexValue(hex[2 * i + 1]));
+        }
+        entry.size  = size;
+        entry.mtime = mtime;
+        cache[line.substr((size_t)path_start)] = entry;
+    }
+}
+
+static void SaveRomHashCache(const std::filesystem::path& filename, const RomHashCache& cache)
+{
+    // Write to a temporary file first so that another process reading the cache never sees a partial one
+    std::filesystem::path temp_filename = filename;
+    temp_filename += ".tmp";
+
+    FILE* output = fopen(temp_filename.string().c_str(), "w");
+    if (!output)
+    {
+        fprintf(stderr, "Failed to write rom hash cache `%s`\n", temp_filename.generic_string().c_str());
+        return;
+    }
+
+    for (const auto& [path, entry] : cache)
+    {
+        for (uint8_t byte : entry.digest)
+        {
+            fprintf(output, "%02x", byte);
+        }
+        fprintf(output, " %" PRIu64 " %" PRId64 " %s\n", (uint64_t)entry.size, entry.mtime, path.c_str());
+    }
+
+    const bool ok = fclose(output) == 0;
+
+    std::error_code ec;
+    if (ok)
+    {
+        std::filesystem::rename(temp_filename, filename, ec);
+    }
+    if (!ok || ec)
+    {
+        fprintf(stderr, "Failed to write rom hash cache `%s`\n", filename.generic_string().c_str());
+        std::filesystem::remove(temp_filename, ec);
+    }
+}
+
+// Returns true if `digest` belongs to a rom whose data the caller wants loaded.
+static bool IsDesiredDigest(const SHA256Digest& digest, const RomLocationSet* desired)
+{
+    if (!desired)
+    {
+        return false;
+    }
+
+    for (const auto& known : ROM_HASHES)
+    {
+        if (known.hash == digest && (*desired)[(size_t)known.location])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct RomCandidate
+{
+    std::filesystem::path path;
+    std::string           cache_key;
+    uintmax_t             size  = 0;
+    int64_t               mtime = 0;
+
+    bool         hashed = false;
+    SHA256Digest digest{};
+    // Only kept for desired roms, so they don't have to be read again
+    std::vector<uint8_t> data;
+};
+
+// Reads and hashes every candidate that isn't already `hashed`, on a few threads.
+static void HashRomCandidates(std::vector<RomCandidate>& candidates, const RomLocationSet* desired)
+{
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (!candidates[i].hashed)
+        {
+            pending.push_back(i);
+        }
+    }
+
+    // Reading is usually the slow part, and a handful of threads is enough to keep a disk busy
+    constexpr size_t max_threads = 4;
+    const size_t     thread_count =
+        std::min({pending.size(), max_threads, (size_t)std::max(1u, std::thread::hardware_concurrency())});
+
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        std::vector<uint8_t> buffer;
+        for (size_t i = next++; i < pending.size(); i = next++)
+        {
+            RomCandidate& candidate = candidates[pending[i]];
+            if (!ReadAllBytes(candidate.path, buffer))
+            {
+                continue;
+            }
+
+            SHA256Context ctx;
+            SHA256Reset(&ctx);
+            SHA256Input(&ctx, buffer.data(), (unsigned int)buffer.size());
+            SHA256Result(&ctx, candidate.digest.data());
+            candidate.hashed = true;
+
+            if (IsDesiredDigest(candidate.digest, desired))
+            {
+                candidate.data = std::move(buffer);
+                buffer         = {};
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
 bool DetectRomsetsByHash(const std::filesystem::path& base_path,
-                             AllRomsetInfo&           all_info,
-                             RomLocationSet*          desired)
+                         AllRomsetInfo&               all_info,
+                         RomLocationSet*              desired,
+                         const std::filesystem::path& hash_cache)
 {
     std::error_code ec;
 
@@ -468,7 +650,13 @@ bool DetectRomsetsByHash(const std::filesystem::path& base_path,
         return false;
     }
 
-    std::vector<uint8_t> buffer;
+    RomHashCache cache;
+    if (!hash_cache.empty())
+    {
+        LoadRomHashCache(hash_cache, cache);
+    }
+
+    std::vector<RomCandidate> candidates;
 
     while (dir_iter != std::filesystem::directory_iterator{})
     {
@@ -482,77 +670,107 @@ bool DetectRomsetsByHash(const std::filesystem::path& base_path,
             return false;
         }
 
-        if (!is_file)
+        if (is_file)
         {
-            dir_iter.increment(ec);
+            const uintmax_t file_size = dir_iter->file_size(ec);
             if (ec)
             {
-                fprintf(stderr, "Failed to get next file: %s\n", ec.message().c_str());
+                fprintf(stderr,
+                        "Failed to get file size of `%s`: %s\n",
+                        dir_iter->path().generic_string().c_str(),
+                        ec.message().c_str());
                 return false;
             }
-            continue;
+
+            if (IsPossibleRomSize(file_size))
+            {
+                RomCandidate& candidate = candidates.emplace_back();
+                candidate.path          = dir_iter->path();
+                candidate.size          = file_size;
+
+                if (!hash_cache.empty())
+                {
+                    // A file whose modification time can't be read is simply hashed every time
+                    const auto            mtime = dir_iter->last_write_time(ec);
+                    std::filesystem::path canonical;
+                    if (!ec)
+                    {
+                        canonical = std::filesystem::canonical(candidate.path, ec);
+                    }
+                    if (!ec)
+                    {
+                        candidate.cache_key = canonical.generic_string();
+                        candidate.mtime     = (int64_t)mtime.time_since_epoch().count();
+
+                        const auto cached = cache.find(candidate.cache_key);
+                        if (cached != cache.end() && cached->second.size == candidate.size &&
+                            cached->second.mtime == candidate.mtime)
+                        {
+                            candidate.digest = cached->second.digest;
+                            candidate.hashed = true;
+                        }
+                    }
+                    ec.clear();
+                }
+            }
         }
 
-        const uintmax_t file_size = dir_iter->file_size(ec);
+        dir_iter.increment(ec);
         if (ec)
         {
-            fprintf(stderr,
-                    "Failed to get file size of `%s`: %s\n",
-                    dir_iter->path().generic_string().c_str(),
-                    ec.message().c_str());
+            fprintf(stderr, "Failed to get next file: %s\n", ec.message().c_str());
             return false;
         }
+    }
+
+    // Entries of a good cache match every candidate, so a changed cache must have been stale or incomplete
+    bool cache_changed = false;
+    for (const RomCandidate& candidate : candidates)
+    {
+        cache_changed = cache_changed || (!candidate.hashed && !candidate.cache_key.empty());
+    }
+
+    HashRomCandidates(candidates, desired);
 
-        // Skip files larger than 4MB
-        if (file_size > (uintmax_t)(4 * 1024 * 1024))
+    for (RomCandidate& candidate : candidates)
+    {
+        if (!candidate.hashed)
         {
-            dir_iter.increment(ec);
-            if (ec)
-            {
-                fprintf(stderr, "Failed to get next file: %s\n", ec.message().c_str());
-                return false;
-            }
             continue;
         }
 
-        ReadAllBytes(dir_iter->path(), buffer);
-
-        SHA256Context ctx;
-        SHA256Digest  digest_bytes;
-
-        SHA256Reset(&ctx);
-        SHA256Input(&ctx, buffer.data(), buffer.size());
-        SHA256Result(&ctx, digest_bytes.data());
+        if (!candidate.cache_key.empty())
+        {
+            cache[candidate.cache_key] = {candidate.digest, candidate.size, candidate.mtime};
+        }
 
         for (const auto& known : ROM_HASHES)
         {
-            if (known.hash == digest_bytes && !all_info.romsets[(size_t)known.romset].HasRom(known.location))
+            if (known.hash == candidate.digest && !all_info.romsets[(size_t)known.romset].HasRom(known.location))
             {
-                all_info.romsets[(size_t)known.romset].rom_paths[(size_t)known.location] = dir_iter->path();
+                all_info.romsets[(size_t)known.romset].rom_paths[(size_t)known.location] = candidate.path;
 
-                if (desired && (*desired)[(size_t)known.location])
+                // Roms found through the cache weren't read, and are loaded from their path later
+                if (desired && (*desired)[(size_t)known.location] && !candidate.data.empty())
                 {
                     auto& rom_data = all_info.romsets[(size_t)known.romset].rom_data[(size_t)known.location];
                     if (IsWaverom(known.location))
                     {
-                        rom_data.resize(buffer.size());
-                        unscramble(rom_data.data(), buffer.data(), (int)buffer.size());
+                        rom_data.resize(candidate.data.size());
+                        unscramble(candidate.data.data(), rom_data.data(), (int)candidate.data.size());
                     }
                     else
                     {
-                        rom_data = std::move(buffer);
-                        buffer   = {};
+                        rom_data = candidate.data;
                     }
                 }
             }
         }
+    }
 
-        dir_iter.increment(ec);
-        if (ec)
-        {
-            fprintf(stderr, "Failed to get next file: %s\n", ec.message().c_str());
-            return false;
-        }
+    if (cache_changed)
+    {
+        SaveRomHashCache(hash_cache, cache);
     }
 
     return true;
@@ -662,11 +880,24 @@ void RomsetInfo::PurgeRomData()
     {
         vec = {};
     }
+    for (auto& map : rom_maps)
+    {
+        map = {};
+    }
 }
 
 bool RomsetInfo::HasRom(RomLocation location) const
 {
-    return !(rom_paths[(size_t)location].empty() && rom_data[(size_t)location].empty());
+    return !(rom_paths[(size_t)location].empty() && GetRomData(location).empty());
+}
+
+std::span<const uint8_t> RomsetInfo::GetRomData(RomLocation location) const
+{
+    if (rom_maps[(size_t)location].file)
+    {
+        return rom_maps[(size_t)location].data;
+    }
+    return rom_data[(size_t)location];
 }
 
 void AllRomsetInfo::PurgeRomData()
@@ -690,7 +921,7 @@ bool LoadRomset(Romset romset, AllRomsetInfo& all_info, RomLoadStatusSet* loaded
     {
         const RomLocation location = (RomLocation)i;
 
-        if (info.rom_paths[i].empty() && info.rom_data[i].empty())
+        if (info.rom_paths[i].empty() && info.GetRomData(location).empty())
         {
             if (loaded)
             {
@@ -698,27 +929,45 @@ bool LoadRomset(Romset romset, AllRomsetInfo& all_info, RomLoadStatusSet* loaded
             }
             continue;
         }
-        else if (!info.rom_paths[i].empty() && info.rom_data[i].empty())
+        else if (!info.rom_paths[i].empty() && info.GetRomData(location).empty())
         {
-            if (!ReadAllBytes(info.rom_paths[i], on_demand_buffer))
+            // Mapping only needs the pages that are actually touched, and program roms can be used as they are
+            auto map = std::make_shared<MappedFile>();
+            if (map->Open(info.rom_paths[i]))
             {
-                all_loaded = false;
-                if (loaded)
+                if (IsWaverom(location))
                 {
-                    (*loaded)[i] = RomLoadStatus::Failed;
+                    const std::span<const uint8_t> source = map->GetData();
+                    info.rom_data[i].resize(source.size());
+                    unscramble(source.data(), info.rom_data[i].data(), (int)source.size());
+                }
+                else
+                {
+                    info.rom_maps[i].data = map->GetData();
+                    info.rom_maps[i].file = std::move(map);
                 }
-                continue;
             }
-
-            if (IsWaverom(location))
+            else if (ReadAllBytes(info.rom_paths[i], on_demand_buffer))
             {
-                info.rom_data[i].resize(on_demand_buffer.size());
-                unscramble(on_demand_buffer.data(), info.rom_data[i].data(), (int)on_demand_buffer.size());
+                if (IsWaverom(location))
+                {
+                    info.rom_data[i].resize(on_demand_buffer.size());
+                    unscramble(on_demand_buffer.data(), info.rom_data[i].data(), (int)on_demand_buffer.size());
+                }
+                else
+                {
+                    info.rom_data[i] = std::move(on_demand_buffer);
+                    on_demand_buffer = {};
+                }
             }
             else
             {
-                info.rom_data[i] = std::move(on_demand_buffer);
-                on_demand_buffer = {};
+                all_loaded = false;
+                if (loaded)
+                {
+                    (*loaded)[i] = RomLoadStatus::Failed;
+                }
+                continue;
             }
 
             if (loaded)
@@ -726,7 +975,7 @@ bool LoadRomset(Romset romset, AllRomsetInfo& all_info, RomLoadStatusSet* loaded
                 (*loaded)[i] = RomLoadStatus::Loaded;
             }
         }
-        else if (!info.rom_data[i].empty())
+        else if (!info.GetRomData(location).empty())
         {
             if (loaded)
             {
@@ -738,6 +987,19 @@ bool LoadRomset(Romset romset, AllRomsetInfo& all_info, RomLoadStatusSet* loaded
     return all_loaded;
 }
 
+bool IsKnownRomDigest(Romset romset, RomLocation location, std::span<const uint8_t> digest)
+{
+    for (const KnownHash& known : ROM_HASHES)
+    {
+        if (known.romset == romset && known.location == location &&
+            std::equal(digest.begin(), digest.end(), known.hash.begin(), known.hash.end()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 const char* ToCString(RomLoadStatus status)
 {
     switch (status)
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "mapped_file.h"
 #include "rom.h"
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <vector>
 
 enum class RomLoadStatus
@@ -41,11 +44,18 @@ struct RomsetInfo
     std::filesystem::path rom_paths[ROMLOCATION_COUNT]{};
     std::vector<uint8_t>  rom_data[ROMLOCATION_COUNT]{};
 
-    // Release all rom_data for all roms in this romset.
+    // Program roms and roms from a bundle are mapped instead of read into `rom_data`, so that rom images can point at
+    // the file contents directly. At most one of `rom_data` and `rom_maps` is populated for a location.
+    MappedRange rom_maps[ROMLOCATION_COUNT]{};
+
+    // Release all rom_data and rom_maps for all roms in this romset.
     void PurgeRomData();
 
-    // Returns true if at least one of `rom_path` or `rom_data` is populated for `location`.
+    // Returns true if at least one of `rom_path`, `rom_data` or `rom_maps` is populated for `location`.
     bool HasRom(RomLocation location) const;
+
+    // Returns the loaded contents of the rom for `location`, from either `rom_data` or `rom_maps`.
+    std::span<const uint8_t> GetRomData(RomLocation location) const;
 };
 
 // Contains RomsetInfo for all supported romsets.
@@ -54,7 +64,7 @@ struct AllRomsetInfo
     // Array indexed by Romset
     RomsetInfo romsets[ROMSET_COUNT]{};
 
-    // Release all rom_data for all romsets.
+    // Release all rom_data and rom_maps for all romsets.
     void PurgeRomData();
 };
 
@@ -75,9 +85,13 @@ bool DetectRomsetsByFilename(const std::filesystem::path& base_path,
 //
 // If `desired` is non-null, this function will use it as a hint to determine what hashes to consider. This function may
 // also load `rom_data` for desired roms.
+//
+// Only files that have the size of a rom are read. They are hashed on a few threads. If `hash_cache` is non-empty,
+// digests are stored in that file and reused for files whose size and modification time haven't changed.
 bool DetectRomsetsByHash(const std::filesystem::path& base_path,
                          AllRomsetInfo&               all_info,
-                         RomLocationSet*              desired = nullptr);
+                         RomLocationSet*              desired    = nullptr,
+                         const std::filesystem::path& hash_cache = {});
 
 // Returns true if `all_info` contains all the files required to load `romset`. Missing roms will be reported in
 // `missing`.
@@ -88,11 +102,15 @@ bool IsCompleteRomset(const AllRomsetInfo& all_info, Romset romset, RomCompletio
 bool PickCompleteRomset(const AllRomsetInfo& all_info, Romset& out_romset);
 
 // For each `rom` in `romset`, this function loads the file referenced by `all_info.romsets[romset].rom_paths[rom]` into
-// the corresponding `rom_data`. Waveroms will be unscrambled at this point.
+// the corresponding `rom_data`. Waveroms will be unscrambled at this point. Other roms are memory mapped into
+// `rom_maps` instead when possible.
 //
-// `rom` will only be loaded when `rom_data` is empty and `rom_path` is non-empty.
+// `rom` will only be loaded when `rom_data` and `rom_maps` are empty and `rom_path` is non-empty.
 //
 // To automatically determine rom_paths, call `DetectRomsetsByHash` with a directory containing roms.
 //
 // Roms that were loaded successfully will be marked as true in `loaded`.
 bool LoadRomset(Romset romset, AllRomsetInfo& all_info, RomLoadStatusSet* loaded = nullptr);
+
+// Returns true if `digest` is the SHA-256 of a known dump of the rom for `location` in `romset`.
+bool IsKnownRomDigest(Romset romset, RomLocation location, std::span<const uint8_t> digest);
@@ -76,8 +76,23 @@ enum {
     SM_DEV_TIMER_CTRL = 0x1f
 };
 
+// How far past the mcu the sub mcu may run, in sub mcu cycles. About 256 instructions.
+static const uint64_t SM_RUN_AHEAD_CYCLES = 256 * 12 * 4;
+
+// Must be checked before the sub mcu does anything the mcu can observe, or reads anything the mcu can change. Returns
+// false while running ahead, which ends the run since the mcu hasn't gotten there yet.
+static inline bool SM_CanInteract(submcu_t& sm)
+{
+    if (!sm.speculating)
+        return true;
+    sm.interacted = true;
+    return false;
+}
+
 void SM_ErrorTrap(submcu_t& sm)
 {
+    if (!SM_CanInteract(sm))
+        return;
     fprintf(stderr, "%.4x\n", sm.pc);
 }
 
@@ -125,6 +140,8 @@ uint8_t SM_Read(submcu_t& sm, uint16_t address)
                 return ret;
             }
             case SM_DEV_P1_DATA:
+                if (!SM_CanInteract(sm))
+                    return 0xff;
                 return MCU_ReadP1(*sm.mcu);
             case SM_DEV_P1_DIR:
                 return sm.p1_dir;
@@ -144,7 +161,8 @@ uint8_t SM_Read(submcu_t& sm, uint16_t address)
     }
     else
     {
-        fprintf(stderr, "sm: unknown read %x\n", address);
+        if (SM_CanInteract(sm))
+            fprintf(stderr, "sm: unknown read %x\n", address);
         return 0;
     }
 }
@@ -162,7 +180,8 @@ void SM_Write(submcu_t& sm, uint16_t address, uint8_t data)
         switch (address)
         {
             case SM_DEV_P1_DATA:
-                MCU_WriteP1(*sm.mcu, data);
+                if (SM_CanInteract(sm))
+                    MCU_WriteP1(*sm.mcu, data);
                 break;
             case SM_DEV_P1_DIR:
                 sm.p1_dir = data;
@@ -192,7 +211,7 @@ void SM_Write(submcu_t& sm, uint16_t address, uint8_t data)
                 sm.device_mode[address] = data;
                 break;
         }
-        if (address == SM_DEV_UART3_MODE_STATUS || address == SM_DEV_UART3_CTRL)
+        if ((address == SM_DEV_UART3_MODE_STATUS || address == SM_DEV_UART3_CTRL) && SM_CanInteract(sm))
             MCU_GA_SetGAInt(*sm.mcu, 5, (sm.device_mode[SM_DEV_UART3_MODE_STATUS] & 0x80) != 0
                 && (sm.device_mode[SM_DEV_UART3_CTRL] & 0x20) == 0);
     }
@@ -204,12 +223,14 @@ void SM_Write(submcu_t& sm, uint16_t address, uint8_t data)
     }
     else
     {
-        fprintf(stderr, "sm: unknown write %x %x\n", address, data);
+        if (SM_CanInteract(sm))
+            fprintf(stderr, "sm: unknown write %x %x\n", address, data);
     }
 }
 
 void SM_SysWrite(submcu_t& sm, uint32_t address, uint8_t data)
 {
+    SM_Sync(sm);
     address &= 0xff;
     if (address < 0xc0)
     {
@@ -251,6 +272,7 @@ void SM_SysWrite(submcu_t& sm, uint32_t address, uint8_t data)
 
 uint8_t SM_SysRead(submcu_t& sm, uint32_t address)
 {
+    SM_Sync(sm);
     address &= 0xff;
     if (address < 0xc0)
     {
@@ -321,6 +343,7 @@ void SM_Reset(submcu_t& sm)
     sm.sr = 0;
     sm.cycles = 0;
     sm.sleep = 0;
+    SM_ResetSchedule(sm);
 }
 
 uint8_t SM_ReadAdvance(submcu_t& sm)
@@ -1420,7 +1443,12 @@ void SM_UpdateUART(submcu_t& sm)
 
     if ((sm.device_mode[SM_DEV_UART1_CTRL] & 4) == 0) // RX disabled
         return;
-    if (mcu.uart_write_ptr == mcu.uart_read_ptr) // no byte
+    if (sm.replaying)
+    {
+        if (sm.saved_uart_write_ptr == mcu.uart_read_ptr.load(std::memory_order_relaxed))
+            return;
+    }
+    else if (!MCU_HasUART(mcu)) // no byte
         return;
 
     if (sm.uart_rx_gotbyte)
@@ -1429,30 +1457,122 @@ void SM_UpdateUART(submcu_t& sm)
     if (sm.cycles < mcu.uart_rx_delay)
         return;
 
-    mcu.uart_rx_byte = mcu.uart_buffer[mcu.uart_read_ptr];
-    mcu.uart_read_ptr = (mcu.uart_read_ptr + 1) % uart_buffer_size;
+    if (!SM_CanInteract(sm))
+        return;
+
+    mcu.uart_rx_byte = MCU_PopUART(mcu);
     sm.uart_rx_gotbyte = 1;
     sm.device_mode[SM_DEV_INT_REQUEST] |= 0x40;
 
     mcu.uart_rx_delay = sm.cycles + 3000 * 4;
 }
 
-void SM_Update(submcu_t& sm, uint64_t cycles)
+static inline void SM_Step(submcu_t& sm)
 {
-    while (sm.cycles < cycles * 5)
+    SM_HandleInterrupt(sm);
+
+    if (!sm.sleep)
     {
-        SM_HandleInterrupt(sm);
+        uint8_t opcode = SM_ReadAdvance(sm);
 
-        if (!sm.sleep)
-        {
-            uint8_t opcode = SM_ReadAdvance(sm);
+        PROF_CountSMInstruction(sm.mcu->pc_profile, (uint16_t)(sm.pc - 1), opcode);
+
+        SM_Opcode_Table[opcode](sm, opcode);
+    }
+
+    sm.cycles += 12 * 4; // FIXME
+
+    SM_UpdateTimer(sm);
+    SM_UpdateUART(sm);
+}
+
+// Runs up to SM_RUN_AHEAD_CYCLES past where the sub mcu is now, which must be in step with the mcu. The run is undone
+// right away if the sub mcu reaches anything the mcu can see, and the sub mcu stays in step until it gets past that
+// point.
+static void SM_RunAhead(submcu_t& sm)
+{
+    sm.saved = sm;
+    sm.saved_uart_write_ptr = sm.mcu->uart_write_ptr.load(std::memory_order_relaxed);
+
+    const uint64_t limit = sm.cycles + SM_RUN_AHEAD_CYCLES;
+
+    sm.speculating = true;
+    sm.interacted = false;
+    while (sm.cycles < limit && !sm.interacted)
+    {
+        SM_Step(sm);
+    }
+    sm.speculating = false;
+
+    if (sm.interacted)
+    {
+        sm.run_ahead_blocked_until = sm.cycles + 1;
+        (submcu_state_t&)sm = sm.saved;
+    }
+    else
+    {
+        sm.ahead = true;
+    }
+}
+
+void SM_Sync(submcu_t& sm)
+{
+    if (!sm.ahead)
+        return;
+
+    (submcu_state_t&)sm = sm.saved;
+    sm.ahead = false;
+
+    sm.replaying = true;
+    while (sm.cycles < sm.sync_target)
+    {
+        SM_Step(sm);
+    }
+    sm.replaying = false;
+
+    // The mcu is busy with the sub mcu, so it's likely to come back soon. Stay in step for a while instead of
+    // throwing more work away.
+    sm.run_ahead_blocked_until = sm.cycles + SM_RUN_AHEAD_CYCLES;
+}
+
+void SM_ResetSchedule(submcu_t& sm)
+{
+    sm.ahead = false;
+    sm.speculating = false;
+    sm.replaying = false;
+    sm.sync_target = 0;
+    sm.run_ahead_blocked_until = 0;
+}
+
+void SM_Update(submcu_t& sm, uint64_t cycles)
+{
+    const uint64_t target = cycles * 5;
 
-            SM_Opcode_Table[opcode](sm, opcode);
+    if (sm.ahead)
+    {
+        if (sm.mcu->uart_write_ptr.load(std::memory_order_relaxed) != sm.saved_uart_write_ptr)
+        {
+            // Midi arrived after the run ahead saw that there was none
+            SM_Sync(sm);
+        }
+        else if (sm.cycles >= target)
+        {
+            sm.sync_target = target;
+            return;
+        }
+        else
+        {
+            // The mcu caught up without touching the sub mcu, so the run ahead stands
+            sm.ahead = false;
         }
+    }
 
-        sm.cycles += 12 * 4; // FIXME
-        
-        SM_UpdateTimer(sm);
-        SM_UpdateUART(sm);
+    while (sm.cycles < target)
+    {
+        SM_Step(sm);
     }
+    sm.sync_target = target;
+
+    if (sm.run_ahead && sm.cycles >= sm.run_ahead_blocked_until)
+        SM_RunAhead(sm);
 }
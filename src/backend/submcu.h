@@ -48,38 +48,69 @@ enum {
     SM_STATUS_N = 128
 };
 
-struct submcu_t {
+// Everything that makes up the state of the sub mcu, so that a run ahead can be undone by copying it back. Registers
+// and the peripherals SM_Update polls every step come first; the ram follows.
+struct submcu_state_t {
     uint16_t pc = 0;
     uint8_t a = 0;
     uint8_t x = 0;
     uint8_t y = 0;
     uint8_t s = 0;
     uint8_t sr = 0;
-    uint64_t cycles = 0;
     uint8_t sleep = 0;
+    uint64_t cycles = 0;
     mcu_t* mcu = nullptr;
-    uint8_t rom[4096]{};
+    const uint8_t* rom = nullptr; // ROMSM_SIZE bytes, owned by the emulator's rom image
 
-    uint8_t ram[128]{};
-    uint8_t shared_ram[192]{};
-    uint8_t access[0x18]{};
+    uint64_t timer_cycles = 0;
+    uint8_t timer_prescaler = 0;
+    uint8_t timer_counter = 0;
+
+    uint8_t uart_rx_gotbyte = 0;
+    uint8_t cts = 0;
 
     uint8_t p0_dir = 0;
     uint8_t p1_dir = 0;
 
     uint8_t device_mode[32]{};
-    uint8_t cts = 0;
 
-    uint64_t timer_cycles = 0;
-    uint8_t timer_prescaler = 0;
-    uint8_t timer_counter = 0;
+    uint8_t ram[128]{};
+    uint8_t shared_ram[192]{};
+    uint8_t access[0x18]{};
+};
 
-    uint8_t uart_rx_gotbyte = 0;
+// The sub mcu normally runs ahead of the mcu instead of alternating with it instruction by instruction. Only the two
+// chips' own state is involved until one of them touches the other, so a run ahead is kept as long as that doesn't
+// happen and is otherwise undone and replayed in step with the mcu. The result is the same as running in step.
+struct submcu_t : submcu_state_t {
+    // Run in step with the mcu when false.
+    bool run_ahead = true;
+
+    // The sub mcu is past `sync_target` and `saved` holds its state from when it was last in step.
+    bool ahead = false;
+    // `speculating` is set while running ahead. Reaching anything the mcu can see sets `interacted` and ends the run.
+    bool speculating = false;
+    bool interacted = false;
+    // Set while replaying an undone run ahead, which must see the uart queue as it was when the run started.
+    bool replaying = false;
+
+    // Where running in step would have left the sub mcu, in its own cycles.
+    uint64_t sync_target = 0;
+    // The sub mcu doesn't run ahead again until it reaches this many cycles.
+    uint64_t run_ahead_blocked_until = 0;
+
+    uint32_t saved_uart_write_ptr = 0;
+    submcu_state_t saved;
 };
 
 void SM_Init(submcu_t& sm, mcu_t& mcu);
 void SM_Reset(submcu_t& sm);
 void SM_Update(submcu_t& sm, uint64_t cycles);
+// Brings a sub mcu that ran ahead back in step with the mcu. Done automatically whenever the mcu accesses it; needed
+// before its state is read from outside.
+void SM_Sync(submcu_t& sm);
+// Forgets any run ahead, for when the state was replaced wholesale.
+void SM_ResetSchedule(submcu_t& sm);
 void SM_SysWrite(submcu_t& sm, uint32_t address, uint8_t data);
 uint8_t SM_SysRead(submcu_t& sm, uint32_t address);
 void SM_PostUART(submcu_t& sm, uint8_t data);
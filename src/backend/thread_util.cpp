@@ -0,0 +1,282 @@
+#include "thread_util.h"
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#endif
+
+#if defined(__linux__)
+// Parses a sysfs cpu list such as "0-3,8,10-11".
+static std::vector<size_t> TH_ParseCpuList(const std::string& list)
+{
+    std::vector<size_t> cpus;
+
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t first = 0;
+        size_t last  = 0;
+        int    used  = 0;
+        if (sscanf(list.c_str() + pos, "%zu-%zu%n", &first, &last, &used) != 2)
+        {
+            if (sscanf(list.c_str() + pos, "%zu%n", &first, &used) != 1)
+            {
+                break;
+            }
+            last = first;
+        }
+
+        for (size_t cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+
+        pos += (size_t)used;
+        if (pos < list.size() && list[pos] == ',')
+        {
+            ++pos;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return cpus;
+}
+
+// Returns the CPUs this process may run on, and for each one the lowest of those that share its physical core.
+static void TH_GetTopology(std::vector<size_t>& cpus, std::vector<size_t>& core_of)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return;
+    }
+
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    for (size_t cpu : cpus)
+    {
+        // Without topology information every cpu counts as its own core
+        size_t core = cpu;
+
+        std::ifstream siblings("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+        std::string   list;
+        if (std::getline(siblings, list))
+        {
+            for (size_t sibling : TH_ParseCpuList(list))
+            {
+                if (std::find(cpus.begin(), cpus.end(), sibling) != cpus.end())
+                {
+                    core = std::min(core, sibling);
+                }
+            }
+        }
+
+        core_of.push_back(core);
+    }
+}
+#elif defined(_WIN32)
+static void TH_GetTopology(std::vector<size_t>& cpus, std::vector<size_t>& core_of)
+{
+    // Only the first processor group is considered; thread affinity masks can't span groups anyway
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask  = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    {
+        return;
+    }
+
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!GetLogicalProcessorInformation(info.data(), &length))
+    {
+        info.clear();
+    }
+
+    for (size_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu)
+    {
+        const DWORD_PTR bit = (DWORD_PTR)1 << cpu;
+        if ((process_mask & bit) == 0)
+        {
+            continue;
+        }
+
+        size_t core = cpu;
+        for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& entry : info)
+        {
+            if (entry.Relationship == RelationProcessorCore && (entry.ProcessorMask & bit))
+            {
+                const DWORD_PTR usable = entry.ProcessorMask & process_mask;
+                for (size_t sibling = 0; sibling < cpu; ++sibling)
+                {
+                    if (usable & ((DWORD_PTR)1 << sibling))
+                    {
+                        core = sibling;
+                        break;
+                    }
+                }
+            }
+        }
+
+        cpus.push_back(cpu);
+        core_of.push_back(core);
+    }
+}
+#else
+// macOS doesn't let threads be pinned, so there is nothing to plan
+static void TH_GetTopology(std::vector<size_t>&, std::vector<size_t>&)
+{
+}
+#endif
+
+TH_AffinityPlan TH_PlanAffinity(size_t instance_count)
+{
+    TH_AffinityPlan plan;
+
+    std::vector<size_t> cpus;
+    std::vector<size_t> core_of;
+    TH_GetTopology(cpus, core_of);
+    if (cpus.empty() || instance_count == 0)
+    {
+        return plan;
+    }
+
+    // One cpu per physical core first, then their other hardware threads
+    std::vector<size_t> order;
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        if (core_of[i] == cpus[i])
+        {
+            order.push_back(cpus[i]);
+        }
+    }
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        if (core_of[i] != cpus[i])
+        {
+            order.push_back(cpus[i]);
+        }
+    }
+
+    for (size_t i = 0; i < instance_count; ++i)
+    {
+        plan.instance_cpus.push_back(order[i % order.size()]);
+    }
+
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        // Instances take the first cpu of every core before any other, so a core is in use iff its first cpu is
+        if (std::find(plan.instance_cpus.begin(), plan.instance_cpus.end(), core_of[i]) == plan.instance_cpus.end())
+        {
+            plan.other_cpus.push_back(cpus[i]);
+        }
+    }
+
+    if (plan.other_cpus.empty())
+    {
+        plan.other_cpus = cpus;
+    }
+
+    return plan;
+}
+
+size_t TH_CountCores()
+{
+    std::vector<size_t> cpus;
+    std::vector<size_t> core_of;
+    TH_GetTopology(cpus, core_of);
+
+    size_t cores = 0;
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        if (core_of[i] == cpus[i])
+        {
+            ++cores;
+        }
+    }
+
+    if (cores == 0)
+    {
+        cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    return cores;
+}
+
+bool TH_PinCurrentThread(std::span<const size_t> cpus)
+{
+    if (cpus.empty())
+    {
+        return false;
+    }
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (size_t cpu : cpus)
+    {
+        mask |= (DWORD_PTR)1 << cpu;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif
+}
+
+bool TH_SetCurrentThreadPolicy(ThreadPolicy policy)
+{
+    if (policy == ThreadPolicy::Default)
+    {
+        return true;
+    }
+
+#if defined(__linux__)
+    sched_param param{};
+    if (policy == ThreadPolicy::Throughput)
+    {
+        return pthread_setschedparam(pthread_self(), SCHED_BATCH, &param) == 0;
+    }
+    else
+    {
+        // Low enough to leave room for the audio server and kernel threads
+        param.sched_priority = sched_get_priority_min(SCHED_RR) + 10;
+        return pthread_setschedparam(pthread_self(), SCHED_RR, &param) == 0;
+    }
+#elif defined(__APPLE__)
+    // On Apple silicon these classes also steer the thread towards performance cores
+    const qos_class_t qos = policy == ThreadPolicy::Throughput ? QOS_CLASS_USER_INITIATED : QOS_CLASS_USER_INTERACTIVE;
+    return pthread_set_qos_class_self_np(qos, 0) == 0;
+#elif defined(_WIN32)
+    const int priority =
+        policy == ThreadPolicy::Throughput ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_TIME_CRITICAL;
+    return SetThreadPriority(GetCurrentThread(), priority) != 0;
+#else
+    return false;
+#endif
+}
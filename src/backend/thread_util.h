@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// How the OS should schedule a thread that runs an emulator or mixes its output.
+enum class ThreadPolicy
+{
+    // Leave the thread as the OS created it.
+    Default,
+    // Long running work where total throughput matters more than latency. Linux: SCHED_BATCH, macOS: user initiated
+    // QoS, Windows: above normal priority.
+    Throughput,
+    // Audio that must keep up with a device. Linux: SCHED_RR (needs CAP_SYS_NICE or an rtprio limit), macOS: user
+    // interactive QoS, Windows: time critical priority. A thread that never sleeps can starve the rest of the system.
+    Realtime,
+};
+
+// Placement of a frontend's threads on logical CPUs.
+struct TH_AffinityPlan
+{
+    // Logical CPU for each instance. Instances get distinct physical cores while there are enough, then the other
+    // hardware threads of those cores, then CPUs are shared.
+    std::vector<size_t> instance_cpus;
+    // CPUs for every other thread, like the mixer. These exclude the physical cores used by instances, including
+    // their other hardware threads, unless instances use every core.
+    std::vector<size_t> other_cpus;
+};
+
+// Plans where to run `instance_count` instances. Returns an empty plan if threads can't be pinned on this platform.
+TH_AffinityPlan TH_PlanAffinity(size_t instance_count);
+
+// Returns the number of physical cores this process may run on, or of logical CPUs if the topology isn't known.
+size_t TH_CountCores();
+
+// Restricts the calling thread to `cpus`. Memory the thread touches first afterwards is allocated on the NUMA node of
+// those CPUs. Returns false if pinning isn't supported or fails.
+bool TH_PinCurrentThread(std::span<const size_t> cpus);
+
+// Applies `policy` to the calling thread. Returns false if it isn't supported or the process lacks the privileges.
+bool TH_SetCurrentThreadPolicy(ThreadPolicy policy);
@@ -0,0 +1,776 @@
+#include "audio.h"
+#include "audio_kernel.h"
+#include "command_line.h"
+#include "config.h"
+#include "emu.h"
+#include "mcu.h"
+#include "mcu_timer.h"
+#include "path_util.h"
+#include "pcm.h"
+#include "resampler.h"
+#include "rom_io.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/rom_loader.h"
+#include "renderer/smf.h"
+#include "renderer/wav.h"
+
+// Frames per sample block, same as the renderer.
+constexpr size_t B_SAMPLE_BLOCK_SIZE = 1024;
+
+// Work done by each microbenchmark call. Large enough that the clock overhead doesn't matter.
+constexpr size_t B_MICRO_CALLS = 1'000'000;
+constexpr size_t B_MIX_SOURCES    = 4;
+constexpr size_t B_MIX_CALLS      = 20'000;
+constexpr size_t B_WAV_CALLS      = 2'000;
+constexpr size_t B_RESAMPLE_CALLS = 2'000;
+
+struct B_Parameters
+{
+    bool help    = false;
+    bool version = false;
+
+    std::filesystem::path rom_directory = std::filesystem::current_path();
+    std::vector<Romset>   romsets;
+    std::filesystem::path corpus_directory;
+    size_t                iterations = 1;
+};
+
+enum class B_ParseError
+{
+    Success,
+    UnexpectedEnd,
+    UnknownArgument,
+    RomDirectoryNotFound,
+    RomsetInvalid,
+    CorpusNotFound,
+    IterationsInvalid,
+};
+
+const char* B_ParseErrorStr(B_ParseError err)
+{
+    switch (err)
+    {
+    case B_ParseError::Success:
+        return "Success";
+    case B_ParseError::UnexpectedEnd:
+        return "Expected another argument";
+    case B_ParseError::UnknownArgument:
+        return "Unknown argument";
+    case B_ParseError::RomDirectoryNotFound:
+        return "Rom directory doesn't exist";
+    case B_ParseError::RomsetInvalid:
+        return "Romset invalid";
+    case B_ParseError::CorpusNotFound:
+        return "Corpus directory doesn't exist";
+    case B_ParseError::IterationsInvalid:
+        return "Iterations invalid (should be a number greater than 0)";
+    }
+    return "Unknown error";
+}
+
+B_ParseError B_ParseCommandLine(int argc, char* argv[], B_Parameters& result)
+{
+    CommandLineReader reader(argc, argv);
+
+    while (reader.Next())
+    {
+        if (reader.Any("-h", "--help", "-?"))
+        {
+            result.help = true;
+            return B_ParseError::Success;
+        }
+        else if (reader.Any("-v", "--version"))
+        {
+            result.version = true;
+            return B_ParseError::Success;
+        }
+        else if (reader.Any("-d", "--rom-directory"))
+        {
+            if (!reader.Next())
+            {
+                return B_ParseError::UnexpectedEnd;
+            }
+
+            result.rom_directory = reader.Arg();
+            if (!std::filesystem::exists(result.rom_directory))
+            {
+                return B_ParseError::RomDirectoryNotFound;
+            }
+        }
+        else if (reader.Any("--romset"))
+        {
+            if (!reader.Next())
+            {
+                return B_ParseError::UnexpectedEnd;
+            }
+
+            Romset romset;
+            if (!ParseRomsetName(reader.Arg(), romset))
+            {
+                return B_ParseError::RomsetInvalid;
+            }
+
+            if (std::find(result.romsets.begin(), result.romsets.end(), romset) == result.romsets.end())
+            {
+                result.romsets.push_back(romset);
+            }
+        }
+        else if (reader.Any("--corpus"))
+        {
+            if (!reader.Next())
+            {
+                return B_ParseError::UnexpectedEnd;
+            }
+
+            result.corpus_directory = reader.Arg();
+            if (!std::filesystem::is_directory(result.corpus_directory))
+            {
+                return B_ParseError::CorpusNotFound;
+            }
+        }
+        else if (reader.Any("-i", "--iterations"))
+        {
+            if (!reader.Next())
+            {
+                return B_ParseError::UnexpectedEnd;
+            }
+
+            if (!reader.TryParse(result.iterations) || result.iterations < 1)
+            {
+                return B_ParseError::IterationsInvalid;
+            }
+        }
+        else
+        {
+            return B_ParseError::UnknownArgument;
+        }
+    }
+
+    // Romsets are reported in a fixed order so that results from different runs line up
+    std::sort(result.romsets.begin(), result.romsets.end());
+
+    return B_ParseError::Success;
+}
+
+double B_Seconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+// Runs `fn` `iterations` times and returns the fastest run in seconds. `setup` is called before each run and isn't
+// timed.
+template <typename SetupFn, typename Fn>
+double B_Best(size_t iterations, SetupFn&& setup, Fn&& fn)
+{
+    double best = 0;
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        setup();
+        const auto t_start = std::chrono::steady_clock::now();
+        fn();
+        const double elapsed = B_Seconds(std::chrono::steady_clock::now() - t_start);
+        if (i == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+struct B_MicroResult
+{
+    const char* name;
+    size_t      calls;
+    double      seconds;
+};
+
+struct B_FileResult
+{
+    std::string name;
+    double      emulated_seconds;
+    double      wall_seconds;
+};
+
+struct B_RomsetResult
+{
+    Romset                     romset;
+    std::vector<B_FileResult>  files;
+    std::vector<B_MicroResult> micro;
+};
+
+// Calls `fn.template operator()<Family>()` for the romset family `family`, so that the specialized backend functions
+// can be called directly.
+template <typename Fn>
+void B_WithFamily(RomsetFamily family, Fn&& fn)
+{
+    switch (family)
+    {
+    case RomsetFamily::MK2:
+        fn.template operator()<RomsetFamily::MK2>();
+        break;
+    case RomsetFamily::MK1:
+        fn.template operator()<RomsetFamily::MK1>();
+        break;
+    case RomsetFamily::SCB55:
+        fn.template operator()<RomsetFamily::SCB55>();
+        break;
+    case RomsetFamily::JV880:
+        fn.template operator()<RomsetFamily::JV880>();
+        break;
+    }
+}
+
+void B_DiscardSamples(void* userdata, std::span<const AudioFrame<int32_t>> frames)
+{
+    (void)userdata;
+    (void)frames;
+}
+
+bool B_InitEmulator(Emulator& emu, std::shared_ptr<const SharedRomImage> image)
+{
+    EMU_Options options;
+    options.sample_block_size = B_SAMPLE_BLOCK_SIZE;
+    if (!emu.Init(options))
+    {
+        fprintf(stderr, "FATAL: Failed to initialize emulator\n");
+        return false;
+    }
+
+    if (!emu.LoadRoms(std::move(image)))
+    {
+        fprintf(stderr, "FATAL: Failed to load roms\n");
+        return false;
+    }
+
+    emu.Reset();
+    emu.SetSampleBlockCallback(B_DiscardSamples, nullptr);
+    return true;
+}
+
+// Same as the renderer's estimate of how much time one step takes.
+uint64_t B_NSPerStep(Romset romset)
+{
+    return GetRomsetFamily(romset) == RomsetFamily::MK1 ? 600 : 500;
+}
+
+// Plays `track` on `emu` the same way the renderer does with `--end cut` and returns the emulated time in
+// nanoseconds.
+uint64_t B_PlayTrack(Emulator& emu, const SMF_Data& data, const SMF_Track& track)
+{
+    const uint64_t division    = data.header.division;
+    const uint64_t ns_per_step = B_NSPerStep(emu.GetMCU().romset);
+
+    uint64_t us_per_qn    = 500000;
+    uint64_t ns_simulated = 0;
+
+    uint64_t last_timestamp = 0;
+    for (const SMF_Event& event : track.events)
+    {
+        const uint64_t delta_time = event.timestamp - last_timestamp;
+        last_timestamp            = event.timestamp;
+
+        const uint64_t this_event_time_ns = ns_simulated + 1000 * SMF_TicksToUS(delta_time, us_per_qn, division);
+
+        if (ns_simulated < this_event_time_ns)
+        {
+            const uint64_t steps = (this_event_time_ns - ns_simulated + ns_per_step - 1) / ns_per_step;
+            emu.StepCycles(steps * MCU_CYCLES_PER_STEP);
+            ns_simulated += steps * ns_per_step;
+        }
+
+        if (event.IsTempo(data.bytes))
+        {
+            us_per_qn = event.GetTempoUS(data.bytes);
+        }
+
+        if (!event.IsMetaEvent())
+        {
+            // The corpus has no sysex large enough to fill the midi queue, so unlike the renderer we don't wait for it
+            // to drain
+            emu.PostMIDI(event.status);
+            emu.PostMIDI(event.GetData(data.bytes));
+        }
+    }
+
+    return ns_simulated;
+}
+
+std::vector<std::filesystem::path> B_ListCorpus(const std::filesystem::path& directory)
+{
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".mid")
+        {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+bool B_RunCorpus(const B_Parameters&                          params,
+                 const std::shared_ptr<const SharedRomImage>& image,
+                 const Emulator&                              reset_emu,
+                 B_RomsetResult&                              result)
+{
+    Emulator emu;
+    if (!B_InitEmulator(emu, image))
+    {
+        return false;
+    }
+
+    for (const std::filesystem::path& path : B_ListCorpus(params.corpus_directory))
+    {
+        SMF_Data data;
+        if (!SMF_TryLoadEvents(path, data))
+        {
+            fprintf(stderr, "FATAL: Failed to read %s\n", path.generic_string().c_str());
+            return false;
+        }
+        const SMF_Track track = SMF_MergeTracks(data);
+
+        uint64_t     ns_simulated = 0;
+        const double wall_seconds = B_Best(
+            params.iterations,
+            [&] { emu.CloneFrom(reset_emu); },
+            [&] { ns_simulated = B_PlayTrack(emu, data, track); });
+
+        const double emulated_seconds = (double)ns_simulated / 1e9;
+        fprintf(stderr,
+                "%s %s: %.2fx realtime\n",
+                RomsetName(result.romset),
+                path.filename().generic_string().c_str(),
+                emulated_seconds / wall_seconds);
+
+        result.files.push_back({
+            .name             = path.filename().generic_string(),
+            .emulated_seconds = emulated_seconds,
+            .wall_seconds     = wall_seconds,
+        });
+    }
+
+    return true;
+}
+
+// Brings `emu` into a state with enough voices playing that the pcm and timers do representative work.
+void B_PrepareMicroState(Emulator& emu)
+{
+    static constexpr uint8_t notes[] = {36, 43, 48, 52, 55, 60, 64, 67};
+    for (uint8_t channel = 0; channel < 2; ++channel)
+    {
+        for (uint8_t note : notes)
+        {
+            const uint8_t note_on[] = {(uint8_t)(0x90 | channel), note, 100};
+            emu.PostMIDI(note_on);
+        }
+    }
+
+    // About 100ms, so that every note has started
+    emu.StepCycles(200'000 * MCU_CYCLES_PER_STEP);
+}
+
+bool B_RunRomsetMicro(const B_Parameters&                          params,
+                      const std::shared_ptr<const SharedRomImage>& image,
+                      const Emulator&                              reset_emu,
+                      B_RomsetResult&                              result)
+{
+    Emulator micro_emu;
+    if (!B_InitEmulator(micro_emu, image))
+    {
+        return false;
+    }
+    micro_emu.CloneFrom(reset_emu);
+    B_PrepareMicroState(micro_emu);
+
+    Emulator emu;
+    if (!B_InitEmulator(emu, image))
+    {
+        return false;
+    }
+
+    mcu_t&       mcu   = emu.GetMCU();
+    pcm_t&       pcm   = emu.GetPCM();
+    mcu_timer_t& timer = *mcu.timer;
+
+    const auto restore = [&] { emu.CloneFrom(micro_emu); };
+
+    // Nothing services interrupts here, so a sleeping mcu is woken up by hand to keep it executing instructions.
+    const double instruction_seconds = B_Best(params.iterations, restore, [&] {
+        for (size_t i = 0; i < B_MICRO_CALLS; ++i)
+        {
+            mcu.sleep = 0;
+            MCU_ReadInstruction(mcu);
+        }
+    });
+    result.micro.push_back({"mcu_read_instruction", B_MICRO_CALLS, instruction_seconds});
+
+    B_WithFamily(mcu.family, [&]<RomsetFamily Family>() {
+        const double pcm_seconds = B_Best(params.iterations, restore, [&] {
+            uint64_t cycles = mcu.cycles;
+            for (size_t i = 0; i < B_MICRO_CALLS; ++i)
+            {
+                cycles += MCU_CYCLES_PER_STEP;
+                PCM_Update<Family>(pcm, cycles);
+            }
+        });
+        result.micro.push_back({"pcm_update", B_MICRO_CALLS, pcm_seconds});
+
+        const double timer_seconds = B_Best(params.iterations, restore, [&] {
+            uint64_t cycles = mcu.cycles;
+            for (size_t i = 0; i < B_MICRO_CALLS; ++i)
+            {
+                cycles += MCU_CYCLES_PER_STEP;
+                TIMER_Clock<Family>(timer, cycles);
+            }
+        });
+        result.micro.push_back({"timer_clock", B_MICRO_CALLS, timer_seconds});
+    });
+
+    return true;
+}
+
+std::shared_ptr<const SharedRomImage> B_LoadRomImage(AllRomsetInfo& info, Romset romset)
+{
+    if (!IsCompleteRomset(info, romset))
+    {
+        fprintf(stderr, "FATAL: Romset %s is incomplete\n", RomsetName(romset));
+        return nullptr;
+    }
+
+    if (!LoadRomset(romset, info))
+    {
+        fprintf(stderr, "FATAL: Failed to load romset %s\n", RomsetName(romset));
+        return nullptr;
+    }
+
+    std::shared_ptr<const SharedRomImage> image = EMU_CreateRomImage(romset, info);
+    info.romsets[(size_t)romset].PurgeRomData();
+    if (!image)
+    {
+        fprintf(stderr, "FATAL: Failed to load roms\n");
+    }
+    return image;
+}
+
+bool B_RunRomset(const B_Parameters& params, AllRomsetInfo& info, B_RomsetResult& result)
+{
+    std::shared_ptr<const SharedRomImage> image = B_LoadRomImage(info, result.romset);
+    if (!image)
+    {
+        return false;
+    }
+
+    fprintf(stderr, "Initializing %s...\n", RomsetName(result.romset));
+
+    // Every measurement starts from a copy of this emulator, so the reset only runs once
+    Emulator reset_emu;
+    if (!B_InitEmulator(reset_emu, image))
+    {
+        return false;
+    }
+    reset_emu.SetFastForward(true);
+    reset_emu.PostSystemReset(EMU_SystemReset::GM_RESET);
+    reset_emu.StepCycles(24'000'000 * MCU_CYCLES_PER_STEP);
+    reset_emu.SetFastForward(false);
+
+    if (!params.corpus_directory.empty() && !B_RunCorpus(params, image, reset_emu, result))
+    {
+        return false;
+    }
+
+    return B_RunRomsetMicro(params, image, reset_emu, result);
+}
+
+template <typename SampleT>
+void B_RunMixMicro(const B_Parameters& params, const char* name, std::vector<B_MicroResult>& results)
+{
+    constexpr size_t count = 2 * B_SAMPLE_BLOCK_SIZE;
+
+    std::vector<SampleT> sources[B_MIX_SOURCES];
+    const SampleT*       source_ptrs[B_MIX_SOURCES];
+    for (size_t i = 0; i < B_MIX_SOURCES; ++i)
+    {
+        sources[i].resize(count);
+        for (size_t j = 0; j < count; ++j)
+        {
+            sources[i][j] = (SampleT)((j * 31 + i * 7) % 1000);
+        }
+        source_ptrs[i] = sources[i].data();
+    }
+    std::vector<SampleT> dest(count);
+
+    const double seconds = B_Best(params.iterations, [] {}, [&] {
+        for (size_t i = 0; i < B_MIX_CALLS; ++i)
+        {
+            AUDIO_Mix(dest.data(), source_ptrs, B_MIX_SOURCES, count);
+        }
+    });
+    results.push_back({name, B_MIX_CALLS, seconds});
+}
+
+// Resamples blocks the size the emulator produces from the SC-55mk2's frequency to 48khz, like `--rate 48000`.
+void B_RunResampleMicro(const B_Parameters& params, std::vector<B_MicroResult>& results)
+{
+    std::vector<AudioFrame<int16_t>> frames(B_SAMPLE_BLOCK_SIZE);
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        frames[i].left  = (int16_t)((i * 31) % 2000);
+        frames[i].right = (int16_t)-frames[i].left;
+    }
+
+    AudioResampler resampler;
+    resampler.Init(66207, 48000);
+
+    const double seconds = B_Best(params.iterations, [] {}, [&] {
+        for (size_t i = 0; i < B_RESAMPLE_CALLS; ++i)
+        {
+            resampler.Process(std::span<const AudioFrame<int16_t>>(frames));
+        }
+        resampler.Flush<int16_t>();
+    });
+    results.push_back({"resample_s16", B_RESAMPLE_CALLS, seconds});
+}
+
+// Writes blocks the size the renderer writes to a file in the temp directory. Includes the time to finish the file,
+// so that the writer thread can't hide any of the work.
+bool B_RunWavMicro(const B_Parameters& params, std::vector<B_MicroResult>& results)
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "nuked-sc55-bench.wav";
+
+    std::vector<AudioFrame<float>> frames(B_SAMPLE_BLOCK_SIZE);
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        frames[i].left  = (float)i / (float)frames.size();
+        frames[i].right = -frames[i].left;
+    }
+
+    bool ok = true;
+    const double seconds = B_Best(params.iterations, [] {}, [&] {
+        WAV_Handle wav;
+        wav.SetSampleRate(66207);
+        if (!wav.Open(path, AudioFormat::F32, {.writer_thread = true}))
+        {
+            ok = false;
+            return;
+        }
+        for (size_t i = 0; i < B_WAV_CALLS; ++i)
+        {
+            wav.Write(std::span<const AudioFrame<float>>(frames));
+        }
+        ok = wav.Finish() && ok;
+    });
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+
+    if (!ok)
+    {
+        fprintf(stderr, "FATAL: Failed to write %s\n", path.generic_string().c_str());
+        return false;
+    }
+
+    results.push_back({"wav_write_f32", B_WAV_CALLS, seconds});
+    return true;
+}
+
+void B_WriteMicro(FILE* out, std::span<const B_MicroResult> results, const char* indent)
+{
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        fprintf(out,
+                "%s{\"name\": \"%s\", \"calls\": %zu, \"ns_per_call\": %.3f}%s\n",
+                indent,
+                results[i].name,
+                results[i].calls,
+                results[i].seconds * 1e9 / (double)results[i].calls,
+                i + 1 < results.size() ? "," : "");
+    }
+}
+
+// Keys and their order never change, so that results can be diffed and parsed by simple tools. File names come from
+// the corpus directory, which only holds plain names, so they aren't escaped.
+void B_WriteReport(FILE*                           out,
+                   const B_Parameters&             params,
+                   std::span<const B_RomsetResult> romsets,
+                   std::span<const B_MicroResult>  micro)
+{
+    fprintf(out, "{\n");
+    fprintf(out, "  \"version\": \"%s\",\n", NUKED_VERSION);
+    fprintf(out, "  \"profiling\": %s,\n", NUKED_ENABLE_PROFILING ? "true" : "false");
+    fprintf(out, "  \"audio_kernel\": \"%s\",\n", AUDIO_KernelName(AUDIO_DetectKernel()));
+    fprintf(out, "  \"iterations\": %zu,\n", params.iterations);
+    fprintf(out, "  \"romsets\": [\n");
+    for (size_t i = 0; i < romsets.size(); ++i)
+    {
+        const B_RomsetResult& romset = romsets[i];
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"romset\": \"%s\",\n", RomsetName(romset.romset));
+        if (params.corpus_directory.empty())
+        {
+            fprintf(out, "      \"corpus\": null,\n");
+        }
+        else
+        {
+            double emulated_seconds = 0;
+            double wall_seconds     = 0;
+            for (const B_FileResult& file : romset.files)
+            {
+                emulated_seconds += file.emulated_seconds;
+                wall_seconds += file.wall_seconds;
+            }
+
+            fprintf(out, "      \"corpus\": {\n");
+            fprintf(out, "        \"emulated_seconds\": %.3f,\n", emulated_seconds);
+            fprintf(out, "        \"wall_seconds\": %.3f,\n", wall_seconds);
+            fprintf(out, "        \"speed\": %.3f,\n", wall_seconds > 0 ? emulated_seconds / wall_seconds : 0.0);
+            fprintf(out, "        \"files\": [\n");
+            for (size_t j = 0; j < romset.files.size(); ++j)
+            {
+                const B_FileResult& file = romset.files[j];
+                fprintf(out,
+                        "          {\"file\": \"%s\", \"emulated_seconds\": %.3f, \"wall_seconds\": %.3f, "
+                        "\"speed\": %.3f}%s\n",
+                        file.name.c_str(),
+                        file.emulated_seconds,
+                        file.wall_seconds,
+                        file.wall_seconds > 0 ? file.emulated_seconds / file.wall_seconds : 0.0,
+                        j + 1 < romset.files.size() ? "," : "");
+            }
+            fprintf(out, "        ]\n");
+            fprintf(out, "      },\n");
+        }
+        fprintf(out, "      \"micro\": [\n");
+        B_WriteMicro(out, romset.micro, "        ");
+        fprintf(out, "      ]\n");
+        fprintf(out, "    }%s\n", i + 1 < romsets.size() ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    fprintf(out, "  \"micro\": [\n");
+    B_WriteMicro(out, micro, "    ");
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+// Picks the romsets to benchmark and finds their roms. Without `--romset`, every complete romset in the rom
+// directory is used.
+bool B_FindRomsets(B_Parameters& params, AllRomsetInfo& info)
+{
+    if (!DetectRomsetsByHash(params.rom_directory, info))
+    {
+        fprintf(stderr, "FATAL: Failed to detect romsets in %s\n", params.rom_directory.generic_string().c_str());
+        return false;
+    }
+
+    if (params.romsets.empty())
+    {
+        for (size_t i = 0; i < ROMSET_COUNT; ++i)
+        {
+            if (IsCompleteRomset(info, (Romset)i))
+            {
+                params.romsets.push_back((Romset)i);
+            }
+        }
+
+        if (params.romsets.empty())
+        {
+            fprintf(stderr, "WARNING: No complete romsets in %s\n", params.rom_directory.generic_string().c_str());
+        }
+    }
+
+    return true;
+}
+
+void B_Usage()
+{
+    constexpr const char* USAGE_STR = R"(Measures the performance of nuked-sc55 and writes the results to stdout as
+JSON.
+
+Usage: %s [options]
+
+General options:
+  -? -h, --help                Display this information.
+  -v, --version                Display version information.
+  -i, --iterations <count>     Run every measurement count times and keep the fastest. Defaults to 1.
+
+Benchmark options:
+  --corpus <dir>               Play every .mid file in dir on each romset and report the emulation
+                               speed. test/integration/avmidi is a good choice.
+
+ROM management options:
+  -d, --rom-directory <dir>    Sets the directory to load roms from.
+  --romset <name>              Benchmark this romset. Can be passed more than once. Defaults to every
+                               complete romset in the rom directory.
+
+)";
+
+    std::string name = P_GetProcessPath().stem().generic_string();
+    fprintf(stderr, USAGE_STR, name.c_str());
+
+    common::PrintRomsets(stderr);
+}
+
+int main(int argc, char* argv[])
+{
+    B_Parameters params;
+    B_ParseError result = B_ParseCommandLine(argc, argv, params);
+
+    if (result != B_ParseError::Success)
+    {
+        fprintf(stderr, "error: %s\n", B_ParseErrorStr(result));
+        B_Usage();
+        return 1;
+    }
+
+    if (params.help)
+    {
+        B_Usage();
+        return 0;
+    }
+
+    if (params.version)
+    {
+        Cfg_WriteVersionInfo(stdout);
+        return 0;
+    }
+
+    AllRomsetInfo info;
+    if (!B_FindRomsets(params, info))
+    {
+        return 1;
+    }
+
+    std::vector<B_RomsetResult> romset_results;
+    for (Romset romset : params.romsets)
+    {
+        B_RomsetResult& romset_result = romset_results.emplace_back();
+        romset_result.romset          = romset;
+        if (!B_RunRomset(params, info, romset_result))
+        {
+            return 1;
+        }
+    }
+
+    std::vector<B_MicroResult> micro_results;
+    B_RunMixMicro<int16_t>(params, "mix_s16", micro_results);
+    B_RunMixMicro<int32_t>(params, "mix_s32", micro_results);
+    B_RunMixMicro<float>(params, "mix_f32", micro_results);
+    B_RunResampleMicro(params, micro_results);
+    if (!B_RunWavMicro(params, micro_results))
+    {
+        return 1;
+    }
+
+    B_WriteReport(stdout, params, romset_results, micro_results);
+
+    return 0;
+}
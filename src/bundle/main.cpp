@@ -0,0 +1,179 @@
+#include "command_line.h"
+#include "config.h"
+#include "path_util.h"
+#include "rom_bundle.h"
+#include "rom_io.h"
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+#include "common/rom_loader.h"
+
+struct BU_Parameters
+{
+    bool help    = false;
+    bool version = false;
+
+    std::filesystem::path rom_directory = std::filesystem::current_path();
+    std::string_view      romset_name;
+    std::filesystem::path output_filename;
+};
+
+enum class BU_ParseError
+{
+    Success,
+    UnexpectedEnd,
+    RomDirectoryNotFound,
+    MultipleOutputs,
+    NoOutput,
+};
+
+const char* BU_ParseErrorStr(BU_ParseError err)
+{
+    switch (err)
+    {
+    case BU_ParseError::Success:
+        return "Success";
+    case BU_ParseError::UnexpectedEnd:
+        return "Expected another argument";
+    case BU_ParseError::RomDirectoryNotFound:
+        return "Rom directory doesn't exist";
+    case BU_ParseError::MultipleOutputs:
+        return "Multiple output files provided";
+    case BU_ParseError::NoOutput:
+        return "No output file provided";
+    }
+    return "Unknown error";
+}
+
+BU_ParseError BU_ParseCommandLine(int argc, char* argv[], BU_Parameters& result)
+{
+    CommandLineReader reader(argc, argv);
+
+    while (reader.Next())
+    {
+        if (reader.Any("-h", "--help", "-?"))
+        {
+            result.help = true;
+            return BU_ParseError::Success;
+        }
+        else if (reader.Any("-v", "--version"))
+        {
+            result.version = true;
+            return BU_ParseError::Success;
+        }
+        else if (reader.Any("-d", "--rom-directory"))
+        {
+            if (!reader.Next())
+            {
+                return BU_ParseError::UnexpectedEnd;
+            }
+
+            result.rom_directory = reader.Arg();
+            if (!std::filesystem::is_directory(result.rom_directory))
+            {
+                return BU_ParseError::RomDirectoryNotFound;
+            }
+        }
+        else if (reader.Any("--romset"))
+        {
+            if (!reader.Next())
+            {
+                return BU_ParseError::UnexpectedEnd;
+            }
+
+            result.romset_name = reader.Arg();
+        }
+        else
+        {
+            if (!result.output_filename.empty())
+            {
+                return BU_ParseError::MultipleOutputs;
+            }
+            result.output_filename = reader.Arg();
+        }
+    }
+
+    if (result.output_filename.empty())
+    {
+        return BU_ParseError::NoOutput;
+    }
+
+    return BU_ParseError::Success;
+}
+
+void BU_Usage()
+{
+    constexpr const char* USAGE_STR = R"(Packs a romset into a single rom bundle that loads without detection or
+unscrambling. Pass the bundle to the other frontends with --rom-directory.
+
+Usage: %s [options] <output>
+
+General options:
+  -? -h, --help                Display this information.
+  -v, --version                Display version information.
+
+ROM management options:
+  -d, --rom-directory <dir>    Sets the directory to load roms from.
+  --romset <name>              Sets the romset to bundle. Autodetected when not passed.
+
+)";
+
+    std::string name = P_GetProcessPath().stem().generic_string();
+    fprintf(stderr, USAGE_STR, name.c_str());
+
+    common::PrintRomsets(stderr);
+}
+
+int main(int argc, char* argv[])
+{
+    BU_Parameters params;
+    BU_ParseError result = BU_ParseCommandLine(argc, argv, params);
+
+    if (result != BU_ParseError::Success)
+    {
+        fprintf(stderr, "error: %s\n", BU_ParseErrorStr(result));
+        BU_Usage();
+        return 1;
+    }
+
+    if (params.help)
+    {
+        BU_Usage();
+        return 0;
+    }
+
+    if (params.version)
+    {
+        Cfg_WriteVersionInfo(stdout);
+        return 0;
+    }
+
+    AllRomsetInfo            romset_info;
+    common::LoadRomsetResult load_result;
+
+    common::LoadRomsetError err = common::LoadRomset(romset_info,
+                                                     params.rom_directory,
+                                                     params.romset_name,
+                                                     false,
+                                                     common::RomOverrides{},
+                                                     {},
+                                                     load_result);
+
+    common::PrintLoadRomsetDiagnostics(stderr, err, load_result, romset_info);
+
+    if (err != common::LoadRomsetError{})
+    {
+        return 1;
+    }
+
+    if (!WriteRomBundle(params.output_filename, load_result.romset, romset_info))
+    {
+        fprintf(stderr, "FATAL: Failed to write rom bundle\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Wrote %s\n", params.output_filename.generic_string().c_str());
+
+    return 0;
+}
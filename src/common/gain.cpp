@@ -15,12 +15,12 @@ enum class ParseUnit
 
 float DbToScalar(float db)
 {
-    return std::powf(10.f, db / 20.f);
+    return powf(10.f, db / 20.f);
 }
 
 float ScalarToDb(float scalar)
 {
-    return 20.f * std::log10f(scalar);
+    return 20.f * log10f(scalar);
 }
 
 static bool IsDigit(char ch)
@@ -98,7 +98,7 @@ ParseGainResult ParseGain(std::string_view str, float& out_gain)
     }
     #else
     // Use from_chars if supported (GCC or MSVC)
-    auto fc_result = std::from_chars(n_first, n_last, num);
+    auto fc_result = std::from_chars(str.data(), str.data() + str.size(), num);
     if (fc_result.ec != std::errc{}) {
         return ParseGainResult::ParseFailed;
     }
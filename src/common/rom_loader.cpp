@@ -1,4 +1,5 @@
 #include "rom_loader.h"
+#include "rom_bundle.h"
 
 namespace common
 {
@@ -17,6 +18,10 @@ const char* ToCString(LoadRomsetError error)
         return "Requested romset is incomplete";
     case LoadRomsetError::RomLoadFailed:
         return "Failed to load roms";
+    case LoadRomsetError::BundleLoadFailed:
+        return "Failed to load rom bundle";
+    case LoadRomsetError::BundleRomsetMismatch:
+        return "Rom bundle contains a different romset";
     }
 
     if (error == LoadRomsetError{})
@@ -34,9 +39,29 @@ LoadRomsetError LoadRomset(AllRomsetInfo&           romset_info,
                            std::string_view             desired_romset,
                            bool                         legacy_loader,
                            const RomOverrides&          overrides,
+                           const std::filesystem::path& hash_cache,
                            LoadRomsetResult&            result)
 {
-    if (desired_romset.size())
+    // A bundle has everything in the form the emulator uses, so there's nothing to detect
+    if (std::filesystem::is_regular_file(rom_directory))
+    {
+        if (!LoadRomBundle(rom_directory, romset_info, result.romset))
+        {
+            return LoadRomsetError::BundleLoadFailed;
+        }
+
+        Romset desired;
+        if (desired_romset.size() && !ParseRomsetName(desired_romset, desired))
+        {
+            return LoadRomsetError::InvalidRomsetName;
+        }
+
+        if (desired_romset.size() && desired != result.romset)
+        {
+            return LoadRomsetError::BundleRomsetMismatch;
+        }
+    }
+    else if (desired_romset.size())
     {
         if (!ParseRomsetName(desired_romset, result.romset))
         {
@@ -56,7 +81,7 @@ LoadRomsetError LoadRomset(AllRomsetInfo&           romset_info,
         }
         else
         {
-            if (!DetectRomsetsByHash(rom_directory, romset_info, &desired))
+            if (!DetectRomsetsByHash(rom_directory, romset_info, &desired, hash_cache))
             {
                 return LoadRomsetError::DetectionFailed;
             }
@@ -74,7 +99,7 @@ LoadRomsetError LoadRomset(AllRomsetInfo&           romset_info,
         }
         else
         {
-            if (!DetectRomsetsByHash(rom_directory, romset_info))
+            if (!DetectRomsetsByHash(rom_directory, romset_info, nullptr, hash_cache))
             {
                 return LoadRomsetError::DetectionFailed;
             }
@@ -94,6 +119,7 @@ LoadRomsetError LoadRomset(AllRomsetInfo&           romset_info,
             {
                 romset_info.romsets[i].rom_paths[j] = overrides[j];
                 romset_info.romsets[i].rom_data[j].clear();
+                romset_info.romsets[i].rom_maps[j] = {};
             }
         }
     }
@@ -130,8 +156,12 @@ void PrintLoadRomsetDiagnostics(FILE*                    output,
     switch (error)
     {
     case LoadRomsetError::DetectionFailed:
+    case LoadRomsetError::BundleLoadFailed:
         // TODO: DetectRomsets* will print its own diagnostics
         break;
+    case LoadRomsetError::BundleRomsetMismatch:
+        fprintf(output, "error: %s; it contains %s\n", ToCString(error), RomsetName(result.romset));
+        break;
     case LoadRomsetError::InvalidRomsetName:
         fprintf(output, "error: %s\n", ToCString(error));
         PrintRomsets(output);
@@ -22,6 +22,12 @@ enum class LoadRomsetError
 
     // loaded roms will be available through `loaded`
     RomLoadFailed,
+
+    // `rom_directory` is a file, but not a valid rom bundle
+    BundleLoadFailed,
+
+    // the rom bundle contains a different romset than `desired_romset`; it will be available through `romset`
+    BundleRomsetMismatch,
 };
 
 // `error`: error code to convert to string
@@ -36,15 +42,17 @@ struct LoadRomsetResult
 };
 
 // `romset_info`: receives rom paths and rom data
-// `rom_directory`: directory containing complete romset(s)
+// `rom_directory`: directory containing complete romset(s), or a rom bundle created by nuked-sc55-bundle
 // `desired_romset`: romset the user wants to load; if empty string the first romset in the directory will be returned
 // `legacy_loader`: use the same logic as nukeykt/Nuked-SC55
+// `hash_cache`: file to cache rom digests in; empty to hash every file. Not used by the legacy loader or for bundles
 // `result`: receives the loaded romset and information about which roms were loaded
 LoadRomsetError LoadRomset(AllRomsetInfo&           romset_info,
                            const std::filesystem::path& rom_directory,
                            std::string_view             desired_romset,
                            bool                         legacy_loader,
                            const RomOverrides&          overrides,
+                           const std::filesystem::path& hash_cache,
                            LoadRomsetResult&            result);
 
 // `output`: where to write romset list
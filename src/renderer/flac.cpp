@@ -0,0 +1,525 @@
+#include "flac.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstring>
+
+// Highest Rice partition order tried. A full block is then split into partitions of 16 residuals.
+constexpr uint32_t FLAC_MAX_PARTITION_ORDER = 8;
+
+// Highest fixed predictor order. FLAC defines orders 0 to 4.
+constexpr uint32_t FLAC_MAX_FIXED_ORDER = 4;
+
+// Largest Rice parameter of each residual coding method. The next value is reserved for escaped partitions.
+constexpr uint32_t FLAC_MAX_RICE_PARAM  = 14;
+constexpr uint32_t FLAC_MAX_RICE2_PARAM = 30;
+
+enum class FLAC_ChannelAssignment : uint32_t
+{
+    Independent = 0b0001,
+    LeftSide    = 0b1000,
+    RightSide   = 0b1001,
+    MidSide     = 0b1010,
+};
+
+// Indices into FLAC_Encoder::m_channels
+enum FLAC_Channel
+{
+    Left,
+    Right,
+    Mid,
+    Side,
+};
+
+static constexpr std::array<uint8_t, 256> FLAC_CRC8_TABLE = [] {
+    std::array<uint8_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+        table[i] = (uint8_t)crc;
+    }
+    return table;
+}();
+
+static constexpr std::array<uint16_t, 256> FLAC_CRC16_TABLE = [] {
+    std::array<uint16_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i << 8;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+        }
+        table[i] = (uint16_t)crc;
+    }
+    return table;
+}();
+
+static uint8_t FLAC_CRC8(std::span<const uint8_t> bytes)
+{
+    uint8_t crc = 0;
+    for (uint8_t byte : bytes)
+    {
+        crc = FLAC_CRC8_TABLE[crc ^ byte];
+    }
+    return crc;
+}
+
+static uint16_t FLAC_CRC16(std::span<const uint8_t> bytes)
+{
+    uint16_t crc = 0;
+    for (uint8_t byte : bytes)
+    {
+        crc = (uint16_t)((crc << 8) ^ FLAC_CRC16_TABLE[(crc >> 8) ^ byte]);
+    }
+    return crc;
+}
+
+// Appends values of up to 32 bits to a byte vector, most significant bit first.
+struct FLAC_BitWriter
+{
+    std::vector<uint8_t>& out;
+
+    // The last `count` bits of `pending` haven't made a whole byte yet
+    uint64_t pending = 0;
+    uint32_t count   = 0;
+
+    void Write(uint32_t value, uint32_t bits)
+    {
+        assert(bits <= 32);
+        pending = (pending << bits) | (value & ((uint64_t(1) << bits) - 1));
+        count += bits;
+        while (count >= 8)
+        {
+            count -= 8;
+            out.push_back((uint8_t)(pending >> count));
+        }
+    }
+
+    // Writes `value` as `value` zeros followed by a one.
+    void WriteUnary(uint32_t value)
+    {
+        while (value >= 32)
+        {
+            Write(0, 32);
+            value -= 32;
+        }
+        Write(1, value + 1);
+    }
+
+    void WriteRice(uint32_t value, uint32_t param)
+    {
+        WriteUnary(value >> param);
+        Write(value, param);
+    }
+
+    // Writes `value` in FLAC's extension of UTF-8 to 36 bits, which frame headers number the frames with.
+    void WriteUTF8(uint32_t value)
+    {
+        if (value < 0x80)
+        {
+            Write(value, 8);
+            return;
+        }
+
+        const uint32_t extra = value < 0x800      ? 1
+                               : value < 0x10000   ? 2
+                               : value < 0x200000  ? 3
+                               : value < 0x4000000 ? 4
+                                                   : 5;
+        Write(((0xff << (7 - extra)) & 0xff) | (value >> (6 * extra)), 8);
+        for (uint32_t i = extra; i-- > 0;)
+        {
+            Write(0x80 | ((value >> (6 * i)) & 0x3f), 8);
+        }
+    }
+
+    void AlignToByte()
+    {
+        if (count != 0)
+        {
+            Write(0, 8 - count);
+        }
+    }
+};
+
+enum class FLAC_SubframeType
+{
+    Constant,
+    Verbatim,
+    Fixed,
+};
+
+// How one channel of a block is encoded, along with its size in bits. The size of fixed subframes is estimated.
+struct FLAC_Subframe
+{
+    FLAC_SubframeType type            = FLAC_SubframeType::Verbatim;
+    uint32_t          order           = 0;
+    uint32_t          partition_order = 0;
+    uint8_t           params[1 << FLAC_MAX_PARTITION_ORDER]{};
+    uint64_t          bits            = 0;
+};
+
+static uint32_t FLAC_ZigZag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+// Residual of the fixed predictor of `order` at samples[i], where i >= order.
+static int64_t FLAC_FixedResidual(const int32_t* samples, size_t i, uint32_t order)
+{
+    switch (order)
+    {
+    case 0:
+        return samples[i];
+    case 1:
+        return (int64_t)samples[i] - samples[i - 1];
+    case 2:
+        return (int64_t)samples[i] - 2 * (int64_t)samples[i - 1] + samples[i - 2];
+    case 3:
+        return (int64_t)samples[i] - 3 * (int64_t)samples[i - 1] + 3 * (int64_t)samples[i - 2] - samples[i - 3];
+    default:
+        return (int64_t)samples[i] - 4 * (int64_t)samples[i - 1] + 6 * (int64_t)samples[i - 2] -
+               4 * (int64_t)samples[i - 3] + samples[i - 4];
+    }
+}
+
+// Picks the Rice parameter with the fewest estimated bits for `count` residuals that add up to `sum` after zigzag
+// coding, and returns it along with the estimate.
+static uint32_t FLAC_PickRiceParam(uint64_t sum, size_t count, uint64_t& bits)
+{
+    const uint64_t mean  = count != 0 ? sum / count : 0;
+    const uint32_t guess = mean != 0 ? (uint32_t)std::bit_width(mean) - 1 : 0;
+
+    uint32_t best = 0;
+    bits          = UINT64_MAX;
+    for (uint32_t param = guess != 0 ? guess - 1 : 0; param <= std::min(guess + 1, FLAC_MAX_RICE2_PARAM); ++param)
+    {
+        const uint64_t estimate = count * (param + 1) + (sum >> param);
+        if (estimate < bits)
+        {
+            bits = estimate;
+            best = param;
+        }
+    }
+    return best;
+}
+
+// Chooses how to split `residuals` of a subframe with a predictor of `order` into Rice partitions.
+static void FLAC_PickPartitions(std::span<const uint32_t> residuals, size_t block_size, FLAC_Subframe& subframe)
+{
+    // Partitions have to divide the block evenly, and the first one has to have room for the warm-up samples
+    uint32_t max_order = 0;
+    while (max_order < FLAC_MAX_PARTITION_ORDER && block_size % (size_t(2) << max_order) == 0 &&
+           (block_size >> (max_order + 1)) > subframe.order)
+    {
+        ++max_order;
+    }
+
+    // Sums of each partition at the highest order, merged pairwise for each order below it
+    uint64_t sums[1 << FLAC_MAX_PARTITION_ORDER];
+    {
+        const size_t partition_size = block_size >> max_order;
+        size_t       offset         = 0;
+        for (size_t p = 0; p < (size_t(1) << max_order); ++p)
+        {
+            const size_t count = p == 0 ? partition_size - subframe.order : partition_size;
+            uint64_t     sum   = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                sum += residuals[offset + i];
+            }
+            sums[p] = sum;
+            offset += count;
+        }
+    }
+
+    subframe.bits = UINT64_MAX;
+    for (uint32_t order = max_order + 1; order-- > 0;)
+    {
+        const size_t partition_count = size_t(1) << order;
+        const size_t partition_size  = block_size >> order;
+
+        uint8_t  params[1 << FLAC_MAX_PARTITION_ORDER];
+        uint64_t bits      = 0;
+        uint32_t max_param = 0;
+        for (size_t p = 0; p < partition_count; ++p)
+        {
+            uint64_t partition_bits = 0;
+            params[p] = (uint8_t)FLAC_PickRiceParam(sums[p], p == 0 ? partition_size - subframe.order : partition_size,
+                                                    partition_bits);
+            bits += partition_bits;
+            max_param = std::max<uint32_t>(max_param, params[p]);
+        }
+        bits += partition_count * (max_param > FLAC_MAX_RICE_PARAM ? 5 : 4);
+
+        if (bits < subframe.bits)
+        {
+            subframe.bits            = bits;
+            subframe.partition_order = order;
+            memcpy(subframe.params, params, partition_count);
+        }
+
+        for (size_t p = 0; p < partition_count / 2; ++p)
+        {
+            sums[p] = sums[2 * p] + sums[2 * p + 1];
+        }
+    }
+}
+
+// Picks the cheapest encoding of one channel of a block. The zigzag coded residuals of fixed subframes are left in
+// `residuals`.
+static FLAC_Subframe FLAC_AnalyzeChannel(std::span<const int32_t> samples, uint32_t bits_per_sample,
+                                         std::vector<uint32_t>& residuals)
+{
+    const size_t n = samples.size();
+
+    FLAC_Subframe subframe;
+    if (std::all_of(samples.begin(), samples.end(), [&](int32_t s) { return s == samples[0]; }))
+    {
+        subframe.type = FLAC_SubframeType::Constant;
+        subframe.bits = 8 + bits_per_sample;
+        return subframe;
+    }
+
+    subframe.type = FLAC_SubframeType::Verbatim;
+    subframe.bits = 8 + n * bits_per_sample;
+    if (n <= FLAC_MAX_FIXED_ORDER)
+    {
+        return subframe;
+    }
+
+    // Compare the orders over the same samples, so that higher orders aren't penalized for their warm-up
+    uint64_t error[FLAC_MAX_FIXED_ORDER + 1]{};
+    for (size_t i = FLAC_MAX_FIXED_ORDER; i < n; ++i)
+    {
+        for (uint32_t order = 0; order <= FLAC_MAX_FIXED_ORDER; ++order)
+        {
+            const int64_t residual = FLAC_FixedResidual(samples.data(), i, order);
+            error[order] += (uint64_t)(residual < 0 ? -residual : residual);
+        }
+    }
+
+    FLAC_Subframe fixed;
+    fixed.type  = FLAC_SubframeType::Fixed;
+    fixed.order = (uint32_t)(std::min_element(std::begin(error), std::end(error)) - std::begin(error));
+
+    residuals.resize(n - fixed.order);
+    for (size_t i = fixed.order; i < n; ++i)
+    {
+        residuals[i - fixed.order] = FLAC_ZigZag((int32_t)FLAC_FixedResidual(samples.data(), i, fixed.order));
+    }
+
+    FLAC_PickPartitions(residuals, n, fixed);
+    fixed.bits += 8 + fixed.order * bits_per_sample + 6;
+
+    return fixed.bits < subframe.bits ? fixed : subframe;
+}
+
+static void FLAC_WriteSubframe(FLAC_BitWriter&           writer,
+                               const FLAC_Subframe&      subframe,
+                               std::span<const int32_t>  samples,
+                               std::span<const uint32_t> residuals,
+                               uint32_t                  bits_per_sample)
+{
+    switch (subframe.type)
+    {
+    case FLAC_SubframeType::Constant:
+        writer.Write(0b00000000, 8);
+        writer.Write((uint32_t)samples[0], bits_per_sample);
+        break;
+    case FLAC_SubframeType::Verbatim:
+        writer.Write(0b00000010, 8);
+        for (int32_t sample : samples)
+        {
+            writer.Write((uint32_t)sample, bits_per_sample);
+        }
+        break;
+    case FLAC_SubframeType::Fixed: {
+        writer.Write(0b00010000 | (subframe.order << 1), 8);
+        for (uint32_t i = 0; i < subframe.order; ++i)
+        {
+            writer.Write((uint32_t)samples[i], bits_per_sample);
+        }
+
+        const size_t partition_count = size_t(1) << subframe.partition_order;
+        const bool   rice2 = std::any_of(subframe.params, subframe.params + partition_count, [](uint8_t param) {
+            return param > FLAC_MAX_RICE_PARAM;
+        });
+        writer.Write(rice2 ? 1 : 0, 2);
+        writer.Write(subframe.partition_order, 4);
+
+        const size_t partition_size = samples.size() >> subframe.partition_order;
+        size_t       offset         = 0;
+        for (size_t p = 0; p < partition_count; ++p)
+        {
+            const uint32_t param = subframe.params[p];
+            writer.Write(param, rice2 ? 5 : 4);
+
+            const size_t count = p == 0 ? partition_size - subframe.order : partition_size;
+            for (size_t i = 0; i < count; ++i)
+            {
+                writer.WriteRice(residuals[offset + i], param);
+            }
+            offset += count;
+        }
+        break;
+    }
+    }
+}
+
+FLAC_Encoder::FLAC_Encoder(uint32_t bits_per_sample)
+    : m_bits_per_sample(bits_per_sample)
+{
+    assert(bits_per_sample == 16 || bits_per_sample == 24);
+    for (std::vector<int32_t>& channel : m_channels)
+    {
+        channel.resize(FLAC_BLOCK_SIZE);
+    }
+}
+
+void FLAC_Encoder::Encode(std::span<const AudioFrame<int16_t>> frames, std::vector<uint8_t>& out)
+{
+    EncodeFrames(frames, out);
+}
+
+void FLAC_Encoder::Encode(std::span<const AudioFrame<int32_t>> frames, std::vector<uint8_t>& out)
+{
+    EncodeFrames(frames, out);
+}
+
+template <typename T>
+void FLAC_Encoder::EncodeFrames(std::span<const AudioFrame<T>> frames, std::vector<uint8_t>& out)
+{
+    const uint32_t shift = 8 * sizeof(T) - m_bits_per_sample;
+
+    while (!frames.empty())
+    {
+        const size_t count = std::min(frames.size(), FLAC_BLOCK_SIZE);
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_channels[Left][i]  = (int32_t)frames[i].left >> shift;
+            m_channels[Right][i] = (int32_t)frames[i].right >> shift;
+        }
+        EncodeBlock(count, out);
+        frames = frames.subspan(count);
+    }
+}
+
+void FLAC_Encoder::EncodeBlock(size_t frame_count, std::vector<uint8_t>& out)
+{
+    for (size_t i = 0; i < frame_count; ++i)
+    {
+        const int32_t left  = m_channels[Left][i];
+        const int32_t right = m_channels[Right][i];
+        m_channels[Mid][i]  = (left + right) >> 1;
+        m_channels[Side][i] = left - right;
+    }
+
+    FLAC_Subframe subframes[4];
+    for (int channel = Left; channel <= Side; ++channel)
+    {
+        // Side needs an extra bit to hold the difference of two samples
+        const uint32_t bits = m_bits_per_sample + (channel == Side ? 1 : 0);
+        subframes[channel] =
+            FLAC_AnalyzeChannel(std::span(m_channels[channel]).first(frame_count), bits, m_residuals[channel]);
+    }
+
+    struct Choice
+    {
+        FLAC_ChannelAssignment assignment;
+        FLAC_Channel           channels[2];
+    };
+    static constexpr Choice CHOICES[] = {
+        {FLAC_ChannelAssignment::Independent, {Left, Right}},
+        {FLAC_ChannelAssignment::LeftSide, {Left, Side}},
+        {FLAC_ChannelAssignment::RightSide, {Side, Right}},
+        {FLAC_ChannelAssignment::MidSide, {Mid, Side}},
+    };
+    const auto bits_of = [&](const Choice& c) {
+        return subframes[c.channels[0]].bits + subframes[c.channels[1]].bits;
+    };
+    const Choice& choice = *std::min_element(std::begin(CHOICES),
+                                             std::end(CHOICES),
+                                             [&](const Choice& a, const Choice& b) { return bits_of(a) < bits_of(b); });
+
+    const size_t   frame_start = out.size();
+    FLAC_BitWriter writer{out};
+
+    // Frame header with a fixed block size. Short blocks spell out their size after the frame number, and the sample
+    // rate comes from STREAMINFO.
+    const bool short_block = frame_count != FLAC_BLOCK_SIZE;
+    writer.Write(0xfff8, 16);
+    writer.Write(short_block ? 0b0111 : 0b1100, 4);
+    writer.Write(0b0000, 4);
+    writer.Write((uint32_t)choice.assignment, 4);
+    writer.Write(m_bits_per_sample == 16 ? 0b100 : 0b110, 3);
+    writer.Write(0, 1);
+    writer.WriteUTF8(m_blocks_encoded);
+    if (short_block)
+    {
+        writer.Write((uint32_t)frame_count - 1, 16);
+    }
+    writer.Write(FLAC_CRC8(std::span(out).subspan(frame_start)), 8);
+
+    for (FLAC_Channel channel : choice.channels)
+    {
+        FLAC_WriteSubframe(writer,
+                           subframes[channel],
+                           std::span(m_channels[channel]).first(frame_count),
+                           m_residuals[channel],
+                           m_bits_per_sample + (channel == Side ? 1 : 0));
+    }
+
+    writer.AlignToByte();
+    writer.Write(FLAC_CRC16(std::span(out).subspan(frame_start)), 16);
+
+    const uint32_t block_bytes = (uint32_t)(out.size() - frame_start);
+    m_min_block_bytes          = std::min(m_min_block_bytes, block_bytes);
+    m_max_block_bytes          = std::max(m_max_block_bytes, block_bytes);
+
+    m_frames_encoded += frame_count;
+    ++m_blocks_encoded;
+}
+
+void FLAC_Encoder::WriteHeader(uint32_t sample_rate, std::span<uint8_t, FLAC_HEADER_SIZE> out) const
+{
+    std::vector<uint8_t> header;
+    FLAC_BitWriter       writer{header};
+
+    writer.Write('f', 8);
+    writer.Write('L', 8);
+    writer.Write('a', 8);
+    writer.Write('C', 8);
+
+    // STREAMINFO is the only metadata block
+    writer.Write(1, 1);
+    writer.Write(0, 7);
+    writer.Write(34, 24);
+
+    // Block and frame sizes are zero when unknown
+    const bool any_blocks = m_blocks_encoded != 0;
+    writer.Write(FLAC_BLOCK_SIZE, 16);
+    writer.Write(FLAC_BLOCK_SIZE, 16);
+    writer.Write(any_blocks ? m_min_block_bytes : 0, 24);
+    writer.Write(any_blocks ? m_max_block_bytes : 0, 24);
+    writer.Write(sample_rate, 20);
+    writer.Write(AudioFrame<int32_t>::channel_count - 1, 3);
+    writer.Write(m_bits_per_sample - 1, 5);
+    writer.Write((uint32_t)(m_frames_encoded >> 32), 4);
+    writer.Write((uint32_t)m_frames_encoded, 32);
+    // The MD5 of the audio is optional; all zeros means it wasn't computed
+    for (int i = 0; i < 4; ++i)
+    {
+        writer.Write(0, 32);
+    }
+
+    assert(header.size() == FLAC_HEADER_SIZE);
+    memcpy(out.data(), header.data(), FLAC_HEADER_SIZE);
+}
@@ -0,0 +1,61 @@
+// A small FLAC encoder for the renderer's output. It only uses FLAC's fixed predictors and picks the stereo
+// decorrelation and Rice partitioning per block, which gets most of the size reduction of LPC at a fraction of the
+// cost.
+
+#pragma once
+
+#include "audio.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Frames in every block except the last one of a stream.
+constexpr size_t FLAC_BLOCK_SIZE = 4096;
+
+// Bytes of the stream marker and STREAMINFO block that start every stream.
+constexpr size_t FLAC_HEADER_SIZE = 42;
+
+class FLAC_Encoder
+{
+public:
+    // `bits_per_sample` is 16 or 24.
+    explicit FLAC_Encoder(uint32_t bits_per_sample);
+
+    uint32_t GetBitsPerSample() const
+    {
+        return m_bits_per_sample;
+    }
+
+    // Encodes `frames` and appends the FLAC frames to `out`. Every call except the last of a stream must pass a
+    // multiple of FLAC_BLOCK_SIZE frames, since only the last block may be shorter.
+    void Encode(std::span<const AudioFrame<int16_t>> frames, std::vector<uint8_t>& out);
+    // Only the top `bits_per_sample` bits of each sample are kept.
+    void Encode(std::span<const AudioFrame<int32_t>> frames, std::vector<uint8_t>& out);
+
+    // Writes the header describing everything encoded so far. It goes in front of the first frame; a stream that
+    // can't be seeked back to can use the header written before encoding anything, which leaves the length unknown.
+    void WriteHeader(uint32_t sample_rate, std::span<uint8_t, FLAC_HEADER_SIZE> out) const;
+
+    uint64_t GetFramesEncoded() const
+    {
+        return m_frames_encoded;
+    }
+
+private:
+    template <typename T>
+    void EncodeFrames(std::span<const AudioFrame<T>> frames, std::vector<uint8_t>& out);
+
+    void EncodeBlock(size_t frame_count, std::vector<uint8_t>& out);
+
+private:
+    uint32_t m_bits_per_sample;
+
+    // One block of each channel the stereo decorrelation can pick from: left, right, mid and side
+    std::vector<int32_t>  m_channels[4];
+    std::vector<uint32_t> m_residuals[4];
+
+    uint64_t m_frames_encoded = 0;
+    uint32_t m_blocks_encoded = 0;
+    uint32_t m_min_block_bytes = UINT32_MAX;
+    uint32_t m_max_block_bytes = 0;
+};
@@ -5,17 +5,26 @@
 #include "emu.h"
 #include "math_util.h"
 #include "path_util.h"
+#include "render.h"
+#include "render_engine.h"
+#include "resampler.h"
 #include "smf.h"
+#include "thread_util.h"
 #include "wav.h"
 #include <algorithm>
+#include <array>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <functional>
+#include <iostream>
 #include <memory>
 #include <mutex>
-#include <source_location>
+#include <optional>
+#include <queue>
+#include <span>
 #include <string>
 #include <thread>
 
@@ -29,14 +38,6 @@
 
 using namespace std::chrono_literals;
 
-enum class R_EndBehavior
-{
-    // Cut the track at the last MIDI event.
-    Cut,
-    // Keep rendering until the emulator produces silence.
-    Release,
-};
-
 struct R_AdvancedParameters
 {
     common::RomOverrides rom_overrides;
@@ -49,18 +50,68 @@ struct R_Parameters
     bool help = false;
     bool version = false;
     size_t instances = 1;
+    R_SplitMode split_mode = R_SplitMode::Modulo;
     std::optional<EMU_SystemReset> reset;
     std::filesystem::path rom_directory = std::filesystem::current_path();
     AudioFormat output_format = AudioFormat::S16;
     bool output_stdout = false;
+    // Print the SHA-256 of the mixed output to stdout instead of writing it. `hash_instances` also prints one for the
+    // audio each instance hands to the mixer.
+    bool hash = false;
+    bool hash_instances = false;
+    bool uncached_output = false;
     bool disable_oversampling = false;
+    // Resample the output to this frequency. Zero keeps the emulator's.
+    uint32_t output_rate = 0;
     std::string_view romset_name;
     bool debug = false;
     R_EndBehavior end_behavior = R_EndBehavior::Cut;
+    // Only render this part of the track. Zero for `end_ns` renders to the end.
+    uint64_t start_ns = 0;
+    uint64_t end_ns = 0;
+    // Deliver the messages before the first note as fast as the firmware reads them, starting the track earlier
+    bool fast_setup = false;
     std::filesystem::path nvram_filename;
+    std::filesystem::path reset_cache_directory;
     bool legacy_romset_detection = false;
+    std::filesystem::path rom_hash_cache;
     bool dump_emidi_loop_points = false;
     float gain = 1.0f;
+    // Render each group of channels to its own file. Each group is a mask of the channels it contains. Empty when
+    // rendering one stem per channel that has events.
+    bool stems = false;
+    std::vector<uint16_t> stem_groups;
+    bool stem_master = false;
+    // Cut the track into up to this many segments and render them in parallel, each from a checkpoint of a serial
+    // pass. Zero renders the track in one go.
+    size_t segments = 0;
+    bool verify_segments = false;
+    // Chunks of mixer input each instance may render ahead of the slowest one. Zero doesn't limit them.
+    size_t queue_depth = R_Mixer::DEFAULT_MAX_QUEUE_DEPTH;
+    // Render every job listed in this file instead of a single input. Results are reported to `report_filename`, or
+    // stdout if it's empty.
+    std::filesystem::path batch_filename;
+    std::filesystem::path report_filename;
+    // Keep the emulators warm and render jobs as they're read from stdin, until it's closed. Jobs use the same format
+    // as batch manifest lines and are reported the same way.
+    bool serve = false;
+    // Number of batch worker threads. Zero picks one per hardware thread.
+    size_t jobs = 0;
+    // If set, render speed is written here as JSON once the track is done
+    std::filesystem::path perf_report_filename;
+    // If set, where each instance and the mix thread spent their time is written here as JSON once the track is done
+    std::filesystem::path stats_json_filename;
+    // If set, firmware instruction counts are written here as folded stacks once the track is done
+    std::filesystem::path pc_profile_filename;
+    // If set, a hash of each instance's state is written here every `state_trace_interval_ns` of emulated time
+    std::filesystem::path state_trace_filename;
+    uint64_t state_trace_interval_ns = 10'000'000;
+    // Compare these two state traces instead of rendering
+    std::filesystem::path compare_trace_a;
+    std::filesystem::path compare_trace_b;
+    // Pin each emulator thread to its own physical core
+    bool pin_threads = false;
+    ThreadPolicy thread_policy = ThreadPolicy::Default;
     R_AdvancedParameters adv;
 };
 
@@ -76,8 +127,31 @@ enum class R_ParseError
     RomDirectoryNotFound,
     FormatInvalid,
     EndInvalid,
+    TimeInvalid,
+    TimeRangeEmpty,
     ResetInvalid,
     GainInvalid,
+    RateInvalid,
+    SplitInvalid,
+    StemsInvalid,
+    StemsNeedOutput,
+    StemsWithInstances,
+    StemMasterWithoutStems,
+    SegmentsInvalid,
+    SegmentsConflict,
+    VerifyWithoutSegments,
+    JobsInvalid,
+    QueueDepthInvalid,
+    BatchConflict,
+    BatchOptionWithoutBatch,
+    HashConflict,
+    FastSetupConflict,
+    PCProfileUnsupported,
+    StateTraceIntervalInvalid,
+    CompareConflict,
+    FLACFormatInvalid,
+    AffinityInvalid,
+    ThreadPolicyInvalid,
 };
 
 const char* R_ParseErrorStr(R_ParseError err)
@@ -89,7 +163,7 @@ const char* R_ParseErrorStr(R_ParseError err)
         case R_ParseError::NoInput:
             return "No input file specified";
         case R_ParseError::NoOutput:
-            return "No output file specified (pass -o)";
+            return "No output file specified (pass -o, --stdout or --hash)";
         case R_ParseError::MultipleInputs:
             return "Multiple input files";
         case R_ParseError::InstancesInvalid:
@@ -104,14 +178,123 @@ const char* R_ParseErrorStr(R_ParseError err)
             return "Output format invalid";
         case R_ParseError::EndInvalid:
             return "End behavior invalid";
+        case R_ParseError::TimeInvalid:
+            return "Time invalid (should be seconds, m:ss or h:mm:ss, optionally with decimals)";
+        case R_ParseError::TimeRangeEmpty:
+            return "--end-time must be after --start";
         case R_ParseError::ResetInvalid:
             return "Reset invalid (should be none, gs, or gm)";
         case R_ParseError::GainInvalid:
             return "Gain invalid (should be a number optionally ending in 'db')";
+        case R_ParseError::RateInvalid:
+            return "Rate invalid (should be 8000-768000)";
+        case R_ParseError::SplitInvalid:
+            return "Split invalid (should be modulo or balanced)";
+        case R_ParseError::StemsInvalid:
+            return "Stems invalid (should be 'all' or groups of channels 1-16 like 1,2,3+4)";
+        case R_ParseError::StemsNeedOutput:
+            return "Stems need an output filename to name them after (pass -o)";
+        case R_ParseError::StemsWithInstances:
+            return "Stems can't be combined with --instances";
+        case R_ParseError::StemMasterWithoutStems:
+            return "--stem-master needs --stems";
+        case R_ParseError::SegmentsInvalid:
+            return "Segments invalid (should be 1-16)";
+        case R_ParseError::SegmentsConflict:
+            return "--segments can't be combined with --instances, --stems, --nvram, --dump-emidi-loop-points, --start "
+                   "or --end-time";
+        case R_ParseError::VerifyWithoutSegments:
+            return "--verify-segments needs --segments";
+        case R_ParseError::JobsInvalid:
+            return "Jobs invalid (should be a number greater than 0)";
+        case R_ParseError::QueueDepthInvalid:
+            return "Queue depth invalid (should be a number of chunks, or 0 for no limit)";
+        case R_ParseError::BatchConflict:
+            return "--batch and --serve can't be combined with each other, an input, -o, --stdout, --instances, "
+                   "--stems, --segments, --nvram, --dump-emidi-loop-points, --perf-report, --stats-json, --pc-profile, "
+                   "--state-trace, --start or --end-time";
+        case R_ParseError::BatchOptionWithoutBatch:
+            return "--jobs and --report need --batch or --serve";
+        case R_ParseError::HashConflict:
+            return "--hash can't be combined with -o, --stdout, --stems, --batch or --serve";
+        case R_ParseError::FastSetupConflict:
+            return "--fast-setup can't be combined with --segments, --start or --end-time";
+        case R_ParseError::PCProfileUnsupported:
+            return "--pc-profile needs a build with NUKED_ENABLE_PC_PROFILING";
+        case R_ParseError::StateTraceIntervalInvalid:
+            return "State trace interval invalid (should be a number of milliseconds greater than 0)";
+        case R_ParseError::FLACFormatInvalid:
+            return "FLAC output needs -f s16 or s32";
+        case R_ParseError::CompareConflict:
+            return "--compare-state-traces can't be combined with an input, -o, --stdout, --hash, --batch or --serve";
+        case R_ParseError::AffinityInvalid:
+            return "Affinity invalid (should be none or cores)";
+        case R_ParseError::ThreadPolicyInvalid:
+            return "Thread policy invalid (should be default, throughput or realtime)";
     }
     return "Unknown error";
 }
 
+// Parses a comma separated list of groups of channels joined by '+', so that "1,2,3+4" renders channels 1 and 2 on
+// their own and channels 3 and 4 together. Every channel may only be in one group.
+bool R_ParseStemGroups(std::string_view str, std::vector<uint16_t>& groups)
+{
+    groups.clear();
+
+    if (str == "all")
+    {
+        return true;
+    }
+
+    uint16_t used = 0;
+    uint16_t group = 0;
+    size_t channel = 0;
+    bool has_digit = false;
+
+    for (size_t i = 0; i <= str.size(); ++i)
+    {
+        const char c = i < str.size() ? str[i] : ',';
+        if (c >= '0' && c <= '9')
+        {
+            channel = 10 * channel + (size_t)(c - '0');
+            has_digit = true;
+            if (channel > SMF_CHANNEL_COUNT)
+            {
+                return false;
+            }
+        }
+        else if (c == '+' || c == ',')
+        {
+            if (!has_digit || channel == 0)
+            {
+                return false;
+            }
+
+            const uint16_t bit = (uint16_t)(1 << (channel - 1));
+            if (used & bit)
+            {
+                return false;
+            }
+            used |= bit;
+            group |= bit;
+            channel = 0;
+            has_digit = false;
+
+            if (c == ',')
+            {
+                groups.push_back(group);
+                group = 0;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
 {
     CommandLineReader reader(argc, argv);
@@ -158,6 +341,26 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::InstancesOutOfRange;
             }
         }
+        else if (reader.Any("--split"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (reader.Arg() == "modulo")
+            {
+                result.split_mode = R_SplitMode::Modulo;
+            }
+            else if (reader.Arg() == "balanced")
+            {
+                result.split_mode = R_SplitMode::Balanced;
+            }
+            else
+            {
+                return R_ParseError::SplitInvalid;
+            }
+        }
         else if (reader.Any("-r", "--reset"))
         {
             if (!reader.Next())
@@ -204,6 +407,15 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
 
             result.nvram_filename = reader.Arg();
         }
+        else if (reader.Any("--reset-cache"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            result.reset_cache_directory = reader.Arg();
+        }
         else if (reader.Any("--romset"))
         {
             if (!reader.Next())
@@ -241,6 +453,19 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
         {
             result.output_stdout = true;
         }
+        else if (reader.Any("--hash"))
+        {
+            result.hash = true;
+        }
+        else if (reader.Any("--hash-instances"))
+        {
+            result.hash           = true;
+            result.hash_instances = true;
+        }
+        else if (reader.Any("--uncached-output"))
+        {
+            result.uncached_output = true;
+        }
         else if (reader.Any("--disable-oversampling"))
         {
             result.disable_oversampling = true;
@@ -257,10 +482,32 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::GainInvalid;
             }
         }
+        else if (reader.Any("--rate"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!reader.TryParse(result.output_rate) || result.output_rate < AudioResampler::MIN_RATE ||
+                result.output_rate > AudioResampler::MAX_RATE)
+            {
+                return R_ParseError::RateInvalid;
+            }
+        }
         else if (reader.Any("--legacy-romset-detection"))
         {
             result.legacy_romset_detection = true;
         }
+        else if (reader.Any("--rom-hash-cache"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            result.rom_hash_cache = reader.Arg();
+        }
         else if (reader.Any("--end"))
         {
             if (!reader.Next())
@@ -281,6 +528,30 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::EndInvalid;
             }
         }
+        else if (reader.Any("--start"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!R_ParseTimeString(reader.Arg(), result.start_ns))
+            {
+                return R_ParseError::TimeInvalid;
+            }
+        }
+        else if (reader.Any("--end-time"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!R_ParseTimeString(reader.Arg(), result.end_ns) || result.end_ns == 0)
+            {
+                return R_ParseError::TimeInvalid;
+            }
+        }
         else if (reader.Any("--override-rom1"))
         {
             if (!reader.Next())
@@ -357,998 +628,1124 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
         {
             result.dump_emidi_loop_points = true;
         }
-        else
+        else if (reader.Any("--stems"))
         {
-            if (result.input_filename.size())
+            if (!reader.Next())
             {
-                return R_ParseError::MultipleInputs;
+                return R_ParseError::UnexpectedEnd;
             }
-            result.input_filename = reader.Arg();
-        }
-    }
-
-    if (result.input_filename.size() == 0)
-    {
-        return R_ParseError::NoInput;
-    }
 
-    if (result.output_filename.size() == 0 && !result.output_stdout)
-    {
-        return R_ParseError::NoOutput;
-    }
+            if (!R_ParseStemGroups(reader.Arg(), result.stem_groups))
+            {
+                return R_ParseError::StemsInvalid;
+            }
+            result.stems = true;
+        }
+        else if (reader.Any("--stem-master"))
+        {
+            result.stem_master = true;
+        }
+        else if (reader.Any("--segments"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-    return R_ParseError::Success;
-}
+            if (!reader.TryParse(result.segments) || result.segments < 1 || result.segments > 16)
+            {
+                return R_ParseError::SegmentsInvalid;
+            }
+        }
+        else if (reader.Any("--verify-segments"))
+        {
+            result.verify_segments = true;
+        }
+        else if (reader.Any("--fast-setup"))
+        {
+            result.fast_setup = true;
+        }
+        else if (reader.Any("--queue-depth"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-[[noreturn]]
-void R_Panic(const char* msg, const std::source_location where = std::source_location::current())
-{
-    fprintf(stderr, "%s:%d: in %s: %s", where.file_name(), (int)where.line(), where.function_name(), msg);
-    exit(1);
-}
+            if (!reader.TryParse(result.queue_depth))
+            {
+                return R_ParseError::QueueDepthInvalid;
+            }
+        }
+        else if (reader.Any("--batch"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-// Audio frame chunk. Points to a header followed by a dynamically sized buffer containing audio data. The buffer
-// contains audio data. This type has reference semantics and represents unowned memory like a bare pointer, so take
-// care making copies of it.
-class R_FrameChunk
-{
-public:
-    [[nodiscard]]
-    static R_FrameChunk Alloc(size_t size_bytes)
-    {
-        R_FrameChunk c;
+            result.batch_filename = reader.Arg();
+        }
+        else if (reader.Any("--serve"))
+        {
+            result.serve = true;
+        }
+        else if (reader.Any("--report"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        // TODO: use a better allocator. We allocate a bit more space because malloc has weak alignment guarantees, and
-        // we want the buffer to be 64-byte aligned for max SIMD compatibility.
-        size_t alloc_size = 64 + sizeof(Header) + size_bytes;
+            result.report_filename = reader.Arg();
+        }
+        else if (reader.Any("-j", "--jobs"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        void* ptr = malloc(alloc_size);
-        if (!ptr)
+            if (!reader.TryParse(result.jobs) || result.jobs == 0)
+            {
+                return R_ParseError::JobsInvalid;
+            }
+        }
+        else if (reader.Any("--perf-report"))
         {
-            return c;
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            result.perf_report_filename = reader.Arg();
         }
+        else if (reader.Any("--stats-json"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        // This should never fail or adjust ptr so passing the aligned pointer back to free should be ok.
-        if (!std::align(alignof(Header), sizeof(Header), ptr, alloc_size))
+            result.stats_json_filename = reader.Arg();
+        }
+        else if (reader.Any("--pc-profile"))
         {
-            R_Panic("failed to align header");
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!NUKED_ENABLE_PC_PROFILING)
+            {
+                return R_ParseError::PCProfileUnsupported;
+            }
+
+            result.pc_profile_filename = reader.Arg();
         }
+        else if (reader.Any("--state-trace"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        Header* h = new (ptr) Header();
-        ptr = (uint8_t*)ptr + sizeof(Header);
+            result.state_trace_filename = reader.Arg();
+        }
+        else if (reader.Any("--state-trace-interval"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        if (!std::align(64, size_bytes, ptr, alloc_size))
+            uint64_t interval_ms = 0;
+            if (!reader.TryParse(interval_ms) || interval_ms == 0)
+            {
+                return R_ParseError::StateTraceIntervalInvalid;
+            }
+            result.state_trace_interval_ns = interval_ms * 1'000'000;
+        }
+        else if (reader.Any("--compare-state-traces"))
         {
-            R_Panic("failed to align buffer");
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+            result.compare_trace_a = reader.Arg();
+
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+            result.compare_trace_b = reader.Arg();
         }
+        else if (reader.Any("--affinity"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        h->buffer      = ptr;
-        c.m_alloc      = h;
-        c.m_alloc->cap = size_bytes;
+            if (reader.Arg() == "none")
+            {
+                result.pin_threads = false;
+            }
+            else if (reader.Arg() == "cores")
+            {
+                result.pin_threads = true;
+            }
+            else
+            {
+                return R_ParseError::AffinityInvalid;
+            }
+        }
+        else if (reader.Any("--thread-policy"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
 
-        return c;
+            if (reader.Arg() == "default")
+            {
+                result.thread_policy = ThreadPolicy::Default;
+            }
+            else if (reader.Arg() == "throughput")
+            {
+                result.thread_policy = ThreadPolicy::Throughput;
+            }
+            else if (reader.Arg() == "realtime")
+            {
+                result.thread_policy = ThreadPolicy::Realtime;
+            }
+            else
+            {
+                return R_ParseError::ThreadPolicyInvalid;
+            }
+        }
+        else
+        {
+            if (result.input_filename.size())
+            {
+                return R_ParseError::MultipleInputs;
+            }
+            result.input_filename = reader.Arg();
+        }
     }
 
-    static void Free(R_FrameChunk c)
+    // Comparing doesn't render anything
+    if (!result.compare_trace_a.empty())
     {
-        free(c.m_alloc);
-        c.m_alloc = nullptr;
-    }
+        if (result.input_filename.size() || result.output_filename.size() || result.output_stdout || result.hash ||
+            !result.batch_filename.empty() || result.serve)
+        {
+            return R_ParseError::CompareConflict;
+        }
 
-    [[nodiscard]]
-    size_t GetBufferLength() const
-    {
-        return m_alloc->len;
+        return R_ParseError::Success;
     }
 
-    [[nodiscard]]
-    void* DataFirst()
+    // Hashing replaces the one mixed output
+    if (result.hash && (result.output_filename.size() || result.output_stdout || result.stems ||
+                        !result.batch_filename.empty() || result.serve))
     {
-        return std::assume_aligned<64>(m_alloc->buffer);
+        return R_ParseError::HashConflict;
     }
 
-    [[nodiscard]]
-    void* DataLast()
+    // Segments start from checkpoints and time ranges from a primed emulator
+    if (result.fast_setup && (result.segments != 0 || result.start_ns != 0 || result.end_ns != 0))
     {
-        // We cannot assume the end is 64-byte aligned because audio frames may be much smaller.
-        return (uint8_t*)DataFirst() + m_alloc->len;
+        return R_ParseError::FastSetupConflict;
     }
 
-    void Write(const void* src, size_t src_len)
+    if (!result.batch_filename.empty() || result.serve)
     {
-        memcpy(DataLast(), src, src_len);
-        m_alloc->len += src_len;
+        // Each job brings its own input and output, and renders on a single emulator
+        if ((!result.batch_filename.empty() && result.serve) || result.input_filename.size() ||
+            result.output_filename.size() || result.output_stdout || result.instances != 1 || result.stems ||
+            result.segments != 0 || !result.nvram_filename.empty() || result.dump_emidi_loop_points ||
+            !result.perf_report_filename.empty() || !result.stats_json_filename.empty() ||
+            !result.pc_profile_filename.empty() ||
+            !result.state_trace_filename.empty() || result.start_ns != 0 || result.end_ns != 0)
+        {
+            return R_ParseError::BatchConflict;
+        }
+
+        return R_ParseError::Success;
     }
 
-    [[nodiscard]]
-    bool IsNull() const
+    if (result.jobs != 0 || !result.report_filename.empty())
     {
-        return m_alloc == nullptr;
+        return R_ParseError::BatchOptionWithoutBatch;
     }
 
-    void SetNext(R_FrameChunk c)
+    if (result.input_filename.size() == 0)
     {
-        m_alloc->next = c.m_alloc;
+        return R_ParseError::NoInput;
     }
 
-    [[nodiscard]]
-    R_FrameChunk GetNext()
+    if (result.output_filename.size() == 0 && !result.output_stdout && !result.hash)
     {
-        R_FrameChunk next;
-        next.m_alloc = m_alloc->next;
-        return next;
+        return R_ParseError::NoOutput;
     }
 
-    [[nodiscard]]
-    bool IsBufferFull() const
+    if (result.stem_master && !result.stems)
     {
-        return m_alloc->len == m_alloc->cap;
+        return R_ParseError::StemMasterWithoutStems;
     }
 
-private:
-    struct Header
+    if (result.stems)
     {
-        Header* next = nullptr;
-        size_t  len  = 0;
-        size_t  cap  = 0;
-        void*   buffer;
-    };
-
-private:
-    Header* m_alloc = nullptr;
-};
-
-// Manages a chunk and frees it when it goes out of scope, similar to unique_ptr. Code outside of the chunk queue should
-// only use this type.
-class R_OwnedChunk
-{
-public:
-    R_OwnedChunk() = default;
+        if (result.output_filename.size() == 0)
+        {
+            return R_ParseError::StemsNeedOutput;
+        }
 
-    explicit R_OwnedChunk(R_FrameChunk c)
-        : m_chunk(c)
-    {
+        if (result.instances != 1)
+        {
+            return R_ParseError::StemsWithInstances;
+        }
     }
 
-    ~R_OwnedChunk()
+    if (result.verify_segments && result.segments == 0)
     {
-        Free();
+        return R_ParseError::VerifyWithoutSegments;
     }
 
-    // Non-copyable
-    R_OwnedChunk(const R_OwnedChunk&)            = delete;
-    R_OwnedChunk& operator=(const R_OwnedChunk&) = delete;
-
-    // Moveable
-    R_OwnedChunk(R_OwnedChunk&& rhs)
+    if (result.segments != 0 && (result.instances != 1 || result.stems || !result.nvram_filename.empty() ||
+                                 result.dump_emidi_loop_points || result.start_ns != 0 || result.end_ns != 0))
     {
-        m_chunk = rhs.Unmanage();
+        return R_ParseError::SegmentsConflict;
     }
 
-    R_OwnedChunk& operator=(R_OwnedChunk&& rhs)
+    if (result.end_ns != 0 && result.end_ns <= result.start_ns)
     {
-        Free();
-        m_chunk = rhs.Unmanage();
-        return *this;
+        return R_ParseError::TimeRangeEmpty;
     }
 
-    void Free()
+    if (result.output_format == AudioFormat::F32 && WAV_IsFLACPath(result.output_filename))
     {
-        R_FrameChunk::Free(m_chunk);
-        m_chunk = R_FrameChunk();
+        return R_ParseError::FLACFormatInvalid;
     }
 
-    void Manage(R_FrameChunk rhs)
-    {
-        Free();
-        m_chunk = rhs;
-    }
+    return R_ParseError::Success;
+}
 
-    [[nodiscard]]
-    R_FrameChunk Unmanage()
+// Names a stem after the channels in it, e.g. out.wav becomes out_ch03+04.wav.
+std::filesystem::path R_GetStemPath(const std::filesystem::path& output, uint16_t group)
+{
+    std::string suffix = "_ch";
+    bool first = true;
+    for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
     {
-        R_FrameChunk ptr = m_chunk;
-        m_chunk          = R_FrameChunk();
-        return ptr;
+        if (group & (1 << channel))
+        {
+            if (!first)
+            {
+                suffix += '+';
+            }
+            if (channel + 1 < 10)
+            {
+                suffix += '0';
+            }
+            suffix += std::to_string(channel + 1);
+            first = false;
+        }
     }
 
-    void Write(const void* src, size_t src_len)
-    {
-        m_chunk.Write(src, src_len);
-    }
+    std::filesystem::path result = output.parent_path() / output.stem();
+    result += suffix;
+    result += output.extension();
+    return result;
+}
+
+void R_CursorUpLines(int n)
+{
+    fprintf(stderr, "\x1b[%dF", n);
+}
 
-    [[nodiscard]]
-    bool IsBufferFull() const
+// Writes the mixed audio of a render to a WAVE file or stdout.
+class R_WAVSink : public R_AudioSink
+{
+public:
+    R_WAVSink(WAV_Handle& output, AudioFormat format)
+        : m_output(output)
+        , m_format(format)
     {
-        return m_chunk.IsBufferFull();
     }
 
-    [[nodiscard]]
-    void* DataFirst()
+    bool Start(uint32_t sample_rate) override
     {
-        return m_chunk.DataFirst();
+        m_output.SetSampleRate(sample_rate);
+        return true;
     }
 
-    [[nodiscard]]
-    void* DataLast()
+    bool Write(std::span<const uint8_t> frames) override
     {
-        return m_chunk.DataLast();
+        switch (m_format)
+        {
+        case AudioFormat::S16:
+            WriteAs<int16_t>(frames);
+            break;
+        case AudioFormat::S32:
+            WriteAs<int32_t>(frames);
+            break;
+        case AudioFormat::F32:
+            WriteAs<float>(frames);
+            break;
+        }
+        // Write errors are reported by Finish
+        return true;
     }
 
-    [[nodiscard]]
-    bool IsNull() const
+    bool Finish() override
     {
-        return m_chunk.IsNull();
+        return m_output.Finish();
     }
 
-    [[nodiscard]]
-    size_t GetBufferLength() const
+private:
+    template <typename T>
+    void WriteAs(std::span<const uint8_t> frames)
     {
-        return m_chunk.GetBufferLength();
+        m_output.Write(std::span((const AudioFrame<T>*)frames.data(), frames.size() / sizeof(AudioFrame<T>)));
     }
 
-private:
-    R_FrameChunk m_chunk;
+    WAV_Handle& m_output;
+    AudioFormat m_format;
 };
 
-// Threadsafe queue for chunks of audio. The intent is that emulators should be able to expand the queue as fast as
-// possible while it may drain at a different rate. Contention is kept low by creating chunks of data and enqueuing or
-// dequeuing chunks at a time. For a buffer size of ~64k, expect each thread to take a lock once per second.
-class R_ChunkQueue
+// Hashes the mixed audio of a render instead of writing it anywhere. The digest covers the same bytes as the data
+// chunk of the equivalent WAVE file.
+class R_HashSink : public R_AudioSink
 {
 public:
-    R_ChunkQueue() = default;
-
-    void Enqueue(R_OwnedChunk chunk)
+    R_HashSink()
     {
-        std::scoped_lock lk(m_mutex);
+        SHA256Reset(&m_context);
+    }
 
-        R_FrameChunk raw = chunk.Unmanage();
-        if (!m_last.IsNull())
-        {
-            m_last.SetNext(raw);
-            m_last = raw;
-        }
-        else
-        {
-            m_first = raw;
-            m_last  = raw;
-        }
-        ++m_count;
+    bool Start(uint32_t sample_rate) override
+    {
+        (void)sample_rate;
+        return true;
     }
 
-    void Dequeue(R_OwnedChunk& chunk)
+    bool Write(std::span<const uint8_t> frames) override
     {
-        std::scoped_lock lk(m_mutex);
+        R_HashBytes(m_context, frames);
+        return true;
+    }
 
-        if (!m_first.IsNull())
-        {
-            chunk.Manage(m_first);
-            m_first = m_first.GetNext();
-            if (m_first.IsNull())
-            {
-                m_last = m_first;
-            }
-        }
-        else
-        {
-            R_Panic("empty queue");
-        }
-        --m_count;
+    bool Finish() override
+    {
+        return true;
     }
 
-    size_t ChunkCount() const
+    SHA256Context& GetContext()
     {
-        return m_count;
+        return m_context;
     }
 
 private:
-    std::mutex          m_mutex;
-    R_FrameChunk        m_first;
-    R_FrameChunk        m_last;
-    std::atomic<size_t> m_count = 0;
+    SHA256Context m_context;
 };
 
-class R_Mixer
+// Loads the romset selected by `params` into an image that any number of emulators can share. Prints diagnostics
+// and returns null if it can't be loaded.
+std::shared_ptr<const SharedRomImage> R_LoadRomImage(const R_Parameters& params)
 {
-public:
-    // Blocks the calling thread until there's enough data in queues to mix.
-    void WaitForWork()
-    {
-        std::unique_lock lk(m_mutex);
-        m_cond.wait(lk, [this]() { return GetReadyChunkCount() > 0; });
-    }
+    AllRomsetInfo romset_info;
 
-    // Returns chunk size in frame count.
-    size_t GetChunkSize() const
-    {
-        return m_chunk_size;
-    }
+    common::LoadRomsetResult load_result;
 
-    size_t GetFramesWritten(size_t queue_id) const
-    {
-        return m_frames_written[queue_id];
-    }
+    common::LoadRomsetError err = common::LoadRomset(romset_info,
+                                                     params.rom_directory,
+                                                     params.romset_name,
+                                                     params.legacy_romset_detection,
+                                                     params.adv.rom_overrides,
+                                                     params.rom_hash_cache,
+                                                     load_result);
 
-    // Sets number of queues and prepares a chunk builder for each.
-    // precondition: 0 <= count <= QUEUE_COUNT
-    template <typename T>
-    void SetQueueCount(size_t count)
-    {
-        m_queues_in_use = count;
-        for (size_t i = 0; i < count; ++i)
-        {
-            m_chunks[i] = AllocChunk<T>();
-        }
-    }
+    common::PrintLoadRomsetDiagnostics(stderr, err, load_result, romset_info);
 
-    // Writes a frame to the chunk currently being built for queue_id. If the chunk becomes full, it is moved into its
-    // queue and a new chunk becomes available.
-    template <typename T>
-    void SubmitFrame(size_t queue_id, const AudioFrame<T>& frame)
+    if (err != common::LoadRomsetError{})
     {
-        m_chunks[queue_id].Write(&frame, sizeof(frame));
-        if (m_chunks[queue_id].IsBufferFull())
-        {
-            m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
-            m_cond.notify_one();
-            m_chunks[queue_id] = AllocChunk<T>();
-        }
-        ++m_frames_written[queue_id];
+        return nullptr;
     }
 
-    // Enqueues whatever data is left in the chunk builder for queue_id and marks it as complete. After this call, no
-    // more data may be submitted to queue_id.
-    void MarkComplete(size_t queue_id)
+    std::shared_ptr<const SharedRomImage> rom_image = EMU_CreateRomImage(load_result.romset, romset_info);
+    if (!rom_image)
     {
-        m_queue_complete[queue_id] = true;
-        m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
-        m_cond.notify_one();
+        fprintf(stderr, "FATAL: Failed to load roms\n");
     }
+    return rom_image;
+}
 
-    // Returns the number N of chunks that can be dequeued from each queue to call MixFrames N times.
-    size_t GetReadyChunkCount()
+EMU_SystemReset R_PickReset(const R_Parameters& params, Romset romset)
+{
+    if (params.reset)
     {
-        size_t count = (size_t)-1;
-        for (size_t i = 0; i < m_queues_in_use; ++i)
-        {
-            // It seems possible to end up in a rare state where e.g. at the end of the midi we have two queues marked
-            // as complete but only one has data. Normally this shouldn't happen because the emulators should be stepped
-            // for roughly the same amount of time and produce roughly the same number of samples. I have not
-            // encountered this problem yet, but multi instance rendering tends to desync slightly. On some midi files,
-            // one emulator steps for longer than the other despite the two sharing end-of-track messages with the same
-            // SMF tick timestamp. I can only guess this is caused by the integer division converting SMF ticks to
-            // microseconds. Until I can find a good test midi or construct one I'm not sure how to solve this, or if
-            // it's even a real problem. However, I have observed 400us/28 frame differences.
-            //
-            // To try to deal with this, we do not consider queues marked as complete and having zero chunks, as they
-            // will never receive new data. However, if another queue is incomplete and has zero chunks, the emulator
-            // responsible for filling that queue will enqueue one eventually. In that case, MixFrames should still mix
-            // samples from that queue without waiting for the complete queue.
-
-            size_t cc = m_queues[i].ChunkCount();
-            if (!(m_queue_complete[i] && cc == 0))
-            {
-                count = Min(count, cc);
-            }
-        }
-        return count;
+        return *params.reset;
     }
 
-    // Dequeues a chunk from each queue and mixes the corresponding audio frames from each chunk into a single buffer.
-    // precondition: GetReadyChunkCount() > 0
-    template <typename T, typename MixFn>
-    size_t MixFrames(std::vector<AudioFrame<T>>& output_buffer, MixFn mix)
+    if (romset == Romset::MK2)
     {
-        output_buffer.clear();
-
-        R_OwnedChunk chunks[QUEUE_COUNT];
+        // user didn't explicitly pass a reset and we're using a buggy romset
+        fprintf(stderr, "WARNING: No reset specified with mk2 romset; using gs\n");
+        return EMU_SystemReset::GS_RESET;
+    }
 
-        // precalcluate the output buffer size so that we don't need to bounds check or reallocate in the mix loop
-        size_t size_requested = 0;
+    return EMU_SystemReset::NONE;
+}
 
-        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
-        {
-            size_t cc = m_queues[queue_id].ChunkCount();
-            if (m_queue_complete[queue_id] && cc == 0)
-            {
-                // See comment in GetReadyChunkCount.
-                continue;
-            }
-            m_queues[queue_id].Dequeue(chunks[queue_id]);
-            size_requested = std::max(size_requested, chunks[queue_id].GetBufferLength());
-        }
+// Compares a segmented render against a serial render of the same track and prints how they differ.
+bool R_CompareRenders(std::span<const uint8_t> segmented, std::span<const uint8_t> serial, size_t frame_size)
+{
+    const size_t segmented_frames = segmented.size() / frame_size;
+    const size_t serial_frames    = serial.size() / frame_size;
 
-        output_buffer.resize(size_requested / sizeof(AudioFrame<T>));
-        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
+    size_t first_difference = 0;
+    size_t differing_frames = 0;
+    for (size_t frame = 0; frame < Min(segmented_frames, serial_frames); ++frame)
+    {
+        if (memcmp(&segmented[frame * frame_size], &serial[frame * frame_size], frame_size) != 0)
         {
-            if (chunks[queue_id].IsNull())
+            if (differing_frames == 0)
             {
-                // Attempt to deal with errors from the prior loop
-                continue;
+                first_difference = frame;
             }
-            mix(output_buffer.data(), chunks[queue_id].DataFirst(), chunks[queue_id].DataLast());
+            ++differing_frames;
         }
-
-        return size_requested / sizeof(AudioFrame<T>);
     }
 
-    // Returns true when all queues are marked as complete and are empty.
-    bool IsFinished() const
+    if (differing_frames == 0 && segmented_frames == serial_frames)
     {
-        for (size_t i = 0; i < m_queues_in_use; ++i)
-        {
-            if (!m_queue_complete[i] || m_queues[i].ChunkCount() != 0)
-            {
-                return false;
-            }
-        }
-
+        fprintf(stderr, "Verified: segmented render is identical to a serial render\n");
         return true;
     }
 
-private:
-    template <typename T>
-    R_OwnedChunk AllocChunk()
+    if (segmented_frames != serial_frames)
     {
-        R_FrameChunk raw = R_FrameChunk::Alloc(m_chunk_size * sizeof(AudioFrame<T>));
-        return R_OwnedChunk(raw);
+        fprintf(stderr,
+                "VERIFY FAILED: segmented render has %zu frames but serial render has %zu\n",
+                segmented_frames,
+                serial_frames);
     }
-
-    void DebugPrintQueues()
+    if (differing_frames != 0)
     {
-        for (size_t i = 0; i < m_queues_in_use; ++i)
-        {
-            fprintf(stderr, "Queue %zu has %zu chunks\n", i, m_queues[i].ChunkCount());
-        }
+        fprintf(stderr,
+                "VERIFY FAILED: %zu frames differ, the first at frame %zu\n",
+                differing_frames,
+                first_difference);
     }
+    return false;
+}
 
-private:
-    // a bit less than 1 second of audio
-    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
-    // one queue per emulator
-    static constexpr size_t QUEUE_COUNT = 16;
-
-    R_ChunkQueue m_queues[QUEUE_COUNT];
-    R_OwnedChunk m_chunks[QUEUE_COUNT];
-    bool         m_queue_complete[QUEUE_COUNT]{};
-    size_t       m_frames_written[QUEUE_COUNT]{};
-
-    size_t m_queues_in_use = 0;
-
-    // Size of chunks in bytes.
-    size_t m_chunk_size = DEFAULT_CHUNK_SIZE;
-
-    // Synchronization between producers/consumer.
-    std::mutex              m_mutex;
-    std::condition_variable m_cond;
-};
-
-enum R_LoopPointType
-{
-    Start,
-    End,
-};
-
-struct R_LoopPoint
-{
-    R_LoopPointType type;
-    uint64_t        frame;
-    uint64_t        timestamp_ns;
-    uint16_t        midi_track;
-    uint8_t         midi_channel;
-};
-
-class R_LoopPointRecorder
+// Writes how fast the instances rendered to `filename`. The instances run in parallel, so the slowest one decides how
+// long the render took. The reset and writing the output aren't included.
+bool R_WritePerfReport(const std::filesystem::path& filename, std::span<const R_TrackRenderState> states)
 {
-public:
-    void Record(const R_LoopPoint& point)
+    FILE* report = fopen(filename.string().c_str(), "w");
+    if (!report)
     {
-        std::scoped_lock lk(m_mutex);
-        m_loop_points.emplace_back(point);
+        return false;
     }
 
-    void SortByTrack()
+    // A time range starts every instance at the same time, which isn't emulated
+    uint64_t start_ns    = UINT64_MAX;
+    uint64_t emulated_ns = 0;
+    double   render_sec  = 0;
+    for (const R_TrackRenderState& state : states)
     {
-        std::stable_sort(m_loop_points.begin(), m_loop_points.end(), [](const auto& a, const auto& b) {
-            return a.midi_track < b.midi_track;
-        });
+        start_ns    = std::min<uint64_t>(start_ns, state.segment ? state.segment->start_ns : 0);
+        emulated_ns = std::max<uint64_t>(emulated_ns, state.ns_simulated);
+        render_sec  = std::max(render_sec, std::chrono::duration<double>(state.elapsed).count());
     }
+    const double emulated_sec = (double)(emulated_ns - std::min(start_ns, emulated_ns)) / 1e9;
 
-    std::span<const R_LoopPoint> GetLoopPoints() const
+    fprintf(report,
+            "{\"emulated_seconds\":%.6f,\"render_seconds\":%.6f,\"speed\":%.6f,\"instance_seconds\":[",
+            emulated_sec,
+            render_sec,
+            render_sec > 0 ? emulated_sec / render_sec : 0.0);
+    for (size_t i = 0; i < states.size(); ++i)
     {
-        return m_loop_points;
+        fprintf(report, "%s%.6f", i ? "," : "", std::chrono::duration<double>(states[i].elapsed).count());
     }
+    fprintf(report, "]}\n");
 
-private:
-    std::mutex                    m_mutex;
-    std::vector<R_LoopPoint> m_loop_points;
-};
+    return fclose(report) == 0;
+}
 
-struct R_TrackRenderState
+// Writes what each part of the render spent its time on to `filename`, so that whatever schedules renders can tell
+// whether more instances would help. `mixer` and `mix_out` are null when there is no mix thread.
+bool R_WriteStatsReport(const std::filesystem::path&                 filename,
+                        std::span<const R_TrackRenderState>          states,
+                        const R_Mixer*                               mixer,
+                        const R_MixOutState*                         mix_out,
+                        uint64_t                                     ns_per_step,
+                        std::chrono::high_resolution_clock::duration wall_time)
 {
-    Emulator emu;
-    R_Mixer* mixer = nullptr;
-    size_t queue_id = 0;
-    size_t ns_simulated = 0;
-    const SMF_Track* track = nullptr;
-    std::thread thread;
-    std::chrono::high_resolution_clock::duration elapsed;
-    size_t num_silent_frames = 0;
-    R_EndBehavior end_behavior;
-    R_LoopPointRecorder* loop_recorder;
-    AudioFormat output_format;
-    float gain = 1.0f;
-
-    // these fields are accessed from main thread during render process
-    std::atomic<size_t> events_processed = 0;
-    std::atomic<bool> done;
-};
+    using Seconds = std::chrono::duration<double>;
 
-struct R_SilenceModelNone
-{
-    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    FILE* report = fopen(filename.string().c_str(), "w");
+    if (!report)
     {
-        (void)in_raw;
         return false;
     }
-};
-
-struct R_SilenceModelGeneric
-{
-    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
-    {
-        // The emulator doesn't produce exact zeroes when no notes are playing.
-        constexpr int32_t MIN = -0x4000;
-        constexpr int32_t MAX = +0x4000;
-        return MIN <= in_raw.left && in_raw.left <= MAX && MIN <= in_raw.right && in_raw.right <= MAX;
-    }
-};
 
-struct R_SilenceModelMK1
-{
-    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    fprintf(report, "{\"wall_seconds\":%.6f,\"instances\":[", Seconds(wall_time).count());
+    for (size_t i = 0; i < states.size(); ++i)
     {
-        // MK1 has a DC offset. TODO: Maybe want thresholds too?
-        return in_raw.left == 0x1000000 && in_raw.right == 0x1000000;
-    }
-};
-
-template <typename SampleT, typename SilenceModel, bool ApplyGain>
-void R_ReceiveSample(void* userdata, const AudioFrame<int32_t>& in)
-{
-    R_TrackRenderState* state = (R_TrackRenderState*)userdata;
+        const R_TrackRenderState& state = states[i];
 
-    AudioFrame<SampleT> out;
-    Normalize(in, out);
+        const uint64_t start_ns    = state.segment ? state.segment->start_ns : 0;
+        const uint64_t emulated_ns = state.ns_simulated - std::min(start_ns, state.ns_simulated);
+        const double   render_sec  = Seconds(state.elapsed).count();
+        const double   steps       = (double)(emulated_ns / ns_per_step);
 
-    // Skip silence processing until end of track
-    if constexpr (!std::is_same_v<SilenceModel, R_SilenceModelNone>)
-    {
-        if (SilenceModel::IsSilence(in))
-        {
-            ++state->num_silent_frames;
-        }
-        else
+        fprintf(report,
+                "%s{\"emulated_seconds\":%.6f,\"render_seconds\":%.6f,\"steps_per_second\":%.1f,"
+                "\"events_processed\":%zu,\"events_total\":%zu,\"frames_rendered\":%zu",
+                i ? "," : "",
+                (double)emulated_ns / 1e9,
+                render_sec,
+                render_sec > 0 ? steps / render_sec : 0.0,
+                state.events_processed.load(),
+                R_GetEventCount(state),
+                state.frames_rendered.load());
+        if (mixer)
         {
-            state->num_silent_frames = 0;
+            fprintf(report, ",\"max_queue_depth\":%zu", mixer->GetMaxQueueDepthReached(state.queue_id));
         }
+        fprintf(report, "}");
     }
+    fprintf(report, "]");
 
-    if constexpr (ApplyGain)
+    if (mix_out)
     {
-        Scale(out, state->gain);
+        const double write_sec = Seconds(mix_out->write_time).count();
+        fprintf(report,
+                ",\"mixer\":{\"frames_mixed\":%zu,\"wait_seconds\":%.6f},"
+                "\"output\":{\"bytes_written\":%llu,\"write_seconds\":%.6f,\"bytes_per_second\":%.1f}",
+                mix_out->frames_mixed.load(),
+                Seconds(mix_out->wait_time).count(),
+                (unsigned long long)mix_out->bytes_written,
+                write_sec,
+                write_sec > 0 ? (double)mix_out->bytes_written / write_sec : 0.0);
     }
+    fprintf(report, "}\n");
 
-    state->mixer->SubmitFrame(state->queue_id, out);
+    return fclose(report) == 0;
 }
 
-void R_RunReset(Emulator& emu, EMU_SystemReset reset)
+// Writes every checkpoint of `traces` to `filename`, one `<instance> <ns> <hash>` line each.
+bool R_WriteStateTrace(const std::filesystem::path& filename, std::span<const R_StateTrace> traces)
 {
-    emu.PostSystemReset(reset);
+    FILE* output = fopen(filename.string().c_str(), "w");
+    if (!output)
+    {
+        return false;
+    }
 
-    for (size_t i = 0; i < 24'000'000; ++i)
+    for (size_t i = 0; i < traces.size(); ++i)
     {
-        emu.Step();
+        for (const R_StateTrace::Checkpoint& checkpoint : traces[i].checkpoints)
+        {
+            fprintf(output,
+                    "%zu %llu %016llx\n",
+                    i,
+                    (unsigned long long)checkpoint.ns,
+                    (unsigned long long)checkpoint.hash);
+        }
     }
-}
 
-void R_PostEvent(Emulator& emu, const SMF_Data& data, const SMF_Event& ev)
-{
-    emu.PostMIDI(ev.status);
-    emu.PostMIDI(ev.GetData(data.bytes));
+    return fclose(output) == 0;
 }
 
-struct R_TrackList
+// Reads a file written by R_WriteStateTrace into one list of checkpoints per instance.
+bool R_ReadStateTrace(const std::filesystem::path& filename, std::vector<std::vector<R_StateTrace::Checkpoint>>& traces)
 {
-    std::vector<SMF_Track> tracks;
-};
+    FILE* input = fopen(filename.string().c_str(), "r");
+    if (!input)
+    {
+        return false;
+    }
 
-// Splits a track into `n` tracks, each track can be processed by a single
-// emulator instance.
-R_TrackList R_SplitTrackModulo(const SMF_Track& merged_track, size_t n)
-{
-    R_TrackList result;
-    result.tracks.resize(n);
+    traces.clear();
 
-    for (auto& event : merged_track.events)
+    size_t             instance = 0;
+    unsigned long long ns       = 0;
+    unsigned long long hash     = 0;
+    int                matched  = 0;
+    while ((matched = fscanf(input, "%zu %llu %llx", &instance, &ns, &hash)) == 3)
     {
-        // System events need to be processed by all emulators
-        if (event.IsSystem())
+        if (instance >= SMF_CHANNEL_COUNT)
         {
-            for (auto& dest : result.tracks)
-            {
-                dest.events.emplace_back(event);
-            }
+            break;
         }
-        else
+        if (instance >= traces.size())
         {
-            auto& dest = result.tracks[event.GetChannel() % n];
-            dest.events.emplace_back(event);
+            traces.resize(instance + 1);
         }
+        traces[instance].push_back({.ns = ns, .hash = hash});
     }
 
-    for (auto& track : result.tracks)
-    {
-        SMF_SetDeltasFromTimestamps(track);
-    }
-
-    return result;
+    const bool complete = matched == EOF && !ferror(input);
+    fclose(input);
+    return complete;
 }
 
-uint64_t R_NSPerStep(Emulator& emu)
+// Finds the earliest checkpoint where two state traces of the same track differ. Returns true if they match.
+bool R_CompareStateTraces(const std::filesystem::path& filename_a, const std::filesystem::path& filename_b)
 {
-    // These are best guesses.
-    if (emu.GetMCU().is_mk1)
+    std::vector<std::vector<R_StateTrace::Checkpoint>> traces[2];
+    for (const auto& [trace, filename] : {std::pair{&traces[0], &filename_a}, std::pair{&traces[1], &filename_b}})
     {
-        return 600;
+        if (!R_ReadStateTrace(*filename, *trace))
+        {
+            fprintf(stderr, "FATAL: Failed to read state trace %s\n", filename->string().c_str());
+            return false;
+        }
     }
-    else
+
+    if (traces[0].size() != traces[1].size())
     {
-        return 500;
+        fprintf(stderr, "Traces have different instance counts: %zu and %zu\n", traces[0].size(), traces[1].size());
+        return false;
     }
-}
 
-void R_NsToTimeString(uint64_t ns, std::string& result)
-{
-    // one second in nanoseconds
-    constexpr uint64_t ONE_SEC = 1'000'000'000;
+    // Instances don't affect each other, so each one diverges on its own; the earliest divergence is the one to chase
+    size_t   diverged_instance   = SIZE_MAX;
+    size_t   diverged_checkpoint = 0;
+    uint64_t diverged_ns         = UINT64_MAX;
+    size_t   checkpoint_count    = 0;
+    for (size_t i = 0; i < traces[0].size(); ++i)
+    {
+        const std::vector<R_StateTrace::Checkpoint>& a = traces[0][i];
+        const std::vector<R_StateTrace::Checkpoint>& b = traces[1][i];
+
+        const size_t common = std::min(a.size(), b.size());
+        size_t       j      = 0;
+        while (j < common && a[j].ns == b[j].ns && a[j].hash == b[j].hash)
+        {
+            ++j;
+        }
+        checkpoint_count += j;
 
-    const uint64_t min  = ns / (60 * ONE_SEC);
-    const uint64_t sec  = (ns / ONE_SEC) % 60;
-    const uint64_t fsec = (uint64_t)(100.0 * ((double)(ns % ONE_SEC) / (double)ONE_SEC));
+        if (j == a.size() && j == b.size())
+        {
+            continue;
+        }
+
+        const uint64_t ns = j < common ? std::min(a[j].ns, b[j].ns) : (j < a.size() ? a[j].ns : b[j].ns);
+        if (ns < diverged_ns)
+        {
+            diverged_instance   = i;
+            diverged_checkpoint = j;
+            diverged_ns         = ns;
+        }
+    }
 
-    result.clear();
-    if (min < 10)
+    if (diverged_instance == SIZE_MAX)
     {
-        result += '0';
+        fprintf(stderr, "Traces match (%zu checkpoints)\n", checkpoint_count);
+        return true;
     }
-    result += std::to_string(min);
-    result += ':';
-    if (sec < 10)
+
+    const std::vector<R_StateTrace::Checkpoint>& a = traces[0][diverged_instance];
+    const std::vector<R_StateTrace::Checkpoint>& b = traces[1][diverged_instance];
+
+    fprintf(stderr,
+            "Traces diverge on instance #%02zu at %.6fs (checkpoint %zu)\n",
+            diverged_instance,
+            (double)diverged_ns / 1e9,
+            diverged_checkpoint);
+    if (diverged_checkpoint != 0)
     {
-        result += '0';
+        fprintf(stderr, "  last match at %.6fs\n", (double)a[diverged_checkpoint - 1].ns / 1e9);
     }
-    result += std::to_string(sec);
-    result += '.';
-    if (fsec < 10)
+    for (const auto& [name, trace] : {std::pair{"a", &a}, std::pair{"b", &b}})
     {
-        result += '0';
+        if (diverged_checkpoint < trace->size())
+        {
+            const R_StateTrace::Checkpoint& checkpoint = (*trace)[diverged_checkpoint];
+            fprintf(stderr,
+                    "  %s: %.6fs %016llx\n",
+                    name,
+                    (double)checkpoint.ns / 1e9,
+                    (unsigned long long)checkpoint.hash);
+        }
+        else
+        {
+            fprintf(stderr, "  %s: ends here\n", name);
+        }
     }
-    result += std::to_string(fsec);
+    return false;
 }
 
-bool R_IsEMIDILoopStart(const SMF_Data& data, const SMF_Event& ev)
+bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
 {
-    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 116;
-}
+    auto t_start = std::chrono::high_resolution_clock::now();
 
-bool R_IsEMIDILoopEnd(const SMF_Data& data, const SMF_Event& ev)
-{
-    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 117;
-}
+    // First combine all of the events so it's easier to process
+    const SMF_Track     merged_track = SMF_MergeTracks(data);
+    const SMF_TrackView merged_view  = SMF_ViewTrack(merged_track);
 
-template <typename SilenceModel>
-constexpr mcu_sample_callback R_PickCallback(const R_TrackRenderState& state)
-{
-    if (state.gain != 1.0f)
+    // Stems get one emulator instance per channel group
+    std::vector<uint16_t> stem_groups;
+    if (params.stems)
     {
-        switch (state.output_format)
+        stem_groups = params.stem_groups.empty() ? R_GroupUsedChannels(merged_track) : params.stem_groups;
+        if (stem_groups.empty())
         {
-        case AudioFormat::S16:
-            return R_ReceiveSample<int16_t, SilenceModel, true>;
-        case AudioFormat::S32:
-            return R_ReceiveSample<int32_t, SilenceModel, true>;
-        case AudioFormat::F32:
-            return R_ReceiveSample<float, SilenceModel, true>;
+            fprintf(stderr, "FATAL: No channels to render stems for\n");
+            return false;
         }
     }
-    else
+
+    // All instances read from the same copy of the roms
+    const std::shared_ptr<const SharedRomImage> rom_image = R_LoadRomImage(params);
+    if (!rom_image)
     {
-        switch (state.output_format)
-        {
-        case AudioFormat::S16:
-            return R_ReceiveSample<int16_t, SilenceModel, false>;
-        case AudioFormat::S32:
-            return R_ReceiveSample<int32_t, SilenceModel, false>;
-        case AudioFormat::F32:
-            return R_ReceiveSample<float, SilenceModel, false>;
-        }
+        return false;
     }
 
-    fprintf(stderr, "output_format = %d\n", (int)state.output_format);
-    fprintf(stderr, "gain = %f\n", state.gain);
-    R_Panic("no valid callback for state");
-}
-
-void R_RenderOne(const SMF_Data& data, R_TrackRenderState& state)
-{
-    uint64_t division = data.header.division;
-    uint64_t us_per_qn = 500000;
+    const EMU_SystemReset reset = R_PickReset(params, rom_image->romset);
 
-    const SMF_Track& track = (const SMF_Track&)*state.track;
+    // Computed once here so that every instance fires shared events like tempo changes at the same step
+    const std::vector<uint64_t> event_times = R_ComputeEventTimes(data, merged_track, R_NSPerStep(rom_image->romset));
 
-    const uint64_t ns_per_step = R_NSPerStep(state.emu);
+    fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
 
-    auto t_start = std::chrono::high_resolution_clock::now();
-    for (const SMF_Event& event : track.events)
+    // Segments get one emulator instance each and all render from the merged track
+    std::vector<R_Segment> segments;
+    if (params.segments != 0)
     {
-        const uint64_t this_event_time_ns =
-            state.ns_simulated + 1000 * SMF_TicksToUS(event.delta_time, us_per_qn, division);
-
-        while (state.ns_simulated < this_event_time_ns)
+        segments = R_SplitTrackSegments(merged_view, event_times, params.segments);
+        if (segments.size() == 1)
         {
-            state.emu.Step();
-            state.ns_simulated += ns_per_step;
+            fprintf(stderr, "WARNING: Track is too short to cut; rendering it in one segment\n");
         }
 
-        if (event.IsTempo(data.bytes))
+        std::string time_str;
+        for (size_t i = 0; i < segments.size(); ++i)
         {
-            us_per_qn = event.GetTempoUS(data.bytes);
+            R_NsToTimeString(segments[i].start_ns, time_str);
+            fprintf(stderr, "Segment #%02zu: starts at %s\n", i, time_str.c_str());
         }
+    }
 
-        // Fire the event.
-        if (!event.IsMetaEvent())
-        {
-            R_PostEvent(state.emu, data, event);
-        }
+    size_t instances = params.instances;
+    if (params.stems)
+    {
+        instances = stem_groups.size();
+    }
+    else if (params.segments != 0)
+    {
+        instances = segments.size();
+    }
+
+    // A single segment already is a serial render
+    const bool verify_segments = params.verify_segments && segments.size() > 1;
 
-        // Save loop points - they will be processed on the main thread later
-        if (R_IsEMIDILoopStart(data, event))
+    // The mixed output is the only output unless rendering stems
+    const bool render_master = !params.stems || params.stem_master;
+
+    // Channels rendered by each instance and the work they're estimated to generate, for the debug summary
+    const std::array<uint64_t, SMF_CHANNEL_COUNT> channel_load = R_EstimateChannelLoad(data, merged_track);
+    std::vector<uint16_t>                         instance_channels;
+
+    // Then create a track specifically for each emulator instance
+    R_TrackList split_tracks;
+    if (params.stems)
+    {
+        instance_channels = stem_groups;
+        split_tracks      = R_SplitTrackByGroup(merged_track, stem_groups);
+    }
+    else if (params.segments == 0)
+    {
+        if (params.split_mode == R_SplitMode::Balanced)
         {
-            state.loop_recorder->Record({
-                .type         = R_LoopPointType::Start,
-                .frame        = state.mixer->GetFramesWritten(state.queue_id),
-                .timestamp_ns = state.ns_simulated,
-                .midi_track   = event.track_id,
-                .midi_channel = event.GetChannel(),
-            });
+            instance_channels = R_BalanceChannels(channel_load, instances);
+            split_tracks      = R_SplitTrackByGroup(merged_track, instance_channels);
         }
-        else if (R_IsEMIDILoopEnd(data, event))
+        else
         {
-            state.loop_recorder->Record({
-                .type         = R_LoopPointType::End,
-                .frame        = state.mixer->GetFramesWritten(state.queue_id),
-                .timestamp_ns = state.ns_simulated,
-                .midi_track   = event.track_id,
-                .midi_channel = event.GetChannel(),
-            });
+            instance_channels.resize(instances);
+            for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+            {
+                instance_channels[channel % instances] |= (uint16_t)(1 << channel);
+            }
+            split_tracks = R_SplitTrackModulo(merged_track, instances);
         }
-
-        ++state.events_processed;
     }
 
-    if (state.end_behavior == R_EndBehavior::Release)
+    // With a time range, each instance renders its own events within it
+    std::vector<R_Segment> ranges;
+    if (params.start_ns != 0 || params.end_ns != 0)
     {
-        // Enable silence processing callback
-        if (state.emu.GetMCU().is_mk1)
-        {
-            state.emu.SetSampleCallback(R_PickCallback<R_SilenceModelMK1>(state), &state);
-        }
-        else
+        const uint64_t ns_per_step = R_NSPerStep(rom_image->romset);
+        for (const SMF_TrackView& track : split_tracks.tracks)
         {
-            state.emu.SetSampleCallback(R_PickCallback<R_SilenceModelGeneric>(state), &state);
+            ranges.push_back(R_SegmentFromTimeRange(track, event_times, ns_per_step, params.start_ns, params.end_ns));
         }
 
-        const uint32_t frequency = PCM_GetOutputFrequency(state.emu.GetPCM());
-        // TODO: make this configurable? do we care? currently 100ms
-        const size_t silence_time = frequency / 10;
-        while (state.num_silent_frames < silence_time)
+        std::string start_str, end_str = "end";
+        R_NsToTimeString(params.start_ns, start_str);
+        if (params.end_ns != 0)
         {
-            state.emu.Step();
+            R_NsToTimeString(params.end_ns, end_str);
         }
+        fprintf(stderr, "Rendering from %s to %s\n", start_str.c_str(), end_str.c_str());
     }
-    state.elapsed = std::chrono::high_resolution_clock::now() - t_start;
-
-    state.mixer->MarkComplete(state.queue_id);
-
-    state.done = true;
-}
 
-void R_CursorUpLines(int n)
-{
-    fprintf(stderr, "\x1b[%dF", n);
-}
-
-struct R_MixOutState
-{
-    R_Mixer* mixer = nullptr;
-
-    // Written by mix thread, read by main thread
-    std::atomic<size_t> frames_mixed = 0;
-
-    // Eventually we need to abstract over this to stream to other outputs.
-    WAV_Handle* output = nullptr;
-};
-
-void R_Mix(int16_t* dest, int16_t* src_first, int16_t* src_last)
-{
-    // TODO more correct to clip *after* summation? we need an intermediate buffer of a larger type?
-    HorizontalSatAddI16(dest, src_first, src_last);
-}
-
-void R_Mix(int32_t* dest, int32_t* src_first, int32_t* src_last)
-{
-    HorizontalSatAddI32(dest, src_first, src_last);
-}
-
-void R_Mix(float* dest, float* src_first, float* src_last)
-{
-    HorizontalAddF32(dest, src_first, src_last);
-}
-
-template <typename T>
-void R_MixOut(R_MixOutState& state)
-{
-    std::vector<AudioFrame<T>> mix_buffer;
-    mix_buffer.reserve(state.mixer->GetChunkSize());
-
-    while (!state.mixer->IsFinished())
+    R_Mixer mixer;
+    if (render_master)
+    {
+        R_SetMixerQueueCount(mixer, params.output_format, instances);
+    }
+    // Segments follow each other in time, so their audio is joined end to end instead of mixed
+    mixer.SetStitching(params.segments != 0);
+    mixer.SetMaxQueueDepth(params.queue_depth);
+    if (mixer.HasFailed())
     {
-        state.mixer->WaitForWork();
+        fprintf(stderr, "FATAL: Failed to allocate mixer queues\n");
+        return false;
+    }
 
-        state.frames_mixed += state.mixer->MixFrames(mix_buffer, [](void* dest, void* src_first, void* src_last) {
-            R_Mix((T*)dest, (T*)src_first, (T*)src_last);
-        });
+    R_LoopPointRecorder loop_recorder;
 
-        for (auto& frame : mix_buffer)
+    TH_AffinityPlan affinity;
+    if (params.pin_threads)
+    {
+        affinity = TH_PlanAffinity(instances);
+        if (affinity.instance_cpus.empty())
         {
-            state.output->Write(frame);
+            fprintf(stderr, "WARNING: Threads can't be pinned on this platform\n");
         }
     }
 
-    state.output->Finish();
-}
-
-bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
-{
-    const size_t instances = params.instances;
-    auto t_start = std::chrono::high_resolution_clock::now();
-
-    // First combine all of the events so it's easier to process
-    const SMF_Track merged_track = SMF_MergeTracks(data);
-    // Then create a track specifically for each emulator instance
-    const R_TrackList split_tracks = R_SplitTrackModulo(merged_track, instances);
-
-    AllRomsetInfo romset_info;
-
-    common::LoadRomsetResult load_result;
-
-    common::LoadRomsetError err = common::LoadRomset(romset_info,
-                                                     params.rom_directory,
-                                                     params.romset_name,
-                                                     params.legacy_romset_detection,
-                                                     params.adv.rom_overrides,
-                                                     load_result);
-
-    common::PrintLoadRomsetDiagnostics(stderr, err, load_result, romset_info);
-
-    if (err != common::LoadRomsetError{})
+    R_TrackRenderState render_states[SMF_CHANNEL_COUNT];
+    if (!R_InitInstances(std::span(render_states, instances),
+                         rom_image,
+                         {
+                             .reset                 = reset,
+                             .disable_oversampling  = params.disable_oversampling,
+                             .nvram_filename        = params.nvram_filename,
+                             .reset_cache_directory = params.reset_cache_directory,
+                             .cpus                  = affinity.instance_cpus,
+                         }))
     {
         return false;
     }
 
-    EMU_SystemReset reset = EMU_SystemReset::NONE;
-    if (params.reset)
+    for (size_t i = 0; i < instances; ++i)
     {
-        reset = *params.reset;
+        if (!affinity.instance_cpus.empty())
+        {
+            render_states[i].cpu = affinity.instance_cpus[i];
+        }
+        render_states[i].thread_policy = params.thread_policy;
     }
-    else if (!params.reset && load_result.romset == Romset::MK2)
+
+    // The main thread only reports progress from here on, so it keeps off the instances' cores
+    if (!affinity.other_cpus.empty())
     {
-        // user didn't explicitly pass a reset and we're using a buggy romset
-        fprintf(stderr, "WARNING: No reset specified with mk2 romset; using gs\n");
-        reset = EMU_SystemReset::GS_RESET;
+        TH_PinCurrentThread(affinity.other_cpus);
     }
 
-    fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
-
-    R_Mixer mixer;
-    switch (params.output_format)
+    // Verification renders the whole track serially on one more instance and compares the result
+    R_TrackRenderState verify_state;
+    R_Mixer            verify_mixer;
+    if (verify_segments)
     {
-    case AudioFormat::S16:
-        mixer.SetQueueCount<int16_t>(instances);
-        break;
-    case AudioFormat::S32:
-        mixer.SetQueueCount<int32_t>(instances);
-        break;
-    case AudioFormat::F32:
-        mixer.SetQueueCount<float>(instances);
-        break;
+        verify_state.emu.Init({
+            .lcd_backend       = nullptr,
+            .nvram_filename    = {},
+            .sample_block_size = R_SAMPLE_BLOCK_SIZE,
+        });
+        verify_state.emu.GetPCM().disable_oversampling = params.disable_oversampling;
+        if (!verify_state.emu.CloneFrom(render_states[0].emu))
+        {
+            fprintf(stderr, "FATAL: Failed to clone emulator #00 for verification\n");
+            return false;
+        }
+        R_SetMixerQueueCount(verify_mixer, params.output_format, 1);
+        if (verify_mixer.HasFailed())
+        {
+            fprintf(stderr, "FATAL: Failed to allocate mixer queues for verification\n");
+            return false;
+        }
     }
 
-    R_LoopPointRecorder loop_recorder;
+    // The mix thread hands buffers to a writer thread so it doesn't stall while the output is slow to accept them
+    const WAV_Options output_options{
+        .writer_thread = true,
+        .uncached      = params.uncached_output,
+    };
 
-    R_TrackRenderState render_states[SMF_CHANNEL_COUNT];
-    for (size_t i = 0; i < instances; ++i)
+    const uint32_t sample_rate = PCM_GetOutputFrequency(render_states[0].emu.GetPCM());
+    const uint32_t output_rate = params.output_rate != 0 ? params.output_rate : sample_rate;
+
+    AudioResampler mix_resampler;
+    if (params.output_rate != 0)
+    {
+        mix_resampler.Init(sample_rate, params.output_rate);
+    }
+
+    WAV_Handle render_output;
+    if (render_master && !params.hash)
     {
-        std::filesystem::path this_nvram = params.nvram_filename;
-        if (!this_nvram.empty())
+        bool output_opened = false;
+        if (params.output_stdout)
+        {
+#ifdef _WIN32
+            // On Windows, stdout is opened in text mode, which causes newline translation to occur.
+            _setmode(_fileno(stdout), O_BINARY);
+#endif
+            output_opened = render_output.OpenStdout(params.output_format, output_options);
+        }
+        else
         {
-            // append instance number so that multiple instances don't clobber each other's nvram
-            this_nvram += std::to_string(i);
+            output_opened = render_output.Open(params.output_filename, params.output_format, output_options);
         }
 
-        render_states[i].emu.Init({.lcd_backend = nullptr, .nvram_filename = this_nvram});
+        if (!output_opened)
+        {
+            fprintf(stderr, "FATAL: Failed to open output\n");
+            return false;
+        }
+    }
+    R_WAVSink  render_sink(render_output, params.output_format);
+    R_HashSink hash_sink;
+
+    SHA256Context instance_hashes[SMF_CHANNEL_COUNT];
+    R_StateTrace  state_traces[SMF_CHANNEL_COUNT];
+
+    // Stems are written directly by their render threads, which already run in parallel
+    const WAV_Options stem_options{
+        .writer_thread = false,
+        .uncached      = params.uncached_output,
+    };
 
-        RomLocationSet loaded{};
-        if (!render_states[i].emu.LoadRoms(load_result.romset, romset_info, &loaded))
+    WAV_Handle     stem_outputs[SMF_CHANNEL_COUNT];
+    AudioResampler stem_resamplers[SMF_CHANNEL_COUNT];
+    for (size_t i = 0; i < stem_groups.size(); ++i)
+    {
+        const std::filesystem::path stem_path = R_GetStemPath(params.output_filename, stem_groups[i]);
+        if (!stem_outputs[i].Open(stem_path, params.output_format, stem_options))
         {
-            fprintf(stderr, "FATAL: Failed to load roms for instance #%02zu\n", i);
+            fprintf(stderr, "FATAL: Failed to open stem %s\n", stem_path.generic_string().c_str());
             return false;
         }
+        stem_outputs[i].SetSampleRate(output_rate);
+        if (params.output_rate != 0)
+        {
+            stem_resamplers[i].Init(sample_rate, params.output_rate);
+            render_states[i].direct_resampler = &stem_resamplers[i];
+        }
+        fprintf(stderr, "Stem #%02zu: %s\n", i, stem_path.generic_string().c_str());
+    }
 
-        render_states[i].emu.Reset();
-        render_states[i].emu.GetPCM().disable_oversampling = params.disable_oversampling;
+    // A track that has no notes has nothing to start earlier
+    std::optional<R_FastSetup> fast_setup;
+    if (params.fast_setup)
+    {
+        const uint64_t first_note_ns = R_FindFirstNoteNS(data, merged_track, event_times);
+        if (first_note_ns != 0)
+        {
+            fast_setup.emplace(first_note_ns, instances);
+        }
+    }
 
-        fprintf(stderr, "Initializing emulator #%02zu...\n", i);
-        R_RunReset(render_states[i].emu, reset);
+    // Clones are taken from instance 0, so nothing can start rendering until all of them exist
+    for (size_t i = 0; i < instances; ++i)
+    {
+        render_states[i].track = params.segments != 0 ? &merged_view : &split_tracks.tracks[i];
+        render_states[i].event_times = event_times;
+        if (params.segments != 0)
+        {
+            render_states[i].segment = &segments[i];
 
-        render_states[i].track = &split_tracks.tracks[i];
-        render_states[i].mixer = &mixer;
+            // The instance of the last segment fast-forwards to its start and hands the ones in between a copy of its
+            // emulator on the way. It starts last, once the others are set up to wait for it.
+            if (i != 0 && i + 1 == instances)
+            {
+                render_states[i].checkpoint_pass    = true;
+                render_states[i].checkpoint_targets = std::span(render_states + 1, instances - 2);
+            }
+            else if (i != 0)
+            {
+                render_states[i].checkpoint = R_CheckpointStatus::Pending;
+            }
+        }
+        else if (!ranges.empty())
+        {
+            render_states[i].segment = &ranges[i];
+        }
+        render_states[i].fast_setup = fast_setup ? &*fast_setup : nullptr;
+        render_states[i].mixer = render_master ? &mixer : nullptr;
+        render_states[i].direct_output = params.stems ? &stem_outputs[i] : nullptr;
         render_states[i].queue_id = i;
         render_states[i].end_behavior = params.end_behavior;
         render_states[i].loop_recorder = &loop_recorder;
         render_states[i].output_format = params.output_format;
         render_states[i].gain = params.gain;
+        if (params.hash_instances)
+        {
+            SHA256Reset(&instance_hashes[i]);
+            render_states[i].stream_hash = &instance_hashes[i];
+        }
+        if (!params.state_trace_filename.empty())
+        {
+            state_traces[i].interval_ns = params.state_trace_interval_ns;
+            render_states[i].state_trace = &state_traces[i];
+        }
 
-        render_states[i].emu.SetSampleCallback(R_PickCallback<R_SilenceModelNone>(render_states[i]), &render_states[i]);
+        render_states[i].emu.SetSampleBlockCallback(R_PickBlockCallback(render_states[i]), &render_states[i]);
 
         render_states[i].thread = std::thread(R_RenderOne, std::cref(data), std::ref(render_states[i]));
     }
 
-    romset_info.PurgeRomData();
+    R_MixOutState mix_out_state;
+    mix_out_state.mixer = &mixer;
+    mix_out_state.sink = params.hash ? (R_AudioSink*)&hash_sink : &render_sink;
+    mix_out_state.sample_rate = sample_rate;
+    mix_out_state.resampler = params.output_rate != 0 ? &mix_resampler : nullptr;
+    mix_out_state.cpus = affinity.other_cpus;
+    mix_out_state.thread_policy = params.thread_policy;
+    std::thread mix_out_thread;
 
-    WAV_Handle render_output;
-    if (params.output_stdout)
+    if (render_master)
     {
-#ifdef _WIN32
-        // On Windows, stdout is opened in text mode, which causes newline translation to occur.
-        _setmode(_fileno(stdout), O_BINARY);
-#endif
-        render_output.OpenStdout(params.output_format);
+        mix_out_thread = R_StartMixOut(mix_out_state, params.output_format);
     }
-    else
+
+    std::vector<uint8_t> segmented_audio;
+    std::vector<uint8_t> serial_audio;
+    R_MixOutState        verify_mix_out_state;
+    std::thread          verify_mix_out_thread;
+    if (verify_segments)
     {
-        render_output.Open(params.output_filename, params.output_format);
-    }
-    render_output.SetSampleRate(PCM_GetOutputFrequency(render_states[0].emu.GetPCM()));
+        verify_state.track         = &merged_view;
+        verify_state.event_times   = event_times;
+        verify_state.mixer         = &verify_mixer;
+        verify_state.end_behavior  = params.end_behavior;
+        verify_state.loop_recorder = &loop_recorder;
+        verify_state.output_format = params.output_format;
+        verify_state.gain          = params.gain;
+        verify_state.thread_policy = params.thread_policy;
 
-    R_MixOutState mix_out_state;
-    mix_out_state.mixer = &mixer;
-    mix_out_state.output = &render_output;
-    std::thread mix_out_thread;
+        verify_state.emu.SetSampleBlockCallback(R_PickBlockCallback(verify_state), &verify_state);
 
-    switch (params.output_format)
-    {
-    case AudioFormat::S16:
-        mix_out_thread = std::thread(R_MixOut<int16_t>, std::ref(mix_out_state));
-        break;
-    case AudioFormat::S32:
-        mix_out_thread = std::thread(R_MixOut<int32_t>, std::ref(mix_out_state));
-        break;
-    case AudioFormat::F32:
-        mix_out_thread = std::thread(R_MixOut<float>, std::ref(mix_out_state));
-        break;
+        verify_state.thread = std::thread(R_RenderOne, std::cref(data), std::ref(verify_state));
+
+        mix_out_state.collect         = &segmented_audio;
+        verify_mix_out_state.mixer   = &verify_mixer;
+        verify_mix_out_state.collect = &serial_audio;
+        verify_mix_out_thread        = R_StartMixOut(verify_mix_out_state, params.output_format);
     }
 
     // Now we wait.
@@ -1357,7 +1754,10 @@ bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
     {
         all_done = true;
 
-        fprintf(stderr, "Rendered %zu frames\n", mix_out_state.frames_mixed.load());
+        // Without a mix thread, the first stem is as good a measure as any
+        const size_t frames_done =
+            render_master ? mix_out_state.frames_mixed.load() : render_states[0].frames_rendered.load();
+        fprintf(stderr, "Rendered %zu frames\n", frames_done);
 
         for (size_t i = 0; i < instances; ++i)
         {
@@ -1367,15 +1767,29 @@ bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
             }
 
             const size_t processed    = render_states[i].events_processed;
-            const size_t total        = render_states[i].track->events.size();
-            const float  percent_done = 100.f * (float)processed / (float)total;
+            const size_t total        = R_GetEventCount(render_states[i]);
+            const float  percent_done = total != 0 ? 100.f * (float)processed / (float)total : 100.f;
 
             fprintf(stderr, "#%02zu %6.2f%% [%zu / %zu]\n", i, percent_done, processed, total);
         }
 
+        if (verify_segments)
+        {
+            if (!verify_state.done)
+            {
+                all_done = false;
+            }
+
+            const size_t processed    = verify_state.events_processed;
+            const size_t total        = R_GetEventCount(verify_state);
+            const float  percent_done = 100.f * (float)processed / (float)total;
+
+            fprintf(stderr, "serial %6.2f%% [%zu / %zu]\n", percent_done, processed, total);
+        }
+
         if (!all_done)
         {
-            R_CursorUpLines(RangeCast<int>(1 + instances));
+            R_CursorUpLines(RangeCast<int>(1 + instances + (verify_segments ? 1 : 0)));
         }
 
         std::this_thread::sleep_for(1000ms);
@@ -1386,7 +1800,65 @@ bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
         render_states[i].thread.join();
     }
 
-    mix_out_thread.join();
+    if (mix_out_thread.joinable())
+    {
+        mix_out_thread.join();
+    }
+
+    if (verify_segments)
+    {
+        verify_state.thread.join();
+        verify_mix_out_thread.join();
+    }
+
+    if (mixer.HasFailed() || verify_mixer.HasFailed())
+    {
+        fprintf(stderr, "FATAL: Ran out of memory for audio chunks\n");
+        return false;
+    }
+
+    if (mix_out_state.output_failed)
+    {
+        fprintf(stderr, "FATAL: Failed to write output\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < instances; ++i)
+    {
+        if (render_states[i].checkpoint_failed)
+        {
+            fprintf(stderr, "FATAL: Failed to copy the emulator state to a segment\n");
+            return false;
+        }
+        if (render_states[i].direct_output_failed)
+        {
+            fprintf(stderr, "FATAL: Failed to write stem #%02zu\n", i);
+            return false;
+        }
+    }
+
+    // Digests go to stdout in the format of sha256sum so they can be diffed or checked directly
+    if (params.hash)
+    {
+        fprintf(stdout, "%s  mix\n", R_FinishHash(hash_sink.GetContext()).c_str());
+    }
+    if (params.hash_instances)
+    {
+        for (size_t i = 0; i < instances; ++i)
+        {
+            fprintf(stdout, "%s  #%02zu\n", R_FinishHash(instance_hashes[i]).c_str(), i);
+        }
+    }
+
+    if (verify_segments)
+    {
+        const size_t frame_size =
+            params.output_format == AudioFormat::S16 ? sizeof(AudioFrame<int16_t>) : sizeof(AudioFrame<int32_t>);
+        if (!R_CompareRenders(segmented_audio, serial_audio, frame_size))
+        {
+            return false;
+        }
+    }
 
     if (params.dump_emidi_loop_points)
     {
@@ -1421,61 +1893,737 @@ bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
 
     if (params.debug)
     {
+        uint64_t total_load = 0;
+        for (uint64_t load : channel_load)
+        {
+            total_load += load;
+        }
+
+        // Every instance runs the same romset, so they all allocate the same
+        fprintf(stderr, "Emulator state: %zu KiB per instance\n", render_states[0].emu.GetMemoryUsage() / 1024);
+
         for (size_t i = 0; i < instances; ++i)
         {
             auto t_instance_sec = (double)render_states[i].elapsed.count() / 1e9;
-            fprintf(stderr, "#%02zu took %.2fs\n", i, t_instance_sec);
+            fprintf(stderr, "#%02zu took %.2fs", i, t_instance_sec);
+
+            if (!instance_channels.empty())
+            {
+                uint64_t instance_load = 0;
+                for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+                {
+                    if (instance_channels[i] & (1 << channel))
+                    {
+                        instance_load += channel_load[channel];
+                    }
+                }
+
+                const std::string channels = R_FormatChannels(instance_channels[i]);
+                fprintf(stderr,
+                        ", channels %s, estimated load %.1f%%",
+                        channels.empty() ? "none" : channels.c_str(),
+                        total_load ? 100.0 * (double)instance_load / (double)total_load : 0.0);
+            }
+
+            fprintf(stderr, "\n");
+
+            R_PrintProfile(render_states[i].emu.GetProfile());
+        }
+    }
+
+    if (!params.perf_report_filename.empty() &&
+        !R_WritePerfReport(params.perf_report_filename, std::span(render_states, instances)))
+    {
+        fprintf(stderr, "FATAL: Failed to write %s\n", params.perf_report_filename.string().c_str());
+        return false;
+    }
+
+    if (!params.stats_json_filename.empty() &&
+        !R_WriteStatsReport(params.stats_json_filename,
+                            std::span(render_states, instances),
+                            render_master ? &mixer : nullptr,
+                            render_master ? &mix_out_state : nullptr,
+                            R_NSPerStep(render_states[0].emu),
+                            std::chrono::high_resolution_clock::now() - t_start))
+    {
+        fprintf(stderr, "FATAL: Failed to write %s\n", params.stats_json_filename.string().c_str());
+        return false;
+    }
+
+    if (!params.pc_profile_filename.empty())
+    {
+        std::vector<const pc_profile_t*> pc_profiles;
+        for (size_t i = 0; i < instances; ++i)
+        {
+            pc_profiles.push_back(&render_states[i].emu.GetPCProfile());
+        }
+
+        PROF_PrintPCSummary(stderr, pc_profiles);
+        if (!PROF_WritePCProfile(params.pc_profile_filename, pc_profiles))
+        {
+            fprintf(stderr, "FATAL: Failed to write %s\n", params.pc_profile_filename.string().c_str());
+            return false;
         }
     }
 
+    if (!params.state_trace_filename.empty() &&
+        !R_WriteStateTrace(params.state_trace_filename, std::span(state_traces, instances)))
+    {
+        fprintf(stderr, "FATAL: Failed to write %s\n", params.state_trace_filename.string().c_str());
+        return false;
+    }
+
     auto t_finish = std::chrono::high_resolution_clock::now();
     auto t_diff   = std::chrono::duration_cast<std::chrono::nanoseconds>(t_finish - t_start);
     auto t_sec    = (double)t_diff.count() / 1e9;
 
     fprintf(stderr, "Done in %.2fs!\n", t_sec);
 
+    // The output doesn't line up with other renders of the track anymore
+    if (fast_setup)
+    {
+        fprintf(stderr, "Fast setup: started the track %.3fs early\n", (double)fast_setup->GetSavedNS() / 1e9);
+    }
+
+    return true;
+}
+
+struct R_BatchJob
+{
+    // Position in the manifest, or in the order jobs were read when serving
+    size_t                id = 0;
+    std::filesystem::path input;
+    std::filesystem::path output;
+};
+
+// Parses one manifest line, which holds an input and an output separated by a tab. A line with only an input renders
+// to the input with a .wav extension. Returns false for empty lines and lines starting with '#', which are skipped.
+bool R_ParseBatchJob(std::string line, R_BatchJob& job)
+{
+    // Manifests written on Windows end their lines with \r\n
+    if (line.ends_with('\r'))
+    {
+        line.pop_back();
+    }
+
+    if (line.empty() || line.starts_with('#'))
+    {
+        return false;
+    }
+
+    const size_t tab = line.find('\t');
+    if (tab == std::string::npos)
+    {
+        job.input  = line;
+        job.output = job.input;
+        job.output.replace_extension(".wav");
+    }
+    else
+    {
+        job.input  = line.substr(0, tab);
+        job.output = line.substr(tab + 1);
+    }
+    return true;
+}
+
+// Reads the jobs listed in a batch manifest.
+bool R_ReadBatchManifest(const std::filesystem::path& filename, std::vector<R_BatchJob>& jobs)
+{
+    std::ifstream manifest(filename);
+    if (!manifest)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        R_BatchJob job;
+        if (R_ParseBatchJob(std::move(line), job))
+        {
+            job.id = jobs.size();
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    return !manifest.bad();
+}
+
+// Writes `str` to `out` as a quoted JSON string.
+void R_WriteJSONString(FILE* out, std::string_view str)
+{
+    fputc('"', out);
+    for (char c : str)
+    {
+        switch (c)
+        {
+        case '"':
+            fputs("\\\"", out);
+            break;
+        case '\\':
+            fputs("\\\\", out);
+            break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                fprintf(out, "\\u%04x", (unsigned)c);
+            }
+            else
+            {
+                fputc(c, out);
+            }
+            break;
+        }
+    }
+    fputc('"', out);
+}
+
+struct R_BatchState
+{
+    const R_Parameters*                   params = nullptr;
+    std::shared_ptr<const SharedRomImage> rom_image;
+    // Every job starts from this state, saved right after the reset
+    std::vector<uint8_t> reset_state;
+    // Number of jobs in the manifest for progress lines. Zero when serving, since jobs keep arriving.
+    size_t job_count = 0;
+
+    // Jobs waiting for a worker. Workers exit once it's empty and `jobs_closed` is set.
+    std::mutex              job_mutex;
+    std::condition_variable job_added;
+    std::queue<R_BatchJob>  pending_jobs;
+    bool                    jobs_closed = false;
+
+    // Guards everything below
+    std::mutex report_mutex;
+    FILE*      report        = nullptr;
+    size_t     jobs_finished = 0;
+    size_t     jobs_failed   = 0;
+};
+
+struct R_BatchResult
+{
+    // Null if the job succeeded
+    const char* error  = nullptr;
+    size_t      frames = 0;
+    // Set if the job was rendered with --fast-setup, to how much earlier the track started
+    std::optional<uint64_t> fast_setup_saved_ns;
+
+    std::chrono::high_resolution_clock::duration elapsed{};
+};
+
+// Renders one job on a worker's emulator, which is restored to the post-reset state first.
+R_BatchResult R_RunBatchJob(const R_BatchState& batch, R_TrackRenderState& state, const R_BatchJob& job)
+{
+    const R_Parameters& params = *batch.params;
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    R_BatchResult result;
+
+    SMF_Data data;
+    if (!SMF_TryLoadEvents(job.input, data))
+    {
+        result.error = "failed to read input";
+        return result;
+    }
+
+    const SMF_Track             track       = SMF_MergeTracks(data);
+    const SMF_TrackView         view        = SMF_ViewTrack(track);
+    const std::vector<uint64_t> event_times = R_ComputeEventTimes(data, track, R_NSPerStep(state.emu));
+
+    if (!state.emu.LoadState(batch.reset_state))
+    {
+        result.error = "failed to restore emulator state";
+        return result;
+    }
+
+    // Workers already keep every core busy, so they write their own output instead of handing it to another thread
+    const WAV_Options output_options{
+        .writer_thread = false,
+        .uncached      = params.uncached_output,
+    };
+
+    WAV_Handle output;
+    if (!output.Open(job.output, params.output_format, output_options))
+    {
+        result.error = "failed to open output";
+        return result;
+    }
+    output.SetSampleRate(state.direct_resampler ? state.direct_resampler->GetOutputRate()
+                                                : PCM_GetOutputFrequency(state.emu.GetPCM()));
+
+    // Loop points aren't reported in batch mode, but R_RenderOne still records them
+    R_LoopPointRecorder loop_recorder;
+
+    std::optional<R_FastSetup> fast_setup;
+    if (params.fast_setup)
+    {
+        const uint64_t first_note_ns = R_FindFirstNoteNS(data, track, event_times);
+        if (first_note_ns != 0)
+        {
+            fast_setup.emplace(first_note_ns, 1);
+        }
+    }
+
+    state.track                = &view;
+    state.event_times          = event_times;
+    state.direct_output        = &output;
+    state.loop_recorder        = &loop_recorder;
+    state.fast_setup           = fast_setup ? &*fast_setup : nullptr;
+    state.ns_simulated         = 0;
+    state.num_silent_frames    = 0;
+    state.events_processed     = 0;
+    state.frames_rendered      = 0;
+    state.done                 = false;
+    state.direct_output_failed = false;
+
+    // `--end release` leaves the per-frame callback installed, so this has to be set for every job
+    state.emu.SetSampleBlockCallback(R_PickBlockCallback(state), &state);
+
+    R_RenderOne(data, state);
+
+    if (state.direct_output_failed)
+    {
+        result.error = "failed to write output";
+    }
+
+    if (fast_setup)
+    {
+        result.fast_setup_saved_ns = fast_setup->GetSavedNS();
+    }
+    state.fast_setup = nullptr;
+
+    result.frames  = state.frames_rendered;
+    result.elapsed = std::chrono::high_resolution_clock::now() - t_start;
+    return result;
+}
+
+// Writes one line of the machine readable report and a progress line to stderr.
+void R_ReportBatchJob(R_BatchState& batch, const R_BatchJob& job, const R_BatchResult& result)
+{
+    auto t_diff = std::chrono::duration_cast<std::chrono::nanoseconds>(result.elapsed);
+    auto t_sec  = (double)t_diff.count() / 1e9;
+
+    const std::string input  = job.input.generic_string();
+    const std::string output = job.output.generic_string();
+
+    std::scoped_lock lk(batch.report_mutex);
+
+    ++batch.jobs_finished;
+    if (result.error)
+    {
+        ++batch.jobs_failed;
+    }
+
+    fprintf(batch.report, "{\"job\":%zu,\"input\":", job.id);
+    R_WriteJSONString(batch.report, input);
+    fprintf(batch.report, ",\"output\":");
+    R_WriteJSONString(batch.report, output);
+    fprintf(batch.report, ",\"status\":\"%s\"", result.error ? "failed" : "ok");
+    if (result.error)
+    {
+        fprintf(batch.report, ",\"error\":");
+        R_WriteJSONString(batch.report, result.error);
+    }
+    if (result.fast_setup_saved_ns)
+    {
+        fprintf(batch.report, ",\"fast_setup_seconds\":%.3f", (double)*result.fast_setup_saved_ns / 1e9);
+    }
+    fprintf(batch.report, ",\"frames\":%zu,\"seconds\":%.3f}\n", result.frames, t_sec);
+    fflush(batch.report);
+
+    if (batch.job_count != 0)
+    {
+        fprintf(stderr, "[%zu/%zu] ", batch.jobs_finished, batch.job_count);
+    }
+    else
+    {
+        fprintf(stderr, "[%zu] ", batch.jobs_finished);
+    }
+
+    if (result.error)
+    {
+        fprintf(stderr, "%s: %s\n", input.c_str(), result.error);
+    }
+    else
+    {
+        fprintf(stderr, "%s took %.2fs\n", input.c_str(), t_sec);
+    }
+}
+
+// Queues a job for the workers.
+void R_AddBatchJob(R_BatchState& batch, R_BatchJob job)
+{
+    {
+        std::scoped_lock lk(batch.job_mutex);
+        batch.pending_jobs.push(std::move(job));
+    }
+    batch.job_added.notify_one();
+}
+
+// Lets workers exit once the jobs already queued are taken.
+void R_CloseBatchJobs(R_BatchState& batch)
+{
+    {
+        std::scoped_lock lk(batch.job_mutex);
+        batch.jobs_closed = true;
+    }
+    batch.job_added.notify_all();
+}
+
+// Waits for the next job. Returns false once there are none left and no more will be queued.
+bool R_TakeBatchJob(R_BatchState& batch, R_BatchJob& job)
+{
+    std::unique_lock lk(batch.job_mutex);
+    batch.job_added.wait(lk, [&] { return !batch.pending_jobs.empty() || batch.jobs_closed; });
+    if (batch.pending_jobs.empty())
+    {
+        return false;
+    }
+
+    job = std::move(batch.pending_jobs.front());
+    batch.pending_jobs.pop();
     return true;
 }
 
+void R_BatchWorker(R_BatchState& batch, std::optional<size_t> cpu)
+{
+    const R_Parameters& params = *batch.params;
+
+    // Pin before the emulator allocates anything so its memory lands on this cpu's NUMA node
+    if (cpu)
+    {
+        TH_PinCurrentThread(std::span(&*cpu, 1));
+    }
+    R_ApplyThreadPolicy(params.thread_policy);
+
+    // The emulator and its buffers are reused for every job this worker takes
+    R_TrackRenderState state;
+    state.end_behavior  = params.end_behavior;
+    state.output_format = params.output_format;
+    state.gain          = params.gain;
+
+    bool ready = state.emu.Init({
+        .lcd_backend       = nullptr,
+        .nvram_filename    = {},
+        .sample_block_size = R_SAMPLE_BLOCK_SIZE,
+    });
+    state.emu.GetPCM().disable_oversampling = params.disable_oversampling;
+    ready = ready && state.emu.LoadRoms(batch.rom_image);
+    if (ready)
+    {
+        state.emu.Reset();
+    }
+
+    // Flushed at the end of every job, which readies it for the next one
+    AudioResampler resampler;
+    if (params.output_rate != 0)
+    {
+        resampler.Init(PCM_GetOutputFrequency(state.emu.GetPCM()), params.output_rate);
+        state.direct_resampler = &resampler;
+    }
+
+    R_BatchJob job;
+    while (R_TakeBatchJob(batch, job))
+    {
+        R_BatchResult result;
+        if (ready)
+        {
+            result = R_RunBatchJob(batch, state, job);
+        }
+        else
+        {
+            result.error = "failed to initialize emulator";
+        }
+
+        R_ReportBatchJob(batch, job, result);
+    }
+}
+
+// Loads the roms, runs the reset once and opens the report. Every job starts from a copy of the state after the reset.
+bool R_PrepareBatch(const R_Parameters& params, R_BatchState& batch)
+{
+    batch.params = &params;
+
+    batch.rom_image = R_LoadRomImage(params);
+    if (!batch.rom_image)
+    {
+        return false;
+    }
+
+    const EMU_SystemReset reset = R_PickReset(params, batch.rom_image->romset);
+
+    fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
+
+    {
+        Emulator emu;
+        if (!emu.Init({}))
+        {
+            fprintf(stderr, "FATAL: Failed to initialize emulator\n");
+            return false;
+        }
+        emu.GetPCM().disable_oversampling = params.disable_oversampling;
+
+        if (!emu.LoadRoms(batch.rom_image))
+        {
+            fprintf(stderr, "FATAL: Failed to load roms\n");
+            return false;
+        }
+
+        emu.Reset();
+
+        fprintf(stderr, "Initializing emulator...\n");
+        if (params.reset_cache_directory.empty())
+        {
+            R_RunReset(emu, reset);
+        }
+        else
+        {
+            R_RunCachedReset(emu,
+                             reset,
+                             R_GetResetCachePath(params.reset_cache_directory,
+                                                 R_BeginResetCacheKey(*batch.rom_image, reset),
+                                                 emu));
+        }
+
+        if (!emu.SaveState(batch.reset_state))
+        {
+            fprintf(stderr, "FATAL: Failed to save emulator state\n");
+            return false;
+        }
+    }
+
+    batch.report = stdout;
+    if (!params.report_filename.empty())
+    {
+        batch.report = fopen(params.report_filename.generic_string().c_str(), "w");
+        if (!batch.report)
+        {
+            fprintf(stderr, "FATAL: Failed to open report %s\n", params.report_filename.generic_string().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Starts `worker_count` workers, each with its own emulator, that take jobs until R_CloseBatchJobs is called.
+std::vector<std::thread> R_StartBatchWorkers(R_BatchState& batch, size_t worker_count)
+{
+    TH_AffinityPlan affinity;
+    if (batch.params->pin_threads)
+    {
+        affinity = TH_PlanAffinity(worker_count);
+        if (affinity.instance_cpus.empty())
+        {
+            fprintf(stderr, "WARNING: Threads can't be pinned on this platform\n");
+        }
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        std::optional<size_t> cpu;
+        if (!affinity.instance_cpus.empty())
+        {
+            cpu = affinity.instance_cpus[i];
+        }
+        workers.emplace_back(R_BatchWorker, std::ref(batch), cpu);
+    }
+    return workers;
+}
+
+void R_FinishBatch(R_BatchState& batch, std::vector<std::thread>& workers)
+{
+    R_CloseBatchJobs(batch);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    if (batch.report != stdout)
+    {
+        fclose(batch.report);
+    }
+}
+
+// Renders every job in the batch manifest. The roms are loaded and the reset is run once, then a fixed pool of workers
+// takes jobs in order, each reusing one emulator.
+bool R_RenderBatch(const R_Parameters& params)
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<R_BatchJob> jobs;
+    if (!R_ReadBatchManifest(params.batch_filename, jobs))
+    {
+        fprintf(stderr, "FATAL: Failed to read batch manifest %s\n", params.batch_filename.generic_string().c_str());
+        return false;
+    }
+
+    if (jobs.empty())
+    {
+        fprintf(stderr, "FATAL: Batch manifest has no jobs\n");
+        return false;
+    }
+
+    R_BatchState batch;
+    if (!R_PrepareBatch(params, batch))
+    {
+        return false;
+    }
+
+    batch.job_count = jobs.size();
+    for (R_BatchJob& job : jobs)
+    {
+        batch.pending_jobs.push(std::move(job));
+    }
+
+    size_t worker_count = params.jobs != 0 ? params.jobs : std::thread::hardware_concurrency();
+    worker_count        = std::clamp<size_t>(worker_count, 1, batch.job_count);
+
+    fprintf(stderr, "Rendering %zu jobs on %zu workers\n", batch.job_count, worker_count);
+
+    std::vector<std::thread> workers = R_StartBatchWorkers(batch, worker_count);
+    R_FinishBatch(batch, workers);
+
+    auto t_finish = std::chrono::high_resolution_clock::now();
+    auto t_diff   = std::chrono::duration_cast<std::chrono::nanoseconds>(t_finish - t_start);
+    auto t_sec    = (double)t_diff.count() / 1e9;
+
+    fprintf(stderr, "Done in %.2fs! %zu of %zu jobs failed\n", t_sec, batch.jobs_failed, batch.job_count);
+
+    return batch.jobs_failed == 0;
+}
+
+// Renders jobs as they're read from stdin until it's closed. The roms stay loaded and every worker keeps its emulator
+// between jobs, so a job only pays for restoring the post-reset state and rendering.
+bool R_Serve(const R_Parameters& params)
+{
+    R_BatchState batch;
+    if (!R_PrepareBatch(params, batch))
+    {
+        return false;
+    }
+
+    size_t worker_count = params.jobs != 0 ? params.jobs : std::thread::hardware_concurrency();
+    worker_count        = std::max<size_t>(worker_count, 1);
+
+    std::vector<std::thread> workers = R_StartBatchWorkers(batch, worker_count);
+
+    fprintf(stderr, "Serving on %zu workers, reading jobs from stdin\n", worker_count);
+
+    size_t      jobs_read = 0;
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        R_BatchJob job;
+        if (R_ParseBatchJob(std::move(line), job))
+        {
+            job.id = jobs_read++;
+            R_AddBatchJob(batch, std::move(job));
+        }
+    }
+
+    R_FinishBatch(batch, workers);
+
+    fprintf(stderr, "Stopped serving! %zu of %zu jobs failed\n", batch.jobs_failed, jobs_read);
+
+    return batch.jobs_failed == 0;
+}
+
 void R_Usage()
 {
     constexpr const char* USAGE_STR = R"(Renders a standard MIDI file to a WAVE file using nuked-sc55.
 
 Usage: %s [options] -o <output> <input>
+       %s [options] --batch <manifest>
+       %s [options] --serve
 
 General options:
   -? -h, --help                Display this information.
   -v, --version                Display version information.
-  -o <filename>                Render WAVE file to filename.
+  -o <filename>                Render WAVE file to filename, or FLAC if it ends in .flac.
   --stdout                     Render raw sample data to stdout. No header
+  --hash                       Print the SHA-256 of the raw sample data instead of writing it.
+  --hash-instances             Like --hash, and also print one for the audio of each instance.
+  --uncached-output            Keep the output file out of the OS file cache.
 
 Audio options:
   -f, --format s16|s32|f32     Set output format.
   --disable-oversampling       Halves output frequency.
   --gain <amount>              Apply gain to the output.
+  --rate <frequency>           Resample the output to frequency, e.g. 44100 or 48000.
   --end cut|release            Choose how the end of the track is handled:
         cut (default)              Stop rendering at the last MIDI event
         release                    Continue to render audio after the last MIDI event until silence
+  --start <time>               Start the output at time, e.g. 90, 1:30 or 1:30.5. Messages before it are
+                               replayed without their notes, so notes held across it aren't heard.
+  --end-time <time>            Stop the output at time instead of at the end of the track.
 
 Emulator options:
   -r, --reset     none|gs|gm   Send GS or GM reset before rendering.
   -n, --instances <count>      Number of emulators to use (increases effective polyphony, but
                                takes longer to render)
+  --split modulo|balanced      Choose how channels are assigned to instances:
+        modulo (default)           Channel c goes to instance c %% count
+        balanced                   Spread channels by their estimated polyphony
   --nvram <filename>           Saves and loads NVRAM to/from disk. JV-880 only.
+  --reset-cache <dir>          Stores the emulator state after the reset in dir and reuses it on
+                               later runs with the same roms, reset and NVRAM.
+  --segments <count>           Cut the track into up to count segments and render them in parallel,
+                               each from a checkpoint of a fast-forwarded serial pass.
+  --verify-segments            Also render the track serially and check that the segments match it.
+  --fast-setup                 Send the messages before the first note as fast as the firmware reads
+                               them and start the track that much earlier. Not bit-exact with a normal
+                               render.
+  --queue-depth <chunks>       Let instances render at most this many chunks of about a second ahead of
+                               the slowest one, to bound memory use. 0 removes the limit. Defaults to 8.
 
 ROM management options:
   -d, --rom-directory <dir>    Sets the directory to load roms from. Romset will be autodetected when
-                               not also passing --romset.
+                               not also passing --romset. May also be a rom bundle.
   --romset <name>              Sets the romset to load.
   --legacy-romset-detection    Load roms using specific filenames like upstream.
+  --rom-hash-cache <filename>  Cache rom digests in filename to speed up romset detection.
 
 MIDI options:
   --dump-emidi-loop-points     Prints any encountered EMIDI loop points to stderr when finished.
+  --stems all|<groups>         Render channels to separate files named after the output, in one pass.
+                               Groups are comma separated and channels are joined by '+', e.g. 1,2,3+4.
+                               all renders one file per channel that has events.
+  --stem-master                Also render the mix of all stems to the output.
+
+Batch options:
+  --batch <manifest>           Render every job in manifest, one per line as <input><TAB><output>.
+                               Lines with only an input render to the input with a .wav extension.
+  -j, --jobs <count>           Number of jobs to render at once. Defaults to one per hardware thread.
+  --serve                      Keep the emulators warm and render jobs read from stdin, one per line in
+                               the manifest format, until stdin is closed.
+  --report <filename>          Write the per-job report to filename instead of stdout.
+
+Threading options:
+  --affinity none|cores        Choose where render threads run:
+        none (default)             Let the OS schedule them
+        cores                      Pin each instance or batch worker to its own physical core
+  --thread-policy <policy>     Choose how render threads are scheduled:
+        default                    Let the OS decide
+        throughput                 Favor throughput (SCHED_BATCH on Linux)
+        realtime                   Run at realtime priority; may need privileges
+
+Development options:
+  --perf-report <filename>     Write the render speed to filename as JSON.
+  --stats-json <filename>      Write per instance and mix thread timings to filename as JSON.
+  --pc-profile <filename>      Print the hottest firmware addresses and write every address that ran to
+                               filename as folded stacks. Needs NUKED_ENABLE_PC_PROFILING.
+  --state-trace <filename>     Write a hash of each instance's emulator state to filename periodically.
+  --state-trace-interval <ms>  Emulated time between state hashes. Defaults to 10.
+  --compare-state-traces <a> <b>
+                               Find where two state traces first differ instead of rendering.
 
 )";
 
     std::string name = P_GetProcessPath().stem().generic_string();
-    fprintf(stderr, USAGE_STR, name.c_str());
+    fprintf(stderr, USAGE_STR, name.c_str(), name.c_str(), name.c_str());
 
     common::PrintRomsets(stderr);
 }
@@ -1507,6 +2655,33 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (!params.compare_trace_a.empty())
+    {
+        return R_CompareStateTraces(params.compare_trace_a, params.compare_trace_b) ? 0 : 1;
+    }
+
+    if (!params.batch_filename.empty())
+    {
+        if (!R_RenderBatch(params))
+        {
+            fprintf(stderr, "Failed to render batch\n");
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (params.serve)
+    {
+        if (!R_Serve(params))
+        {
+            fprintf(stderr, "Failed to serve\n");
+            return 1;
+        }
+
+        return 0;
+    }
+
     SMF_Data data;
     data = SMF_LoadEvents(params.input_filename);
 
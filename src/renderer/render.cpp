@@ -0,0 +1,164 @@
+#include "render.h"
+#include "render_engine.h"
+
+const char* R_RenderErrorStr(R_RenderError err)
+{
+    switch (err)
+    {
+    case R_RenderError::Success:
+        return "Success";
+    case R_RenderError::InvalidOptions:
+        return "Invalid render options";
+    case R_RenderError::InvalidMIDI:
+        return "MIDI data couldn't be parsed";
+    case R_RenderError::EmulatorFailed:
+        return "Failed to set up an emulator";
+    case R_RenderError::SinkFailed:
+        return "Audio sink failed";
+    case R_RenderError::OutOfMemory:
+        return "Out of memory";
+    }
+    return "Unknown error";
+}
+
+R_RenderError R_RenderSMF(const std::shared_ptr<const SharedRomImage>& rom_image,
+                          std::span<const uint8_t>                     smf_bytes,
+                          const R_RenderOptions&                       options,
+                          R_AudioSink&                                 sink)
+{
+    const size_t instances = options.instances;
+    if (!rom_image || instances < 1 || instances > SMF_CHANNEL_COUNT)
+    {
+        return R_RenderError::InvalidOptions;
+    }
+
+    if (options.output_rate != 0 &&
+        (options.output_rate < AudioResampler::MIN_RATE || options.output_rate > AudioResampler::MAX_RATE))
+    {
+        return R_RenderError::InvalidOptions;
+    }
+
+    if (options.end_ns != 0 && options.end_ns <= options.start_ns)
+    {
+        return R_RenderError::InvalidOptions;
+    }
+
+    SMF_Data data;
+    if (!SMF_ParseEvents(smf_bytes, data))
+    {
+        return R_RenderError::InvalidMIDI;
+    }
+
+    const SMF_Track             merged_track = SMF_MergeTracks(data);
+    const uint64_t              ns_per_step  = R_NSPerStep(rom_image->romset);
+    const std::vector<uint64_t> event_times  = R_ComputeEventTimes(data, merged_track, ns_per_step);
+
+    R_TrackList split_tracks;
+    if (options.split_mode == R_SplitMode::Balanced)
+    {
+        split_tracks = R_SplitTrackByGroup(
+            merged_track, R_BalanceChannels(R_EstimateChannelLoad(data, merged_track), instances));
+    }
+    else
+    {
+        split_tracks = R_SplitTrackModulo(merged_track, instances);
+    }
+
+    // Each instance renders its own events within the time range
+    std::vector<R_Segment> ranges;
+    if (options.start_ns != 0 || options.end_ns != 0)
+    {
+        for (const SMF_TrackView& track : split_tracks.tracks)
+        {
+            ranges.push_back(
+                R_SegmentFromTimeRange(track, event_times, ns_per_step, options.start_ns, options.end_ns));
+        }
+    }
+
+    R_Mixer mixer;
+    R_SetMixerQueueCount(mixer, options.format, instances);
+    mixer.SetMaxQueueDepth(options.queue_depth);
+    if (mixer.HasFailed())
+    {
+        return R_RenderError::OutOfMemory;
+    }
+
+    // Loop points aren't reported, but R_RenderOne still records them
+    R_LoopPointRecorder loop_recorder;
+
+    TH_AffinityPlan affinity;
+    if (options.pin_threads)
+    {
+        affinity = TH_PlanAffinity(instances);
+    }
+
+    // Each state holds a whole emulator, so they're kept off the stack of the caller. The calling thread belongs to
+    // the caller, so it isn't pinned while setting up instances; they're only pinned once they start rendering.
+    std::unique_ptr<R_TrackRenderState[]> states = std::make_unique<R_TrackRenderState[]>(instances);
+    if (!R_InitInstances(std::span(states.get(), instances),
+                         rom_image,
+                         {
+                             .reset                 = options.reset,
+                             .disable_oversampling  = options.disable_oversampling,
+                             .nvram_filename        = {},
+                             .reset_cache_directory = options.reset_cache_directory,
+                             .cpus                  = {},
+                         }))
+    {
+        return R_RenderError::EmulatorFailed;
+    }
+
+    const uint32_t sample_rate = PCM_GetOutputFrequency(states[0].emu.GetPCM());
+
+    AudioResampler resampler;
+    if (options.output_rate != 0 && !resampler.Init(sample_rate, options.output_rate))
+    {
+        return R_RenderError::InvalidOptions;
+    }
+
+    for (size_t i = 0; i < instances; ++i)
+    {
+        R_TrackRenderState& state = states[i];
+
+        state.track         = &split_tracks.tracks[i];
+        state.event_times   = event_times;
+        state.segment       = ranges.empty() ? nullptr : &ranges[i];
+        state.mixer         = &mixer;
+        state.queue_id      = i;
+        state.end_behavior  = options.end_behavior;
+        state.loop_recorder = &loop_recorder;
+        state.output_format = options.format;
+        state.gain          = options.gain;
+        state.thread_policy = options.thread_policy;
+        if (!affinity.instance_cpus.empty())
+        {
+            state.cpu = affinity.instance_cpus[i];
+        }
+
+        state.emu.SetSampleBlockCallback(R_PickBlockCallback(state), &state);
+
+        state.thread = std::thread(R_RenderOne, std::cref(data), std::ref(state));
+    }
+
+    R_MixOutState mix_out_state;
+    mix_out_state.mixer         = &mixer;
+    mix_out_state.sink          = &sink;
+    mix_out_state.sample_rate   = sample_rate;
+    mix_out_state.resampler     = options.output_rate != 0 ? &resampler : nullptr;
+    mix_out_state.cpus          = affinity.other_cpus;
+    mix_out_state.thread_policy = options.thread_policy;
+
+    std::thread mix_out_thread = R_StartMixOut(mix_out_state, options.format);
+
+    for (size_t i = 0; i < instances; ++i)
+    {
+        states[i].thread.join();
+    }
+    mix_out_thread.join();
+
+    if (mixer.HasFailed())
+    {
+        return R_RenderError::OutOfMemory;
+    }
+    return mix_out_state.output_failed ? R_RenderError::SinkFailed : R_RenderError::Success;
+}
@@ -0,0 +1,100 @@
+// Renders standard MIDI files with nuked-sc55 emulators from memory, for programs that embed the renderer. The
+// nuked-sc55-render executable is a command line frontend for the same code.
+#pragma once
+
+#include "audio.h"
+#include "emu.h"
+#include "thread_util.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+enum class R_EndBehavior
+{
+    // Cut the track at the last MIDI event.
+    Cut,
+    // Keep rendering until the emulator produces silence.
+    Release,
+};
+
+enum class R_SplitMode
+{
+    // Channel c goes to instance c % n.
+    Modulo,
+    // Channels are spread over the instances by how much work they're estimated to generate.
+    Balanced,
+};
+
+// Receives the mixed audio of a render while it's in progress. Every call is made from a thread the renderer starts.
+class R_AudioSink
+{
+public:
+    virtual ~R_AudioSink() = default;
+
+    // Called once before any audio with the frequency of the emulator output. Returning false cancels the render.
+    virtual bool Start(uint32_t sample_rate) = 0;
+
+    // Called with each block of mixed audio, as interleaved stereo frames in the format of the render. Blocks hold
+    // up to 64k frames, about a second. Returning false cancels the render.
+    virtual bool Write(std::span<const uint8_t> frames) = 0;
+
+    // Called once after the last block, unless the render was cancelled. Returning false fails the render.
+    virtual bool Finish() = 0;
+};
+
+struct R_RenderOptions
+{
+    // Number of emulators to spread the channels over, 1-16.
+    size_t      instances  = 1;
+    R_SplitMode split_mode = R_SplitMode::Modulo;
+    // Sent before the track starts. SC-55mk2 roms play some instruments out of tune without a GS reset.
+    EMU_SystemReset reset                = EMU_SystemReset::NONE;
+    AudioFormat     format               = AudioFormat::S16;
+    R_EndBehavior   end_behavior         = R_EndBehavior::Cut;
+    float           gain                 = 1.0f;
+    bool            disable_oversampling = false;
+    // Resample the output to this frequency, within AudioResampler::MIN_RATE and MAX_RATE. Zero keeps the emulator's
+    // frequency.
+    uint32_t output_rate = 0;
+    // If set, the emulator state after the reset is stored here and reused by later renders with the same roms and
+    // reset.
+    std::filesystem::path reset_cache_directory;
+    // Only render the part of the track from `start_ns` to `end_ns`. Messages before the start other than notes are
+    // replayed to set up the emulators, so notes still held at the start aren't heard. An `end_ns` of 0 renders to the
+    // end of the track and finishes it according to `end_behavior`.
+    uint64_t start_ns = 0;
+    uint64_t end_ns   = 0;
+    // Chunks of about a second each that an instance may render ahead of the slowest one before it waits, which bounds
+    // memory use. Zero doesn't limit them.
+    size_t queue_depth = 8;
+    // Pin each instance to its own physical core.
+    bool         pin_threads   = false;
+    ThreadPolicy thread_policy = ThreadPolicy::Default;
+};
+
+enum class R_RenderError
+{
+    Success,
+    // There is no rom image, the number of instances or the output rate is out of range, or the time range is empty.
+    InvalidOptions,
+    // The MIDI data couldn't be parsed.
+    InvalidMIDI,
+    // An emulator couldn't be set up from the rom image.
+    EmulatorFailed,
+    // The sink failed to start, write or finish.
+    SinkFailed,
+    // There wasn't enough memory for the audio passed between the emulators and the sink.
+    OutOfMemory,
+};
+
+const char* R_RenderErrorStr(R_RenderError err);
+
+// Renders the standard MIDI file in `smf_bytes` on emulators running `rom_image`, passing the mixed audio to `sink`
+// as it's produced. Returns once the render is done. Renders on different threads can run at the same time and share
+// a rom image.
+R_RenderError R_RenderSMF(const std::shared_ptr<const SharedRomImage>& rom_image,
+                          std::span<const uint8_t>                     smf_bytes,
+                          const R_RenderOptions&                       options,
+                          R_AudioSink&                                 sink);
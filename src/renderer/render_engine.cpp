@@ -0,0 +1,1529 @@
+#include "render_engine.h"
+#include <cstdio>
+#include <fstream>
+#include <charconv>
+#include <random>
+#include <utility>
+
+// Only called from the render thread, so the counter doesn't need an atomic increment.
+static void R_CountFrames(R_TrackRenderState& state, size_t count)
+{
+    state.frames_rendered.store(state.frames_rendered.load(std::memory_order_relaxed) + count,
+                                std::memory_order_relaxed);
+}
+
+template <typename T>
+static std::span<const uint8_t> R_FrameBytes(std::span<const AudioFrame<T>> frames)
+{
+    return std::span((const uint8_t*)frames.data(), frames.size_bytes());
+}
+
+struct R_SilenceModelNone
+{
+    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    {
+        (void)in_raw;
+        return false;
+    }
+};
+
+struct R_SilenceModelGeneric
+{
+    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    {
+        // The emulator doesn't produce exact zeroes when no notes are playing.
+        constexpr int32_t MIN = -0x4000;
+        constexpr int32_t MAX = +0x4000;
+        return MIN <= in_raw.left && in_raw.left <= MAX && MIN <= in_raw.right && in_raw.right <= MAX;
+    }
+};
+
+struct R_SilenceModelMK1
+{
+    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    {
+        // MK1 has a DC offset. TODO: Maybe want thresholds too?
+        return in_raw.left == 0x1000000 && in_raw.right == 0x1000000;
+    }
+};
+
+template <typename SampleT>
+static void R_WriteDirect(R_TrackRenderState& state, std::span<const AudioFrame<SampleT>> frames)
+{
+    if (state.direct_resampler)
+    {
+        state.direct_output->Write(state.direct_resampler->Process(frames));
+    }
+    else
+    {
+        state.direct_output->Write(frames);
+    }
+}
+
+// Writes the output `state.direct_resampler` held back once the render is over.
+static void R_FlushDirectResampler(R_TrackRenderState& state)
+{
+    switch (state.output_format)
+    {
+    case AudioFormat::S16:
+        state.direct_output->Write(state.direct_resampler->Flush<int16_t>());
+        break;
+    case AudioFormat::S32:
+        state.direct_output->Write(state.direct_resampler->Flush<int32_t>());
+        break;
+    case AudioFormat::F32:
+        state.direct_output->Write(state.direct_resampler->Flush<float>());
+        break;
+    }
+}
+
+template <typename SampleT, typename SilenceModel, bool ApplyGain>
+void R_ReceiveSample(void* userdata, const AudioFrame<int32_t>& in)
+{
+    R_TrackRenderState* state = (R_TrackRenderState*)userdata;
+
+    AudioFrame<SampleT> out;
+    Normalize(in, out);
+
+    // Skip silence processing until end of track
+    if constexpr (!std::is_same_v<SilenceModel, R_SilenceModelNone>)
+    {
+        if (SilenceModel::IsSilence(in))
+        {
+            ++state->num_silent_frames;
+        }
+        else
+        {
+            state->num_silent_frames = 0;
+        }
+    }
+
+    if constexpr (ApplyGain)
+    {
+        Scale(out, state->gain);
+    }
+
+    if (state->stream_hash)
+    {
+        R_HashBytes(*state->stream_hash, R_FrameBytes(std::span<const AudioFrame<SampleT>>(&out, 1)));
+    }
+    if (state->mixer)
+    {
+        state->mixer->SubmitFrame(state->queue_id, out);
+    }
+    if (state->direct_output)
+    {
+        R_WriteDirect(*state, std::span<const AudioFrame<SampleT>>(&out, 1));
+    }
+    R_CountFrames(*state, 1);
+}
+
+template <typename SampleT, bool ApplyGain>
+void R_ReceiveSampleBlock(void* userdata, std::span<const AudioFrame<int32_t>> in)
+{
+    R_TrackRenderState* state = (R_TrackRenderState*)userdata;
+
+    AudioFrame<SampleT> out[R_SAMPLE_BLOCK_SIZE];
+
+    const size_t sample_count = in.size() * AudioFrame<int32_t>::channel_count;
+
+    AUDIO_Normalize((SampleT*)out, (const int32_t*)in.data(), sample_count);
+
+    if constexpr (ApplyGain)
+    {
+        AUDIO_Gain((SampleT*)out, sample_count, state->gain);
+    }
+
+    const std::span<const AudioFrame<SampleT>> frames(out, in.size());
+    if (state->stream_hash)
+    {
+        R_HashBytes(*state->stream_hash, R_FrameBytes(frames));
+    }
+    if (state->mixer)
+    {
+        state->mixer->SubmitFrames(state->queue_id, frames);
+    }
+    if (state->direct_output)
+    {
+        R_WriteDirect(*state, frames);
+    }
+    R_CountFrames(*state, frames.size());
+}
+
+void R_RunReset(Emulator& emu, EMU_SystemReset reset)
+{
+    // Nothing listens to the audio of a reset
+    emu.SetFastForward(true);
+    emu.PostSystemReset(reset);
+    emu.StepCycles(24'000'000 * MCU_CYCLES_PER_STEP);
+    emu.SetFastForward(false);
+}
+
+SHA256Context R_BeginResetCacheKey(const SharedRomImage& image, EMU_SystemReset reset)
+{
+    SHA256Context context;
+    SHA256Reset(&context);
+
+    auto input = [&](const void* data, size_t size) {
+        SHA256Input(&context, (const uint8_t*)data, (unsigned int)size);
+    };
+
+    const char tag[] = "nuked-sc55 reset cache";
+    const uint32_t header[] = {EMU_STATE_VERSION, (uint32_t)image.romset, (uint32_t)reset};
+    input(tag, sizeof(tag));
+    input(header, sizeof(header));
+    for (size_t i = 0; i < ROMLOCATION_COUNT; ++i)
+    {
+        const std::span<const uint8_t> rom = EMU_GetRomData(image, (RomLocation)i);
+        input(rom.data(), rom.size());
+    }
+
+    return context;
+}
+
+std::string R_FinishHash(SHA256Context& context)
+{
+    uint8_t digest[SHA256HashSize];
+    SHA256Result(&context, digest);
+
+    std::string result;
+    for (uint8_t byte : digest)
+    {
+        constexpr const char* DIGITS = "0123456789abcdef";
+        result += DIGITS[byte >> 4];
+        result += DIGITS[byte & 0xf];
+    }
+    return result;
+}
+
+std::filesystem::path R_GetResetCachePath(const std::filesystem::path& directory, SHA256Context key, Emulator& emu)
+{
+    const mcu_t& mcu = emu.GetMCU();
+    if (mcu.nvram)
+    {
+        SHA256Input(&key, mcu.nvram.get(), NVRAM_SIZE);
+    }
+
+    uint8_t digest[SHA256HashSize];
+    SHA256Result(&key, digest);
+
+    std::string name;
+    for (uint8_t byte : digest)
+    {
+        constexpr const char* HEX = "0123456789abcdef";
+        name += HEX[byte >> 4];
+        name += HEX[byte & 15];
+    }
+    name += ".state";
+
+    return directory / name;
+}
+
+void R_RunCachedReset(Emulator& emu, EMU_SystemReset reset, const std::filesystem::path& cache_path)
+{
+    std::ifstream cache_in(cache_path, std::ios::binary);
+    if (cache_in)
+    {
+        std::vector<uint8_t> state{std::istreambuf_iterator<char>(cache_in), std::istreambuf_iterator<char>()};
+        if (emu.LoadState(state))
+        {
+            return;
+        }
+        fprintf(stderr, "WARNING: Ignoring unusable reset cache %s\n", cache_path.generic_string().c_str());
+    }
+
+    R_RunReset(emu, reset);
+
+    std::vector<uint8_t> state;
+    if (!emu.SaveState(state))
+    {
+        return;
+    }
+
+    // Write to a temporary file first so that other renders sharing the directory never see a partial state
+    std::error_code ec;
+    std::filesystem::create_directories(cache_path.parent_path(), ec);
+
+    std::filesystem::path temp_path = cache_path;
+    temp_path += ".tmp" + std::to_string(std::random_device{}());
+
+    {
+        std::ofstream cache_out(temp_path, std::ios::binary);
+        cache_out.write((const char*)state.data(), (std::streamsize)state.size());
+        if (!cache_out)
+        {
+            fprintf(stderr, "WARNING: Failed to write reset cache %s\n", temp_path.generic_string().c_str());
+            cache_out.close();
+            std::filesystem::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temp_path, cache_path, ec);
+    if (ec)
+    {
+        fprintf(stderr, "WARNING: Failed to write reset cache %s\n", cache_path.generic_string().c_str());
+        std::filesystem::remove(temp_path, ec);
+    }
+}
+
+// Runs the emulator `steps` steps further into the render, stopping at every --state-trace checkpoint on the way.
+static void R_Step(R_TrackRenderState& state, uint64_t ns_per_step, uint64_t steps)
+{
+    R_StateTrace* trace = state.state_trace;
+    while (trace && state.ns_simulated + steps * ns_per_step >= trace->next_ns)
+    {
+        // Checkpoints fall on whole steps, at or just after each multiple of the interval
+        const uint64_t until = (trace->next_ns - state.ns_simulated + ns_per_step - 1) / ns_per_step;
+        state.emu.StepCycles(until * MCU_CYCLES_PER_STEP);
+        state.ns_simulated += until * ns_per_step;
+        steps -= until;
+
+        trace->Record(state.ns_simulated, state.emu.HashState());
+    }
+
+    state.emu.StepCycles(steps * MCU_CYCLES_PER_STEP);
+    state.ns_simulated += steps * ns_per_step;
+}
+
+// Most events are tiny compared to the midi queue, but a burst of sysex at one timestamp can fill it up. The queue
+// only drains while the emulator runs, so wait in chunks of this many steps until it has room. That delays the
+// following events a little, like a real midi cable would.
+constexpr uint64_t R_MIDI_WAIT_STEPS = 1000;
+
+// Gives up waiting after this many chunks, in case the firmware isn't reading midi at all. Giving up lasts for the rest
+// of the render, see R_TrackRenderState::midi_stalled.
+constexpr uint64_t R_MIDI_WAIT_LIMIT = 10000;
+
+static void R_PostMIDI(R_TrackRenderState& state, uint64_t ns_per_step, std::span<const uint8_t> bytes)
+{
+    // Anything bigger than half the queue is fed in pieces so it never has to fit all at once
+    constexpr size_t chunk_size = uart_buffer_size / 2;
+
+    while (!bytes.empty())
+    {
+        const std::span<const uint8_t> chunk = bytes.first(std::min(bytes.size(), chunk_size));
+
+        if (!state.midi_stalled)
+        {
+            for (uint64_t i = 0; i < R_MIDI_WAIT_LIMIT && state.emu.GetMIDIQueueSpace() < chunk.size(); ++i)
+            {
+                R_Step(state, ns_per_step, R_MIDI_WAIT_STEPS);
+            }
+        }
+
+        if (!state.emu.PostMIDI(chunk))
+        {
+            if (!state.midi_stalled)
+            {
+                fprintf(stderr, "WARNING: Emulator isn't reading MIDI; dropping events that don't fit\n");
+            }
+            state.midi_stalled = true;
+        }
+
+        bytes = bytes.subspan(chunk.size());
+    }
+}
+
+static void R_PostEvent(R_TrackRenderState& state, uint64_t ns_per_step, const SMF_Data& data, const SMF_Event& ev)
+{
+    const SMF_ByteSpan event_data = ev.GetData(data.bytes);
+    state.midi_message.assign(1, ev.status);
+    state.midi_message.insert(state.midi_message.end(), event_data.begin(), event_data.end());
+    R_PostMIDI(state, ns_per_step, state.midi_message);
+}
+
+R_TrackList R_SplitTrackModulo(const SMF_Track& merged_track, size_t n)
+{
+    R_TrackList result;
+    result.tracks.resize(n);
+
+    for (auto& dest : result.tracks)
+    {
+        dest.track = &merged_track;
+    }
+
+    for (size_t i = 0; i < merged_track.events.size(); ++i)
+    {
+        const SMF_Event& event = merged_track.events[i];
+        const uint32_t   index = (uint32_t)i;
+
+        // System events need to be processed by all emulators
+        if (event.IsSystem())
+        {
+            for (auto& dest : result.tracks)
+            {
+                dest.indices.emplace_back(index);
+            }
+        }
+        else
+        {
+            auto& dest = result.tracks[event.GetChannel() % n];
+            dest.indices.emplace_back(index);
+        }
+    }
+
+    return result;
+}
+
+R_TrackList R_SplitTrackByGroup(const SMF_Track& merged_track, std::span<const uint16_t> groups)
+{
+    R_TrackList result;
+    result.tracks.resize(groups.size());
+
+    for (auto& dest : result.tracks)
+    {
+        dest.track = &merged_track;
+    }
+
+    for (size_t i = 0; i < merged_track.events.size(); ++i)
+    {
+        const SMF_Event& event = merged_track.events[i];
+        const uint32_t   index = (uint32_t)i;
+
+        // System events need to be processed by all emulators
+        if (event.IsSystem())
+        {
+            for (auto& dest : result.tracks)
+            {
+                dest.indices.emplace_back(index);
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < groups.size(); ++j)
+            {
+                if (groups[j] & (1 << event.GetChannel()))
+                {
+                    result.tracks[j].indices.emplace_back(index);
+                    break;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+// Extra work counted for every note on top of the time it sounds, in quarter notes. Short notes like drum hits keep a
+// voice busy well past their note off.
+constexpr uint64_t R_NOTE_LOAD_QN_DIVISOR = 4;
+
+std::array<uint64_t, SMF_CHANNEL_COUNT> R_EstimateChannelLoad(const SMF_Data& data, const SMF_Track& merged_track)
+{
+    enum KeyState : uint8_t
+    {
+        Off,
+        Held,
+        Sustained,
+    };
+
+    std::array<uint64_t, SMF_CHANNEL_COUNT> load{};
+
+    KeyState keys[SMF_CHANNEL_COUNT][128]{};
+    uint64_t sounding[SMF_CHANNEL_COUNT]{};
+    bool     sustain[SMF_CHANNEL_COUNT]{};
+    uint64_t last_timestamp = 0;
+
+    const uint64_t note_load = data.header.division / R_NOTE_LOAD_QN_DIVISOR;
+
+    auto release = [&](uint8_t channel, KeyState from) {
+        for (KeyState& key : keys[channel])
+        {
+            if (key != Off && (from == Off || key == from))
+            {
+                key = Off;
+                --sounding[channel];
+            }
+        }
+    };
+
+    for (const SMF_Event& event : merged_track.events)
+    {
+        for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+        {
+            load[channel] += sounding[channel] * (event.timestamp - last_timestamp);
+        }
+        last_timestamp = event.timestamp;
+
+        const uint8_t channel = event.GetChannel();
+
+        if (event.IsNoteOn(data.bytes))
+        {
+            KeyState& key = keys[channel][data.bytes[event.data_first] & 0x7f];
+            if (key == Off)
+            {
+                ++sounding[channel];
+            }
+            key = Held;
+            load[channel] += note_load;
+        }
+        else if (event.IsNoteOff(data.bytes))
+        {
+            KeyState& key = keys[channel][data.bytes[event.data_first] & 0x7f];
+            if (key == Held && sustain[channel])
+            {
+                key = Sustained;
+            }
+            else if (key != Off)
+            {
+                key = Off;
+                --sounding[channel];
+            }
+        }
+        else if (event.IsControlChange())
+        {
+            const uint8_t controller = data.bytes[event.data_first];
+            const uint8_t value      = data.bytes[event.data_first + 1];
+            if (controller == 64)
+            {
+                sustain[channel] = value >= 64;
+                if (!sustain[channel])
+                {
+                    release(channel, Sustained);
+                }
+            }
+            else if (controller == 120 || controller == 123)
+            {
+                // All sound off, all notes off
+                release(channel, Off);
+            }
+        }
+    }
+
+    return load;
+}
+
+std::vector<uint16_t> R_BalanceChannels(std::span<const uint64_t, SMF_CHANNEL_COUNT> load, size_t n)
+{
+    // Longest processing time first: the busiest remaining channel goes to the least loaded instance
+    size_t order[SMF_CHANNEL_COUNT];
+    for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        order[channel] = channel;
+    }
+    std::stable_sort(std::begin(order), std::end(order), [&](size_t a, size_t b) {
+        return load[a] > load[b];
+    });
+
+    std::vector<uint16_t> groups(n);
+    std::vector<uint64_t> instance_load(n);
+    for (size_t channel : order)
+    {
+        const auto   least_loaded = std::min_element(instance_load.begin(), instance_load.end());
+        const size_t dest         = (size_t)(least_loaded - instance_load.begin());
+        groups[dest] |= (uint16_t)(1 << channel);
+        instance_load[dest] += load[channel];
+    }
+
+    return groups;
+}
+
+std::string R_FormatChannels(uint16_t group)
+{
+    std::string result;
+    for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        if (group & (1 << channel))
+        {
+            if (!result.empty())
+            {
+                result += '+';
+            }
+            result += std::to_string(channel + 1);
+        }
+    }
+    return result;
+}
+
+std::vector<uint16_t> R_GroupUsedChannels(const SMF_Track& merged_track)
+{
+    uint16_t used = 0;
+    for (auto& event : merged_track.events)
+    {
+        if (!event.IsSystem())
+        {
+            used |= (uint16_t)(1 << event.GetChannel());
+        }
+    }
+
+    std::vector<uint16_t> groups;
+    for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        if (used & (1 << channel))
+        {
+            groups.push_back((uint16_t)(1 << channel));
+        }
+    }
+    return groups;
+}
+
+uint64_t R_NSPerStep(Romset romset)
+{
+    // These are best guesses.
+    if (GetRomsetFamily(romset) == RomsetFamily::MK1)
+    {
+        return 600;
+    }
+    else
+    {
+        return 500;
+    }
+}
+
+uint64_t R_NSPerStep(Emulator& emu)
+{
+    return R_NSPerStep(emu.GetMCU().romset);
+}
+
+void R_NsToTimeString(uint64_t ns, std::string& result)
+{
+    // one second in nanoseconds
+    constexpr uint64_t ONE_SEC = 1'000'000'000;
+
+    const uint64_t min  = ns / (60 * ONE_SEC);
+    const uint64_t sec  = (ns / ONE_SEC) % 60;
+    const uint64_t fsec = (uint64_t)(100.0 * ((double)(ns % ONE_SEC) / (double)ONE_SEC));
+
+    result.clear();
+    if (min < 10)
+    {
+        result += '0';
+    }
+    result += std::to_string(min);
+    result += ':';
+    if (sec < 10)
+    {
+        result += '0';
+    }
+    result += std::to_string(sec);
+    result += '.';
+    if (fsec < 10)
+    {
+        result += '0';
+    }
+    result += std::to_string(fsec);
+}
+
+bool R_ParseTimeString(std::string_view str, uint64_t& ns)
+{
+    constexpr uint64_t ONE_SEC = 1'000'000'000;
+
+    // Whole seconds are in `parts`, from hours down to seconds; only the last one may have a fraction
+    uint64_t parts[3]{};
+    size_t   part_count = 0;
+    uint64_t frac_ns    = 0;
+
+    size_t pos = 0;
+    while (true)
+    {
+        if (part_count == std::size(parts))
+        {
+            return false;
+        }
+
+        const size_t end = std::min(str.find_first_of(":.", pos), str.size());
+        const auto [ptr, ec] = std::from_chars(str.data() + pos, str.data() + end, parts[part_count]);
+        if (ec != std::errc{} || ptr != str.data() + end || end == pos)
+        {
+            return false;
+        }
+        ++part_count;
+        pos = end;
+
+        if (pos == str.size())
+        {
+            break;
+        }
+
+        if (str[pos] == '.')
+        {
+            const std::string_view digits = str.substr(pos + 1);
+            if (digits.empty() || digits.size() > 9)
+            {
+                return false;
+            }
+
+            uint64_t scale = ONE_SEC;
+            for (char c : digits)
+            {
+                if (c < '0' || c > '9')
+                {
+                    return false;
+                }
+                scale /= 10;
+                frac_ns += (uint64_t)(c - '0') * scale;
+            }
+            break;
+        }
+
+        ++pos;
+    }
+
+    // Only the leading part may exceed its unit, so that "90" and "90:00" both work
+    for (size_t i = 1; i < part_count; ++i)
+    {
+        if (parts[i] >= 60)
+        {
+            return false;
+        }
+    }
+
+    uint64_t seconds = 0;
+    for (size_t i = 0; i < part_count; ++i)
+    {
+        if (seconds > UINT64_MAX / ONE_SEC / 60)
+        {
+            return false;
+        }
+        seconds = seconds * 60 + parts[i];
+    }
+    if (seconds >= UINT64_MAX / ONE_SEC)
+    {
+        return false;
+    }
+
+    ns = seconds * ONE_SEC + frac_ns;
+    return true;
+}
+
+static bool R_IsEMIDILoopStart(const SMF_Data& data, const SMF_Event& ev)
+{
+    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 116;
+}
+
+static bool R_IsEMIDILoopEnd(const SMF_Data& data, const SMF_Event& ev)
+{
+    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 117;
+}
+
+template <typename SilenceModel>
+constexpr mcu_sample_callback R_PickCallback(const R_TrackRenderState& state)
+{
+    if (state.gain != 1.0f)
+    {
+        switch (state.output_format)
+        {
+        case AudioFormat::S16:
+            return R_ReceiveSample<int16_t, SilenceModel, true>;
+        case AudioFormat::S32:
+            return R_ReceiveSample<int32_t, SilenceModel, true>;
+        case AudioFormat::F32:
+            return R_ReceiveSample<float, SilenceModel, true>;
+        }
+    }
+    else
+    {
+        switch (state.output_format)
+        {
+        case AudioFormat::S16:
+            return R_ReceiveSample<int16_t, SilenceModel, false>;
+        case AudioFormat::S32:
+            return R_ReceiveSample<int32_t, SilenceModel, false>;
+        case AudioFormat::F32:
+            return R_ReceiveSample<float, SilenceModel, false>;
+        }
+    }
+
+    // Both switches cover every AudioFormat
+    std::unreachable();
+}
+
+mcu_sample_block_callback R_PickBlockCallback(const R_TrackRenderState& state)
+{
+    if (state.gain != 1.0f)
+    {
+        switch (state.output_format)
+        {
+        case AudioFormat::S16:
+            return R_ReceiveSampleBlock<int16_t, true>;
+        case AudioFormat::S32:
+            return R_ReceiveSampleBlock<int32_t, true>;
+        case AudioFormat::F32:
+            return R_ReceiveSampleBlock<float, true>;
+        }
+    }
+    else
+    {
+        switch (state.output_format)
+        {
+        case AudioFormat::S16:
+            return R_ReceiveSampleBlock<int16_t, false>;
+        case AudioFormat::S32:
+            return R_ReceiveSampleBlock<int32_t, false>;
+        case AudioFormat::F32:
+            return R_ReceiveSampleBlock<float, false>;
+        }
+    }
+
+    // Both switches cover every AudioFormat
+    std::unreachable();
+}
+
+std::vector<uint64_t> R_ComputeEventTimes(const SMF_Data& data, const SMF_Track& track, uint64_t ns_per_step)
+{
+    const uint64_t division = data.header.division;
+
+    std::vector<uint64_t> event_times(track.events.size());
+
+    uint64_t us_per_qn      = 500000;
+    uint64_t ns_simulated   = 0;
+    uint64_t last_timestamp = 0;
+
+    for (size_t i = 0; i < track.events.size(); ++i)
+    {
+        const SMF_Event& event = track.events[i];
+
+        const uint64_t this_event_time_ns =
+            ns_simulated + 1000 * SMF_TicksToUS(event.timestamp - last_timestamp, us_per_qn, division);
+        last_timestamp = event.timestamp;
+
+        if (ns_simulated < this_event_time_ns)
+        {
+            // Round up so that we step at least as far as the event.
+            const uint64_t steps = (this_event_time_ns - ns_simulated + ns_per_step - 1) / ns_per_step;
+            ns_simulated += steps * ns_per_step;
+        }
+        event_times[i] = ns_simulated;
+
+        if (event.IsTempo(data.bytes))
+        {
+            us_per_qn = event.GetTempoUS(data.bytes);
+        }
+    }
+
+    return event_times;
+}
+
+uint64_t R_FindFirstNoteNS(const SMF_Data& data, const SMF_Track& track, std::span<const uint64_t> event_times)
+{
+    for (size_t i = 0; i < track.events.size(); ++i)
+    {
+        if (track.events[i].IsNoteOn(data.bytes))
+        {
+            return event_times[i];
+        }
+    }
+    return 0;
+}
+
+// Time the emulator is given to act on each message replayed by R_PrimeSegment. Resets take much longer than anything
+// else.
+constexpr uint64_t R_SEGMENT_EVENT_SETTLE_NS = 1'000'000;
+constexpr uint64_t R_SEGMENT_SYSEX_SETTLE_NS = 100'000'000;
+
+std::vector<R_Segment> R_SplitTrackSegments(const SMF_TrackView&      track,
+                                            std::span<const uint64_t> event_times,
+                                            size_t                    count)
+{
+    std::vector<R_Segment> segments;
+    segments.push_back({});
+
+    const uint64_t length_ns = track.Size() != 0 ? event_times[track.indices[track.Size() - 1]] : 0;
+
+    // Each segment after the first starts at the first event at or after its share of the track. Events at the same
+    // time as the start of the previous segment belong to it, so that every segment covers some time.
+    size_t event = 1;
+    for (size_t j = 1; j < count; ++j)
+    {
+        const uint64_t target = length_ns / count * j;
+        while (event < track.Size() && (event_times[track.indices[event]] < target ||
+                                        event_times[track.indices[event]] <= segments.back().start_ns))
+        {
+            ++event;
+        }
+        if (event == track.Size())
+        {
+            break;
+        }
+
+        segments.push_back({
+            .first_event = event,
+            .start_ns    = event_times[track.indices[event]],
+        });
+    }
+
+    for (size_t j = 0; j + 1 < segments.size(); ++j)
+    {
+        segments[j].last_event = segments[j + 1].first_event;
+        segments[j].end_ns     = segments[j + 1].start_ns;
+    }
+    segments.back().last_event = track.Size();
+
+    return segments;
+}
+
+R_Segment R_SegmentFromTimeRange(const SMF_TrackView&      track,
+                                 std::span<const uint64_t> event_times,
+                                 uint64_t                  ns_per_step,
+                                 uint64_t                  start_ns,
+                                 uint64_t                  end_ns)
+{
+    R_Segment segment;
+    segment.start_ns = start_ns - start_ns % ns_per_step;
+    segment.end_ns   = end_ns;
+
+    while (segment.first_event < track.Size() && event_times[track.indices[segment.first_event]] < segment.start_ns)
+    {
+        ++segment.first_event;
+    }
+
+    segment.last_event = segment.first_event;
+    while (segment.last_event < track.Size() &&
+           (end_ns == 0 || event_times[track.indices[segment.last_event]] < end_ns))
+    {
+        ++segment.last_event;
+    }
+
+    return segment;
+}
+
+std::vector<size_t> R_SelectPrimeEvents(const SMF_Data& data, const SMF_TrackView& track, size_t first_event)
+{
+    // Messages already seen while walking backwards from the segment start, which override earlier ones
+    bool controller_seen[SMF_CHANNEL_COUNT][128]{};
+    bool program_seen[SMF_CHANNEL_COUNT]{};
+    bool bend_seen[SMF_CHANNEL_COUNT]{};
+    bool pressure_seen[SMF_CHANNEL_COUNT]{};
+
+    auto forget_channel = [&](uint8_t channel) {
+        std::fill(std::begin(controller_seen[channel]), std::end(controller_seen[channel]), false);
+        program_seen[channel]  = false;
+        bend_seen[channel]     = false;
+        pressure_seen[channel] = false;
+    };
+
+    auto keep_last = [](bool& seen) {
+        return !std::exchange(seen, true);
+    };
+
+    std::vector<size_t> selected;
+    for (size_t i = first_event; i-- > 0;)
+    {
+        const SMF_Event& event = track[i];
+        if (event.IsMetaEvent() || event.IsNoteOn(data.bytes) || event.IsNoteOff(data.bytes) ||
+            event.IsPolyAftertouch())
+        {
+            continue;
+        }
+
+        const uint8_t channel = event.GetChannel();
+        bool          keep    = true;
+
+        if (event.IsSystem())
+        {
+            // System exclusive messages can reset parts or move them to other channels
+            for (uint8_t c = 0; c < SMF_CHANNEL_COUNT; ++c)
+            {
+                forget_channel(c);
+            }
+        }
+        else if (event.IsControlChange())
+        {
+            const uint8_t controller = event.GetData(data.bytes)[0] & 0x7f;
+            switch (controller)
+            {
+            case 0:
+            case 32:
+                // Bank select only takes effect at the next program change
+                keep = keep_last(controller_seen[channel][controller]);
+                break;
+            case 6:
+            case 38:
+            case 96:
+            case 97:
+            case 98:
+            case 99:
+            case 100:
+            case 101:
+                // Data entry depends on the parameter selected before it
+                forget_channel(channel);
+                break;
+            default:
+                if (controller >= 120)
+                {
+                    // Mode messages reset controllers and notes
+                    forget_channel(channel);
+                }
+                else
+                {
+                    keep = keep_last(controller_seen[channel][controller]);
+                }
+                break;
+            }
+        }
+        else
+        {
+            switch (event.status & 0xf0)
+            {
+            case 0xc0:
+                keep = keep_last(program_seen[channel]);
+                if (keep)
+                {
+                    // Bank selects before this program change apply to it
+                    controller_seen[channel][0]  = false;
+                    controller_seen[channel][32] = false;
+                }
+                break;
+            case 0xd0:
+                keep = keep_last(pressure_seen[channel]);
+                break;
+            case 0xe0:
+                keep = keep_last(bend_seen[channel]);
+                break;
+            }
+        }
+
+        if (keep)
+        {
+            selected.push_back(i);
+        }
+    }
+
+    std::reverse(selected.begin(), selected.end());
+    return selected;
+}
+
+// Brings a fresh emulator into roughly the state a serial render would be in at the start of a time range by replaying
+// the messages picked by R_SelectPrimeEvents. The messages are sent back to back instead of at their original times,
+// and the audio produced meanwhile is discarded. Segments need the exact state instead, see R_RunCheckpointPass.
+static void R_PrimeSegment(const SMF_Data& data, R_TrackRenderState& state, uint64_t ns_per_step)
+{
+    // Nothing before the segment is heard, so its audio is never built
+    state.emu.SetFastForward(true);
+
+    for (size_t i : R_SelectPrimeEvents(data, *state.track, state.segment->first_event))
+    {
+        const SMF_Event& event = (*state.track)[i];
+        R_PostEvent(state, ns_per_step, data, event);
+
+        const uint64_t settle_ns = event.IsSystemExclusive() ? R_SEGMENT_SYSEX_SETTLE_NS : R_SEGMENT_EVENT_SETTLE_NS;
+        state.emu.StepCycles(settle_ns / ns_per_step * MCU_CYCLES_PER_STEP);
+    }
+
+    state.emu.SetFastForward(false);
+}
+
+// Copies the emulator of `state` into `target`, which then starts its segment from there.
+static void R_HandCheckpoint(R_TrackRenderState& state, R_TrackRenderState& target)
+{
+    if (target.emu.CloneFrom(state.emu))
+    {
+        target.ns_simulated = state.ns_simulated;
+        target.midi_stalled = state.midi_stalled;
+        target.checkpoint   = R_CheckpointStatus::Ready;
+    }
+    else
+    {
+        state.checkpoint_failed = true;
+        target.checkpoint       = R_CheckpointStatus::Abandoned;
+        state.mixer->Cancel();
+    }
+    target.checkpoint.notify_one();
+}
+
+// Runs `state` from the start of the track to the start of its segment exactly like a serial render, but without
+// building any audio. On the way, each instance in `checkpoint_targets` gets a copy of the emulator as it is at the
+// start of that instance's segment. Returns false if the render was cancelled, in which case the instances that are
+// still waiting are released without a checkpoint.
+static bool R_RunCheckpointPass(const SMF_Data& data, R_TrackRenderState& state, uint64_t ns_per_step)
+{
+    const SMF_TrackView& track = *state.track;
+
+    // The trace starts with the segment, like the audio
+    R_StateTrace* const trace = std::exchange(state.state_trace, nullptr);
+    state.emu.SetFastForward(true);
+
+    size_t next_target = 0;
+    bool   cancelled   = false;
+    for (size_t i = 0; i < state.segment->first_event; ++i)
+    {
+        if (state.mixer->IsCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        const SMF_Event& event         = track[i];
+        const uint64_t   event_time_ns = state.event_times[track.indices[i]];
+        if (state.ns_simulated < event_time_ns)
+        {
+            R_Step(state, ns_per_step, (event_time_ns - state.ns_simulated) / ns_per_step);
+        }
+
+        // A segment's instance starts out just before its first event, like a serial render stepping up to it
+        if (next_target < state.checkpoint_targets.size() &&
+            state.checkpoint_targets[next_target].segment->first_event == i)
+        {
+            R_HandCheckpoint(state, state.checkpoint_targets[next_target++]);
+        }
+
+        if (!event.IsMetaEvent())
+        {
+            R_PostEvent(state, ns_per_step, data, event);
+        }
+    }
+
+    if (!cancelled && state.ns_simulated < state.segment->start_ns)
+    {
+        R_Step(state, ns_per_step, (state.segment->start_ns - state.ns_simulated) / ns_per_step);
+    }
+
+    for (; next_target < state.checkpoint_targets.size(); ++next_target)
+    {
+        R_TrackRenderState& target = state.checkpoint_targets[next_target];
+        target.checkpoint          = R_CheckpointStatus::Abandoned;
+        target.checkpoint.notify_one();
+    }
+
+    state.emu.SetFastForward(false);
+    state.state_trace = trace;
+
+    return !cancelled && !state.mixer->IsCancelled();
+}
+
+// Delivering setup messages early only waits for the firmware to read each byte, checking this often.
+constexpr uint64_t R_SETUP_WAIT_STEPS = 100;
+
+// GS reset and GM system on. The firmware keeps reading midi while it resets, so these still need their settle time.
+static bool R_IsResetSysEx(std::span<const uint8_t> data)
+{
+    const bool gs_reset = data.size() >= 7 && data[0] == 0x41 && data[2] == 0x42 && data[3] == 0x12 &&
+                          data[4] == 0x40 && data[5] == 0x00 && data[6] == 0x7f;
+    const bool gm_on    = data.size() >= 4 && data[0] == 0x7e && data[2] == 0x09;
+    return gs_reset || gm_on;
+}
+
+// Delivers one setup message ahead of its timestamp and runs the emulator until the firmware has read all of it, so
+// the next one is paced by the firmware instead of by the track.
+static void R_PostSetupEvent(R_TrackRenderState& state, uint64_t ns_per_step, const SMF_Data& data, const SMF_Event& ev)
+{
+    R_PostEvent(state, ns_per_step, data, ev);
+
+    const uint64_t wait_limit = state.midi_stalled ? 0 : R_MIDI_WAIT_LIMIT * R_MIDI_WAIT_STEPS / R_SETUP_WAIT_STEPS;
+    for (uint64_t i = 0; i < wait_limit && !state.emu.IsMIDIIdle(); ++i)
+    {
+        R_Step(state, ns_per_step, R_SETUP_WAIT_STEPS);
+    }
+    if (!state.emu.IsMIDIIdle())
+    {
+        state.midi_stalled = true;
+    }
+
+    if (ev.IsSystemExclusive() && R_IsResetSysEx(ev.GetData(data.bytes)))
+    {
+        const uint64_t steps = R_SEGMENT_SYSEX_SETTLE_NS / ns_per_step;
+        R_Step(state, ns_per_step, steps);
+    }
+}
+
+// Called by each instance when it reaches the first note, or the end of its events. Brings every instance to the same
+// point and returns how far the rest of the track moves earlier.
+static uint64_t R_FinishFastSetup(R_TrackRenderState& state, uint64_t ns_per_step)
+{
+    const uint64_t resume_ns = state.fast_setup->Finish(state.ns_simulated);
+
+    // Both are whole steps
+    const uint64_t steps = (resume_ns - state.ns_simulated) / ns_per_step;
+    R_Step(state, ns_per_step, steps);
+
+    state.emu.SetFastForward(false);
+    return state.fast_setup->GetSavedNS();
+}
+
+void R_PrintProfile(const EMU_Profile& profile)
+{
+    if (!profile.enabled)
+    {
+        return;
+    }
+
+    uint64_t total_ns = 0;
+    for (const EMU_ProfileStage& stage : profile.stages)
+    {
+        total_ns += stage.ns;
+    }
+
+    for (const EMU_ProfileStage& stage : profile.stages)
+    {
+        fprintf(stderr,
+                "    %-12s %8.3fs %5.1f%% %12zu calls\n",
+                stage.name,
+                (double)stage.ns / 1e9,
+                total_ns ? 100.0 * (double)stage.ns / (double)total_ns : 0.0,
+                (size_t)stage.calls);
+    }
+}
+
+void R_ApplyThreadPolicy(ThreadPolicy policy)
+{
+    static std::atomic<bool> warned = false;
+    if (!TH_SetCurrentThreadPolicy(policy) && !warned.exchange(true))
+    {
+        fprintf(stderr, "WARNING: Failed to apply the thread policy; continuing with the default\n");
+    }
+}
+
+bool R_InitInstances(std::span<R_TrackRenderState>                states,
+                     const std::shared_ptr<const SharedRomImage>& rom_image,
+                     const R_InstanceSetup&                       setup)
+{
+    // Every instance boots into the same state, so the reset only needs to run once unless each instance loads its
+    // own nvram
+    const bool clone_instances = setup.nvram_filename.empty();
+
+    SHA256Context reset_cache_key;
+    if (!setup.reset_cache_directory.empty())
+    {
+        reset_cache_key = R_BeginResetCacheKey(*rom_image, setup.reset);
+    }
+
+    for (size_t i = 0; i < states.size(); ++i)
+    {
+        // Memory is placed on the NUMA node of the thread that touches it first
+        if (i < setup.cpus.size())
+        {
+            TH_PinCurrentThread(setup.cpus.subspan(i, 1));
+        }
+
+        std::filesystem::path this_nvram = setup.nvram_filename;
+        if (!this_nvram.empty())
+        {
+            // append instance number so that multiple instances don't clobber each other's nvram
+            this_nvram += std::to_string(i);
+        }
+
+        Emulator& emu = states[i].emu;
+        emu.Init({
+            .lcd_backend       = nullptr,
+            .nvram_filename    = this_nvram,
+            .sample_block_size = R_SAMPLE_BLOCK_SIZE,
+        });
+        emu.GetPCM().disable_oversampling = setup.disable_oversampling;
+
+        if (i != 0 && clone_instances)
+        {
+            if (!emu.CloneFrom(states[0].emu))
+            {
+                fprintf(stderr, "FATAL: Failed to clone emulator #00 into #%02zu\n", i);
+                return false;
+            }
+            continue;
+        }
+
+        if (!emu.LoadRoms(rom_image))
+        {
+            fprintf(stderr, "FATAL: Failed to load roms for instance #%02zu\n", i);
+            return false;
+        }
+
+        emu.Reset();
+
+        fprintf(stderr, "Initializing emulator #%02zu...\n", i);
+        if (setup.reset_cache_directory.empty())
+        {
+            R_RunReset(emu, setup.reset);
+        }
+        else
+        {
+            R_RunCachedReset(emu,
+                             setup.reset,
+                             R_GetResetCachePath(setup.reset_cache_directory, reset_cache_key, emu));
+        }
+    }
+
+    return true;
+}
+
+void R_RenderOne(const SMF_Data& data, R_TrackRenderState& state)
+{
+    if (state.cpu)
+    {
+        TH_PinCurrentThread(std::span(&*state.cpu, 1));
+    }
+    R_ApplyThreadPolicy(state.thread_policy);
+
+    const SMF_TrackView& track = *state.track;
+
+    const uint64_t ns_per_step = R_NSPerStep(state.emu);
+
+    // The reset isn't part of the render, so it's left out of the --debug profile
+    state.emu.ResetProfile();
+
+    bool cancelled = false;
+
+    size_t first_event = 0;
+    size_t last_event  = track.Size();
+    if (state.segment)
+    {
+        first_event = state.segment->first_event;
+        last_event  = state.segment->last_event;
+
+        if (state.checkpoint_pass)
+        {
+            cancelled = !R_RunCheckpointPass(data, state, ns_per_step);
+        }
+        else if (state.checkpoint != R_CheckpointStatus::None)
+        {
+            state.checkpoint.wait(R_CheckpointStatus::Pending);
+            cancelled = state.checkpoint != R_CheckpointStatus::Ready;
+        }
+        else if (state.segment->start_ns != 0)
+        {
+            // A time range may start before the first event of its instance, which still has to wait for the start
+            R_PrimeSegment(data, state, ns_per_step);
+            state.ns_simulated = state.segment->start_ns;
+        }
+    }
+
+    if (state.state_trace)
+    {
+        state.state_trace->Start(state.ns_simulated);
+    }
+
+    // Nothing is heard until the first note, so the setup messages before it are delivered without building audio
+    bool     in_setup = state.fast_setup != nullptr;
+    uint64_t saved_ns = 0;
+    if (in_setup)
+    {
+        state.emu.SetFastForward(true);
+    }
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (size_t i = first_event; i < last_event && !cancelled; ++i)
+    {
+        if (state.mixer && state.mixer->IsCancelled())
+        {
+            cancelled = true;
+            break;
+        }
+
+        const SMF_Event& event = track[i];
+
+        if (in_setup)
+        {
+            if (state.event_times[track.indices[i]] < state.fast_setup->GetFirstNoteNS())
+            {
+                if (!event.IsMetaEvent())
+                {
+                    R_PostSetupEvent(state, ns_per_step, data, event);
+                }
+                ++state.events_processed;
+                continue;
+            }
+
+            saved_ns = R_FinishFastSetup(state, ns_per_step);
+            in_setup = false;
+        }
+
+        // Event times are whole steps, so this lands exactly on the event
+        const uint64_t this_event_time_ns = state.event_times[track.indices[i]] - saved_ns;
+        if (state.ns_simulated < this_event_time_ns)
+        {
+            const uint64_t steps = (this_event_time_ns - state.ns_simulated) / ns_per_step;
+            R_Step(state, ns_per_step, steps);
+        }
+
+        // Fire the event.
+        if (!event.IsMetaEvent())
+        {
+            R_PostEvent(state, ns_per_step, data, event);
+        }
+
+        // Save loop points - they will be processed on the main thread later
+        if (R_IsEMIDILoopStart(data, event))
+        {
+            // Frame count must include frames still buffered in the emulator
+            state.emu.FlushSamples();
+
+            state.loop_recorder->Record({
+                .type         = R_LoopPointType::Start,
+                .frame        = state.frames_rendered,
+                .timestamp_ns = state.ns_simulated,
+                .midi_track   = event.track_id,
+                .midi_channel = event.GetChannel(),
+            });
+        }
+        else if (R_IsEMIDILoopEnd(data, event))
+        {
+            state.emu.FlushSamples();
+            state.loop_recorder->Record({
+                .type         = R_LoopPointType::End,
+                .frame        = state.frames_rendered,
+                .timestamp_ns = state.ns_simulated,
+                .midi_track   = event.track_id,
+                .midi_channel = event.GetChannel(),
+            });
+        }
+
+        ++state.events_processed;
+    }
+
+    // Instances without any notes of their own still have to let the others continue
+    if (in_setup)
+    {
+        R_FinishFastSetup(state, ns_per_step);
+    }
+
+    // A cancelled render stops right away, since nobody wants the rest of the audio
+    if (!cancelled && state.segment && state.segment->end_ns != 0)
+    {
+        // Stop where the next segment starts
+        if (state.ns_simulated < state.segment->end_ns)
+        {
+            const uint64_t steps = (state.segment->end_ns - state.ns_simulated) / ns_per_step;
+            R_Step(state, ns_per_step, steps);
+        }
+    }
+    else if (!cancelled && state.end_behavior == R_EndBehavior::Release)
+    {
+        // Enable silence processing callback. This switches back to per-frame delivery so that we stop at exactly the
+        // same step as before.
+        if (state.emu.GetMCU().is_mk1)
+        {
+            state.emu.SetSampleCallback(R_PickCallback<R_SilenceModelMK1>(state), &state);
+        }
+        else
+        {
+            state.emu.SetSampleCallback(R_PickCallback<R_SilenceModelGeneric>(state), &state);
+        }
+
+        const uint32_t frequency = PCM_GetOutputFrequency(state.emu.GetPCM());
+        // TODO: make this configurable? do we care? currently 100ms
+        const size_t silence_time = frequency / 10;
+        while (state.num_silent_frames < silence_time)
+        {
+            // The silent frame count can only grow by one per frame, so we can skip ahead by the remainder.
+            state.emu.StepUntilFrames(silence_time - state.num_silent_frames);
+        }
+    }
+    state.emu.FlushSamples();
+    state.elapsed = std::chrono::high_resolution_clock::now() - t_start;
+
+    if (state.mixer)
+    {
+        state.mixer->MarkComplete(state.queue_id);
+    }
+    if (state.direct_output)
+    {
+        if (state.direct_resampler)
+        {
+            R_FlushDirectResampler(state);
+        }
+        state.direct_output_failed = !state.direct_output->Finish();
+    }
+
+    state.done = true;
+}
+
+template <typename T>
+void R_MixOut(R_MixOutState& state)
+{
+    if (!state.cpus.empty())
+    {
+        TH_PinCurrentThread(state.cpus);
+    }
+    R_ApplyThreadPolicy(state.thread_policy);
+
+    std::vector<AudioFrame<T>> mix_buffer;
+    mix_buffer.reserve(state.mixer->GetChunkSize());
+
+    const uint32_t output_rate = state.resampler ? state.resampler->GetOutputRate() : state.sample_rate;
+    if (state.sink && !state.sink->Start(output_rate))
+    {
+        state.output_failed = true;
+        state.mixer->Cancel();
+    }
+
+    while (!state.mixer->IsFinished())
+    {
+        const auto t_wait = std::chrono::high_resolution_clock::now();
+        state.mixer->WaitForWork();
+        state.wait_time += std::chrono::high_resolution_clock::now() - t_wait;
+
+        state.frames_mixed += state.mixer->MixFrames(mix_buffer);
+
+        const std::span<const AudioFrame<T>> mixed(mix_buffer);
+
+        // Verification compares renders at the emulator's frequency
+        if (state.collect)
+        {
+            const std::span<const uint8_t> bytes = R_FrameBytes(mixed);
+            state.collect->insert(state.collect->end(), bytes.begin(), bytes.end());
+        }
+
+        if (state.sink && !state.output_failed)
+        {
+            const std::span<const AudioFrame<T>> frames = state.resampler ? state.resampler->Process(mixed) : mixed;
+
+            const auto t_write = std::chrono::high_resolution_clock::now();
+            if (!state.sink->Write(R_FrameBytes(frames)))
+            {
+                state.output_failed = true;
+                state.mixer->Cancel();
+            }
+            state.write_time += std::chrono::high_resolution_clock::now() - t_write;
+            state.bytes_written += frames.size_bytes();
+        }
+    }
+
+    if (state.sink && !state.output_failed)
+    {
+        std::span<const AudioFrame<T>> tail;
+        if (state.resampler)
+        {
+            tail = state.resampler->Flush<T>();
+        }
+
+        const auto t_write = std::chrono::high_resolution_clock::now();
+        if (!tail.empty() && !state.sink->Write(R_FrameBytes(tail)))
+        {
+            state.output_failed = true;
+        }
+        else
+        {
+            state.output_failed = !state.sink->Finish();
+        }
+        state.write_time += std::chrono::high_resolution_clock::now() - t_write;
+        state.bytes_written += tail.size_bytes();
+    }
+}
+
+void R_SetMixerQueueCount(R_Mixer& mixer, AudioFormat format, size_t count)
+{
+    switch (format)
+    {
+    case AudioFormat::S16:
+        mixer.SetQueueCount<int16_t>(count);
+        break;
+    case AudioFormat::S32:
+        mixer.SetQueueCount<int32_t>(count);
+        break;
+    case AudioFormat::F32:
+        mixer.SetQueueCount<float>(count);
+        break;
+    }
+}
+
+std::thread R_StartMixOut(R_MixOutState& state, AudioFormat format)
+{
+    switch (format)
+    {
+    case AudioFormat::S16:
+        return std::thread(R_MixOut<int16_t>, std::ref(state));
+    case AudioFormat::S32:
+        return std::thread(R_MixOut<int32_t>, std::ref(state));
+    case AudioFormat::F32:
+        return std::thread(R_MixOut<float>, std::ref(state));
+    }
+    std::unreachable();
+}
+
+size_t R_GetEventCount(const R_TrackRenderState& state)
+{
+    if (state.segment)
+    {
+        return state.segment->last_event - state.segment->first_event;
+    }
+    return state.track->Size();
+}
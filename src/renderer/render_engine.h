@@ -0,0 +1,1096 @@
+// Internals of the renderer shared by R_RenderSMF and the nuked-sc55-render frontend: emulator instances that each
+// render part of a track, and the mixer that combines their output.
+#pragma once
+
+#include "audio.h"
+#include "audio_kernel.h"
+#include "emu.h"
+#include "math_util.h"
+#include "render.h"
+#include "resampler.h"
+#include "ringbuffer.h"
+#include "smf.h"
+#include "thread_util.h"
+#include "wav.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include "sha/sha.h"
+}
+
+// Audio frame chunk. Points to a header followed by a dynamically sized buffer containing audio data. The buffer
+// contains audio data. This type has reference semantics and represents unowned memory like a bare pointer, so take
+// care making copies of it.
+class R_FrameChunk
+{
+public:
+    [[nodiscard]]
+    static R_FrameChunk Alloc(size_t size_bytes)
+    {
+        R_FrameChunk c;
+
+        // Chunks are recycled by R_Mixer, so this only runs until the pool covers the queue depth. We allocate a bit
+        // more space because malloc has weak alignment guarantees, and we want the buffer to be 64-byte aligned for max
+        // SIMD compatibility.
+        size_t alloc_size = 64 + sizeof(Header) + size_bytes;
+
+        void* ptr = malloc(alloc_size);
+        if (!ptr)
+        {
+            return c;
+        }
+
+        // This should never fail or adjust ptr so passing the aligned pointer back to free should be ok.
+        void* const base = ptr;
+        if (!std::align(alignof(Header), sizeof(Header), ptr, alloc_size))
+        {
+            free(base);
+            return c;
+        }
+
+        Header* h = new (ptr) Header();
+        ptr = (uint8_t*)ptr + sizeof(Header);
+
+        if (!std::align(64, size_bytes, ptr, alloc_size))
+        {
+            free(base);
+            return c;
+        }
+
+        h->buffer      = ptr;
+        c.m_alloc      = h;
+        c.m_alloc->cap = size_bytes;
+
+        return c;
+    }
+
+    static void Free(R_FrameChunk c)
+    {
+        free(c.m_alloc);
+        c.m_alloc = nullptr;
+    }
+
+    [[nodiscard]]
+    size_t GetBufferLength() const
+    {
+        return m_alloc->len;
+    }
+
+    [[nodiscard]]
+    void* DataFirst()
+    {
+        return std::assume_aligned<64>(m_alloc->buffer);
+    }
+
+    [[nodiscard]]
+    void* DataLast()
+    {
+        // We cannot assume the end is 64-byte aligned because audio frames may be much smaller.
+        return (uint8_t*)DataFirst() + m_alloc->len;
+    }
+
+    void Write(const void* src, size_t src_len)
+    {
+        memcpy(DataLast(), src, src_len);
+        m_alloc->len += src_len;
+    }
+
+    // Empties the buffer so the chunk can be reused.
+    void Clear()
+    {
+        m_alloc->len = 0;
+    }
+
+    [[nodiscard]]
+    bool IsNull() const
+    {
+        return m_alloc == nullptr;
+    }
+
+    [[nodiscard]]
+    bool IsBufferFull() const
+    {
+        return m_alloc->len == m_alloc->cap;
+    }
+
+private:
+    struct Header
+    {
+        size_t  len  = 0;
+        size_t  cap  = 0;
+        void*   buffer;
+    };
+
+private:
+    Header* m_alloc = nullptr;
+};
+
+// Manages a chunk and frees it when it goes out of scope, similar to unique_ptr. Code outside of the chunk queue should
+// only use this type.
+class R_OwnedChunk
+{
+public:
+    R_OwnedChunk() = default;
+
+    explicit R_OwnedChunk(R_FrameChunk c)
+        : m_chunk(c)
+    {
+    }
+
+    ~R_OwnedChunk()
+    {
+        Free();
+    }
+
+    // Non-copyable
+    R_OwnedChunk(const R_OwnedChunk&)            = delete;
+    R_OwnedChunk& operator=(const R_OwnedChunk&) = delete;
+
+    // Moveable
+    R_OwnedChunk(R_OwnedChunk&& rhs)
+    {
+        m_chunk = rhs.Unmanage();
+    }
+
+    R_OwnedChunk& operator=(R_OwnedChunk&& rhs)
+    {
+        Free();
+        m_chunk = rhs.Unmanage();
+        return *this;
+    }
+
+    void Free()
+    {
+        R_FrameChunk::Free(m_chunk);
+        m_chunk = R_FrameChunk();
+    }
+
+    void Manage(R_FrameChunk rhs)
+    {
+        Free();
+        m_chunk = rhs;
+    }
+
+    [[nodiscard]]
+    R_FrameChunk Unmanage()
+    {
+        R_FrameChunk ptr = m_chunk;
+        m_chunk          = R_FrameChunk();
+        return ptr;
+    }
+
+    void Write(const void* src, size_t src_len)
+    {
+        m_chunk.Write(src, src_len);
+    }
+
+    void Clear()
+    {
+        m_chunk.Clear();
+    }
+
+    [[nodiscard]]
+    bool IsBufferFull() const
+    {
+        return m_chunk.IsBufferFull();
+    }
+
+    [[nodiscard]]
+    void* DataFirst()
+    {
+        return m_chunk.DataFirst();
+    }
+
+    [[nodiscard]]
+    void* DataLast()
+    {
+        return m_chunk.DataLast();
+    }
+
+    [[nodiscard]]
+    bool IsNull() const
+    {
+        return m_chunk.IsNull();
+    }
+
+    [[nodiscard]]
+    size_t GetBufferLength() const
+    {
+        return m_chunk.GetBufferLength();
+    }
+
+private:
+    R_FrameChunk m_chunk;
+};
+
+// Threadsafe queue for chunks of audio. The intent is that emulators should be able to expand the queue as fast as
+// possible while it may drain at a different rate. Each queue has exactly one producer and one consumer, so it's a
+// lock-free ring of chunk pointers. Data moves a chunk at a time, so for a buffer size of ~64k, expect each side to
+// touch the queue once per second.
+class R_ChunkQueue
+{
+public:
+    // If the ring can't be allocated the queue is left without capacity, see IsValid.
+    R_ChunkQueue()
+    {
+        if (m_buffer.Init(CAPACITY * sizeof(R_FrameChunk)))
+        {
+            m_view = RingbufferView(m_buffer);
+        }
+    }
+
+    ~R_ChunkQueue()
+    {
+        R_OwnedChunk chunk;
+        while (TryDequeue(chunk))
+        {
+            chunk.Free();
+        }
+    }
+
+    R_ChunkQueue(const R_ChunkQueue&)            = delete;
+    R_ChunkQueue& operator=(const R_ChunkQueue&) = delete;
+
+    // Moves `chunk` into the queue. Returns false and leaves `chunk` alone if the queue is full.
+    bool TryEnqueue(R_OwnedChunk& chunk)
+    {
+        if (m_view.GetWritableElements<R_FrameChunk>() == 0)
+        {
+            return false;
+        }
+        m_view.UncheckedWriteOne(chunk.Unmanage());
+        return true;
+    }
+
+    // Moves `chunk` into the queue, waiting for the consumer if the queue is full. CAPACITY covers about an hour of
+    // audio, so in practice this never waits.
+    void Enqueue(R_OwnedChunk chunk)
+    {
+        while (!TryEnqueue(chunk))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    bool TryDequeue(R_OwnedChunk& chunk)
+    {
+        if (m_view.GetReadableElements<R_FrameChunk>() == 0)
+        {
+            return false;
+        }
+        R_FrameChunk raw;
+        m_view.UncheckedReadOne(raw);
+        chunk.Manage(raw);
+        return true;
+    }
+
+    size_t ChunkCount() const
+    {
+        return m_view.GetReadableElements<R_FrameChunk>();
+    }
+
+    // False if the constructor couldn't allocate the ring. Such a queue is always full and always empty.
+    bool IsValid() const
+    {
+        return m_view.GetByteLength() != 0;
+    }
+
+private:
+    // Must be a power of 2.
+    static constexpr size_t CAPACITY = 4096;
+
+    GenericBuffer  m_buffer;
+    RingbufferView m_view;
+};
+
+class R_Mixer
+{
+public:
+    // Chunks each queue may hold by default, about 8 seconds of audio
+    static constexpr size_t DEFAULT_MAX_QUEUE_DEPTH = 8;
+
+    // Blocks the calling thread until there's enough data in queues to mix.
+    void WaitForWork()
+    {
+        while (true)
+        {
+            // Read before checking the queues so that a chunk enqueued after the check changes it and ends the wait
+            const uint32_t seq = m_enqueue_seq.load();
+            if (GetReadyChunkCount() > 0)
+            {
+                return;
+            }
+            m_enqueue_seq.wait(seq);
+        }
+    }
+
+    // Returns chunk size in frame count.
+    size_t GetChunkSize() const
+    {
+        return m_chunk_size;
+    }
+
+    size_t GetFramesWritten(size_t queue_id) const
+    {
+        return m_frames_written[queue_id];
+    }
+
+    // Returns the most chunks queue_id has held at once. Only valid once its producer is done.
+    size_t GetMaxQueueDepthReached(size_t queue_id) const
+    {
+        return m_max_depth_reached[queue_id];
+    }
+
+    // Sets number of queues and prepares a chunk builder for each. Check HasFailed afterwards; a mixer that failed
+    // here must not be rendered into.
+    // precondition: 0 <= count <= QUEUE_COUNT
+    template <typename T>
+    void SetQueueCount(size_t count)
+    {
+        m_queues_in_use = count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!m_queues[i].IsValid() || !m_free_chunks[i].IsValid())
+            {
+                m_failed.store(true, std::memory_order_relaxed);
+                return;
+            }
+            m_chunks[i] = AllocChunk<T>(i);
+        }
+    }
+
+    // Plays the queues back one after another in queue order instead of mixing them together. A queue starts playing
+    // once every queue before it is complete and has been played back.
+    void SetStitching(bool stitching)
+    {
+        m_stitching = stitching;
+    }
+
+    // Limits how many chunks a queue holds before submitting to it waits for the mix thread, so that an emulator
+    // rendering faster than the others can't buffer an unbounded amount of audio. Zero doesn't limit queues. Stitched
+    // queues are never limited, since each has to hold its audio until the queues before it are played back.
+    void SetMaxQueueDepth(size_t depth)
+    {
+        m_max_queue_depth = depth;
+    }
+
+    // Writes a frame to the chunk currently being built for queue_id. If the chunk becomes full, it is moved into its
+    // queue and a new chunk becomes available.
+    template <typename T>
+    void SubmitFrame(size_t queue_id, const AudioFrame<T>& frame)
+    {
+        if (m_chunks[queue_id].IsNull())
+        {
+            // A chunk couldn't be allocated and the render is being cancelled
+            return;
+        }
+        m_chunks[queue_id].Write(&frame, sizeof(frame));
+        if (m_chunks[queue_id].IsBufferFull())
+        {
+            EnqueueChunk(queue_id);
+            m_chunks[queue_id] = AllocChunk<T>(queue_id);
+        }
+        ++m_frames_written[queue_id];
+    }
+
+    // Writes a contiguous block of frames to queue_id. Behaves the same as calling SubmitFrame for each frame.
+    template <typename T>
+    void SubmitFrames(size_t queue_id, std::span<const AudioFrame<T>> frames)
+    {
+        const size_t chunk_bytes = m_chunk_size * sizeof(AudioFrame<T>);
+
+        while (!frames.empty() && !m_chunks[queue_id].IsNull())
+        {
+            const size_t space = (chunk_bytes - m_chunks[queue_id].GetBufferLength()) / sizeof(AudioFrame<T>);
+            const size_t count = Min(space, frames.size());
+
+            m_chunks[queue_id].Write(frames.data(), count * sizeof(AudioFrame<T>));
+            if (m_chunks[queue_id].IsBufferFull())
+            {
+                EnqueueChunk(queue_id);
+                m_chunks[queue_id] = AllocChunk<T>(queue_id);
+            }
+            m_frames_written[queue_id] += count;
+
+            frames = frames.subspan(count);
+        }
+    }
+
+    // Enqueues whatever data is left in the chunk builder for queue_id and marks it as complete. After this call, no
+    // more data may be submitted to queue_id.
+    void MarkComplete(size_t queue_id)
+    {
+        // The last chunk has to be in the queue before the mix thread can see the queue as complete, otherwise it
+        // could skip the queue for having no chunks
+        if (!m_chunks[queue_id].IsNull())
+        {
+            m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
+        }
+        RecordQueueDepth(queue_id);
+        m_queue_complete[queue_id] = true;
+        NotifyMixThread();
+    }
+
+    // Returns the number N of chunks that can be dequeued from each queue to call MixFrames N times.
+    size_t GetReadyChunkCount()
+    {
+        if (m_stitching)
+        {
+            return GetReadyStitchChunkCount();
+        }
+
+        size_t count = (size_t)-1;
+        for (size_t i = 0; i < m_queues_in_use; ++i)
+        {
+            // Instances fire every event at the time a serial render would (see R_ComputeEventTimes), so with
+            // `--end cut` they all produce the same number of frames. With `--end release` each instance keeps going
+            // until its own output is silent, so one queue can be complete while others still receive data.
+            //
+            // Queues marked as complete and having zero chunks will never receive new data, so they aren't
+            // considered. However, if another queue is incomplete and has zero chunks, the emulator responsible for
+            // filling that queue will enqueue one eventually. In that case, MixFrames should still mix samples from
+            // that queue without waiting for the complete queue.
+
+            size_t cc = m_queues[i].ChunkCount();
+            if (!(m_queue_complete[i] && cc == 0))
+            {
+                count = Min(count, cc);
+            }
+        }
+        return count;
+    }
+
+    // Dequeues a chunk from each queue and mixes the corresponding audio frames from each chunk into a single buffer.
+    // precondition: GetReadyChunkCount() > 0
+    template <typename T>
+    size_t MixFrames(std::vector<AudioFrame<T>>& output_buffer)
+    {
+        output_buffer.clear();
+
+        if (m_stitching)
+        {
+            return StitchFrames(output_buffer);
+        }
+
+        R_OwnedChunk chunks[QUEUE_COUNT];
+
+        // precalcluate the output buffer size so that we don't need to bounds check or reallocate in the mix loop
+        size_t size_requested = 0;
+
+        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
+        {
+            size_t cc = m_queues[queue_id].ChunkCount();
+            if (m_queue_complete[queue_id] && cc == 0)
+            {
+                // See comment in GetReadyChunkCount.
+                continue;
+            }
+            if (!m_queues[queue_id].TryDequeue(chunks[queue_id]))
+            {
+                // Only happens if the precondition was broken; the queue counts as silence
+                continue;
+            }
+            size_requested = std::max(size_requested, chunks[queue_id].GetBufferLength());
+        }
+        NotifyProducers();
+
+        output_buffer.resize(size_requested / sizeof(AudioFrame<T>));
+
+        const T* srcs[QUEUE_COUNT];
+        size_t   src_lengths[QUEUE_COUNT];
+        size_t   src_count = 0;
+        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
+        {
+            if (chunks[queue_id].IsNull())
+            {
+                // Attempt to deal with errors from the prior loop
+                continue;
+            }
+            srcs[src_count]        = (const T*)chunks[queue_id].DataFirst();
+            src_lengths[src_count] = chunks[queue_id].GetBufferLength() / sizeof(T);
+            ++src_count;
+        }
+
+        MixSources((T*)output_buffer.data(), srcs, src_lengths, src_count, size_requested / sizeof(T));
+
+        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
+        {
+            // Hand the chunk back to its producer. The free list can hold every chunk the queue can, so this only
+            // fails to recycle if the chunk gets freed instead.
+            if (!chunks[queue_id].IsNull())
+            {
+                m_free_chunks[queue_id].TryEnqueue(chunks[queue_id]);
+            }
+        }
+
+        return size_requested / sizeof(AudioFrame<T>);
+    }
+
+    // Asks the emulators to stop early because their output isn't wanted anymore. They still mark their queues as
+    // complete, so the mix thread has to keep mixing until IsFinished.
+    void Cancel()
+    {
+        m_cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const
+    {
+        return m_cancelled.load(std::memory_order_relaxed);
+    }
+
+    // Returns true if the mixer ran out of memory for its queues or chunks. The render is cancelled when that happens,
+    // so the output is incomplete.
+    bool HasFailed() const
+    {
+        return m_failed.load(std::memory_order_relaxed);
+    }
+
+    // Returns true when all queues are marked as complete and are empty.
+    bool IsFinished() const
+    {
+        for (size_t i = 0; i < m_queues_in_use; ++i)
+        {
+            if (!m_queue_complete[i] || m_queues[i].ChunkCount() != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    // Skips past the queues that have been played back completely and returns the number of chunks ready in the one
+    // playing now.
+    size_t GetReadyStitchChunkCount()
+    {
+        while (m_stitch_queue + 1 < m_queues_in_use && m_queue_complete[m_stitch_queue] &&
+               m_queues[m_stitch_queue].ChunkCount() == 0)
+        {
+            ++m_stitch_queue;
+        }
+        return m_queues[m_stitch_queue].ChunkCount();
+    }
+
+    // Copies the next chunk of the queue playing now to the output.
+    // precondition: GetReadyStitchChunkCount() > 0
+    template <typename T>
+    size_t StitchFrames(std::vector<AudioFrame<T>>& output_buffer)
+    {
+        R_OwnedChunk chunk;
+        if (!m_queues[m_stitch_queue].TryDequeue(chunk))
+        {
+            return 0;
+        }
+
+        const size_t frame_count = chunk.GetBufferLength() / sizeof(AudioFrame<T>);
+        output_buffer.resize(frame_count);
+        memcpy(output_buffer.data(), chunk.DataFirst(), chunk.GetBufferLength());
+
+        m_free_chunks[m_stitch_queue].TryEnqueue(chunk);
+
+        return frame_count;
+    }
+
+    // Mixes `count` samples from sources of possibly different lengths. Sources that end early count as silence. Every
+    // sample is still summed in one go so that it's only clipped once.
+    template <typename T>
+    static void MixSources(T* dest, const T** srcs, const size_t* src_lengths, size_t src_count, size_t count)
+    {
+        size_t offset = 0;
+        while (offset < count)
+        {
+            const T* active[QUEUE_COUNT];
+            size_t   active_count = 0;
+            size_t   end          = count;
+            for (size_t i = 0; i < src_count; ++i)
+            {
+                if (src_lengths[i] > offset)
+                {
+                    active[active_count++] = srcs[i] + offset;
+                    end                    = Min(end, src_lengths[i]);
+                }
+            }
+
+            AUDIO_Mix(dest + offset, active, active_count, end - offset);
+            offset = end;
+        }
+    }
+
+    // Returns an empty chunk for queue_id, reusing one the mix thread is done with if possible.
+    template <typename T>
+    R_OwnedChunk AllocChunk(size_t queue_id)
+    {
+        R_OwnedChunk chunk;
+        if (m_free_chunks[queue_id].TryDequeue(chunk))
+        {
+            chunk.Clear();
+            return chunk;
+        }
+
+        R_FrameChunk raw = R_FrameChunk::Alloc(m_chunk_size * sizeof(AudioFrame<T>));
+        if (raw.IsNull())
+        {
+            // Callers skip writes while their chunk is null, so the emulators wind down like any other cancellation
+            m_failed.store(true, std::memory_order_relaxed);
+            Cancel();
+            return chunk;
+        }
+        return R_OwnedChunk(raw);
+    }
+
+    void EnqueueChunk(size_t queue_id)
+    {
+        WaitForQueueSpace(queue_id);
+        m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
+        RecordQueueDepth(queue_id);
+        NotifyMixThread();
+    }
+
+    void RecordQueueDepth(size_t queue_id)
+    {
+        m_max_depth_reached[queue_id] = std::max(m_max_depth_reached[queue_id], m_queues[queue_id].ChunkCount());
+    }
+
+    // Blocks the producer of queue_id while its queue is at the maximum depth.
+    void WaitForQueueSpace(size_t queue_id)
+    {
+        if (m_max_queue_depth == 0 || m_stitching)
+        {
+            return;
+        }
+
+        while (true)
+        {
+            // Read before checking the queue so that a chunk dequeued after the check changes it and ends the wait
+            const uint32_t seq = m_dequeue_seq.load();
+            if (m_queues[queue_id].ChunkCount() < m_max_queue_depth)
+            {
+                return;
+            }
+            m_dequeue_seq.wait(seq);
+        }
+    }
+
+    void NotifyMixThread()
+    {
+        m_enqueue_seq.fetch_add(1);
+        m_enqueue_seq.notify_one();
+    }
+
+    void NotifyProducers()
+    {
+        m_dequeue_seq.fetch_add(1);
+        m_dequeue_seq.notify_all();
+    }
+
+    void DebugPrintQueues()
+    {
+        for (size_t i = 0; i < m_queues_in_use; ++i)
+        {
+            fprintf(stderr, "Queue %zu has %zu chunks\n", i, m_queues[i].ChunkCount());
+        }
+    }
+
+private:
+    // a bit less than 1 second of audio
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+    // one queue per emulator
+    static constexpr size_t QUEUE_COUNT = 16;
+
+    R_ChunkQueue      m_queues[QUEUE_COUNT];
+    // Chunks the mix thread is done with, going back to the producer of each queue
+    R_ChunkQueue      m_free_chunks[QUEUE_COUNT];
+    R_OwnedChunk      m_chunks[QUEUE_COUNT];
+    std::atomic<bool> m_queue_complete[QUEUE_COUNT]{};
+    size_t            m_frames_written[QUEUE_COUNT]{};
+    // Only written by the producer of each queue
+    size_t            m_max_depth_reached[QUEUE_COUNT]{};
+
+    size_t m_queues_in_use = 0;
+
+    // Set before rendering starts
+    bool   m_stitching       = false;
+    size_t m_max_queue_depth = DEFAULT_MAX_QUEUE_DEPTH;
+
+    // Only touched by the mix thread while stitching
+    size_t m_stitch_queue = 0;
+
+    // Size of chunks in bytes.
+    size_t m_chunk_size = DEFAULT_CHUNK_SIZE;
+
+    // Bumped whenever a chunk is enqueued or a queue completes, for the mix thread to wait on.
+    std::atomic<uint32_t> m_enqueue_seq = 0;
+    // Bumped whenever the mix thread dequeues chunks, for producers of full queues to wait on.
+    std::atomic<uint32_t> m_dequeue_seq = 0;
+
+    std::atomic<bool> m_cancelled = false;
+    std::atomic<bool> m_failed    = false;
+};
+
+enum R_LoopPointType
+{
+    Start,
+    End,
+};
+
+struct R_LoopPoint
+{
+    R_LoopPointType type;
+    uint64_t        frame;
+    uint64_t        timestamp_ns;
+    uint16_t        midi_track;
+    uint8_t         midi_channel;
+};
+
+class R_LoopPointRecorder
+{
+public:
+    void Record(const R_LoopPoint& point)
+    {
+        std::scoped_lock lk(m_mutex);
+        m_loop_points.emplace_back(point);
+    }
+
+    void SortByTrack()
+    {
+        std::stable_sort(m_loop_points.begin(), m_loop_points.end(), [](const auto& a, const auto& b) {
+            return a.midi_track < b.midi_track;
+        });
+    }
+
+    std::span<const R_LoopPoint> GetLoopPoints() const
+    {
+        return m_loop_points;
+    }
+
+private:
+    std::mutex                    m_mutex;
+    std::vector<R_LoopPoint> m_loop_points;
+};
+
+// A stretch of a track that can be rendered on its own emulator, starting from the state a serial render has when it
+// reaches start_ns.
+struct R_Segment
+{
+    // Events [first_event, last_event) are rendered. Events before first_event only set up the emulator.
+    size_t first_event = 0;
+    size_t last_event  = 0;
+    // Times at which a serial render reaches first_event and last_event. end_ns is 0 for the last segment, which
+    // ends like a whole track does.
+    uint64_t start_ns = 0;
+    uint64_t end_ns   = 0;
+};
+
+// Shared by the instances of a render that deliver the setup messages of a track, everything before its first note, as
+// fast as the firmware reads them instead of at their timestamps. Once every instance has delivered them, they all
+// continue from the same point and the rest of the track plays that much earlier.
+class R_FastSetup
+{
+public:
+    // `first_note_ns` is when the first note of the track plays. Every one of `instances` must call Finish once.
+    R_FastSetup(uint64_t first_note_ns, size_t instances)
+        : m_first_note_ns(first_note_ns)
+        , m_remaining(instances)
+    {
+    }
+
+    uint64_t GetFirstNoteNS() const
+    {
+        return m_first_note_ns;
+    }
+
+    // Called by an instance once it's delivered every setup message, `ns` into the render. Waits for the other
+    // instances and returns the time they all continue from.
+    uint64_t Finish(uint64_t ns)
+    {
+        std::unique_lock lock(m_mutex);
+        m_resume_ns = std::max(m_resume_ns, ns);
+        if (--m_remaining == 0)
+        {
+            m_finished.notify_all();
+        }
+        m_finished.wait(lock, [this] { return m_remaining == 0; });
+        return m_resume_ns;
+    }
+
+    // How much earlier than its timestamp the first note plays. Only valid once every instance has finished.
+    uint64_t GetSavedNS() const
+    {
+        return m_first_note_ns > m_resume_ns ? m_first_note_ns - m_resume_ns : 0;
+    }
+
+private:
+    uint64_t                m_first_note_ns;
+    std::mutex              m_mutex;
+    std::condition_variable m_finished;
+    size_t                  m_remaining;
+    uint64_t                m_resume_ns = 0;
+};
+
+// Hashes of one instance's emulator state, taken every `interval_ns` of emulated time for --state-trace.
+struct R_StateTrace
+{
+    struct Checkpoint
+    {
+        uint64_t ns;
+        uint64_t hash;
+    };
+
+    uint64_t                interval_ns = 0;
+    uint64_t                next_ns     = 0;
+    std::vector<Checkpoint> checkpoints;
+
+    // Takes the first checkpoint at the first multiple of `interval_ns` after `ns`.
+    void Start(uint64_t ns)
+    {
+        next_ns = (ns / interval_ns + 1) * interval_ns;
+        checkpoints.clear();
+    }
+
+    void Record(uint64_t ns, uint64_t hash)
+    {
+        checkpoints.push_back({.ns = ns, .hash = hash});
+        next_ns = (ns / interval_ns + 1) * interval_ns;
+    }
+};
+
+enum class R_CheckpointStatus
+{
+    // The instance doesn't start from a checkpoint
+    None,
+    // The checkpoint pass hasn't reached the instance's segment yet
+    Pending,
+    // The instance's emulator holds the state at the start of its segment
+    Ready,
+    // The render was cancelled before the checkpoint pass reached the instance's segment
+    Abandoned,
+};
+
+struct R_TrackRenderState
+{
+    Emulator emu;
+    // Either or both of these receive the rendered audio. The mixer is null when rendering stems without a master or
+    // in batch mode, where each job writes its output directly.
+    R_Mixer* mixer = nullptr;
+    WAV_Handle* direct_output = nullptr;
+    // If set, audio is resampled by this before it's written to `direct_output`
+    AudioResampler* direct_resampler = nullptr;
+    size_t queue_id = 0;
+    size_t ns_simulated = 0;
+    const SMF_TrackView* track = nullptr;
+    // Indexed like the events of the track `track` views, from R_ComputeEventTimes
+    std::span<const uint64_t> event_times;
+    // If set, only this part of `track` is rendered
+    const R_Segment* segment = nullptr;
+    // If set, the setup messages of `track` are delivered as fast as the firmware takes them. Not used with `segment`.
+    R_FastSetup* fast_setup = nullptr;
+    std::thread thread;
+    std::chrono::high_resolution_clock::duration elapsed;
+    size_t num_silent_frames = 0;
+    R_EndBehavior end_behavior;
+    R_LoopPointRecorder* loop_recorder;
+    AudioFormat output_format;
+    float gain = 1.0f;
+    // If set, the audio this instance hands to the mixer or `direct_output` is also hashed here, before resampling
+    SHA256Context* stream_hash = nullptr;
+    // If set, the emulator state is hashed into this along the render. Only `interval_ns` has to be set up front.
+    R_StateTrace* state_trace = nullptr;
+    // Applied by the render thread before it starts
+    std::optional<size_t> cpu;
+    ThreadPolicy thread_policy = ThreadPolicy::Default;
+    // Set once the firmware has stopped reading midi. From then on events that don't fit are dropped right away
+    // instead of waiting for the queue each time.
+    bool midi_stalled = false;
+    // Status and data of the event being posted, so that they go into the midi queue together
+    std::vector<uint8_t> midi_message;
+    // Segments start from the emulator state a serial render has at their start. The instance of the last segment
+    // fast-forwards through the track to get there, and on the way copies its emulator into the instance of each
+    // segment in `checkpoint_targets` as it reaches its start. Those instances wait for `checkpoint` to become Ready.
+    bool                          checkpoint_pass = false;
+    std::span<R_TrackRenderState> checkpoint_targets;
+    std::atomic<R_CheckpointStatus> checkpoint = R_CheckpointStatus::None;
+
+    // these fields are accessed from main thread during render process
+    std::atomic<size_t> events_processed = 0;
+    // Only written by the render thread
+    std::atomic<size_t> frames_rendered = 0;
+    std::atomic<bool> done;
+    // Written by the render thread before it sets `done`
+    bool direct_output_failed = false;
+    // Set by the checkpoint pass if copying its emulator into one of `checkpoint_targets` failed
+    bool checkpoint_failed = false;
+};
+
+// Number of frames the emulator buffers before passing them to R_ReceiveSampleBlock.
+constexpr size_t R_SAMPLE_BLOCK_SIZE = 1024;
+
+struct R_TrackList
+{
+    std::vector<SMF_TrackView> tracks;
+};
+
+struct R_MixOutState
+{
+    R_Mixer* mixer = nullptr;
+
+    // Written by mix thread, read by main thread
+    std::atomic<size_t> frames_mixed = 0;
+    // Written by mix thread before it exits. The mixer is cancelled as soon as the sink fails.
+    bool output_failed = false;
+
+    // Written by mix thread, only valid once it has exited. `wait_time` is spent in R_Mixer::WaitForWork waiting for
+    // the instances, `write_time` in `sink` writing `bytes_written`.
+    std::chrono::high_resolution_clock::duration wait_time{};
+    std::chrono::high_resolution_clock::duration write_time{};
+    uint64_t                                     bytes_written = 0;
+
+    // Receives the mixed audio. Started with `sample_rate` before the first block.
+    R_AudioSink* sink        = nullptr;
+    uint32_t     sample_rate = 0;
+
+    // If set, the mixed audio is resampled by this before it's passed to `sink`, which is started with the output
+    // rate instead
+    AudioResampler* resampler = nullptr;
+
+    // If set, the mixed audio is also appended here
+    std::vector<uint8_t>* collect = nullptr;
+
+    // Applied by the mix thread before it starts. Empty `cpus` leaves its affinity alone.
+    std::span<const size_t> cpus;
+    ThreadPolicy thread_policy = ThreadPolicy::Default;
+};
+
+void R_RunReset(Emulator& emu, EMU_SystemReset reset);
+
+// Starts the hash that names reset cache files. It covers everything the reset depends on except for the nvram,
+// which differs between instances and is added by R_GetResetCachePath.
+SHA256Context R_BeginResetCacheKey(const SharedRomImage& image, EMU_SystemReset reset);
+
+inline void R_HashBytes(SHA256Context& context, std::span<const uint8_t> bytes)
+{
+    SHA256Input(&context, bytes.data(), (unsigned int)bytes.size());
+}
+
+// Returns the digest of everything added to `context` as lowercase hex.
+std::string R_FinishHash(SHA256Context& context);
+
+// Returns the file in `directory` holding the state `emu` will be in after R_RunReset.
+std::filesystem::path R_GetResetCachePath(const std::filesystem::path& directory, SHA256Context key, Emulator& emu);
+
+// Like R_RunReset, but loads the result from `cache_path` if an earlier run stored it there, and stores it otherwise.
+void R_RunCachedReset(Emulator& emu, EMU_SystemReset reset, const std::filesystem::path& cache_path);
+
+// Splits a track into `n` tracks, each track can be processed by a single
+// emulator instance.
+R_TrackList R_SplitTrackModulo(const SMF_Track& merged_track, size_t n);
+
+// Splits a track into one track per channel group, for rendering stems. Channels that aren't in any group are dropped.
+R_TrackList R_SplitTrackByGroup(const SMF_Track& merged_track, std::span<const uint16_t> groups);
+
+// Estimates how much work each channel generates as the total time its notes are sounding, including time held by
+// the sustain pedal, in ticks.
+std::array<uint64_t, SMF_CHANNEL_COUNT> R_EstimateChannelLoad(const SMF_Data& data, const SMF_Track& merged_track);
+
+// Spreads the channels over `n` instances so that the most loaded instance has as little load as possible. Returns
+// the channels assigned to each instance as a mask.
+std::vector<uint16_t> R_BalanceChannels(std::span<const uint64_t, SMF_CHANNEL_COUNT> load, size_t n);
+
+// Returns the channels in `group` as e.g. "1+5+10".
+std::string R_FormatChannels(uint16_t group);
+
+// Returns one group per channel that has at least one event.
+std::vector<uint16_t> R_GroupUsedChannels(const SMF_Track& merged_track);
+
+uint64_t R_NSPerStep(Romset romset);
+
+uint64_t R_NSPerStep(Emulator& emu);
+
+void R_NsToTimeString(uint64_t ns, std::string& result);
+
+// Parses a time like "90", "1:30" or "1:02:03.5" into nanoseconds. Seconds may have up to nine decimals.
+bool R_ParseTimeString(std::string_view str, uint64_t& ns);
+
+mcu_sample_block_callback R_PickBlockCallback(const R_TrackRenderState& state);
+
+// Computes when each event of `track` fires, in nanoseconds of emulated time. Each event is reached by stepping from
+// the previous one for the whole steps that cover its delta at the current tempo, exactly as a serial render of the
+// whole track would. Instances and segments look their events up here instead of timing them from the deltas between
+// the events they receive, which would round differently and let instances drift apart.
+std::vector<uint64_t> R_ComputeEventTimes(const SMF_Data& data, const SMF_Track& track, uint64_t ns_per_step);
+
+// Returns when the first note of `track` plays, or 0 if it has no notes. Everything before it is setup that
+// R_FastSetup can deliver early.
+uint64_t R_FindFirstNoteNS(const SMF_Data& data, const SMF_Track& track, std::span<const uint64_t> event_times);
+
+// Cuts `track` into at most `count` segments of about the same length. Each one starts from the exact state of a serial
+// render, so cuts can go at any event.
+std::vector<R_Segment> R_SplitTrackSegments(const SMF_TrackView&      track,
+                                            std::span<const uint64_t> event_times,
+                                            size_t                    count);
+
+// Returns the part of `track` between `start_ns` and `end_ns` as a segment. `start_ns` is rounded down to a whole step
+// so that events keep the timing of a whole render. An `end_ns` of 0 renders to the end of the track.
+R_Segment R_SegmentFromTimeRange(const SMF_TrackView&      track,
+                                 std::span<const uint64_t> event_times,
+                                 uint64_t                  ns_per_step,
+                                 uint64_t                  start_ns,
+                                 uint64_t                  end_ns);
+
+// Picks the events before `first_event` that are replayed to prepare an emulator for a segment starting there. Notes
+// are left out, and so are controller changes, program changes, pitch bends and channel pressure that a later message
+// of the same kind on the same channel overrides. Data entry, mode messages and system exclusive messages are always
+// kept, and nothing before them is dropped in favor of something after them.
+std::vector<size_t> R_SelectPrimeEvents(const SMF_Data& data, const SMF_TrackView& track, size_t first_event);
+
+// Prints where an instance spent its time, for --debug.
+void R_PrintProfile(const EMU_Profile& profile);
+
+// Applies `policy` to the calling thread. Failing isn't fatal; the render just runs at the default priority.
+void R_ApplyThreadPolicy(ThreadPolicy policy);
+
+// How R_InitInstances sets up emulators.
+struct R_InstanceSetup
+{
+    EMU_SystemReset reset                = EMU_SystemReset::NONE;
+    bool            disable_oversampling = false;
+    // If set, each instance loads and saves its nvram here with its number appended. Otherwise every instance is
+    // cloned from the first one after its reset.
+    std::filesystem::path nvram_filename;
+    std::filesystem::path reset_cache_directory;
+    // If set, instance i is set up while the calling thread is pinned to cpus[i], so that its memory is allocated on
+    // the NUMA node it will render on. The calling thread stays pinned to the last cpu.
+    std::span<const size_t> cpus;
+};
+
+// Sets up the emulator of every state in `states` and runs its reset. Prints why and returns false if one fails.
+bool R_InitInstances(std::span<R_TrackRenderState>                states,
+                     const std::shared_ptr<const SharedRomImage>& rom_image,
+                     const R_InstanceSetup&                       setup);
+
+void R_RenderOne(const SMF_Data& data, R_TrackRenderState& state);
+
+void R_SetMixerQueueCount(R_Mixer& mixer, AudioFormat format, size_t count);
+
+std::thread R_StartMixOut(R_MixOutState& state, AudioFormat format);
+
+// Number of events `state` fires over the whole render.
+size_t R_GetEventCount(const R_TrackRenderState& state);
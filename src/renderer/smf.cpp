@@ -4,7 +4,8 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstring>
-#include <fstream>
+#include <queue>
+#include <tuple>
 
 // security: do not call without verifying [ptr,ptr+1] is a readable range
 // performance: 16 bit load + rol in clang and gcc, worse in MSVC
@@ -152,11 +153,10 @@ inline void Check(bool stat, const char* msg)
 #define STR2(x) STR1(x)
 #define CHECK(expr) Check((expr), __FILE__ ":" STR2(__LINE__) ": " #expr)
 
-static void SMF_ReadHeader(SMF_Reader& reader, SMF_Header& header)
+[[nodiscard]]
+static bool SMF_ReadHeader(SMF_Reader& reader, SMF_Header& header)
 {
-    CHECK(reader.ReadU16BE(header.format));
-    CHECK(reader.ReadU16BE(header.ntrks));
-    CHECK(reader.ReadU16BE(header.division));
+    return reader.ReadU16BE(header.format) && reader.ReadU16BE(header.ntrks) && reader.ReadU16BE(header.division);
 }
 
 [[nodiscard]]
@@ -179,43 +179,71 @@ static bool SMF_ReadVarint(SMF_Reader& reader, uint32_t& value)
     return true;
 }
 
-void SMF_SetDeltasFromTimestamps(SMF_Track& track)
+SMF_Track SMF_MergeTracks(const SMF_Data& data)
 {
-    if (track.events.size() == 0)
+    // Next unmerged event of a track
+    struct Cursor
     {
-        return;
-    }
+        uint64_t timestamp;
+        size_t   position;
+        size_t   track;
 
-    track.events[0].delta_time = RangeCast<uint32_t>(track.events[0].timestamp);
-    for (size_t i = 1; i < track.events.size(); ++i)
+        // std::priority_queue puts the largest element first
+        bool operator<(const Cursor& other) const
+        {
+            return std::tie(timestamp, position, track) > std::tie(other.timestamp, other.position, other.track);
+        }
+    };
+
+    size_t total_events = 0;
+    for (const SMF_Track& track : data.tracks)
     {
-        track.events[i].delta_time = RangeCast<uint32_t>(
-            track.events[i].timestamp - track.events[i - 1].timestamp
-        );
+        total_events += track.events.size();
     }
-}
 
-SMF_Track SMF_MergeTracks(const SMF_Data& data)
-{
     SMF_Track merged_track;
-    for (const SMF_Track& track : data.tracks)
+    merged_track.events.reserve(total_events);
+
+    // Each track is already in order, so only the next event of each needs to be compared
+    std::priority_queue<Cursor> cursors;
+    for (size_t i = 0; i < data.tracks.size(); ++i)
     {
-        merged_track.events.insert(
-            merged_track.events.end(),
-            track.events.begin(),
-            track.events.end());
+        if (!data.tracks[i].events.empty())
+        {
+            cursors.push({data.tracks[i].events[0].timestamp, 0, i});
+        }
     }
-    std::stable_sort(merged_track.events.begin(), merged_track.events.end(), [](const SMF_Event& left, const SMF_Event& right) {
-        if (left.timestamp == right.timestamp)
+
+    while (!cursors.empty())
+    {
+        Cursor next = cursors.top();
+        cursors.pop();
+
+        const std::vector<SMF_Event>& events = data.tracks[next.track].events;
+        merged_track.events.push_back(events[next.position]);
+
+        if (++next.position < events.size())
         {
-            return left.seq_id < right.seq_id;
+            next.timestamp = events[next.position].timestamp;
+            cursors.push(next);
         }
-        return left.timestamp < right.timestamp;
-    });
-    SMF_SetDeltasFromTimestamps(merged_track);
+    }
+
     return merged_track;
 }
 
+SMF_TrackView SMF_ViewTrack(const SMF_Track& track)
+{
+    SMF_TrackView view;
+    view.track = &track;
+    view.indices.resize(track.events.size());
+    for (size_t i = 0; i < track.events.size(); ++i)
+    {
+        view.indices[i] = RangeCast<uint32_t>(i);
+    }
+    return view;
+}
+
 inline bool SMF_IsStatusByte(uint8_t byte)
 {
     return (byte & 0x80) != 0;
@@ -234,10 +262,16 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
     while (reader.GetOffset() < expected_end)
     {
         uint32_t delta_time;
-        CHECK(SMF_ReadVarint(reader, delta_time));
+        if (!SMF_ReadVarint(reader, delta_time))
+        {
+            return false;
+        }
 
         uint8_t event_head;
-        CHECK(reader.ReadU8(event_head));
+        if (!reader.ReadU8(event_head))
+        {
+            return false;
+        }
 
         if (SMF_IsStatusByte(event_head))
         {
@@ -255,8 +289,6 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
 
         new_track.events.emplace_back();
         SMF_Event& new_event = new_track.events.back();
-        new_event.seq_id = new_track.events.size();
-        new_event.delta_time = delta_time;
         new_event.timestamp = total_time;
         new_event.status = running_status;
         new_event.track_id = this_track;
@@ -269,16 +301,22 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
             case 0xA0:
             case 0xB0:
             case 0xE0:
-                new_event.data_first = reader.GetOffset();
-                CHECK(reader.Skip(2));
-                new_event.data_last = reader.GetOffset();
+                new_event.data_first = RangeCast<uint32_t>(reader.GetOffset());
+                if (!reader.Skip(2))
+                {
+                    return false;
+                }
+                new_event.data_last = RangeCast<uint32_t>(reader.GetOffset());
                 break;
             // 1 param
             case 0xC0:
             case 0xD0:
-                new_event.data_first = reader.GetOffset();
-                CHECK(reader.Skip(1));
-                new_event.data_last = reader.GetOffset();
+                new_event.data_first = RangeCast<uint32_t>(reader.GetOffset());
+                if (!reader.Skip(1))
+                {
+                    return false;
+                }
+                new_event.data_last = RangeCast<uint32_t>(reader.GetOffset());
                 break;
             // variable length
             case 0xF0:
@@ -287,43 +325,61 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
                     {
                         // Sysex events
                         uint32_t sysex_len;
-                        CHECK(SMF_ReadVarint(reader, sysex_len));
-                        new_event.data_first = reader.GetOffset();
-                        CHECK(reader.Skip(sysex_len));
-                        new_event.data_last = reader.GetOffset();
+                        if (!SMF_ReadVarint(reader, sysex_len))
+                        {
+                            return false;
+                        }
+                        new_event.data_first = RangeCast<uint32_t>(reader.GetOffset());
+                        if (!reader.Skip(sysex_len))
+                        {
+                            return false;
+                        }
+                        new_event.data_last = RangeCast<uint32_t>(reader.GetOffset());
                     }
                     else if (new_event.status == 0xFF)
                     {
                         // Meta events
                         uint32_t meta_len;
-                        new_event.data_first = reader.GetOffset();
+                        new_event.data_first = RangeCast<uint32_t>(reader.GetOffset());
                         uint8_t meta_type;
-                        CHECK(reader.ReadU8(meta_type));
-                        CHECK(SMF_ReadVarint(reader, meta_len));
-                        CHECK(reader.Skip(meta_len));
-                        new_event.data_last = reader.GetOffset();
+                        if (!reader.ReadU8(meta_type))
+                        {
+                            return false;
+                        }
+                        if (!SMF_ReadVarint(reader, meta_len))
+                        {
+                            return false;
+                        }
+                        if (!reader.Skip(meta_len))
+                        {
+                            return false;
+                        }
+                        new_event.data_last = RangeCast<uint32_t>(reader.GetOffset());
 
                         // End of track: stop reading events and skip to where the next track would be
                         if (meta_type == 0x2F)
                         {
-                            CHECK(reader.Seek(expected_end));
+                            if (!reader.Seek(expected_end))
+                            {
+                                return false;
+                            }
                             return true;
                         }
                     }
                     else
                     {
-                        fprintf(stderr, "Panic: unhandled Fx message: %x\n", new_event.status);
-                        exit(1);
+                        // System common and realtime messages can't appear in a file
+                        return false;
                     }
                 }
                 break;
         }
     }
 
+    // Tolerated since the events themselves were read fine
     if (reader.GetOffset() > expected_end)
     {
         fprintf(stderr, "Read past expected track end\n");
-        return false;
     }
 
     return true;
@@ -337,51 +393,58 @@ void SMF_PrintStats(const SMF_Data& data)
     }
 }
 
-bool SMF_ReadAllBytes(const std::filesystem::path& filename, std::vector<uint8_t>& buffer)
-{
-    std::ifstream input(filename, std::ios::binary);
-
-    if (!input)
-    {
-        return false;
-    }
-
-    input.seekg(0, std::ios::end);
-    std::streamoff byte_count = input.tellg();
-    input.seekg(0, std::ios::beg);
-
-    buffer.resize(RangeCast<size_t>(byte_count));
-
-    input.read((char*)buffer.data(), RangeCast<std::streamsize>(byte_count));
-
-    return input.good();
-}
-
 bool SMF_ReadChunk(SMF_Reader& reader, SMF_Data& data)
 {
     uint64_t chunk_start = reader.GetOffset();
 
     uint8_t chunk_type[4];
-    CHECK(reader.ReadBytes(chunk_type, 4));
+    if (!reader.ReadBytes(chunk_type, 4))
+    {
+        return false;
+    }
 
     uint32_t chunk_size = 0;
-    CHECK(reader.ReadU32BE(chunk_size));
+    if (!reader.ReadU32BE(chunk_size))
+    {
+        return false;
+    }
 
     uint64_t chunk_end = reader.GetOffset() + chunk_size;
 
     if (memcmp(chunk_type, "MThd", 4) == 0)
     {
-        SMF_ReadHeader(reader, data.header);
+        return SMF_ReadHeader(reader, data.header);
     }
     else if (memcmp(chunk_type, "MTrk", 4) == 0)
     {
-        SMF_ReadTrack(reader, data, chunk_end);
+        return SMF_ReadTrack(reader, data, chunk_end);
     }
     else
     {
         fprintf(stderr, "Unexpected chunk type at %zu\n", (size_t)chunk_start);
         return false;
     }
+}
+
+static bool SMF_ParseChunks(SMF_ByteSpan bytes, SMF_Data& data)
+{
+    data.bytes = bytes;
+
+    // Without a header the tracks can't be timed
+    if (bytes.size() < 4 || memcmp(bytes.data(), "MThd", 4) != 0)
+    {
+        return false;
+    }
+
+    SMF_Reader reader(data.bytes);
+
+    while (!reader.AtEnd())
+    {
+        if (!SMF_ReadChunk(reader, data))
+        {
+            return false;
+        }
+    }
 
     return true;
 }
@@ -395,15 +458,35 @@ SMF_Data SMF_LoadEvents(const std::filesystem::path& filename)
 {
     SMF_Data data;
 
-    CHECK(SMF_ReadAllBytes(filename, data.bytes));
+    CHECK(SMF_TryLoadEvents(filename, data));
 
-    SMF_Reader reader(data.bytes);
+    return data;
+}
 
-    while (!reader.AtEnd())
+bool SMF_TryLoadEvents(const std::filesystem::path& filename, SMF_Data& data)
+{
+    data = SMF_Data();
+
+    // Mapping fails for empty files, which simply have no events
+    std::error_code ec;
+    if (std::filesystem::file_size(filename, ec) == 0 && !ec)
     {
-        CHECK(SMF_ReadChunk(reader, data));
+        return true;
     }
 
-    return data;
+    if (!data.file.Open(filename))
+    {
+        return false;
+    }
+
+    CHECK(SMF_ParseChunks(data.file.GetData(), data));
+
+    return true;
+}
+
+bool SMF_ParseEvents(SMF_ByteSpan bytes, SMF_Data& data)
+{
+    data = SMF_Data();
+    return SMF_ParseChunks(bytes, data);
 }
 
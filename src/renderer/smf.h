@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "mapped_file.h"
 #include <cstdint>
 #include <filesystem>
 #include <span>
@@ -16,21 +17,18 @@ struct SMF_Header
     uint16_t division;
 };
 
+// Files with millions of events are common enough that the size of this struct matters. Data stays in the file and
+// is referenced by offset, and the time since the previous event is computed from timestamps when needed.
 struct SMF_Event
 {
-    // Position of this event within the track. Used during sorting so events
-    // with the same timestamp preserve ordering.
-    uint64_t seq_id;
     // Absolute timestamp relative to track start.
     uint64_t timestamp;
-    // Time since track start (only for first event in a track) or the prior event.
-    uint32_t delta_time;
+    // Offset to raw data bytes for this message within an SMF_ByteSpan.
+    uint32_t data_first, data_last;
     // Number of MTrk chunk containing this event.
     uint16_t track_id;
     // MIDI message type.
     uint8_t status;
-    // Offset to raw data bytes for this message within an SMF_ByteSpan.
-    size_t data_first, data_last;
 
     uint8_t GetChannel() const
     {
@@ -42,6 +40,22 @@ struct SMF_Event
         return (status & 0xf0) == 0xb0;
     }
 
+    // A note on with a velocity of 0 counts as a note off.
+    bool IsNoteOn(SMF_ByteSpan bytes) const
+    {
+        return (status & 0xf0) == 0x90 && bytes[data_first + 1] != 0;
+    }
+
+    bool IsNoteOff(SMF_ByteSpan bytes) const
+    {
+        return (status & 0xf0) == 0x80 || ((status & 0xf0) == 0x90 && bytes[data_first + 1] == 0);
+    }
+
+    bool IsPolyAftertouch() const
+    {
+        return (status & 0xf0) == 0xa0;
+    }
+
     bool IsSystem() const
     {
         return status >= 0xf0;
@@ -71,29 +85,59 @@ struct SMF_Event
 
     SMF_ByteSpan GetData(SMF_ByteSpan bytes) const
     {
-        return SMF_ByteSpan(&bytes[data_first], &bytes[data_last]);
+        return bytes.subspan(data_first, data_last - data_first);
     }
 };
 
+static_assert(sizeof(SMF_Event) == 24);
+
 struct SMF_Track
 {
     std::vector<SMF_Event> events;
 };
 
+// Some of the events of a track in their original order. Events are referenced by index so that splitting a track
+// between emulator instances doesn't copy it.
+struct SMF_TrackView
+{
+    const SMF_Track*      track = nullptr;
+    std::vector<uint32_t> indices;
+
+    size_t Size() const
+    {
+        return indices.size();
+    }
+
+    const SMF_Event& operator[](size_t i) const
+    {
+        return track->events[indices[i]];
+    }
+};
+
 struct SMF_Data
 {
     SMF_Header header;
-    std::vector<uint8_t> bytes;
+    // The file is mapped rather than read, so only the parts being parsed or played need to be in memory
+    MappedFile             file;
+    SMF_ByteSpan           bytes;
     std::vector<SMF_Track> tracks;
 };
 
 const size_t SMF_CHANNEL_COUNT = 16;
 
-void SMF_SetDeltasFromTimestamps(SMF_Track& track);
+// Combines all tracks of `data` into one. Events are ordered by timestamp; ties are broken by position within their
+// track and then by track number.
 SMF_Track SMF_MergeTracks(const SMF_Data& data);
+// Returns a view of every event in `track`.
+SMF_TrackView SMF_ViewTrack(const SMF_Track& track);
 void SMF_PrintStats(const SMF_Data& data);
 SMF_Data SMF_LoadEvents(const char* filename);
 SMF_Data SMF_LoadEvents(const std::filesystem::path& filename);
+// Like SMF_LoadEvents, but returns false instead of exiting if the file can't be read. Malformed files still exit.
+bool SMF_TryLoadEvents(const std::filesystem::path& filename, SMF_Data& data);
+// Parses a file that's already in memory. `data` refers to `bytes`, which must outlive it. Returns false if the file
+// is malformed.
+bool SMF_ParseEvents(SMF_ByteSpan bytes, SMF_Data& data);
 
 inline uint64_t SMF_TicksToUS(uint64_t ticks, uint64_t us_per_qn, uint64_t division)
 {
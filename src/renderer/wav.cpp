@@ -3,10 +3,23 @@
 
 #include "wav.h"
 #include "cast.h"
+#include "flac.h"
+#include "math_util.h"
+#include "ringbuffer.h"
 
+#include <atomic>
 #include <bit>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
 #include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#endif
 
 // Constants from rfc2361
 enum class WaveFormat : uint16_t
@@ -15,41 +28,306 @@ enum class WaveFormat : uint16_t
     IEEE_FLOAT = 0x0003,
 };
 
-void WAV_WriteBytes(FILE* output, const char* bytes, size_t len)
+// Each buffer is written to the output in one call.
+constexpr size_t WAV_BUFFER_SIZE = 1024 * 1024;
+
+// Largest header of any format.
+constexpr size_t WAV_MAX_HEADER_SIZE = 58;
+
+// FLAC blocks don't straddle buffers, so only the last buffer of a file can end in a short block
+static_assert(WAV_BUFFER_SIZE % (FLAC_BLOCK_SIZE * sizeof(AudioFrame<int32_t>)) == 0);
+static_assert(WAV_BUFFER_SIZE % (FLAC_BLOCK_SIZE * sizeof(AudioFrame<int16_t>)) == 0);
+
+struct WAV_Writer
+{
+    FILE* output   = nullptr;
+    bool  uncached = false;
+
+    // Frames are collected in buffers[front] while the writer thread, if there is one, writes out the other buffer.
+    GenericBuffer buffers[2];
+    size_t        front = 0;
+    size_t        fill  = 0;
+
+    std::thread       thread;
+    // Set when the back buffer has been handed to the thread, cleared by the thread once it's written.
+    std::atomic<bool> busy = false;
+    std::atomic<bool> stop = false;
+    size_t            back_len = 0;
+
+    // Bytes written to `output` so far.
+    uint64_t          offset = 0;
+    // Bytes of `output` dropped from the page cache so far, when uncached.
+    uint64_t          dropped = 0;
+    std::atomic<bool> failed = false;
+
+    // If set, buffers hold native AudioFrame<T> of `format` and are encoded into `encoded` before they're written.
+    // Encoding happens wherever writing would, so with a writer thread it stays off the thread that calls Write.
+    std::unique_ptr<FLAC_Encoder> flac;
+    AudioFormat                   format = AudioFormat::S16;
+    std::vector<uint8_t>          encoded;
+};
+
+static void WAV_WriteOut(WAV_Writer& writer, const void* data, size_t len)
 {
-    fwrite(bytes, 1, len, output);
+    if (fwrite(data, 1, len, writer.output) != len)
+    {
+        writer.failed = true;
+    }
+
+#if defined(__linux__)
+    if (writer.uncached)
+    {
+        // Start writeback of this write now, and drop the pages of the previous one, whose writeback had a whole
+        // write's time to complete, so the page cache doesn't fill up with audio that will never be read back. Pages
+        // still under writeback can't be dropped, so the previous window is waited on first.
+        const int fd = fileno(writer.output);
+        sync_file_range(fd, (off_t)writer.offset, (off_t)len, SYNC_FILE_RANGE_WRITE);
+        if (writer.dropped < writer.offset)
+        {
+            const off_t dropped = (off_t)writer.dropped;
+            const off_t window  = (off_t)(writer.offset - writer.dropped);
+            sync_file_range(fd,
+                            dropped,
+                            window,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(fd, dropped, window, POSIX_FADV_DONTNEED);
+            writer.dropped = writer.offset;
+        }
+    }
+#endif
+
+    writer.offset += len;
 }
 
-void WAV_WriteCString(FILE* output, const char* s)
+// Writes a buffer of frames, encoding it first if the output is FLAC.
+static void WAV_WriteBuffer(WAV_Writer& writer, const void* data, size_t len)
 {
-    WAV_WriteBytes(output, s, strlen(s));
+    if (!writer.flac)
+    {
+        WAV_WriteOut(writer, data, len);
+        return;
+    }
+
+    writer.encoded.clear();
+    if (writer.format == AudioFormat::S16)
+    {
+        writer.flac->Encode(std::span((const AudioFrame<int16_t>*)data, len / sizeof(AudioFrame<int16_t>)),
+                            writer.encoded);
+    }
+    else
+    {
+        writer.flac->Encode(std::span((const AudioFrame<int32_t>*)data, len / sizeof(AudioFrame<int32_t>)),
+                            writer.encoded);
+    }
+    WAV_WriteOut(writer, writer.encoded.data(), writer.encoded.size());
 }
 
-void WAV_WriteU16LE(FILE* output, uint16_t value)
+static void WAV_WriterThread(WAV_Writer& writer)
 {
-    if constexpr (std::endian::native == std::endian::big)
+    while (true)
     {
-        value = std::byteswap(value);
+        writer.busy.wait(false);
+        if (writer.stop)
+        {
+            return;
+        }
+
+        WAV_WriteBuffer(writer, writer.buffers[writer.front ^ 1].DataFirst(), writer.back_len);
+
+        writer.busy = false;
+        writer.busy.notify_one();
     }
-    WAV_WriteBytes(output, (const char*)&value, sizeof(uint16_t));
 }
 
-void WAV_WriteU32LE(FILE* output, uint32_t value)
+// Passes the front buffer on to be written. Only blocks if the previous buffer is still being written.
+static void WAV_SubmitFront(WAV_Writer& writer)
 {
-    if constexpr (std::endian::native == std::endian::big)
+    if (!writer.thread.joinable())
     {
-        value = std::byteswap(value);
+        WAV_WriteBuffer(writer, writer.buffers[writer.front].DataFirst(), writer.fill);
+        writer.fill = 0;
+        return;
+    }
+
+    writer.busy.wait(true);
+
+    writer.back_len = writer.fill;
+    writer.front ^= 1;
+    writer.fill = 0;
+
+    writer.busy = true;
+    writer.busy.notify_one();
+}
+
+// Writes everything that's buffered and waits for it to reach the output.
+static void WAV_Drain(WAV_Writer& writer)
+{
+    if (writer.fill != 0)
+    {
+        WAV_SubmitFront(writer);
+    }
+
+    writer.busy.wait(true);
+
+    if (fflush(writer.output) != 0)
+    {
+        writer.failed = true;
     }
-    WAV_WriteBytes(output, (const char*)&value, sizeof(uint32_t));
 }
 
-void WAV_WriteF32LE(FILE* output, float value)
+static void WAV_StopWriter(WAV_Writer& writer)
 {
-    // byteswap is only implemented for integral types, so forward the call to
-    // the U32 implementation
-    WAV_WriteU32LE(output, std::bit_cast<uint32_t>(value));
+    WAV_Drain(writer);
+
+    if (writer.thread.joinable())
+    {
+        writer.stop = true;
+        writer.busy = true;
+        writer.busy.notify_one();
+        writer.thread.join();
+
+        // Nothing is in flight anymore, later drains must not wait for the thread
+        writer.busy = false;
+    }
+}
+
+// Builds a header in memory so that it can be written in one call.
+struct WAV_HeaderBuilder
+{
+    uint8_t bytes[WAV_MAX_HEADER_SIZE];
+    size_t  len = 0;
+
+    void WriteBytes(const void* src, size_t src_len)
+    {
+        assert(len + src_len <= sizeof(bytes));
+        memcpy(bytes + len, src, src_len);
+        len += src_len;
+    }
+
+    void WriteCString(const char* s)
+    {
+        WriteBytes(s, strlen(s));
+    }
+
+    void WriteU16LE(uint16_t value)
+    {
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            value = std::byteswap(value);
+        }
+        WriteBytes(&value, sizeof(uint16_t));
+    }
+
+    void WriteU32LE(uint32_t value)
+    {
+        if constexpr (std::endian::native == std::endian::big)
+        {
+            value = std::byteswap(value);
+        }
+        WriteBytes(&value, sizeof(uint32_t));
+    }
+};
+
+bool WAV_IsFLACPath(const std::filesystem::path& filename)
+{
+    std::string extension = filename.extension().generic_string();
+    for (char& c : extension)
+    {
+        c = (char)tolower((unsigned char)c);
+    }
+    return extension == ".flac";
+}
+
+// Builds the header of a WAVE file holding `frames_written` frames.
+static void WAV_BuildHeader(WAV_HeaderBuilder& header,
+                            AudioFormat        format,
+                            uint32_t           sample_rate,
+                            uint64_t           frames_written)
+{
+switch (format)
+    {
+    case AudioFormat::S16: {
+        const uint32_t data_size = RangeCast<uint32_t>(frames_written * sizeof(AudioFrame<int16_t>));
+
+        // RIFF header
+        header.WriteCString("RIFF");
+        header.WriteU32LE(36 + data_size);
+        header.WriteCString("WAVE");
+        // fmt
+        header.WriteCString("fmt ");
+        header.WriteU32LE(16);
+        header.WriteU16LE((uint16_t)WaveFormat::PCM);
+        header.WriteU16LE(AudioFrame<int16_t>::channel_count);
+        header.WriteU32LE(sample_rate);
+        header.WriteU32LE(sample_rate * sizeof(AudioFrame<int16_t>));
+        header.WriteU16LE(sizeof(AudioFrame<int16_t>));
+        header.WriteU16LE(8 * sizeof(int16_t));
+        // data
+        header.WriteCString("data");
+        header.WriteU32LE(data_size);
+
+        assert(header.len == 44);
+
+        break;
+    }
+    case AudioFormat::S32: {
+        const uint32_t data_size = RangeCast<uint32_t>(frames_written * sizeof(AudioFrame<int32_t>));
+
+        // RIFF header
+        header.WriteCString("RIFF");
+        header.WriteU32LE(36 + data_size);
+        header.WriteCString("WAVE");
+        // fmt
+        header.WriteCString("fmt ");
+        header.WriteU32LE(16);
+        header.WriteU16LE((uint16_t)WaveFormat::PCM);
+        header.WriteU16LE(AudioFrame<int32_t>::channel_count);
+        header.WriteU32LE(sample_rate);
+        header.WriteU32LE(sample_rate * sizeof(AudioFrame<int32_t>));
+        header.WriteU16LE(sizeof(AudioFrame<int32_t>));
+        header.WriteU16LE(8 * sizeof(int32_t));
+        // data
+        header.WriteCString("data");
+        header.WriteU32LE(data_size);
+
+        assert(header.len == 44);
+
+        break;
+    }
+    case AudioFormat::F32: {
+        const uint32_t data_size = RangeCast<uint32_t>(frames_written * sizeof(AudioFrame<float>));
+
+        // RIFF header
+        header.WriteCString("RIFF");
+        header.WriteU32LE(50 + data_size);
+        header.WriteCString("WAVE");
+        // fmt
+        header.WriteCString("fmt ");
+        header.WriteU32LE(18);
+        header.WriteU16LE((uint16_t)WaveFormat::IEEE_FLOAT);
+        header.WriteU16LE(AudioFrame<float>::channel_count);
+        header.WriteU32LE(sample_rate);
+        header.WriteU32LE(sample_rate * sizeof(AudioFrame<float>));
+        header.WriteU16LE(sizeof(AudioFrame<float>));
+        header.WriteU16LE(8 * sizeof(float));
+        header.WriteU16LE(0);
+        // fact
+        header.WriteCString("fact");
+        header.WriteU32LE(4);
+        header.WriteU32LE(RangeCast<uint32_t>(frames_written));
+        // data
+        header.WriteCString("data");
+        header.WriteU32LE(data_size);
+
+        assert(header.len == 58);
+
+        break;
+    }
+    }
 }
 
+WAV_Handle::WAV_Handle() = default;
+
 WAV_Handle::~WAV_Handle()
 {
     Close();
@@ -57,8 +335,10 @@ WAV_Handle::~WAV_Handle()
 
 WAV_Handle::WAV_Handle(WAV_Handle&& rhs) noexcept
 {
+    // The writer thread only refers to the writer, which stays where it is
     m_output         = rhs.m_output;
     rhs.m_output     = nullptr;
+    m_writer         = std::move(rhs.m_writer);
     m_format         = rhs.m_format;
     m_sample_rate    = rhs.m_sample_rate;
     m_frames_written = rhs.m_frames_written;
@@ -69,6 +349,7 @@ WAV_Handle& WAV_Handle::operator=(WAV_Handle&& rhs) noexcept
     Close();
     m_output         = rhs.m_output;
     rhs.m_output     = nullptr;
+    m_writer         = std::move(rhs.m_writer);
     m_format         = rhs.m_format;
     m_sample_rate    = rhs.m_sample_rate;
     m_frames_written = rhs.m_frames_written;
@@ -80,26 +361,98 @@ void WAV_Handle::SetSampleRate(uint32_t sample_rate)
     m_sample_rate = sample_rate;
 }
 
-void WAV_Handle::OpenStdout(AudioFormat format)
+bool WAV_Handle::OpenStdout(AudioFormat format, const WAV_Options& options)
 {
     m_format = format;
     m_output = stdout;
+
+    WAV_Options stdout_options = options;
+    stdout_options.uncached    = false;
+    return Start(stdout_options);
 }
 
-void WAV_Handle::Open(const char* filename, AudioFormat format)
+bool WAV_Handle::Open(const char* filename, AudioFormat format, const WAV_Options& options)
 {
-    Open(std::filesystem::path(filename), format);
+    return Open(std::filesystem::path(filename), format, options);
 }
 
-void WAV_Handle::Open(const std::filesystem::path& filename, AudioFormat format)
+bool WAV_Handle::Open(const std::filesystem::path& filename, AudioFormat format, const WAV_Options& options)
 {
+    const bool flac = WAV_IsFLACPath(filename);
+    if (flac && format == AudioFormat::F32)
+    {
+        fprintf(stderr, "ERROR: FLAC can't hold f32 samples: %s\n", filename.generic_string().c_str());
+        return false;
+    }
+
     m_format = format;
     m_output = fopen(filename.generic_string().c_str(), "wb");
-    fseek(m_output, format == AudioFormat::F32 ? 58 : 44, SEEK_SET);
+    if (!m_output)
+    {
+        fprintf(stderr, "ERROR: Failed to open %s for writing: %s\n", filename.generic_string().c_str(), strerror(errno));
+        return false;
+    }
+
+    // Leave room for the header, which is filled in by Finish
+    const long header_size = flac ? (long)FLAC_HEADER_SIZE : format == AudioFormat::F32 ? 58 : 44;
+    fseek(m_output, header_size, SEEK_SET);
+
+#if defined(__APPLE__)
+    if (options.uncached)
+    {
+        fcntl(fileno(m_output), F_NOCACHE, 1);
+    }
+#endif
+
+    if (!Start(options))
+    {
+        return false;
+    }
+
+    m_writer->offset  = (uint64_t)header_size;
+    m_writer->dropped = (uint64_t)header_size;
+    m_writer->format = format;
+    if (flac)
+    {
+        m_writer->flac = std::make_unique<FLAC_Encoder>(format == AudioFormat::S16 ? 16 : 24);
+    }
+
+    return true;
+}
+
+bool WAV_Handle::Start(const WAV_Options& options)
+{
+    m_writer           = std::make_unique<WAV_Writer>();
+    m_writer->output   = m_output;
+    m_writer->uncached = options.uncached;
+
+    if (!m_writer->buffers[0].Init(WAV_BUFFER_SIZE) ||
+        (options.writer_thread && !m_writer->buffers[1].Init(WAV_BUFFER_SIZE)))
+    {
+        fprintf(stderr, "ERROR: Failed to allocate output buffer\n");
+        Close();
+        return false;
+    }
+
+    // Everything goes through our own buffers in large writes, so stdio doesn't need to buffer too
+    setvbuf(m_output, nullptr, _IONBF, 0);
+
+    if (options.writer_thread)
+    {
+        m_writer->thread = std::thread(WAV_WriterThread, std::ref(*m_writer));
+    }
+
+    return true;
 }
 
 void WAV_Handle::Close()
 {
+    if (m_writer)
+    {
+        WAV_StopWriter(*m_writer);
+        m_writer.reset();
+    }
+
     if (m_output && m_output != stdout)
     {
         fclose(m_output);
@@ -107,118 +460,115 @@ void WAV_Handle::Close()
     m_output = nullptr;
 }
 
+template <typename T>
+void WAV_Handle::WriteFrames(std::span<const AudioFrame<T>> frames)
+{
+    WAV_Writer& writer = *m_writer;
+
+    m_frames_written += frames.size();
+
+    while (!frames.empty())
+    {
+        // The buffer size is a multiple of every frame size, so frames never straddle two buffers
+        const size_t space = (WAV_BUFFER_SIZE - writer.fill) / sizeof(AudioFrame<T>);
+        const size_t count = Min(space, frames.size());
+
+        // FLAC is encoded from native frames
+        uint8_t* dest = (uint8_t*)writer.buffers[writer.front].DataFirst() + writer.fill;
+        if (std::endian::native == std::endian::little || writer.flac)
+        {
+            memcpy(dest, frames.data(), count * sizeof(AudioFrame<T>));
+        }
+        else
+        {
+            using U = std::conditional_t<sizeof(T) == 2, uint16_t, uint32_t>;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const U le[2] = {
+                    std::byteswap(std::bit_cast<U>(frames[i].left)),
+                    std::byteswap(std::bit_cast<U>(frames[i].right)),
+                };
+                memcpy(dest + i * sizeof(le), le, sizeof(le));
+            }
+        }
+        writer.fill += count * sizeof(AudioFrame<T>);
+
+        if (writer.fill == WAV_BUFFER_SIZE)
+        {
+            WAV_SubmitFront(writer);
+        }
+
+        frames = frames.subspan(count);
+    }
+}
+
 void WAV_Handle::Write(const AudioFrame<int16_t>& frame)
 {
-    WAV_WriteU16LE(m_output, std::bit_cast<uint16_t>(frame.left));
-    WAV_WriteU16LE(m_output, std::bit_cast<uint16_t>(frame.right));
-    ++m_frames_written;
+    WriteFrames(std::span(&frame, 1));
 }
 
 void WAV_Handle::Write(const AudioFrame<int32_t>& frame)
 {
-    WAV_WriteU32LE(m_output, std::bit_cast<uint32_t>(frame.left));
-    WAV_WriteU32LE(m_output, std::bit_cast<uint32_t>(frame.right));
-    ++m_frames_written;
+    WriteFrames(std::span(&frame, 1));
 }
 
 void WAV_Handle::Write(const AudioFrame<float>& frame)
 {
-    WAV_WriteF32LE(m_output, frame.left);
-    WAV_WriteF32LE(m_output, frame.right);
-    ++m_frames_written;
+    WriteFrames(std::span(&frame, 1));
 }
 
-void WAV_Handle::Finish()
+void WAV_Handle::Write(std::span<const AudioFrame<int16_t>> frames)
 {
-    // we wrote raw samples, nothing to do
-    if (m_output == stdout)
-    {
-        return;
-    }
-
-    // go back and fill in the header
-    fseek(m_output, 0, SEEK_SET);
-
-    switch (m_format)
-    {
-    case AudioFormat::S16: {
-        const uint32_t data_size = RangeCast<uint32_t>(m_frames_written * sizeof(AudioFrame<int16_t>));
+    WriteFrames(frames);
+}
 
-        // RIFF header
-        WAV_WriteCString(m_output, "RIFF");
-        WAV_WriteU32LE(m_output, 36 + data_size);
-        WAV_WriteCString(m_output, "WAVE");
-        // fmt
-        WAV_WriteCString(m_output, "fmt ");
-        WAV_WriteU32LE(m_output, 16);
-        WAV_WriteU16LE(m_output, (uint16_t)WaveFormat::PCM);
-        WAV_WriteU16LE(m_output, AudioFrame<int16_t>::channel_count);
-        WAV_WriteU32LE(m_output, m_sample_rate);
-        WAV_WriteU32LE(m_output, m_sample_rate * sizeof(AudioFrame<int16_t>));
-        WAV_WriteU16LE(m_output, sizeof(AudioFrame<int16_t>));
-        WAV_WriteU16LE(m_output, 8 * sizeof(int16_t));
-        // data
-        WAV_WriteCString(m_output, "data");
-        WAV_WriteU32LE(m_output, data_size);
+void WAV_Handle::Write(std::span<const AudioFrame<int32_t>> frames)
+{
+    WriteFrames(frames);
+}
 
-        assert(ftell(m_output) == 44);
+void WAV_Handle::Write(std::span<const AudioFrame<float>> frames)
+{
+    WriteFrames(frames);
+}
 
-        break;
+bool WAV_Handle::Finish()
+{
+    if (!m_writer)
+    {
+        return false;
     }
-    case AudioFormat::S32: {
-        const uint32_t data_size = RangeCast<uint32_t>(m_frames_written * sizeof(AudioFrame<int32_t>));
-
-        // RIFF header
-        WAV_WriteCString(m_output, "RIFF");
-        WAV_WriteU32LE(m_output, 36 + data_size);
-        WAV_WriteCString(m_output, "WAVE");
-        // fmt
-        WAV_WriteCString(m_output, "fmt ");
-        WAV_WriteU32LE(m_output, 16);
-        WAV_WriteU16LE(m_output, (uint16_t)WaveFormat::PCM);
-        WAV_WriteU16LE(m_output, AudioFrame<int32_t>::channel_count);
-        WAV_WriteU32LE(m_output, m_sample_rate);
-        WAV_WriteU32LE(m_output, m_sample_rate * sizeof(AudioFrame<int32_t>));
-        WAV_WriteU16LE(m_output, sizeof(AudioFrame<int32_t>));
-        WAV_WriteU16LE(m_output, 8 * sizeof(int32_t));
-        // data
-        WAV_WriteCString(m_output, "data");
-        WAV_WriteU32LE(m_output, data_size);
 
-        assert(ftell(m_output) == 44);
+    WAV_StopWriter(*m_writer);
+    bool ok = !m_writer->failed;
 
-        break;
+    // we wrote raw samples, nothing to do
+    if (m_output == stdout)
+    {
+        Close();
+        return ok;
     }
-    case AudioFormat::F32: {
-        const uint32_t data_size = RangeCast<uint32_t>(m_frames_written * sizeof(AudioFrame<float>));
-
-        // RIFF header
-        WAV_WriteCString(m_output, "RIFF");
-        WAV_WriteU32LE(m_output, 50 + data_size);
-        WAV_WriteCString(m_output, "WAVE");
-        // fmt
-        WAV_WriteCString(m_output, "fmt ");
-        WAV_WriteU32LE(m_output, 18);
-        WAV_WriteU16LE(m_output, (uint16_t)WaveFormat::IEEE_FLOAT);
-        WAV_WriteU16LE(m_output, AudioFrame<float>::channel_count);
-        WAV_WriteU32LE(m_output, m_sample_rate);
-        WAV_WriteU32LE(m_output, m_sample_rate * sizeof(AudioFrame<float>));
-        WAV_WriteU16LE(m_output, sizeof(AudioFrame<float>));
-        WAV_WriteU16LE(m_output, 8 * sizeof(float));
-        WAV_WriteU16LE(m_output, 0);
-        // fact
-        WAV_WriteCString(m_output, "fact");
-        WAV_WriteU32LE(m_output, 4);
-        WAV_WriteU32LE(m_output, RangeCast<uint32_t>(m_frames_written));
-        // data
-        WAV_WriteCString(m_output, "data");
-        WAV_WriteU32LE(m_output, data_size);
-
-        assert(ftell(m_output) == 58);
 
-        break;
+    WAV_HeaderBuilder header;
+    if (m_writer->flac)
+    {
+        m_writer->flac->WriteHeader(m_sample_rate, std::span(header.bytes).first<FLAC_HEADER_SIZE>());
+        header.len = FLAC_HEADER_SIZE;
     }
+    else
+    {
+        WAV_BuildHeader(header, m_format, m_sample_rate, m_frames_written);
     }
 
+    // go back and fill in the header
+    if (fseek(m_output, 0, SEEK_SET) != 0 || fwrite(header.bytes, 1, header.len, m_output) != header.len)
+    {
+        ok = false;
+    }
+
+    ok = ok && fflush(m_output) == 0;
+
     Close();
+
+    return ok;
 }
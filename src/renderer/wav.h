@@ -1,5 +1,5 @@
 // This is a very minimal WAVE writer. It only exists to output something other
-// than raw sample data.
+// than raw sample data. Files named *.flac are written as FLAC instead.
 
 #pragma once
 
@@ -7,11 +7,31 @@
 #include <cstdint>
 #include <cstdio>
 #include <filesystem>
+#include <memory>
+#include <span>
+
+struct WAV_Options
+{
+    // Write to the output on a dedicated thread, so that Write only blocks if the disk falls behind by more than a
+    // buffer.
+    bool writer_thread = false;
+
+    // Ask the OS not to keep the written data in its page cache. Useful for renders much larger than memory, and on
+    // network storage. Ignored for stdout and on platforms without a way to do it.
+    bool uncached = false;
+};
+
+// Returns true if `filename` names a FLAC file, which WAV_Handle::Open writes instead of a WAVE file. FLAC only holds
+// integer samples; S32 is stored as 24 bits.
+bool WAV_IsFLACPath(const std::filesystem::path& filename);
+
+// wav.cpp
+struct WAV_Writer;
 
 class WAV_Handle
 {
 public:
-    WAV_Handle() = default;
+    WAV_Handle();
     ~WAV_Handle();
     // moveable
     WAV_Handle(WAV_Handle&&) noexcept;
@@ -22,18 +42,29 @@ public:
 
     void SetSampleRate(uint32_t sample_rate);
 
-    void OpenStdout(AudioFormat format);
-    void Open(const char* filename, AudioFormat format);
-    void Open(const std::filesystem::path& filename, AudioFormat format);
+    bool OpenStdout(AudioFormat format, const WAV_Options& options = {});
+    bool Open(const char* filename, AudioFormat format, const WAV_Options& options = {});
+    bool Open(const std::filesystem::path& filename, AudioFormat format, const WAV_Options& options = {});
     void Close();
     void Write(const AudioFrame<int16_t>& frame);
     void Write(const AudioFrame<int32_t>& frame);
     void Write(const AudioFrame<float>& frame);
-    void Finish();
+    void Write(std::span<const AudioFrame<int16_t>> frames);
+    void Write(std::span<const AudioFrame<int32_t>> frames);
+    void Write(std::span<const AudioFrame<float>> frames);
+    // Writes everything that's still buffered and fills in the header. Returns false if any write failed.
+    bool Finish();
+
+private:
+    template <typename T>
+    void WriteFrames(std::span<const AudioFrame<T>> frames);
+
+    bool Start(const WAV_Options& options);
 
 private:
-    FILE*       m_output = nullptr;
-    uint64_t    m_frames_written = 0;
-    AudioFormat m_format;
-    uint32_t    m_sample_rate;
+    FILE*                       m_output = nullptr;
+    std::unique_ptr<WAV_Writer> m_writer;
+    uint64_t                    m_frames_written = 0;
+    AudioFormat                 m_format;
+    uint32_t                    m_sample_rate;
 };
@@ -135,6 +135,11 @@ void LCD_SDL_Backend::HandleEvent(const SDL_Event& sdl_event)
         {
             m_quit_requested = true;
         }
+        else if (sdl_event.window.event == SDL_WINDOWEVENT_EXPOSED)
+        {
+            // LCD_Render only calls Render when the contents change, so show the last frame again here
+            Present();
+        }
         break;
 
     case SDL_KEYDOWN:
@@ -261,9 +266,20 @@ void LCD_SDL_Backend::HandleEvent(const SDL_Event& sdl_event)
     }
 }
 
-void LCD_SDL_Backend::Render()
+void LCD_SDL_Backend::Render(std::span<const lcd_rect_t> dirty)
+{
+    const int pitch = (int)m_lcd->width * 4;
+    for (const lcd_rect_t& rect : dirty)
+    {
+        const SDL_Rect sdl_rect{rect.left, rect.top, rect.width, rect.height};
+        const uint32_t* pixels = &m_lcd->buffer[(size_t)rect.top * m_lcd->width + (size_t)rect.left];
+        SDL_UpdateTexture(m_texture, &sdl_rect, pixels, pitch);
+    }
+    Present();
+}
+
+void LCD_SDL_Backend::Present()
 {
-    SDL_UpdateTexture(m_texture, NULL, m_lcd->buffer, lcd_width_max * 4);
     SDL_RenderCopy(m_renderer, m_texture, NULL, NULL);
     SDL_RenderPresent(m_renderer);
 }
@@ -13,7 +13,10 @@ public:
     void Stop();
 
     void HandleEvent(const SDL_Event& ev);
-    void Render();
+    void Render(std::span<const lcd_rect_t> dirty);
+
+    // Shows the texture again without uploading anything.
+    void Present();
 
     bool IsQuitRequested() const;
 
@@ -32,24 +32,34 @@
  *  POSSIBILITY OF SUCH DAMAGE.
  */
 #include "audio.h"
+#include "audio_kernel.h"
 #include "audio_sdl.h"
 #include "cast.h"
 #include "command_line.h"
 #include "config.h"
 #include "emu.h"
 #include "lcd_sdl.h"
+#include "math_util.h"
 #include "mcu.h"
 #include "midi.h"
 #include "output_common.h"
 #include "path_util.h"
 #include "pcm.h"
+#include "resampler.h"
 #include "ringbuffer.h"
+#include "thread_util.h"
 #include <SDL.h>
+#include <atomic>
 #include <bit>
+#include <cstring>
 #include <optional>
+#include <span>
 #include <thread>
+#include <vector>
 
 #include "output_asio.h"
+#include "output_coreaudio.h"
+#include "output_jack.h"
 #include "output_sdl.h"
 
 #include "common/gain.h"
@@ -65,6 +75,72 @@ size_t FE_CalcRingbufferSizeBytes(uint32_t buffer_size, uint32_t buffer_count)
     return std::bit_ceil<size_t>(1 + (size_t)buffer_size * (size_t)buffer_count * sizeof(ElemT));
 }
 
+// Sample buffers are mirrored when possible so that chunks and output periods of any size can be handed out whole.
+// Without mirroring, chunks have to evenly divide the buffer, which only power-of-2 chunks are sure to do. Parameters
+// are only rounded to a power of 2 when mirroring isn't supported at all, so a mirrored buffer that fails to map here
+// can't fall back for `chunk_frames` of any other size.
+[[nodiscard]]
+bool FE_InitSampleBuffer(GenericBuffer& buffer, size_t size_bytes, size_t chunk_frames)
+{
+    if (buffer.InitMirrored(size_bytes))
+    {
+        return true;
+    }
+    if (!std::has_single_bit(chunk_frames))
+    {
+        fprintf(stderr, "ERROR: Failed to map a mirrored buffer for chunks of %zu frames\n", chunk_frames);
+        return false;
+    }
+    return buffer.Init(size_bytes);
+}
+
+// Time between a note on arriving from the MIDI driver and its audio leaving the emulator's buffer, as measured by the
+// instance thread for `--stats`. Read and reset by the main thread.
+struct FE_LatencyStats
+{
+    std::atomic<uint64_t> min_ns  = UINT64_MAX;
+    std::atomic<uint64_t> max_ns  = 0;
+    std::atomic<uint64_t> sum_ns  = 0;
+    std::atomic<uint32_t> samples = 0;
+
+    void Record(uint64_t latency_ns)
+    {
+        if (latency_ns < min_ns.load(std::memory_order_relaxed))
+        {
+            min_ns.store(latency_ns, std::memory_order_relaxed);
+        }
+        if (latency_ns > max_ns.load(std::memory_order_relaxed))
+        {
+            max_ns.store(latency_ns, std::memory_order_relaxed);
+        }
+        sum_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// A midi message waiting in FE_Instance::midi_view for its release time. Messages longer than `bytes` take several
+// records with the same time.
+struct FE_TimedMIDI
+{
+    uint64_t time_ns;
+    uint8_t  size;
+    uint8_t  bytes[23];
+};
+static_assert(sizeof(FE_TimedMIDI) == 32, "record size must divide the ringbuffer size");
+
+// Number of FE_TimedMIDI records that can wait at once. Must be a power of 2.
+const size_t FE_TIMED_MIDI_CAPACITY = 4096;
+
+// Maps host time onto the emulator's frame counter. The frame the output is playing right now is `frames_posted` minus
+// whatever is still buffered, but that estimate jumps around as the output takes whole chunks at a time. It's smoothed
+// so that it stays put, while still following any slow drift between the host clock and the audio clock.
+struct FE_MIDIClock
+{
+    bool valid = false;
+    // Playing frame minus host time in frames
+    double offset = 0;
+};
+
 struct FE_Instance
 {
     Emulator emu;
@@ -76,23 +152,72 @@ struct FE_Instance
     void*          chunk_first = nullptr;
     void*          chunk_last  = nullptr;
 
-    std::thread thread;
     AudioFormat format;
 
-    // read by instance thread, written by main thread
-    std::atomic<bool> running = false;
+    // Set while a worker is rendering this instance, so that no other worker touches it meanwhile
+    std::atomic<bool> claimed = false;
+
+    // Set by FE_Run for the audio output and format. `get_fill` returns how full the output buffer is, from 0 to 1, and
+    // may be called by any worker. `render_chunk` is only called by the worker that claimed the instance.
+    double (*get_fill)(const FE_Instance& instance) = nullptr;
+    void (*render_chunk)(FE_Instance& instance)     = nullptr;
+
+    // Owned by the audio output; wakes waiting workers when there is room in a buffer
+    AudioPacer* pacer = nullptr;
 
     uint32_t buffer_size;
     uint32_t buffer_count;
 
     float gain = 1.0f;
 
+    // With --midi-latency, midi is queued here by the midi thread and released by its worker once the instance reaches
+    // the frame corresponding to the message time plus `midi_latency_frames`.
+    bool           timed_midi = false;
+    GenericBuffer  midi_buffer;
+    RingbufferView midi_view;
+    double         midi_latency_frames = 0;
+    double         frames_per_ns = 0;
+    FE_MIDIClock   midi_clock;
+
+    // Number of PCM voices keyed on, published by the worker after each chunk for `--midi-routing voices`.
+    std::atomic<uint32_t> voices_in_use = 0;
+
+    // For `--stats`. The output records how full the buffer was each time it took audio, and the worker publishes how
+    // far the instance has rendered.
+    AudioSourceStats      output_stats;
+    std::atomic<uint64_t> frames_rendered = 0;
+
+    // For `--stats`, the midi thread leaves the receive time of a note on here and the worker turns it into a latency
+    // measurement when the note is rendered. Only one probe is in flight at a time.
+    bool                  latency_probes = false;
+    std::atomic<uint64_t> probe_time_ns  = 0;
+    FE_LatencyStats       latency;
+
+    // Main thread only
+    uint64_t stats_last_frames = 0;
+
+    // With --affinity cores, the instance is set up from this cpu so that its memory is on the cpu's NUMA node
+    std::optional<size_t> cpu;
+
+#if NUKED_ENABLE_ASIO || NUKED_ENABLE_JACK
+    // ASIO drivers and JACK servers often can't run at the emulator's frequency, so audio is resampled to theirs.
+    AudioResampler resampler;
+#endif
+
 #if NUKED_ENABLE_ASIO
-    // ASIO uses an SDL_AudioStream because it needs resampling to a more conventional frequency, but putting data into
-    // the stream one frame at a time is *slow* so we buffer audio in `sample_buffer` and add it all at once.
+    // Resampled audio is handed to the ASIO output through an SDL_AudioStream, which converts it to the driver's sample
+    // format. Putting data into the stream one frame at a time is *slow* so we buffer audio in `sample_buffer` and add
+    // it all at once.
     SDL_AudioStream* stream = nullptr;
 #endif
 
+#if NUKED_ENABLE_JACK
+    // JACK takes floats at the server's frequency, so each block from the emulator is converted here and resampled
+    // into `sample_buffer`, which then holds periods of AudioFrame<float>. A block yields up to `jack_block_frames`.
+    std::vector<AudioFrame<float>> jack_block;
+    size_t                         jack_block_frames = 0;
+#endif
+
     template <typename SampleT>
     void Prepare()
     {
@@ -107,24 +232,100 @@ struct FE_Instance
         view.UncheckedFinishWrite<AudioFrame<SampleT>>(buffer_size);
     }
 
+    // Number of frames that still need to be written before the current chunk is finished.
     template <typename SampleT>
-    void CreateAndPrepareBuffer()
+    size_t GetRemainingChunkFrames() const
     {
-        sample_buffer.Init(FE_CalcRingbufferSizeBytes<AudioFrame<SampleT>>(buffer_size, buffer_count));
+        return (size_t)((AudioFrame<SampleT>*)chunk_last - (AudioFrame<SampleT>*)chunk_first);
+    }
+
+    template <typename SampleT>
+    [[nodiscard]]
+    bool CreateAndPrepareBuffer()
+    {
+        if (!FE_InitSampleBuffer(
+                sample_buffer, FE_CalcRingbufferSizeBytes<AudioFrame<SampleT>>(buffer_size, buffer_count), buffer_size))
+        {
+            return false;
+        }
         view = RingbufferView(sample_buffer);
         Prepare<SampleT>();
+        return true;
+    }
+
+    // Creates the buffer for samples in `format`. Returns false if it can't be allocated.
+    [[nodiscard]]
+    bool CreateAndPrepareBuffer()
+    {
+        switch (format)
+        {
+        case AudioFormat::S16:
+            return CreateAndPrepareBuffer<int16_t>();
+        case AudioFormat::S32:
+            return CreateAndPrepareBuffer<int32_t>();
+        case AudioFormat::F32:
+            return CreateAndPrepareBuffer<float>();
+        }
+        return false;
     }
 };
 
 const size_t FE_MAX_INSTANCES = 16;
 
+enum class FE_RoutingMode
+{
+    // Channel c goes to instance c % n.
+    Modulo,
+    // Each note goes to the instance playing the fewest notes.
+    Notes,
+    // Like Notes, but also counts the voices each instance's PCM chip has keyed on.
+    Voices,
+};
+
+// Remembers which instance plays each note so that its note off and aftertouch follow it. Only used by the midi
+// thread.
+struct FE_NoteRouter
+{
+    static constexpr uint8_t NO_INSTANCE = 0xff;
+
+    FE_NoteRouter()
+    {
+        memset(note_instance, NO_INSTANCE, sizeof(note_instance));
+    }
+
+    uint8_t note_instance[16][128];
+    // False once the note is released but the sustain pedal keeps it sounding
+    bool note_held[16][128]{};
+    bool sustain[16]{};
+    // Notes each instance is playing, including sustained ones
+    uint32_t notes_sounding[FE_MAX_INSTANCES]{};
+};
+
 struct FE_Application {
     FE_Instance instances[FE_MAX_INSTANCES];
     size_t instances_in_use = 0;
 
+    FE_RoutingMode routing = FE_RoutingMode::Modulo;
+    FE_NoteRouter  router;
+
+    // Print stats every second, see FE_PrintStats
+    bool stats = false;
+
     AllRomsetInfo romset_info;
     Romset            romset;
 
+    // Built from `romset_info` by the first instance and shared by the others
+    std::shared_ptr<const SharedRomImage> rom_image;
+
+    // Empty unless threads are pinned with --affinity. Worker w runs on `instance_cpus[w]`.
+    TH_AffinityPlan affinity;
+
+    // Instances are rendered by a pool of workers, see FE_RunWorker
+    size_t                   worker_count = 1;
+    std::vector<std::thread> workers;
+    std::atomic<bool>        workers_running = false;
+    ThreadPolicy             thread_policy   = ThreadPolicy::Default;
+
     AudioOutput audio_output{};
 
     bool running = false;
@@ -147,6 +348,7 @@ struct FE_Parameters
     size_t instances = 1;
     std::string_view romset_name;
     bool legacy_romset_detection = false;
+    std::filesystem::path rom_hash_cache;
     std::optional<std::filesystem::path> rom_directory;
     AudioFormat output_format = AudioFormat::S16;
     bool no_lcd = false;
@@ -154,9 +356,22 @@ struct FE_Parameters
     std::optional<uint32_t> asio_sample_rate;
     std::string asio_left_channel;
     std::string asio_right_channel;
+    std::optional<uint32_t> coreaudio_sample_rate;
+    JACK_PortLayout jack_layout = JACK_PortLayout::Mixed;
+    bool jack_connect = true;
     std::filesystem::path nvram_filename;
+    std::optional<uint32_t> midi_latency_ms;
+    FE_RoutingMode midi_routing = FE_RoutingMode::Modulo;
+    bool stats = false;
     FE_AdvancedParameters adv;
     float gain = 1.0f;
+    // Pin each instance thread to its own physical core
+    bool pin_threads = false;
+    ThreadPolicy thread_policy = ThreadPolicy::Default;
+    // Number of threads rendering instances. Zero picks one per physical core, up to the number of instances.
+    size_t workers = 0;
+    // If set, firmware instruction counts are written here as folded stacks on exit
+    std::filesystem::path pc_profile_filename;
 };
 
 bool FE_AllocateInstance(FE_Application& container, FE_Instance** result)
@@ -177,20 +392,189 @@ bool FE_AllocateInstance(FE_Application& container, FE_Instance** result)
     return true;
 }
 
-void FE_SendMIDI(FE_Application& fe, size_t n, std::span<const uint8_t> bytes)
+// Queues `bytes` to be released by FE_ReleaseTimedMIDI. Called on the midi thread.
+bool FE_QueueTimedMIDI(FE_Instance& instance, std::span<const uint8_t> bytes, uint64_t time_ns)
+{
+    constexpr size_t record_bytes = sizeof(FE_TimedMIDI::bytes);
+
+    const size_t records = (bytes.size() + record_bytes - 1) / record_bytes;
+    if (instance.midi_view.GetWritableElements<FE_TimedMIDI>() < records)
+    {
+        return false;
+    }
+
+    while (!bytes.empty())
+    {
+        FE_TimedMIDI record;
+        record.time_ns = time_ns;
+        record.size    = (uint8_t)Min(bytes.size(), record_bytes);
+        memcpy(record.bytes, bytes.data(), record.size);
+        instance.midi_view.UncheckedWriteOne(record);
+
+        bytes = bytes.subspan(record.size);
+    }
+
+    return true;
+}
+
+bool FE_IsNoteOn(std::span<const uint8_t> bytes)
+{
+    return bytes.size() >= 3 && (bytes[0] & 0xF0) == 0x90 && bytes[2] != 0;
+}
+
+void FE_SendMIDI(FE_Application& fe, size_t n, std::span<const uint8_t> bytes, uint64_t time_ns)
+{
+    FE_Instance& instance = fe.instances[n];
+
+    // Timed midi is measured as it's released instead
+    if (instance.latency_probes && !instance.timed_midi && FE_IsNoteOn(bytes))
+    {
+        uint64_t no_probe = 0;
+        instance.probe_time_ns.compare_exchange_strong(no_probe, time_ns, std::memory_order_relaxed);
+    }
+
+    const bool queued =
+        instance.timed_midi ? FE_QueueTimedMIDI(instance, bytes, time_ns) : instance.emu.PostMIDI(bytes);
+    if (!queued)
+    {
+        fprintf(stderr, "WARNING: MIDI queue for instance %02zu is full; dropped %zu bytes\n", n, bytes.size());
+    }
+}
+
+void FE_BroadcastMIDI(FE_Application& fe, std::span<const uint8_t> bytes, uint64_t time_ns)
+{
+    for (size_t i = 0; i < fe.instances_in_use; ++i)
+    {
+        FE_SendMIDI(fe, i, bytes, time_ns);
+    }
+}
+
+// Forgets a note once nothing keeps it sounding anymore.
+void FE_ReleaseNote(FE_NoteRouter& router, uint8_t channel, uint8_t key)
 {
-    fe.instances[n].emu.PostMIDI(bytes);
+    uint8_t& instance = router.note_instance[channel][key];
+    if (instance != FE_NoteRouter::NO_INSTANCE)
+    {
+        --router.notes_sounding[instance];
+        instance = FE_NoteRouter::NO_INSTANCE;
+    }
 }
 
-void FE_BroadcastMIDI(FE_Application& fe, std::span<const uint8_t> bytes)
+// Picks the instance for a new note: the one already playing the same key, so that retriggers and their note offs
+// stay together, or otherwise the least loaded one.
+size_t FE_PickNoteInstance(FE_Application& fe, uint8_t channel, uint8_t key)
 {
+    FE_NoteRouter& router = fe.router;
+
+    if (router.note_instance[channel][key] != FE_NoteRouter::NO_INSTANCE)
+    {
+        return router.note_instance[channel][key];
+    }
+
+    size_t   best      = 0;
+    uint64_t best_load = UINT64_MAX;
     for (size_t i = 0; i < fe.instances_in_use; ++i)
     {
-        FE_SendMIDI(fe, i, bytes);
+        uint64_t load = router.notes_sounding[i];
+        if (fe.routing == FE_RoutingMode::Voices)
+        {
+            // The voice count lags behind by up to a chunk, so notes sent since then still count through
+            // `notes_sounding`
+            load += fe.instances[i].voices_in_use.load(std::memory_order_relaxed);
+        }
+
+        if (load < best_load)
+        {
+            best      = i;
+            best_load = load;
+        }
+    }
+
+    router.note_instance[channel][key] = (uint8_t)best;
+    ++router.notes_sounding[best];
+    return best;
+}
+
+// Routes channel messages for FE_RoutingMode::Notes and Voices. Notes are spread over the instances, and everything
+// else that affects a channel goes to all of them so that each one has the same controller and program state.
+void FE_RouteNoteMIDI(FE_Application& fe, std::span<const uint8_t> bytes, uint64_t time_ns)
+{
+    FE_NoteRouter& router = fe.router;
+
+    const uint8_t status  = bytes[0] & 0xF0;
+    const uint8_t channel = bytes[0] & 0x0F;
+    const uint8_t data1   = bytes.size() > 1 ? bytes[1] & 0x7F : 0;
+    const uint8_t data2   = bytes.size() > 2 ? bytes[2] & 0x7F : 0;
+
+    const bool is_note_on  = status == 0x90 && data2 != 0;
+    const bool is_note_off = status == 0x80 || (status == 0x90 && data2 == 0);
+
+    if (is_note_on)
+    {
+        const size_t instance = FE_PickNoteInstance(fe, channel, data1);
+        router.note_held[channel][data1] = true;
+        FE_SendMIDI(fe, instance, bytes, time_ns);
+    }
+    else if (is_note_off || status == 0xA0)
+    {
+        const uint8_t instance = router.note_instance[channel][data1];
+        if (instance == FE_NoteRouter::NO_INSTANCE)
+        {
+            // Started before we were tracking it, or already cut off by the sustain pedal or an all notes off
+            if (is_note_off)
+            {
+                FE_BroadcastMIDI(fe, bytes, time_ns);
+            }
+            return;
+        }
+
+        FE_SendMIDI(fe, instance, bytes, time_ns);
+
+        if (is_note_off)
+        {
+            router.note_held[channel][data1] = false;
+            if (!router.sustain[channel])
+            {
+                FE_ReleaseNote(router, channel, data1);
+            }
+        }
+    }
+    else
+    {
+        FE_BroadcastMIDI(fe, bytes, time_ns);
+
+        if (status != 0xB0)
+        {
+            return;
+        }
+
+        // Sustain pedal, all sound off, reset all controllers, all notes off
+        if (data1 == 64 || data1 == 121)
+        {
+            router.sustain[channel] = data1 == 64 && data2 >= 64;
+            if (!router.sustain[channel])
+            {
+                for (uint8_t key = 0; key < 128; ++key)
+                {
+                    if (!router.note_held[channel][key])
+                    {
+                        FE_ReleaseNote(router, channel, key);
+                    }
+                }
+            }
+        }
+        else if (data1 == 120 || data1 == 123)
+        {
+            for (uint8_t key = 0; key < 128; ++key)
+            {
+                router.note_held[channel][key] = false;
+                FE_ReleaseNote(router, channel, key);
+            }
+        }
     }
 }
 
-void FE_RouteMIDI(FE_Application& fe, std::span<const uint8_t> bytes)
+void FE_RouteMIDI(FE_Application& fe, std::span<const uint8_t> bytes, uint64_t time_ns)
 {
     if (bytes.size() == 0)
     {
@@ -210,11 +594,22 @@ void FE_RouteMIDI(FE_Application& fe, std::span<const uint8_t> bytes)
 
     if (is_sysex)
     {
-        FE_BroadcastMIDI(fe, bytes);
+        FE_BroadcastMIDI(fe, bytes, time_ns);
+    }
+    else if (fe.routing != FE_RoutingMode::Modulo && fe.instances_in_use > 1)
+    {
+        if (first >= 0xF0)
+        {
+            FE_BroadcastMIDI(fe, bytes, time_ns);
+        }
+        else
+        {
+            FE_RouteNoteMIDI(fe, bytes, time_ns);
+        }
     }
     else
     {
-        FE_SendMIDI(fe, channel % fe.instances_in_use, bytes);
+        FE_SendMIDI(fe, channel % fe.instances_in_use, bytes, time_ns);
     }
 }
 
@@ -240,6 +635,37 @@ void FE_ReceiveSampleSDL(void* userdata, const AudioFrame<int32_t>& in)
     }
 }
 
+template <typename SampleT, bool ApplyGain>
+void FE_ReceiveSampleBlockSDL(void* userdata, std::span<const AudioFrame<int32_t>> in)
+{
+    FE_Instance& fe = *(FE_Instance*)userdata;
+
+    while (!in.empty())
+    {
+        AudioFrame<SampleT>* out   = (AudioFrame<SampleT>*)fe.chunk_first;
+        const size_t         count = Min(fe.GetRemainingChunkFrames<SampleT>(), in.size());
+
+        const size_t sample_count = count * AudioFrame<int32_t>::channel_count;
+
+        AUDIO_Normalize((SampleT*)out, (const int32_t*)in.data(), sample_count);
+
+        if constexpr (ApplyGain)
+        {
+            AUDIO_Gain((SampleT*)out, sample_count, fe.gain);
+        }
+
+        fe.chunk_first = out + count;
+
+        if (fe.chunk_first == fe.chunk_last)
+        {
+            fe.Finish<SampleT>();
+            fe.Prepare<SampleT>();
+        }
+
+        in = in.subspan(count);
+    }
+}
+
 #if NUKED_ENABLE_ASIO
 template <typename SampleT, bool ApplyGain>
 void FE_ReceiveSampleASIO(void* userdata, const AudioFrame<int32_t>& in)
@@ -262,12 +688,88 @@ void FE_ReceiveSampleASIO(void* userdata, const AudioFrame<int32_t>& in)
         fe.Prepare<SampleT>();
 
         auto span = fe.view.UncheckedPrepareRead<AudioFrame<SampleT>>(fe.buffer_size);
-        SDL_AudioStreamPut(fe.stream, span.data(), (int)(span.size() * sizeof(AudioFrame<SampleT>)));
+        auto resampled = fe.resampler.Process(std::span<const AudioFrame<SampleT>>(span));
+        SDL_AudioStreamPut(fe.stream, resampled.data(), (int)(resampled.size() * sizeof(AudioFrame<SampleT>)));
         fe.view.UncheckedFinishRead<AudioFrame<SampleT>>(fe.buffer_size);
     }
 }
 #endif
 
+#if NUKED_ENABLE_JACK
+template <bool ApplyGain>
+void FE_ReceiveSampleBlockJACK(void* userdata, std::span<const AudioFrame<int32_t>> in)
+{
+    FE_Instance& fe = *(FE_Instance*)userdata;
+
+    const size_t sample_count = in.size() * AudioFrame<int32_t>::channel_count;
+
+    AUDIO_Normalize((float*)fe.jack_block.data(), (const int32_t*)in.data(), sample_count);
+
+    if constexpr (ApplyGain)
+    {
+        AUDIO_Gain((float*)fe.jack_block.data(), sample_count, fe.gain);
+    }
+
+    auto resampled = fe.resampler.Process(std::span<const AudioFrame<float>>(fe.jack_block.data(), in.size()));
+
+    while (!resampled.empty())
+    {
+        AudioFrame<float>* out   = (AudioFrame<float>*)fe.chunk_first;
+        const size_t       count = Min(fe.GetRemainingChunkFrames<float>(), resampled.size());
+
+        memcpy(out, resampled.data(), count * sizeof(AudioFrame<float>));
+
+        fe.chunk_first = out + count;
+
+        if (fe.chunk_first == fe.chunk_last)
+        {
+            fe.Finish<float>();
+            fe.Prepare<float>();
+        }
+
+        resampled = resampled.subspan(count);
+    }
+}
+#endif
+
+constexpr mcu_sample_block_callback FE_PickBlockCallbackSDL(const FE_Instance& inst)
+{
+    if (inst.gain != 1.f)
+    {
+        switch (inst.format)
+        {
+        case AudioFormat::S16:
+            return FE_ReceiveSampleBlockSDL<int16_t, true>;
+        case AudioFormat::S32:
+            return FE_ReceiveSampleBlockSDL<int32_t, true>;
+        case AudioFormat::F32:
+            return FE_ReceiveSampleBlockSDL<float, true>;
+        }
+    }
+    else
+    {
+        switch (inst.format)
+        {
+        case AudioFormat::S16:
+            return FE_ReceiveSampleBlockSDL<int16_t, false>;
+        case AudioFormat::S32:
+            return FE_ReceiveSampleBlockSDL<int32_t, false>;
+        case AudioFormat::F32:
+            return FE_ReceiveSampleBlockSDL<float, false>;
+        }
+    }
+
+    fprintf(stderr, "PANIC: FE_PickBlockCallbackSDL has no callback for format %d\n", (int)inst.format);
+    exit(1);
+}
+
+#if NUKED_ENABLE_JACK
+constexpr mcu_sample_block_callback FE_PickBlockCallbackJACK(const FE_Instance& inst)
+{
+    return inst.gain != 1.f ? FE_ReceiveSampleBlockJACK<true> : FE_ReceiveSampleBlockJACK<false>;
+}
+#endif
+
 constexpr mcu_sample_callback FE_PickCallback(const FE_Application& app, const FE_Instance& inst)
 {
     if (app.audio_output.kind == AudioOutputKind::SDL)
@@ -351,16 +853,22 @@ FE_PickOutputResult FE_PickOutputDevice(std::string_view preferred_name, AudioOu
     AudioOutputList outputs;
     FE_QueryAllOutputs(outputs);
 
+#if NUKED_ENABLE_COREAUDIO
+    const AudioOutput default_device = {.name = "Default device (CoreAudio)", .kind = AudioOutputKind::CoreAudio};
+#else
+    const AudioOutput default_device = {.name = "Default device (SDL)", .kind = AudioOutputKind::SDL};
+#endif
+
     const size_t num_audio_devs = outputs.size();
     if (num_audio_devs == 0)
     {
-        out_device = {.name = "Default device (SDL)", .kind = AudioOutputKind::SDL};
+        out_device = default_device;
         return FE_PickOutputResult::NoOutputDevices;
     }
 
     if (preferred_name.size() == 0)
     {
-        out_device = {.name = "Default device (SDL)", .kind = AudioOutputKind::SDL};
+        out_device = default_device;
         return FE_PickOutputResult::WantDefaultDevice;
     }
 
@@ -391,12 +899,29 @@ void FE_QueryAllOutputs(AudioOutputList& outputs)
 {
     outputs.clear();
 
+#if NUKED_ENABLE_COREAUDIO
+    // SDL lists the same devices, so these come first to be picked when matching by name
+    if (!Out_CoreAudio_QueryOutputs(outputs))
+    {
+        fprintf(stderr, "Failed to query CoreAudio outputs.\n");
+        return;
+    }
+#endif
+
     if (!Out_SDL_QueryOutputs(outputs))
     {
         fprintf(stderr, "Failed to query SDL outputs: %s\n", SDL_GetError());
         return;
     }
 
+#if NUKED_ENABLE_JACK
+    if (!Out_JACK_QueryOutputs(outputs))
+    {
+        fprintf(stderr, "Failed to query JACK outputs.\n");
+        return;
+    }
+#endif
+
 #if NUKED_ENABLE_ASIO
     if (!Out_ASIO_QueryOutputs(outputs))
     {
@@ -415,6 +940,10 @@ const char* FE_AudioOutputMarkerString(AudioOutputKind kind)
         return "(SDL) ";
     case AudioOutputKind::ASIO:
         return "(ASIO)";
+    case AudioOutputKind::CoreAudio:
+        return "(CA)  ";
+    case AudioOutputKind::JACK:
+        return "(JACK)";
     }
     fprintf(stderr, "PANIC: FE_AudioOutputMarkerString got invalid kind");
     std::abort();
@@ -448,8 +977,12 @@ void FE_PrintAudioDevices()
 
         for (size_t i = 0; i < outputs.size(); ++i)
         {
-#if NUKED_ENABLE_ASIO
+#if NUKED_ENABLE_ASIO || NUKED_ENABLE_COREAUDIO || NUKED_ENABLE_JACK
             fprintf(stderr, "  %s %zu: %s\n", FE_AudioOutputMarkerString(outputs[i].kind), i, outputs[i].name.c_str());
+#else
+            fprintf(stderr, "  %zu: %s\n", i, outputs[i].name.c_str());
+#endif
+#if NUKED_ENABLE_ASIO
             if (outputs[i].kind == AudioOutputKind::ASIO)
             {
                 ASIO_OutputChannelList channels;
@@ -483,8 +1016,6 @@ void FE_PrintAudioDevices()
                     fprintf(stderr, "(failed to query channels)\n");
                 }
             }
-#else
-            fprintf(stderr, "  %zu: %s\n", i, outputs[i].name.c_str());
 #endif
         }
 
@@ -503,20 +1034,17 @@ bool FE_OpenSDLAudio(FE_Application& fe, const AudioOutputParameters& params, co
     for (size_t i = 0; i < fe.instances_in_use; ++i)
     {
         FE_Instance& inst = fe.instances[i];
-        inst.emu.SetSampleCallback(FE_PickCallback(fe, inst), &inst);
-        switch (inst.format)
+        if (!inst.emu.SetSampleBlockCallback(FE_PickBlockCallbackSDL(inst), &inst))
         {
-        case AudioFormat::S16:
-            inst.CreateAndPrepareBuffer<int16_t>();
-            break;
-        case AudioFormat::S32:
-            inst.CreateAndPrepareBuffer<int32_t>();
-            break;
-        case AudioFormat::F32:
-            inst.CreateAndPrepareBuffer<float>();
-            break;
+            inst.emu.SetSampleCallback(FE_PickCallback(fe, inst), &inst);
         }
-        Out_SDL_AddSource(fe.instances[i].view);
+        if (!inst.CreateAndPrepareBuffer())
+        {
+            fprintf(stderr, "#%02zu: failed to allocate audio buffer\n", i);
+            return false;
+        }
+        Out_SDL_AddSource(fe.instances[i].view, &inst.output_stats);
+        inst.pacer = &Out_SDL_GetPacer();
         fprintf(stderr, "#%02zu: allocated %zu bytes for audio\n", i, inst.sample_buffer.GetByteLength());
     }
 
@@ -529,6 +1057,106 @@ bool FE_OpenSDLAudio(FE_Application& fe, const AudioOutputParameters& params, co
     return true;
 }
 
+#if NUKED_ENABLE_COREAUDIO
+bool FE_OpenCoreAudio(FE_Application& fe, const CoreAudio_OutputParameters& params, const char* device_name)
+{
+    if (!Out_CoreAudio_Create(device_name, params))
+    {
+        fprintf(stderr, "Failed to create CoreAudio output\n");
+        return false;
+    }
+
+    // Same ringbuffers as SDL, so the instances also run FE_RunInstanceSDL
+    for (size_t i = 0; i < fe.instances_in_use; ++i)
+    {
+        FE_Instance& inst = fe.instances[i];
+        if (!inst.emu.SetSampleBlockCallback(FE_PickBlockCallbackSDL(inst), &inst))
+        {
+            inst.emu.SetSampleCallback(FE_PickCallback(fe, inst), &inst);
+        }
+        if (!inst.CreateAndPrepareBuffer())
+        {
+            fprintf(stderr, "#%02zu: failed to allocate audio buffer\n", i);
+            return false;
+        }
+        Out_CoreAudio_AddSource(inst.view, &inst.output_stats);
+        inst.pacer = &Out_CoreAudio_GetPacer();
+        fprintf(stderr, "#%02zu: allocated %zu bytes for audio\n", i, inst.sample_buffer.GetByteLength());
+    }
+
+    if (!Out_CoreAudio_Start())
+    {
+        fprintf(stderr, "Failed to start CoreAudio output\n");
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+#if NUKED_ENABLE_JACK
+bool FE_OpenJACKAudio(FE_Application& fe, const JACK_OutputParameters& params)
+{
+    if (!Out_JACK_Create(params))
+    {
+        fprintf(stderr, "Failed to create JACK output\n");
+        return false;
+    }
+
+    const uint32_t frequency = Out_JACK_GetFrequency();
+
+    for (size_t i = 0; i < fe.instances_in_use; ++i)
+    {
+        FE_Instance& inst = fe.instances[i];
+
+        const uint32_t emu_frequency = PCM_GetOutputFrequency(inst.emu.GetPCM());
+        if (!inst.resampler.Init(emu_frequency, frequency))
+        {
+            fprintf(stderr, "Can't resample from %uhz to %uhz\n", emu_frequency, frequency);
+            return false;
+        }
+
+        if (!inst.emu.SetSampleBlockCallback(FE_PickBlockCallbackJACK(inst), &inst))
+        {
+            fprintf(stderr, "JACK output needs the emulator to deliver blocks of samples\n");
+            return false;
+        }
+
+        // JACK ports only take floats, and the ringbuffer is read a period at a time
+        const size_t block_frames = inst.emu.GetMCU().sample_block_size;
+        inst.format               = AudioFormat::F32;
+        inst.buffer_size          = Out_JACK_GetBufferSize();
+        inst.jack_block.resize(block_frames);
+        inst.jack_block_frames = ((uint64_t)block_frames * frequency + emu_frequency - 1) / emu_frequency + 1;
+
+        // Room for the requested periods plus a block that finishes the last one
+        if (!FE_InitSampleBuffer(inst.sample_buffer,
+                                 FE_CalcRingbufferSizeBytes<AudioFrame<float>>(
+                                     inst.buffer_size,
+                                     inst.buffer_count + (uint32_t)(inst.jack_block_frames / inst.buffer_size) + 1),
+                                 inst.buffer_size))
+        {
+            fprintf(stderr, "#%02zu: failed to allocate audio buffer\n", i);
+            return false;
+        }
+        inst.view = RingbufferView(inst.sample_buffer);
+        inst.Prepare<float>();
+
+        Out_JACK_AddSource(inst.view, &inst.output_stats);
+        inst.pacer = &Out_JACK_GetPacer();
+        fprintf(stderr, "#%02zu: allocated %zu bytes for audio\n", i, inst.sample_buffer.GetByteLength());
+    }
+
+    if (!Out_JACK_Start())
+    {
+        fprintf(stderr, "Failed to start JACK output\n");
+        return false;
+    }
+
+    return true;
+}
+#endif
+
 #if NUKED_ENABLE_ASIO
 bool FE_OpenASIOAudio(FE_Application& fe, const ASIO_OutputParameters& params, const char* name)
 {
@@ -542,27 +1170,29 @@ bool FE_OpenASIOAudio(FE_Application& fe, const ASIO_OutputParameters& params, c
     {
         FE_Instance& inst = fe.instances[i];
 
+        const uint32_t emu_frequency = PCM_GetOutputFrequency(inst.emu.GetPCM());
+        if (!inst.resampler.Init(emu_frequency, (uint32_t)Out_ASIO_GetFrequency()))
+        {
+            fprintf(stderr, "Can't resample from %uhz to %dhz\n", emu_frequency, Out_ASIO_GetFrequency());
+            return false;
+        }
+
+        // Already resampled, so the stream only converts the sample format
         inst.stream = SDL_NewAudioStream(AudioFormatToSDLAudioFormat(inst.format),
                                          2,
-                                         (int)PCM_GetOutputFrequency(inst.emu.GetPCM()),
+                                         Out_ASIO_GetFrequency(),
                                          Out_ASIO_GetFormat(),
                                          2,
                                          Out_ASIO_GetFrequency());
-        Out_ASIO_AddSource(inst.stream);
+        Out_ASIO_AddSource(inst.stream, &inst.output_stats);
+        inst.pacer = &Out_ASIO_GetPacer();
 
         inst.emu.SetSampleCallback(FE_PickCallback(fe, inst), &inst);
 
-        switch (inst.format)
+        if (!inst.CreateAndPrepareBuffer())
         {
-        case AudioFormat::S16:
-            inst.CreateAndPrepareBuffer<int16_t>();
-            break;
-        case AudioFormat::S32:
-            inst.CreateAndPrepareBuffer<int32_t>();
-            break;
-        case AudioFormat::F32:
-            inst.CreateAndPrepareBuffer<float>();
-            break;
+            fprintf(stderr, "#%02zu: failed to allocate audio buffer\n", i);
+            return false;
         }
         fprintf(
             stderr, "#%02zu: allocated %zu bytes for audio\n", i, inst.sample_buffer.GetByteLength());
@@ -580,7 +1210,8 @@ bool FE_OpenASIOAudio(FE_Application& fe, const ASIO_OutputParameters& params, c
 
 void FE_FixupParameters(FE_Parameters& params)
 {
-    if (!std::has_single_bit(params.buffer_size))
+    // Mirrored sample buffers take chunks of any size
+    if (!std::has_single_bit(params.buffer_size) && !GenericBuffer::IsMirroringSupported())
     {
         const uint32_t next_low  = std::bit_floor(params.buffer_size);
         const uint32_t next_high = std::bit_ceil(params.buffer_size);
@@ -605,6 +1236,8 @@ bool FE_OpenAudio(FE_Application& fe, const FE_Parameters& params)
     switch (output.kind)
     {
     case AudioOutputKind::SDL:
+    case AudioOutputKind::CoreAudio:
+    case AudioOutputKind::JACK:
         // explicitly do nothing
         break;
     case AudioOutputKind::ASIO:
@@ -617,78 +1250,397 @@ bool FE_OpenAudio(FE_Application& fe, const FE_Parameters& params)
     out_params.buffer_size = params.buffer_size;
     out_params.format      = params.output_format;
 
+#if NUKED_ENABLE_COREAUDIO
+    CoreAudio_OutputParameters coreaudio_params;
+    coreaudio_params.common             = out_params;
+    coreaudio_params.device_sample_rate = params.coreaudio_sample_rate;
+#endif
+
     switch (output_result)
     {
     case FE_PickOutputResult::WantMatchedName:
         if (output.kind == AudioOutputKind::SDL)
         {
-            return FE_OpenSDLAudio(fe, out_params, output.name.c_str());
+            return FE_OpenSDLAudio(fe, out_params, output.name.c_str());
+        }
+        else if (output.kind == AudioOutputKind::ASIO)
+        {
+#if NUKED_ENABLE_ASIO
+            ASIO_OutputParameters asio_params;
+            asio_params.common = out_params;
+            asio_params.left_channel  = params.asio_left_channel;
+            asio_params.right_channel = params.asio_right_channel;
+            return FE_OpenASIOAudio(fe, asio_params, output.name.c_str());
+#else
+            fprintf(stderr, "Attempted to open ASIO output without ASIO support\n");
+#endif
+        }
+        else if (output.kind == AudioOutputKind::CoreAudio)
+        {
+#if NUKED_ENABLE_COREAUDIO
+            return FE_OpenCoreAudio(fe, coreaudio_params, output.name.c_str());
+#else
+            fprintf(stderr, "Attempted to open CoreAudio output without CoreAudio support\n");
+#endif
+        }
+        else if (output.kind == AudioOutputKind::JACK)
+        {
+#if NUKED_ENABLE_JACK
+            return FE_OpenJACKAudio(fe,
+                                    {
+                                        .layout  = params.jack_layout,
+                                        .connect = params.jack_connect,
+                                    });
+#else
+            fprintf(stderr, "Attempted to open JACK output without JACK support\n");
+#endif
+        }
+        return false;
+    case FE_PickOutputResult::WantDefaultDevice:
+#if NUKED_ENABLE_COREAUDIO
+        return FE_OpenCoreAudio(fe, coreaudio_params, nullptr);
+#else
+        return FE_OpenSDLAudio(fe, out_params, nullptr);
+#endif
+    case FE_PickOutputResult::NoOutputDevices:
+        // in some cases this may still work
+        fprintf(stderr, "No output devices found; attempting to open default device\n");
+#if NUKED_ENABLE_COREAUDIO
+        return FE_OpenCoreAudio(fe, coreaudio_params, nullptr);
+#else
+        return FE_OpenSDLAudio(fe, out_params, nullptr);
+#endif
+    case FE_PickOutputResult::NoMatchingName:
+        // in some cases SDL cannot list all audio devices so we should still try
+        fprintf(stderr, "No output device named '%s'; attempting to open it anyways...\n", params.audio_device.c_str());
+        return FE_OpenSDLAudio(fe, out_params, output.name.c_str());
+    }
+
+    return false;
+}
+
+// Posts every timed midi message that is due by the current frame, and returns how many frames the emulator can run
+// before the next one is, up to `max_frames`.
+// Records the latency of a note received at `time_ns` that is about to be rendered, which will be heard once the output
+// has played the `buffered_frames` ahead of it.
+void FE_RecordLatency(FE_Instance& instance, uint64_t time_ns, size_t buffered_frames)
+{
+    const double   frequency   = (double)PCM_GetOutputFrequency(instance.emu.GetPCM());
+    const double   buffered_ns = (double)buffered_frames / frequency * 1e9;
+    const uint64_t now_ns      = MIDI_GetHostTimeNS();
+    const uint64_t waited_ns   = now_ns > time_ns ? now_ns - time_ns : 0;
+
+    instance.latency.Record(waited_ns + (uint64_t)buffered_ns);
+}
+
+// Takes the pending untimed latency probe, if any. Midi posted before a chunk is applied at its start.
+void FE_TakeLatencyProbe(FE_Instance& instance, size_t buffered_frames)
+{
+    const uint64_t time_ns = instance.probe_time_ns.exchange(0, std::memory_order_relaxed);
+    if (time_ns != 0)
+    {
+        FE_RecordLatency(instance, time_ns, buffered_frames);
+    }
+}
+
+// Frames rendered by `instance` that the SDL or CoreAudio output hasn't taken yet.
+template <typename SampleT>
+size_t FE_GetBufferedFrames(const FE_Instance& instance)
+{
+    return instance.view.GetReadableBytes() / sizeof(AudioFrame<SampleT>) +
+           (instance.buffer_size - instance.GetRemainingChunkFrames<SampleT>());
+}
+
+template <typename SampleT>
+uint64_t FE_ReleaseTimedMIDI(FE_Instance& instance, uint64_t max_frames)
+{
+    const uint64_t frames_posted = instance.emu.GetMCU().frames_posted;
+
+    const size_t buffered_frames = FE_GetBufferedFrames<SampleT>(instance);
+    const double measured =
+        (double)frames_posted - (double)buffered_frames - (double)MIDI_GetHostTimeNS() * instance.frames_per_ns;
+
+    FE_MIDIClock& clock = instance.midi_clock;
+    if (!clock.valid)
+    {
+        clock.offset = measured;
+        clock.valid  = true;
+    }
+    else
+    {
+        clock.offset += (measured - clock.offset) / 128;
+    }
+
+    while (instance.midi_view.GetReadableElements<FE_TimedMIDI>() != 0)
+    {
+        const FE_TimedMIDI& record = instance.midi_view.UncheckedPrepareRead<FE_TimedMIDI>(1)[0];
+
+        const double target =
+            (double)record.time_ns * instance.frames_per_ns + clock.offset + instance.midi_latency_frames;
+        if (target > (double)frames_posted)
+        {
+            return Min(max_frames, (uint64_t)(target - (double)frames_posted) + 1);
+        }
+
+        if (!instance.emu.PostMIDI(std::span<const uint8_t>(record.bytes, record.size)))
+        {
+            // The emulator isn't keeping up with its queue; try again after this chunk
+            return max_frames;
+        }
+
+        if (instance.latency_probes && FE_IsNoteOn(std::span<const uint8_t>(record.bytes, record.size)))
+        {
+            FE_RecordLatency(instance, record.time_ns, buffered_frames);
+        }
+
+        instance.midi_view.UncheckedFinishRead<FE_TimedMIDI>(1);
+    }
+
+    return max_frames;
+}
+
+void FE_PublishVoiceCount(FE_Instance& instance)
+{
+    const pcm_t& pcm = instance.emu.GetPCM();
+    instance.voices_in_use.store((uint32_t)std::popcount(pcm.voice_mask & pcm.voice_mask_pending),
+                                 std::memory_order_relaxed);
+}
+
+template <typename SampleT>
+double FE_GetFillSDL(const FE_Instance& instance)
+{
+    // The output reads however much the device asks for, so chunks don't line up with reads. The instance is full once
+    // the chunk being written and the next one wouldn't both fit.
+    if (instance.view.GetWritableElements<AudioFrame<SampleT>>() < 2 * (size_t)instance.buffer_size)
+    {
+        return 1.0;
+    }
+
+    // Frames the output is behind on will be skipped, so they don't count towards the fill
+    const size_t max_frame_count = instance.buffer_count * instance.buffer_size;
+    const size_t lag             = instance.output_stats.lag_frames.load(std::memory_order_relaxed);
+    const size_t readable        = instance.view.GetReadableElements<AudioFrame<SampleT>>();
+    return (double)(readable - Min(readable, lag)) / (double)max_frame_count;
+}
+
+template <typename SampleT>
+void FE_RenderChunkSDL(FE_Instance& instance)
+{
+    if (instance.latency_probes)
+    {
+        FE_TakeLatencyProbe(instance, FE_GetBufferedFrames<SampleT>(instance));
+    }
+
+    // Run until the chunk currently being written is complete. Stepping by a whole buffer instead could complete two
+    // chunks at once and overrun the ringbuffer.
+    uint64_t frames = instance.GetRemainingChunkFrames<SampleT>();
+
+    if (instance.timed_midi)
+    {
+        // Stop early if a midi message is due before the end of the chunk
+        frames = FE_ReleaseTimedMIDI<SampleT>(instance, frames);
+    }
+
+    instance.emu.StepUntilFrames(frames);
+
+    FE_PublishVoiceCount(instance);
+    instance.frames_rendered.store(instance.emu.GetMCU().frames_posted, std::memory_order_relaxed);
+}
+
+#if NUKED_ENABLE_ASIO
+double FE_GetFillASIO(const FE_Instance& instance)
+{
+    // Recalculated every time because an ASIO reset might change the buffer size. Note that this is the byte count
+    // coming out of the stream; it won't line up with the amount of data we put in so be careful not to confuse the
+    // two!!
+    const size_t max_byte_count =
+        instance.buffer_count * (size_t)Out_ASIO_GetBufferSize() * Out_ASIO_GetFormatFrameSizeBytes();
+    return (double)SDL_AudioStreamAvailable(instance.stream) / (double)max_byte_count;
+}
+
+template <typename SampleT>
+void FE_RenderChunkASIO(FE_Instance& instance)
+{
+    if (instance.latency_probes)
+    {
+        // The stream holds frames at the ASIO frequency; convert them back to emulator frames
+        const double stream_frames =
+            (double)SDL_AudioStreamAvailable(instance.stream) / (double)Out_ASIO_GetFormatFrameSizeBytes();
+        const double emu_frames = stream_frames * (double)PCM_GetOutputFrequency(instance.emu.GetPCM()) /
+                                  (double)Out_ASIO_GetFrequency();
+        const size_t chunk_frames = instance.buffer_size - instance.GetRemainingChunkFrames<SampleT>();
+        FE_TakeLatencyProbe(instance, (size_t)emu_frames + chunk_frames);
+    }
+
+    // Run until the current chunk is put into the stream
+    instance.emu.StepUntilFrames(instance.GetRemainingChunkFrames<SampleT>());
+
+    FE_PublishVoiceCount(instance);
+    instance.frames_rendered.store(instance.emu.GetMCU().frames_posted, std::memory_order_relaxed);
+}
+#endif
+
+#if NUKED_ENABLE_JACK
+double FE_GetFillJACK(const FE_Instance& instance)
+{
+    // A block can finish the period being written and start the next, so the instance is full once it doesn't have
+    // room for both
+    const size_t writable = instance.view.GetWritableElements<AudioFrame<float>>();
+    if (writable < instance.buffer_size + instance.jack_block_frames)
+    {
+        return 1.0;
+    }
+
+    const size_t max_frame_count = instance.buffer_count * instance.buffer_size;
+    return (double)instance.view.GetReadableElements<AudioFrame<float>>() / (double)max_frame_count;
+}
+
+void FE_RenderChunkJACK(FE_Instance& instance)
+{
+    const mcu_t& mcu = instance.emu.GetMCU();
+
+    if (instance.latency_probes)
+    {
+        // The ringbuffer holds frames at the server's frequency; convert them back to emulator frames
+        const size_t jack_frames = instance.view.GetReadableElements<AudioFrame<float>>() + instance.buffer_size -
+                                   instance.GetRemainingChunkFrames<float>();
+        const double emu_frames = (double)jack_frames * (double)instance.resampler.GetInputRate() /
+                                  (double)instance.resampler.GetOutputRate();
+        FE_TakeLatencyProbe(instance, (size_t)emu_frames + mcu.frames_posted % mcu.sample_block_size);
+    }
+
+    // Run until the emulator hands over its current block
+    instance.emu.StepUntilFrames(mcu.sample_block_size - mcu.frames_posted % mcu.sample_block_size);
+
+    FE_PublishVoiceCount(instance);
+    instance.frames_rendered.store(mcu.frames_posted, std::memory_order_relaxed);
+}
+#endif
+
+// Claims the instance with the emptiest output buffer, which is the one closest to underrunning, among those that
+// aren't full or claimed by another worker. Returns null if there is none.
+FE_Instance* FE_ClaimInstance(FE_Application& fe)
+{
+    while (true)
+    {
+        FE_Instance* best      = nullptr;
+        double       best_fill = 1.0;
+        for (size_t i = 0; i < fe.instances_in_use; ++i)
+        {
+            FE_Instance& instance = fe.instances[i];
+            if (instance.claimed.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+
+            const double fill = instance.get_fill(instance);
+            if (fill < best_fill)
+            {
+                best      = &instance;
+                best_fill = fill;
+            }
+        }
+
+        if (!best)
+        {
+            return nullptr;
         }
-        else if (output.kind == AudioOutputKind::ASIO)
+
+        bool expected = false;
+        if (best->claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
         {
-#if NUKED_ENABLE_ASIO
-            ASIO_OutputParameters asio_params;
-            asio_params.common = out_params;
-            asio_params.left_channel  = params.asio_left_channel;
-            asio_params.right_channel = params.asio_right_channel;
-            return FE_OpenASIOAudio(fe, asio_params, output.name.c_str());
-#else
-            fprintf(stderr, "Attempted to open ASIO output without ASIO support\n");
-#endif
+            return best;
         }
-        return false;
-    case FE_PickOutputResult::WantDefaultDevice:
-        return FE_OpenSDLAudio(fe, out_params, nullptr);
-    case FE_PickOutputResult::NoOutputDevices:
-        // in some cases this may still work
-        fprintf(stderr, "No output devices found; attempting to open default device\n");
-        return FE_OpenSDLAudio(fe, out_params, nullptr);
-    case FE_PickOutputResult::NoMatchingName:
-        // in some cases SDL cannot list all audio devices so we should still try
-        fprintf(stderr, "No output device named '%s'; attempting to open it anyways...\n", params.audio_device.c_str());
-        return FE_OpenSDLAudio(fe, out_params, output.name.c_str());
+        // Another worker took it first, so look again
     }
-
-    return false;
 }
 
-template <typename SampleT>
-void FE_RunInstanceSDL(FE_Instance& instance)
+// Renders a chunk at a time of whichever instance needs it most, until FE_Run stops the workers. An instance can be
+// rendered by a different worker each time; claiming it hands its state over.
+void FE_RunWorker(FE_Application& fe, size_t worker_id)
 {
-    const size_t max_byte_count = instance.buffer_count * instance.buffer_size * sizeof(AudioFrame<SampleT>);
+    if (worker_id < fe.affinity.instance_cpus.size())
+    {
+        TH_PinCurrentThread(std::span(&fe.affinity.instance_cpus[worker_id], 1));
+    }
+
+    if (!TH_SetCurrentThreadPolicy(fe.thread_policy))
+    {
+        fprintf(stderr, "WARNING: Failed to apply the thread policy; continuing with the default\n");
+    }
+
+    // Every instance shares the one output and so the same pacer
+    AudioPacer& pacer = *fe.instances[0].pacer;
 
-    while (instance.running)
+    while (fe.workers_running.load(std::memory_order_relaxed))
     {
-        while (instance.view.GetReadableBytes() >= max_byte_count)
+        const uint32_t period   = pacer.GetPeriod();
+        FE_Instance*   instance = FE_ClaimInstance(fe);
+        if (!instance)
         {
-            SDL_Delay(1);
+            // Every instance is full or being rendered by another worker
+            pacer.Wait(period);
+            continue;
         }
 
-        instance.emu.Step();
+        instance->render_chunk(*instance);
+        instance->claimed.store(false, std::memory_order_release);
     }
 }
 
-#if NUKED_ENABLE_ASIO
-void FE_RunInstanceASIO(FE_Instance& instance)
+// Prints one line per instance with what happened since the last call `elapsed_s` seconds ago, and resets the counters.
+void FE_PrintStats(FE_Application& fe, double elapsed_s)
 {
-    while (instance.running)
+    for (size_t i = 0; i < fe.instances_in_use; ++i)
     {
-        // we recalc every time because ASIO reset might change this
-        const size_t buffer_size = (size_t)Out_ASIO_GetBufferSize();
+        FE_Instance& instance = fe.instances[i];
+
+        const uint32_t fill_min     = instance.output_stats.fill_min.exchange(UINT32_MAX, std::memory_order_relaxed);
+        const uint32_t fill_max     = instance.output_stats.fill_max.exchange(0, std::memory_order_relaxed);
+        const uint64_t fill_sum     = instance.output_stats.fill_sum.exchange(0, std::memory_order_relaxed);
+        const uint32_t fill_samples = instance.output_stats.fill_samples.exchange(0, std::memory_order_relaxed);
+        const uint32_t underruns    = instance.output_stats.underruns.exchange(0, std::memory_order_relaxed);
+
+        const uint64_t latency_min     = instance.latency.min_ns.exchange(UINT64_MAX, std::memory_order_relaxed);
+        const uint64_t latency_max     = instance.latency.max_ns.exchange(0, std::memory_order_relaxed);
+        const uint64_t latency_sum     = instance.latency.sum_ns.exchange(0, std::memory_order_relaxed);
+        const uint32_t latency_samples = instance.latency.samples.exchange(0, std::memory_order_relaxed);
+
+        const uint64_t frames    = instance.frames_rendered.load(std::memory_order_relaxed);
+        const double   frequency = (double)PCM_GetOutputFrequency(instance.emu.GetPCM());
+        const double   speed     = (double)(frames - instance.stats_last_frames) / (frequency * elapsed_s);
+
+        instance.stats_last_frames = frames;
 
-        // note that this is the byte count coming out of the stream; it won't line up with the amount of data we put in
-        // so be careful not to confuse the two!!
-        const size_t max_byte_count = instance.buffer_count * buffer_size * Out_ASIO_GetFormatFrameSizeBytes();
+        fprintf(stderr, "#%02zu: speed %.2fx, underruns %u", i, speed, underruns);
 
-        while ((size_t)SDL_AudioStreamAvailable(instance.stream) >= max_byte_count)
+        const uint32_t lag = instance.output_stats.lag_frames.load(std::memory_order_relaxed);
+        if (lag)
         {
-            SDL_Delay(1);
+            fprintf(stderr, ", lag %u", lag);
         }
 
-        instance.emu.Step();
+        if (fill_samples)
+        {
+            fprintf(stderr,
+                    ", fill min/avg/max %u/%u/%u",
+                    fill_min,
+                    (uint32_t)(fill_sum / fill_samples),
+                    fill_max);
+        }
+
+        if (latency_samples)
+        {
+            fprintf(stderr,
+                    ", midi latency min/avg/max %.1f/%.1f/%.1f ms",
+                    (double)latency_min / 1e6,
+                    (double)latency_sum / latency_samples / 1e6,
+                    (double)latency_max / 1e6);
+        }
+
+        fprintf(stderr, "\n");
     }
 }
-#endif
 
 bool FE_HandleGlobalEvent(FE_Application& fe, const SDL_Event& ev)
 {
@@ -704,8 +1656,20 @@ bool FE_HandleGlobalEvent(FE_Application& fe, const SDL_Event& ev)
 
 void FE_EventLoop(FE_Application& fe)
 {
+    uint64_t last_stats_ns = MIDI_GetHostTimeNS();
+
     while (fe.running)
     {
+        if (fe.stats)
+        {
+            const uint64_t now_ns = MIDI_GetHostTimeNS();
+            if (now_ns - last_stats_ns >= 1'000'000'000)
+            {
+                FE_PrintStats(fe, (double)(now_ns - last_stats_ns) / 1e9);
+                last_stats_ns = now_ns;
+            }
+        }
+
 #if NUKED_ENABLE_ASIO
         if (Out_ASIO_IsResetRequested())
         {
@@ -713,6 +1677,14 @@ void FE_EventLoop(FE_Application& fe)
         }
 #endif
 
+#if NUKED_ENABLE_JACK
+        if (fe.audio_output.kind == AudioOutputKind::JACK && Out_JACK_IsShutDown())
+        {
+            fprintf(stderr, "JACK server shut down; exiting\n");
+            fe.running = false;
+        }
+#endif
+
         for (size_t i = 0; i < fe.instances_in_use; ++i)
         {
             if (fe.instances[i].sdl_lcd)
@@ -754,39 +1726,79 @@ void FE_Run(FE_Application& fe)
 
     for (size_t i = 0; i < fe.instances_in_use; ++i)
     {
-        fe.instances[i].running = true;
-        if (fe.audio_output.kind == AudioOutputKind::SDL)
+        FE_Instance& instance = fe.instances[i];
+        if (fe.audio_output.kind == AudioOutputKind::SDL || fe.audio_output.kind == AudioOutputKind::CoreAudio)
         {
-            switch (fe.instances[i].format)
+            switch (instance.format)
             {
             case AudioFormat::S16:
-                fe.instances[i].thread = std::thread(FE_RunInstanceSDL<int16_t>, std::ref(fe.instances[i]));
+                instance.get_fill     = FE_GetFillSDL<int16_t>;
+                instance.render_chunk = FE_RenderChunkSDL<int16_t>;
                 break;
             case AudioFormat::S32:
-                fe.instances[i].thread = std::thread(FE_RunInstanceSDL<int32_t>, std::ref(fe.instances[i]));
+                instance.get_fill     = FE_GetFillSDL<int32_t>;
+                instance.render_chunk = FE_RenderChunkSDL<int32_t>;
                 break;
             case AudioFormat::F32:
-                fe.instances[i].thread = std::thread(FE_RunInstanceSDL<float>, std::ref(fe.instances[i]));
+                instance.get_fill     = FE_GetFillSDL<float>;
+                instance.render_chunk = FE_RenderChunkSDL<float>;
                 break;
             }
         }
         else if (fe.audio_output.kind == AudioOutputKind::ASIO)
         {
 #if NUKED_ENABLE_ASIO
-            fe.instances[i].thread = std::thread(FE_RunInstanceASIO, std::ref(fe.instances[i]));
+            instance.get_fill = FE_GetFillASIO;
+            switch (instance.format)
+            {
+            case AudioFormat::S16:
+                instance.render_chunk = FE_RenderChunkASIO<int16_t>;
+                break;
+            case AudioFormat::S32:
+                instance.render_chunk = FE_RenderChunkASIO<int32_t>;
+                break;
+            case AudioFormat::F32:
+                instance.render_chunk = FE_RenderChunkASIO<float>;
+                break;
+            }
 #else
             fprintf(stderr, "Attempted to start ASIO instance without ASIO support\n");
+            return;
+#endif
+        }
+        else if (fe.audio_output.kind == AudioOutputKind::JACK)
+        {
+#if NUKED_ENABLE_JACK
+            instance.get_fill     = FE_GetFillJACK;
+            instance.render_chunk = FE_RenderChunkJACK;
+#else
+            fprintf(stderr, "Attempted to start JACK instance without JACK support\n");
+            return;
 #endif
         }
     }
 
+    fe.workers_running = true;
+    for (size_t i = 0; i < fe.worker_count; ++i)
+    {
+        fe.workers.emplace_back(FE_RunWorker, std::ref(fe), i);
+    }
+
     FE_EventLoop(fe);
 
-    for (size_t i = 0; i < fe.instances_in_use; ++i)
+    fe.workers_running = false;
+
+    // Wake workers waiting for the output so that they see they should stop
+    if (fe.instances_in_use && fe.instances[0].pacer)
     {
-        fe.instances[i].running = false;
-        fe.instances[i].thread.join();
+        fe.instances[0].pacer->Signal();
     }
+
+    for (std::thread& worker : fe.workers)
+    {
+        worker.join();
+    }
+    fe.workers.clear();
 }
 
 #ifdef _WIN32
@@ -838,6 +1850,16 @@ bool FE_CreateInstance(FE_Application& container, const std::filesystem::path& b
     fe->buffer_count = params.buffer_count;
     fe->gain         = params.gain;
 
+    fe->latency_probes = params.stats;
+
+    if (instance_id < container.affinity.instance_cpus.size())
+    {
+        // The emulator's memory is placed on the NUMA node of the thread that touches it first, so it's set up from
+        // the core of the worker with the same index, which runs it whenever there are as many workers as instances
+        fe->cpu = container.affinity.instance_cpus[instance_id];
+        TH_PinCurrentThread(std::span(&*fe->cpu, 1));
+    }
+
     if (!params.no_lcd)
     {
         fe->sdl_lcd = std::make_unique<LCD_SDL_Backend>();
@@ -850,13 +1872,25 @@ bool FE_CreateInstance(FE_Application& container, const std::filesystem::path& b
         this_nvram += std::to_string(container.instances_in_use - 1);
     }
 
-    if (!fe->emu.Init({.lcd_backend = fe->sdl_lcd.get(), .nvram_filename = this_nvram}))
+    // Blocks line up with the chunks FE_ReceiveSampleBlockSDL writes to the ringbuffer.
+    const EMU_Options emu_options{
+        .lcd_backend       = fe->sdl_lcd.get(),
+        .nvram_filename    = this_nvram,
+        .sample_block_size = params.buffer_size,
+    };
+
+    if (!fe->emu.Init(emu_options))
     {
         fprintf(stderr, "ERROR: Failed to init emulator.\n");
         return false;
     }
 
-    if (!fe->emu.LoadRoms(container.romset, container.romset_info))
+    if (!container.rom_image)
+    {
+        container.rom_image = EMU_CreateRomImage(container.romset, container.romset_info);
+    }
+
+    if (!fe->emu.LoadRoms(container.rom_image))
     {
         fprintf(stderr, "ERROR: Failed to load roms for instance %02zu\n", instance_id);
         return false;
@@ -874,6 +1908,19 @@ bool FE_CreateInstance(FE_Application& container, const std::filesystem::path& b
     return true;
 }
 
+// Switches `instance` to releasing midi at its timestamp plus `latency_ms`, rather than as soon as it arrives. Only the
+// SDL and CoreAudio outputs know which frame is currently playing, so this is not used with ASIO.
+void FE_EnableTimedMIDI(FE_Instance& instance, uint32_t latency_ms)
+{
+    const double frequency = (double)PCM_GetOutputFrequency(instance.emu.GetPCM());
+
+    instance.midi_buffer.Init(FE_TIMED_MIDI_CAPACITY * sizeof(FE_TimedMIDI));
+    instance.midi_view           = RingbufferView(instance.midi_buffer);
+    instance.frames_per_ns       = frequency / 1e9;
+    instance.midi_latency_frames = frequency * latency_ms / 1000.0;
+    instance.timed_midi          = true;
+}
+
 void FE_DestroyInstance(FE_Instance& instance)
 {
 #if NUKED_ENABLE_ASIO
@@ -903,6 +1950,22 @@ void FE_Quit(FE_Application& container)
         Out_SDL_Stop();
         Out_SDL_Destroy();
         break;
+    case AudioOutputKind::CoreAudio:
+#if NUKED_ENABLE_COREAUDIO
+        Out_CoreAudio_Stop();
+        Out_CoreAudio_Destroy();
+#else
+        fprintf(stderr, "Out_CoreAudio_Stop() called without CoreAudio support\n");
+#endif
+        break;
+    case AudioOutputKind::JACK:
+#if NUKED_ENABLE_JACK
+        Out_JACK_Stop();
+        Out_JACK_Destroy();
+#else
+        fprintf(stderr, "Out_JACK_Stop() called without JACK support\n");
+#endif
+        break;
     }
 
     for (size_t i = 0; i < container.instances_in_use; ++i)
@@ -927,8 +1990,16 @@ enum class FE_ParseError
     FormatInvalid,
     ASIOSampleRateOutOfRange,
     ASIOChannelInvalid,
+    CoreAudioSampleRateOutOfRange,
+    JACKPortsInvalid,
     ResetInvalid,
     GainInvalid,
+    MidiLatencyInvalid,
+    MidiRoutingInvalid,
+    AffinityInvalid,
+    ThreadPolicyInvalid,
+    WorkersInvalid,
+    PCProfileUnsupported,
 };
 
 const char* FE_ParseErrorStr(FE_ParseError err)
@@ -957,10 +2028,26 @@ const char* FE_ParseErrorStr(FE_ParseError err)
             return "ASIO sample rate out of range";
         case FE_ParseError::ASIOChannelInvalid:
             return "ASIO channel invalid";
+        case FE_ParseError::CoreAudioSampleRateOutOfRange:
+            return "CoreAudio sample rate out of range";
+        case FE_ParseError::JACKPortsInvalid:
+            return "JACK ports invalid (should be mixed or instances)";
         case FE_ParseError::ResetInvalid:
             return "Reset invalid (should be none, gs, or gm)";
         case FE_ParseError::GainInvalid:
             return "Gain invalid (should be a number optionally ending in 'db')";
+        case FE_ParseError::MidiLatencyInvalid:
+            return "MIDI latency invalid (should be a number of milliseconds)";
+        case FE_ParseError::MidiRoutingInvalid:
+            return "MIDI routing invalid (should be modulo, notes, or voices)";
+        case FE_ParseError::AffinityInvalid:
+            return "Affinity invalid (should be none or cores)";
+        case FE_ParseError::ThreadPolicyInvalid:
+            return "Thread policy invalid (should be default, throughput or realtime)";
+        case FE_ParseError::WorkersInvalid:
+            return "Workers invalid (should be 1-16)";
+        case FE_ParseError::PCProfileUnsupported:
+            return "--pc-profile needs a build with NUKED_ENABLE_PC_PROFILING";
         }
     return "Unknown error";
 }
@@ -1056,6 +2143,120 @@ FE_ParseError FE_ParseCommandLine(int argc, char* argv[], FE_Parameters& result)
                 return FE_ParseError::BufferSizeInvalid;
             }
         }
+        else if (reader.Any("--midi-latency"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (uint32_t latency_ms; reader.TryParse(latency_ms))
+            {
+                result.midi_latency_ms = latency_ms;
+            }
+            else
+            {
+                return FE_ParseError::MidiLatencyInvalid;
+            }
+        }
+        else if (reader.Any("--stats"))
+        {
+            result.stats = true;
+        }
+        else if (reader.Any("--midi-routing"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (reader.Arg() == "modulo")
+            {
+                result.midi_routing = FE_RoutingMode::Modulo;
+            }
+            else if (reader.Arg() == "notes")
+            {
+                result.midi_routing = FE_RoutingMode::Notes;
+            }
+            else if (reader.Arg() == "voices")
+            {
+                result.midi_routing = FE_RoutingMode::Voices;
+            }
+            else
+            {
+                return FE_ParseError::MidiRoutingInvalid;
+            }
+        }
+        else if (reader.Any("--affinity"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (reader.Arg() == "none")
+            {
+                result.pin_threads = false;
+            }
+            else if (reader.Arg() == "cores")
+            {
+                result.pin_threads = true;
+            }
+            else
+            {
+                return FE_ParseError::AffinityInvalid;
+            }
+        }
+        else if (reader.Any("--thread-policy"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (reader.Arg() == "default")
+            {
+                result.thread_policy = ThreadPolicy::Default;
+            }
+            else if (reader.Arg() == "throughput")
+            {
+                result.thread_policy = ThreadPolicy::Throughput;
+            }
+            else if (reader.Arg() == "realtime")
+            {
+                result.thread_policy = ThreadPolicy::Realtime;
+            }
+            else
+            {
+                return FE_ParseError::ThreadPolicyInvalid;
+            }
+        }
+        else if (reader.Any("--workers"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (!reader.TryParse(result.workers) || result.workers < 1 || result.workers > 16)
+            {
+                return FE_ParseError::WorkersInvalid;
+            }
+        }
+        else if (reader.Any("--pc-profile"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (!NUKED_ENABLE_PC_PROFILING)
+            {
+                return FE_ParseError::PCProfileUnsupported;
+            }
+
+            result.pc_profile_filename = reader.Arg();
+        }
         else if (reader.Any("-r", "--reset"))
         {
             if (!reader.Next())
@@ -1153,6 +2354,15 @@ FE_ParseError FE_ParseCommandLine(int argc, char* argv[], FE_Parameters& result)
         {
             result.legacy_romset_detection = true;
         }
+        else if (reader.Any("--rom-hash-cache"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            result.rom_hash_cache = reader.Arg();
+        }
         else if (reader.Any("--override-rom1"))
         {
             if (!reader.Next())
@@ -1259,6 +2469,49 @@ FE_ParseError FE_ParseCommandLine(int argc, char* argv[], FE_Parameters& result)
 
             result.asio_right_channel = reader.Arg();
         }
+#endif
+#if NUKED_ENABLE_COREAUDIO
+        else if (reader.Any("--coreaudio-sample-rate"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            uint32_t coreaudio_sample_rate = 0;
+            if (!reader.TryParse(coreaudio_sample_rate))
+            {
+                return FE_ParseError::CoreAudioSampleRateOutOfRange;
+            }
+
+            result.coreaudio_sample_rate = coreaudio_sample_rate;
+        }
+#endif
+#if NUKED_ENABLE_JACK
+        else if (reader.Any("--jack-ports"))
+        {
+            if (!reader.Next())
+            {
+                return FE_ParseError::UnexpectedEnd;
+            }
+
+            if (reader.Arg() == "mixed")
+            {
+                result.jack_layout = JACK_PortLayout::Mixed;
+            }
+            else if (reader.Arg() == "instances")
+            {
+                result.jack_layout = JACK_PortLayout::PerInstance;
+            }
+            else
+            {
+                return FE_ParseError::JACKPortsInvalid;
+            }
+        }
+        else if (reader.Any("--jack-no-connect"))
+        {
+            result.jack_connect = false;
+        }
 #endif
         else
         {
@@ -1284,17 +2537,30 @@ Audio options:
   -f, --format       s16|s32|f32                Set output format.
   --disable-oversampling                        Halves output frequency.
   --gain <amount>                               Apply gain to the output.
+  --midi-latency <ms>                           Play MIDI at its timestamp plus a fixed latency.
+  --stats                                       Print buffer, speed and latency stats every second.
 
 Emulator options:
   -r, --reset     none|gs|gm                    Reset system in GS or GM mode.
   -n, --instances <count>                       Set number of emulator instances.
+  --midi-routing modulo|notes|voices            Choose how MIDI is spread over instances.
   --no-lcd                                      Run without LCDs.
   --nvram <filename>                            Saves and loads NVRAM to/from disk. JV-880 only.
 
+Threading options:
+  --workers <count>                             Number of threads rendering instances (default: one per core).
+  --affinity none|cores                         Pin each worker thread to its own physical core.
+  --thread-policy default|throughput|realtime   Choose how worker threads are scheduled.
+
+Development options:
+  --pc-profile <filename>                       Print the hottest firmware addresses on exit and write every
+                                                address that ran to filename. Needs NUKED_ENABLE_PC_PROFILING.
+
 ROM management options:
-  -d, --rom-directory <dir>                     Sets the directory to load roms from.
+  -d, --rom-directory <dir>                     Sets the directory to load roms from, or a rom bundle.
   --romset <name>                               Sets the romset to load.
   --legacy-romset-detection                     Load roms using specific filenames like upstream.
+  --rom-hash-cache <filename>                   Cache rom digests in filename to speed up romset detection.
 
 )";
 
@@ -1304,6 +2570,22 @@ ROM management options:
   --asio-left-channel <channel_name_or_number>  Set left channel for ASIO output.
   --asio-right-channel <channel_name_or_number> Set right channel for ASIO output.
 
+)";
+#endif
+
+#if NUKED_ENABLE_JACK
+    constexpr const char* EXTRA_JACK_STR = R"(JACK options (select with -a JACK):
+  --jack-ports mixed|instances                  Mix instances into one pair of ports, or give each its own.
+  --jack-no-connect                             Leave the ports unconnected instead of connecting them to
+                                                the system playback ports.
+
+)";
+#endif
+
+#if NUKED_ENABLE_COREAUDIO
+    constexpr const char* EXTRA_COREAUDIO_STR = R"(CoreAudio options:
+  --coreaudio-sample-rate <freq>                Switch the output device to this frequency.
+
 )";
 #endif
 
@@ -1312,6 +2594,12 @@ ROM management options:
     common::PrintRomsets(stderr);
 #if NUKED_ENABLE_ASIO
     fprintf(stderr, EXTRA_ASIO_STR);
+#endif
+#if NUKED_ENABLE_COREAUDIO
+    fprintf(stderr, EXTRA_COREAUDIO_STR);
+#endif
+#if NUKED_ENABLE_JACK
+    fprintf(stderr, EXTRA_JACK_STR);
 #endif
     MIDI_PrintDevices();
     FE_PrintAudioDevices();
@@ -1346,6 +2634,8 @@ int main(int argc, char *argv[])
     FE_FixupParameters(params);
 
     FE_Application frontend;
+    frontend.routing = params.midi_routing;
+    frontend.stats   = params.stats;
 
     std::filesystem::path base_path = P_GetProcessPath().parent_path();
 
@@ -1368,6 +2658,7 @@ int main(int argc, char *argv[])
                                                      params.romset_name,
                                                      params.legacy_romset_detection,
                                                      params.adv.rom_overrides,
+                                                     params.rom_hash_cache,
                                                      load_result);
 
     common::PrintLoadRomsetDiagnostics(stderr, err, load_result, frontend.romset_info);
@@ -1399,6 +2690,18 @@ int main(int argc, char *argv[])
 
     fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
 
+    frontend.worker_count  = Min(params.workers != 0 ? params.workers : TH_CountCores(), params.instances);
+    frontend.thread_policy = params.thread_policy;
+
+    if (params.pin_threads)
+    {
+        frontend.affinity = TH_PlanAffinity(params.instances);
+        if (frontend.affinity.instance_cpus.empty())
+        {
+            fprintf(stderr, "WARNING: Threads can't be pinned on this platform\n");
+        }
+    }
+
     for (size_t i = 0; i < params.instances; ++i)
     {
         if (!FE_CreateInstance(frontend, base_path, params))
@@ -1408,6 +2711,12 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Threads started from here on, like the audio and midi callbacks, inherit this on Linux
+    if (!frontend.affinity.other_cpus.empty())
+    {
+        TH_PinCurrentThread(frontend.affinity.other_cpus);
+    }
+
     frontend.romset_info.PurgeRomData();
 
     if (!FE_OpenAudio(frontend, params))
@@ -1417,19 +2726,52 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (!MIDI_Init(frontend, params.midi_device))
+    if (params.midi_latency_ms)
     {
-        fprintf(stderr, "ERROR: Failed to initialize the MIDI Input.\nWARNING: Continuing without MIDI Input...\n");
-        fflush(stderr);
+        if (frontend.audio_output.kind == AudioOutputKind::SDL ||
+            frontend.audio_output.kind == AudioOutputKind::CoreAudio)
+        {
+            for (size_t i = 0; i < frontend.instances_in_use; ++i)
+            {
+                FE_EnableTimedMIDI(frontend.instances[i], *params.midi_latency_ms);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "WARNING: --midi-latency is only supported with SDL and CoreAudio output; ignoring it\n");
+        }
     }
 
+    // Posted before MIDI input starts, since only one thread may post to an emulator at a time
     for (size_t i = 0; i < frontend.instances_in_use; ++i)
     {
         frontend.instances[i].emu.PostSystemReset(reset);
     }
 
+    if (!MIDI_Init(frontend, params.midi_device))
+    {
+        fprintf(stderr, "ERROR: Failed to initialize the MIDI Input.\nWARNING: Continuing without MIDI Input...\n");
+        fflush(stderr);
+    }
+
     FE_Run(frontend);
 
+    // The workers have stopped, so the counts can be read from this thread
+    if (!params.pc_profile_filename.empty())
+    {
+        std::vector<const pc_profile_t*> pc_profiles;
+        for (size_t i = 0; i < frontend.instances_in_use; ++i)
+        {
+            pc_profiles.push_back(&frontend.instances[i].emu.GetPCProfile());
+        }
+
+        PROF_PrintPCSummary(stderr, pc_profiles);
+        if (!PROF_WritePCProfile(params.pc_profile_filename, pc_profiles))
+        {
+            fprintf(stderr, "ERROR: Failed to write %s\n", params.pc_profile_filename.string().c_str());
+        }
+    }
+
     FE_Quit(frontend);
 
     return 0;
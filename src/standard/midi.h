@@ -33,10 +33,27 @@
  */
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <span>
 #include <string_view>
 
 struct FE_Application;
 
+// Clock used to timestamp incoming midi, in nanoseconds.
+inline uint64_t MIDI_GetHostTimeNS()
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Timestamps reported by midi apis are relative to some earlier point. A timestamp derived from them that is later
+// than the arrival time or lags it by more than this is replaced by the arrival time, so errors can't accumulate.
+constexpr uint64_t MIDI_MAX_TIMESTAMP_LAG_NS = 50'000'000;
+
+// Implemented by the frontend. `time_ns` is when the message was received, on the MIDI_GetHostTimeNS clock.
+void FE_RouteMIDI(FE_Application& fe, std::span<const uint8_t> bytes, uint64_t time_ns);
+
 bool MIDI_Init(FE_Application& fe, std::string_view port_name_or_id);
 void MIDI_Quit(void);
 void MIDI_PrintDevices();
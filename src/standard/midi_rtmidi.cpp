@@ -12,11 +12,26 @@ static RtMidiIn *s_midi_in = nullptr;
 
 static FE_Application* midi_frontend = nullptr;
 
-void FE_RouteMIDI(FE_Application& fe, std::span<const uint8_t> bytes);
+// Time given to the previous message
+static uint64_t s_last_time_ns = 0;
 
-static void MidiOnReceive(double, std::vector<uint8_t> *message, void *)
+// rtmidi only reports the time since the previous message. Adding that up keeps messages that were delivered in a
+// burst at their original spacing.
+static uint64_t MidiMessageTime(double delta_seconds)
 {
-    FE_RouteMIDI(*midi_frontend, *message);
+    const uint64_t now  = MIDI_GetHostTimeNS();
+    uint64_t       time = s_last_time_ns + (uint64_t)(delta_seconds * 1e9);
+    if (s_last_time_ns == 0 || time > now || now - time > MIDI_MAX_TIMESTAMP_LAG_NS)
+    {
+        time = now;
+    }
+    s_last_time_ns = time;
+    return time;
+}
+
+static void MidiOnReceive(double delta_seconds, std::vector<uint8_t> *message, void *)
+{
+    FE_RouteMIDI(*midi_frontend, *message, MidiMessageTime(delta_seconds));
 }
 
 static void MidiOnError(RtMidiError::Type, const std::string &errorText, void *)
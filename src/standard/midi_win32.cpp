@@ -51,7 +51,19 @@ static uint8_t midi_in_buffer[1024];
 
 static FE_Application* midi_frontend = nullptr;
 
-void FE_RouteMIDI(FE_Application& fe, std::span<const uint8_t> bytes);
+// Host time when midiInStart was called. Windows timestamps messages in milliseconds since then.
+static uint64_t midi_start_ns = 0;
+
+static uint64_t MIDI_MessageTime(DWORD_PTR timestamp_ms)
+{
+    const uint64_t now  = MIDI_GetHostTimeNS();
+    uint64_t       time = midi_start_ns + (uint64_t)timestamp_ms * 1'000'000;
+    if (time > now || now - time > MIDI_MAX_TIMESTAMP_LAG_NS)
+    {
+        time = now;
+    }
+    return time;
+}
 
 void CALLBACK MIDI_Callback(
     HMIDIIN   hMidiIn,
@@ -63,7 +75,6 @@ void CALLBACK MIDI_Callback(
 {
     (void)hMidiIn;
     (void)dwInstance;
-    (void)dwParam2;
 
     switch (wMsg)
     {
@@ -85,7 +96,7 @@ void CALLBACK MIDI_Callback(
                             (uint8_t)((dwParam1 >> 8) & 0xff),
                             (uint8_t)((dwParam1 >> 16) & 0xff),
                         };
-                        FE_RouteMIDI(*midi_frontend, buf);
+                        FE_RouteMIDI(*midi_frontend, buf, MIDI_MessageTime(dwParam2));
                     }
                     break;
                 case 0xc0:
@@ -95,7 +106,7 @@ void CALLBACK MIDI_Callback(
                             (uint8_t)b1,
                             (uint8_t)((dwParam1 >> 8) & 0xff),
                         };
-                        FE_RouteMIDI(*midi_frontend, buf);
+                        FE_RouteMIDI(*midi_frontend, buf, MIDI_MessageTime(dwParam2));
                     }
                     break;
             }
@@ -116,7 +127,9 @@ void CALLBACK MIDI_Callback(
 
             if (wMsg == MIM_LONGDATA)
             {
-                FE_RouteMIDI(*midi_frontend, std::span(midi_in_buffer, midi_buffer.dwBytesRecorded));
+                FE_RouteMIDI(*midi_frontend,
+                             std::span(midi_in_buffer, midi_buffer.dwBytesRecorded),
+                             MIDI_MessageTime(dwParam2));
             }
 
             midiInPrepareHeader(midi_handle, &midi_buffer, sizeof(MIDIHDR));
@@ -256,6 +269,7 @@ bool MIDI_Init(FE_Application& fe, std::string_view port_name_or_id)
         return false;
     }
 
+    midi_start_ns = MIDI_GetHostTimeNS();
     result = midiInStart(midi_handle);
     if (result != MMSYSERR_NOERROR)
     {
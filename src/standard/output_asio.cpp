@@ -6,6 +6,7 @@
 #include "asiodrivers.h"
 
 #include "audio.h"
+#include "audio_kernel.h"
 #include "audio_sdl.h"
 #include "command_line.h"
 #include "math_util.h"
@@ -29,8 +30,9 @@ struct ASIOOutput
 
     ASIOBufferInfo   buffer_info[N_BUFFERS]{};
     ASIOChannelInfo  channel_info[MAX_CHANNELS]{};
-    SDL_AudioStream* streams[MAX_STREAMS]{};
-    size_t           stream_count = 0;
+    SDL_AudioStream*  streams[MAX_STREAMS]{};
+    AudioSourceStats* stats[MAX_STREAMS]{};
+    size_t            stream_count = 0;
 
     // Size of a buffer as requested by ASIO driver
     long min_size;
@@ -52,15 +54,18 @@ struct ASIOOutput
 
     ASIOSampleType output_type;
 
-    // Contains interleaved frames received from individual `streams`.
-    // This is necessarily 2 * `buffer_size_bytes` long.
-    GenericBuffer mix_buffers[2]{};
+    // Interleaved frames received from each of `streams`, and the mix of all of them. Each of these is necessarily
+    // 2 * `buffer_size_bytes` long.
+    GenericBuffer stream_buffers[MAX_STREAMS]{};
+    GenericBuffer mix_buffer{};
 
     // Parameters requested by the user
     ASIO_OutputParameters create_params;
 
     long left_channel;
     long right_channel;
+
+    AudioPacer pacer;
 };
 
 // there isn't a way around using globals here, the ASIO API doesn't accept arbitrary userdata in its callbacks
@@ -467,7 +472,13 @@ bool Out_ASIO_Create(const char* driver_name, const ASIO_OutputParameters& param
     // *2 because an ASIO buffer only represents one channel, but our mix buffer will hold 2 channels
     const size_t mb_size = 2 * g_output.buffer_size_bytes;
 
-    if (!g_output.mix_buffers[0].Init(mb_size) || !g_output.mix_buffers[1].Init(mb_size))
+    bool allocated = g_output.mix_buffer.Init(mb_size);
+    for (GenericBuffer& buffer : g_output.stream_buffers)
+    {
+        allocated = allocated && buffer.Init(mb_size);
+    }
+
+    if (!allocated)
     {
         fprintf(stderr, "Failed to allocate mix buffer for ASIO output.\n");
         ASIOExit();
@@ -498,7 +509,7 @@ bool Out_ASIO_Start()
     return true;
 }
 
-void Out_ASIO_AddSource(SDL_AudioStream* stream)
+void Out_ASIO_AddSource(SDL_AudioStream* stream, AudioSourceStats* stats)
 {
     if (g_output.stream_count == MAX_STREAMS)
     {
@@ -506,9 +517,15 @@ void Out_ASIO_AddSource(SDL_AudioStream* stream)
         exit(1);
     }
     g_output.streams[g_output.stream_count] = stream;
+    g_output.stats[g_output.stream_count]   = stats;
     ++g_output.stream_count;
 }
 
+AudioPacer& Out_ASIO_GetPacer()
+{
+    return g_output.pacer;
+}
+
 int Out_ASIO_GetFrequency()
 {
     return (int)g_output.actual_freq;
@@ -619,34 +636,34 @@ inline void Deinterleave(void* dst_a, void* dst_b, const void* src, size_t count
     }
 }
 
-template <typename FrameT>
-inline void MixBuffer(GenericBuffer& dst, const GenericBuffer& src)
+template <typename SampleT>
+inline void MixBuffers(GenericBuffer& dst, std::span<const GenericBuffer> srcs)
 {
-    auto dst_span = std::span<FrameT>((FrameT*)dst.DataFirst(), dst.GetByteLength() / sizeof(FrameT));
-    auto src_span = std::span<FrameT>((FrameT*)src.DataFirst(), src.GetByteLength() / sizeof(FrameT));
-    assert(src_span.size() == dst_span.size());
-    for (size_t samp = 0; samp < dst_span.size(); ++samp)
+    const SampleT* src_ptrs[MAX_STREAMS];
+    for (size_t i = 0; i < srcs.size(); ++i)
     {
-        MixFrame(dst_span[samp], src_span[samp]);
+        assert(srcs[i].GetByteLength() == dst.GetByteLength());
+        src_ptrs[i] = (const SampleT*)srcs[i].DataFirst();
     }
+    AUDIO_Mix((SampleT*)dst.DataFirst(), src_ptrs, srcs.size(), dst.GetByteLength() / sizeof(SampleT));
 }
 
-inline void MixBuffer(GenericBuffer& dst, const GenericBuffer& src, SDL_AudioFormat format)
+inline void MixBuffers(GenericBuffer& dst, std::span<const GenericBuffer> srcs, SDL_AudioFormat format)
 {
     switch (format)
     {
     case AUDIO_S16SYS:
-        MixBuffer<AudioFrame<int16_t>>(dst, src);
+        MixBuffers<int16_t>(dst, srcs);
         break;
     case AUDIO_S32SYS:
-        MixBuffer<AudioFrame<int32_t>>(dst, src);
+        MixBuffers<int32_t>(dst, srcs);
         break;
     case AUDIO_F32SYS:
-        MixBuffer<AudioFrame<float>>(dst, src);
+        MixBuffers<float>(dst, srcs);
         break;
     default:
         fprintf(
-            stderr, "PANIC: MixBuffer called for unsupported format %s (%x)\n", SDLAudioFormatToString(format), format);
+            stderr, "PANIC: MixBuffers called for unsupported format %s (%x)\n", SDLAudioFormatToString(format), format);
         exit(1);
     }
 }
@@ -659,39 +676,48 @@ static ASIOTime* bufferSwitchTimeInfo(ASIOTime* params, long index, ASIOBool dir
     size_t renderable_frames = g_output.buffer_size_frames;
     for (size_t i = 0; i < g_output.stream_count; ++i)
     {
-        renderable_frames =
-            Min(renderable_frames, (size_t)SDL_AudioStreamAvailable(g_output.streams[i]) / sizeof(AudioFrame<int32_t>));
+        const size_t available = (size_t)SDL_AudioStreamAvailable(g_output.streams[i]) / sizeof(AudioFrame<int32_t>);
+        renderable_frames      = Min(renderable_frames, available);
+
+        if (g_output.stats[i])
+        {
+            g_output.stats[i]->Record(available, available < g_output.buffer_size_frames);
+        }
     }
 
     if (renderable_frames < g_output.buffer_size_frames || g_output.stream_count == 0)
     {
         memset(g_output.buffer_info[0].buffers[index], 0, g_output.buffer_size_bytes);
         memset(g_output.buffer_info[1].buffers[index], 0, g_output.buffer_size_bytes);
+        // Producers are behind, make sure they aren't waiting
+        g_output.pacer.Signal();
         return 0;
     }
 
-    SDL_AudioStreamGet(
-        g_output.streams[0], g_output.mix_buffers[1].DataFirst(), (int)g_output.mix_buffers[1].GetByteLength());
-
-    for (size_t i = 1; i < g_output.stream_count; ++i)
+    // read each stream into its staging buffer
+    for (size_t i = 0; i < g_output.stream_count; ++i)
     {
-        // read from stream into staging buffer
-        SDL_AudioStreamGet(
-            g_output.streams[i], g_output.mix_buffers[0].DataFirst(), (int)g_output.mix_buffers[0].GetByteLength());
-
-        // mix staging buffer into final buffer
-        MixBuffer(g_output.mix_buffers[1], g_output.mix_buffers[0], Out_ASIO_GetFormat());
+        SDL_AudioStreamGet(g_output.streams[i],
+                           g_output.stream_buffers[i].DataFirst(),
+                           (int)g_output.stream_buffers[i].GetByteLength());
     }
 
+    // mix all of them at once so that the sum is only clipped once
+    MixBuffers(g_output.mix_buffer,
+               std::span<const GenericBuffer>(g_output.stream_buffers, g_output.stream_count),
+               Out_ASIO_GetFormat());
+
     // unpack final buffer and send it to ASIO driver
     Deinterleave(g_output.buffer_info[0].buffers[index],
                  g_output.buffer_info[1].buffers[index],
-                 g_output.mix_buffers[1].DataFirst(),
+                 g_output.mix_buffer.DataFirst(),
                  g_output.buffer_size_frames,
                  Out_ASIO_GetFormatSampleSizeBytes());
 
     ASIOOutputReady();
 
+    g_output.pacer.Signal();
+
     return 0;
 }
 
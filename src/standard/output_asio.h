@@ -33,8 +33,12 @@ void Out_ASIO_Stop();
 bool Out_ASIO_IsResetRequested();
 bool Out_ASIO_Reset();
 
-// Adds a stream to be mixed into the ASIO output. It should not be freed until ASIO shuts down.
-void Out_ASIO_AddSource(SDL_AudioStream* stream);
+// Adds a stream to be mixed into the ASIO output. It should not be freed until ASIO shuts down. `stats` is optional and
+// must outlive the output.
+void Out_ASIO_AddSource(SDL_AudioStream* stream, AudioSourceStats* stats = nullptr);
+
+// Signaled every time the driver asks for a buffer.
+AudioPacer& Out_ASIO_GetPacer();
 
 int             Out_ASIO_GetFrequency();
 SDL_AudioFormat Out_ASIO_GetFormat();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -10,6 +11,8 @@ enum class AudioOutputKind
 {
     SDL,
     ASIO,
+    CoreAudio,
+    JACK,
 };
 
 struct AudioOutput
@@ -27,3 +30,67 @@ struct AudioOutputParameters
     uint32_t    buffer_size;
     AudioFormat format;
 };
+
+// Counters an output keeps for each source it mixes, read and reset by the frontend for `--stats`. Only the output's
+// callback writes them, so a reset can occasionally lose one sample; that's fine for statistics.
+struct AudioSourceStats
+{
+    // Frames the source had ready each time the output took audio from it
+    std::atomic<uint32_t> fill_min     = UINT32_MAX;
+    std::atomic<uint32_t> fill_max     = 0;
+    std::atomic<uint64_t> fill_sum     = 0;
+    std::atomic<uint32_t> fill_samples = 0;
+
+    // Times the source didn't have a full buffer ready. Depending on the output, it's either left out of the mix or
+    // what it had is played and the rest concealed.
+    std::atomic<uint32_t> underruns = 0;
+
+    // Frames the source is behind the output after underruns, for outputs that catch up on them. The source should
+    // render this much further ahead to stay at the same fill level.
+    std::atomic<uint32_t> lag_frames = 0;
+
+    void Record(size_t ready_frames, bool underrun)
+    {
+        const uint32_t frames = (uint32_t)ready_frames;
+        if (frames < fill_min.load(std::memory_order_relaxed))
+        {
+            fill_min.store(frames, std::memory_order_relaxed);
+        }
+        if (frames > fill_max.load(std::memory_order_relaxed))
+        {
+            fill_max.store(frames, std::memory_order_relaxed);
+        }
+        fill_sum.fetch_add(frames, std::memory_order_relaxed);
+        fill_samples.fetch_add(1, std::memory_order_relaxed);
+        if (underrun)
+        {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Lets producers sleep until the output has consumed audio instead of polling. The output calls Signal every time its
+// callback runs, and a producer with a full buffer calls Wait with the period it saw before checking the buffer, so a
+// period that ends in between wakes it right away.
+class AudioPacer
+{
+public:
+    uint32_t GetPeriod() const
+    {
+        return m_period.load(std::memory_order_acquire);
+    }
+
+    void Wait(uint32_t seen_period) const
+    {
+        m_period.wait(seen_period, std::memory_order_acquire);
+    }
+
+    void Signal()
+    {
+        m_period.fetch_add(1, std::memory_order_release);
+        m_period.notify_all();
+    }
+
+private:
+    std::atomic<uint32_t> m_period = 0;
+};
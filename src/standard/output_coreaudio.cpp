@@ -0,0 +1,472 @@
+#include "output_coreaudio.h"
+
+#include "audio_kernel.h"
+#include "math_util.h"
+#include <AudioToolbox/AudioToolbox.h>
+#include <CoreAudio/CoreAudio.h>
+#include <cstring>
+#include <vector>
+
+// one per instance
+const size_t MAX_STREAMS = 16;
+
+// kAudioObjectPropertyElementMain; older SDKs only know it as kAudioObjectPropertyElementMaster
+const AudioObjectPropertyElement ELEMENT_MAIN = 0;
+
+struct CoreAudioOutput
+{
+    AudioComponentInstance unit   = nullptr;
+    AudioDeviceID          device = kAudioObjectUnknown;
+
+    RingbufferView*   views[MAX_STREAMS]{};
+    AudioSourceStats* stats[MAX_STREAMS]{};
+    size_t            stream_count = 0;
+
+    // The device asks for however many frames it wants, which isn't always a whole buffer, so the sources are mixed
+    // a buffer at a time into `mix_buffer` and copied out of it.
+    GenericBuffer mix_buffer;
+    size_t        mix_read_frames  = 0;
+    size_t        frame_size_bytes = 0;
+    void (*mix_sources)()          = nullptr;
+
+    // Parameters requested by the user
+    CoreAudio_OutputParameters create_params;
+
+    AudioPacer pacer;
+};
+
+static CoreAudioOutput g_output;
+
+// Mixes the next buffer from each source into `mix_buffer`. Sources that don't have a full buffer ready are left out.
+template <typename SampleT>
+void MixSources()
+{
+    using Frame = AudioFrame<SampleT>;
+
+    const size_t frame_count = g_output.create_params.common.buffer_size;
+
+    const SampleT* srcs[MAX_STREAMS];
+    size_t         src_count = 0;
+    bool           ready[MAX_STREAMS]{};
+
+    for (size_t i = 0; i < g_output.stream_count; ++i)
+    {
+        const size_t readable = g_output.views[i]->GetReadableElements<Frame>();
+        if (readable >= frame_count)
+        {
+            srcs[src_count++] = (const SampleT*)g_output.views[i]->UncheckedPrepareRead<Frame>(frame_count).data();
+            ready[i]          = true;
+        }
+
+        if (g_output.stats[i])
+        {
+            g_output.stats[i]->Record(readable, !ready[i]);
+        }
+    }
+
+    AUDIO_Mix((SampleT*)g_output.mix_buffer.DataFirst(), srcs, src_count, frame_count * Frame::channel_count);
+
+    for (size_t i = 0; i < g_output.stream_count; ++i)
+    {
+        if (ready[i])
+        {
+            g_output.views[i]->UncheckedFinishRead<Frame>(frame_count);
+        }
+    }
+}
+
+static OSStatus RenderCallback(void*                       userdata,
+                               AudioUnitRenderActionFlags* flags,
+                               const AudioTimeStamp*       timestamp,
+                               UInt32                      bus,
+                               UInt32                      frame_count,
+                               AudioBufferList*            io_data)
+{
+    (void)userdata;
+    (void)flags;
+    (void)timestamp;
+    (void)bus;
+
+    const size_t buffer_frames = g_output.create_params.common.buffer_size;
+    const size_t frame_size    = g_output.frame_size_bytes;
+
+    uint8_t* out       = (uint8_t*)io_data->mBuffers[0].mData;
+    size_t   remaining = Min<size_t>(frame_count, io_data->mBuffers[0].mDataByteSize / frame_size);
+
+    while (remaining)
+    {
+        if (g_output.mix_read_frames == buffer_frames)
+        {
+            g_output.mix_sources();
+            g_output.mix_read_frames = 0;
+        }
+
+        const size_t   count = Min(remaining, buffer_frames - g_output.mix_read_frames);
+        const uint8_t* mixed = (const uint8_t*)g_output.mix_buffer.DataFirst() + g_output.mix_read_frames * frame_size;
+        memcpy(out, mixed, count * frame_size);
+
+        out += count * frame_size;
+        remaining -= count;
+        g_output.mix_read_frames += count;
+    }
+
+    g_output.pacer.Signal();
+
+    return noErr;
+}
+
+static bool GetOutputDevices(std::vector<AudioDeviceID>& devices)
+{
+    const AudioObjectPropertyAddress address = {
+        kAudioHardwarePropertyDevices,
+        kAudioObjectPropertyScopeGlobal,
+        ELEMENT_MAIN,
+    };
+
+    UInt32 size = 0;
+    if (AudioObjectGetPropertyDataSize(kAudioObjectSystemObject, &address, 0, nullptr, &size) != noErr)
+    {
+        return false;
+    }
+
+    std::vector<AudioDeviceID> all_devices(size / sizeof(AudioDeviceID));
+    if (AudioObjectGetPropertyData(kAudioObjectSystemObject, &address, 0, nullptr, &size, all_devices.data()) != noErr)
+    {
+        return false;
+    }
+    all_devices.resize(size / sizeof(AudioDeviceID));
+
+    // Input-only devices are in the list too
+    const AudioObjectPropertyAddress streams_address = {
+        kAudioDevicePropertyStreams,
+        kAudioObjectPropertyScopeOutput,
+        ELEMENT_MAIN,
+    };
+
+    devices.clear();
+    for (AudioDeviceID device : all_devices)
+    {
+        UInt32 streams_size = 0;
+        if (AudioObjectGetPropertyDataSize(device, &streams_address, 0, nullptr, &streams_size) == noErr &&
+            streams_size > 0)
+        {
+            devices.push_back(device);
+        }
+    }
+
+    return true;
+}
+
+static bool GetDeviceName(AudioDeviceID device, std::string& name)
+{
+    const AudioObjectPropertyAddress address = {
+        kAudioObjectPropertyName,
+        kAudioObjectPropertyScopeGlobal,
+        ELEMENT_MAIN,
+    };
+
+    CFStringRef cf_name = nullptr;
+    UInt32      size    = sizeof(cf_name);
+    if (AudioObjectGetPropertyData(device, &address, 0, nullptr, &size, &cf_name) != noErr || !cf_name)
+    {
+        return false;
+    }
+
+    char buffer[256];
+    const bool converted = CFStringGetCString(cf_name, buffer, sizeof(buffer), kCFStringEncodingUTF8);
+    CFRelease(cf_name);
+
+    if (!converted)
+    {
+        return false;
+    }
+
+    name = buffer;
+    return true;
+}
+
+static bool GetDefaultOutputDevice(AudioDeviceID& device)
+{
+    const AudioObjectPropertyAddress address = {
+        kAudioHardwarePropertyDefaultOutputDevice,
+        kAudioObjectPropertyScopeGlobal,
+        ELEMENT_MAIN,
+    };
+
+    UInt32 size = sizeof(device);
+    return AudioObjectGetPropertyData(kAudioObjectSystemObject, &address, 0, nullptr, &size, &device) == noErr &&
+           device != kAudioObjectUnknown;
+}
+
+static bool FindOutputDevice(const char* device_name, AudioDeviceID& device)
+{
+    if (!device_name)
+    {
+        return GetDefaultOutputDevice(device);
+    }
+
+    std::vector<AudioDeviceID> devices;
+    if (!GetOutputDevices(devices))
+    {
+        return false;
+    }
+
+    std::string name;
+    for (AudioDeviceID candidate : devices)
+    {
+        if (GetDeviceName(candidate, name) && name == device_name)
+        {
+            device = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Sets a global property on `device`. Prints a warning and returns false if the device refuses it.
+template <typename T>
+static bool SetDeviceProperty(AudioDeviceID               device,
+                              AudioObjectPropertySelector selector,
+                              const T&                    value,
+                              const char*                 what)
+{
+    const AudioObjectPropertyAddress address = {
+        selector,
+        kAudioObjectPropertyScopeGlobal,
+        ELEMENT_MAIN,
+    };
+
+    const OSStatus err = AudioObjectSetPropertyData(device, &address, 0, nullptr, sizeof(T), &value);
+    if (err != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to set %s (error %d)\n", what, (int)err);
+        return false;
+    }
+
+    return true;
+}
+
+static const char* FormatName(AudioFormat format)
+{
+    switch (format)
+    {
+    case AudioFormat::S16:
+        return "s16";
+    case AudioFormat::S32:
+        return "s32";
+    case AudioFormat::F32:
+        return "f32";
+    }
+    return "unknown";
+}
+
+template <typename T>
+static bool GetDeviceProperty(AudioDeviceID device, AudioObjectPropertySelector selector, T& value)
+{
+    const AudioObjectPropertyAddress address = {
+        selector,
+        kAudioObjectPropertyScopeGlobal,
+        ELEMENT_MAIN,
+    };
+
+    UInt32 size = sizeof(T);
+    return AudioObjectGetPropertyData(device, &address, 0, nullptr, &size, &value) == noErr;
+}
+
+bool Out_CoreAudio_QueryOutputs(AudioOutputList& list)
+{
+    std::vector<AudioDeviceID> devices;
+    if (!GetOutputDevices(devices))
+    {
+        return false;
+    }
+
+    std::string name;
+    for (AudioDeviceID device : devices)
+    {
+        if (GetDeviceName(device, name))
+        {
+            list.push_back({.name = name, .kind = AudioOutputKind::CoreAudio});
+        }
+    }
+
+    return true;
+}
+
+bool Out_CoreAudio_Create(const char* device_name, const CoreAudio_OutputParameters& params)
+{
+    if (!FindOutputDevice(device_name, g_output.device))
+    {
+        fprintf(stderr, "CoreAudio: no output device named '%s'\n", device_name ? device_name : "(default)");
+        return false;
+    }
+
+    // Neither of these is fatal; the output unit works with whatever the device ends up using
+    if (params.device_sample_rate)
+    {
+        SetDeviceProperty(
+            g_output.device, kAudioDevicePropertyNominalSampleRate, (Float64)*params.device_sample_rate, "sample rate");
+    }
+    SetDeviceProperty(
+        g_output.device, kAudioDevicePropertyBufferFrameSize, (UInt32)params.common.buffer_size, "buffer size");
+
+    const AudioComponentDescription description = {
+        .componentType         = kAudioUnitType_Output,
+        .componentSubType      = kAudioUnitSubType_HALOutput,
+        .componentManufacturer = kAudioUnitManufacturer_Apple,
+        .componentFlags        = 0,
+        .componentFlagsMask    = 0,
+    };
+
+    AudioComponent component = AudioComponentFindNext(nullptr, &description);
+    if (!component || AudioComponentInstanceNew(component, &g_output.unit) != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to create output unit\n");
+        return false;
+    }
+
+    OSStatus err = AudioUnitSetProperty(g_output.unit,
+                                        kAudioOutputUnitProperty_CurrentDevice,
+                                        kAudioUnitScope_Global,
+                                        0,
+                                        &g_output.device,
+                                        sizeof(g_output.device));
+    if (err != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to select device (error %d)\n", (int)err);
+        return false;
+    }
+
+    AudioStreamBasicDescription format{};
+    format.mSampleRate       = params.common.frequency;
+    format.mFormatID         = kAudioFormatLinearPCM;
+    format.mChannelsPerFrame = 2;
+    format.mFramesPerPacket  = 1;
+    switch (params.common.format)
+    {
+    case AudioFormat::S16:
+        format.mFormatFlags    = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+        format.mBitsPerChannel = 16;
+        g_output.mix_sources   = MixSources<int16_t>;
+        break;
+    case AudioFormat::S32:
+        format.mFormatFlags    = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+        format.mBitsPerChannel = 32;
+        g_output.mix_sources   = MixSources<int32_t>;
+        break;
+    case AudioFormat::F32:
+        format.mFormatFlags    = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+        format.mBitsPerChannel = 32;
+        g_output.mix_sources   = MixSources<float>;
+        break;
+    }
+    format.mBytesPerFrame  = format.mChannelsPerFrame * format.mBitsPerChannel / 8;
+    format.mBytesPerPacket = format.mBytesPerFrame;
+
+    err = AudioUnitSetProperty(
+        g_output.unit, kAudioUnitProperty_StreamFormat, kAudioUnitScope_Input, 0, &format, sizeof(format));
+    if (err != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to set stream format (error %d)\n", (int)err);
+        return false;
+    }
+
+    const AURenderCallbackStruct callback = {
+        .inputProc       = RenderCallback,
+        .inputProcRefCon = nullptr,
+    };
+
+    err = AudioUnitSetProperty(
+        g_output.unit, kAudioUnitProperty_SetRenderCallback, kAudioUnitScope_Input, 0, &callback, sizeof(callback));
+    if (err != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to set render callback (error %d)\n", (int)err);
+        return false;
+    }
+
+    err = AudioUnitInitialize(g_output.unit);
+    if (err != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to initialize output unit (error %d)\n", (int)err);
+        return false;
+    }
+
+    g_output.frame_size_bytes = format.mBytesPerFrame;
+    g_output.mix_buffer.Init(params.common.buffer_size * g_output.frame_size_bytes);
+    // Forces the first callback to mix a new buffer
+    g_output.mix_read_frames = params.common.buffer_size;
+    g_output.create_params   = params;
+
+    std::string name;
+    GetDeviceName(g_output.device, name);
+    fprintf(stderr, "Audio device: %s (CoreAudio)\n", name.c_str());
+
+    Float64 device_rate   = 0;
+    UInt32  device_frames = 0;
+    GetDeviceProperty(g_output.device, kAudioDevicePropertyNominalSampleRate, device_rate);
+    GetDeviceProperty(g_output.device, kAudioDevicePropertyBufferFrameSize, device_frames);
+
+    fprintf(stderr,
+            "Audio requested: format=%s, frequency=%u, frames=%u\n",
+            FormatName(params.common.format),
+            params.common.frequency,
+            params.common.buffer_size);
+    fprintf(stderr, "Audio device: frequency=%.0f, frames=%u\n", device_rate, (unsigned)device_frames);
+
+    if ((uint32_t)device_rate != params.common.frequency)
+    {
+        fprintf(stderr, "CoreAudio will resample to the device frequency.\n");
+    }
+
+    return true;
+}
+
+void Out_CoreAudio_Destroy()
+{
+    if (!g_output.unit)
+    {
+        return;
+    }
+
+    Out_CoreAudio_Stop();
+    AudioUnitUninitialize(g_output.unit);
+    AudioComponentInstanceDispose(g_output.unit);
+    g_output.unit = nullptr;
+}
+
+bool Out_CoreAudio_Start()
+{
+    const OSStatus err = AudioOutputUnitStart(g_output.unit);
+    if (err != noErr)
+    {
+        fprintf(stderr, "CoreAudio: failed to start output unit (error %d)\n", (int)err);
+        return false;
+    }
+
+    return true;
+}
+
+void Out_CoreAudio_Stop()
+{
+    AudioOutputUnitStop(g_output.unit);
+}
+
+void Out_CoreAudio_AddSource(RingbufferView& view, AudioSourceStats* stats)
+{
+    if (g_output.stream_count == MAX_STREAMS)
+    {
+        fprintf(stderr, "PANIC: attempted to add more than %zu CoreAudio streams\n", MAX_STREAMS);
+        exit(1);
+    }
+
+    g_output.views[g_output.stream_count] = &view;
+    g_output.stats[g_output.stream_count] = stats;
+
+    ++g_output.stream_count;
+}
+
+AudioPacer& Out_CoreAudio_GetPacer()
+{
+    return g_output.pacer;
+}
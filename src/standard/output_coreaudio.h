@@ -0,0 +1,31 @@
+#pragma once
+
+#include "output_common.h"
+
+#include "ringbuffer.h"
+#include <optional>
+
+struct CoreAudio_OutputParameters
+{
+    AudioOutputParameters common;
+
+    // If set, the device is switched to this frequency. Otherwise it keeps its current frequency and the output unit
+    // resamples from `common.frequency`.
+    std::optional<uint32_t> device_sample_rate;
+};
+
+bool Out_CoreAudio_QueryOutputs(AudioOutputList& list);
+
+// Opens the device named `device_name`, or the system default output if it is null.
+bool Out_CoreAudio_Create(const char* device_name, const CoreAudio_OutputParameters& params);
+// Implies Out_CoreAudio_Stop()
+void Out_CoreAudio_Destroy();
+
+bool Out_CoreAudio_Start();
+void Out_CoreAudio_Stop();
+
+// `stats` is optional and must outlive the output.
+void Out_CoreAudio_AddSource(RingbufferView& view, AudioSourceStats* stats = nullptr);
+
+// Signaled every time the device takes audio from the sources.
+AudioPacer& Out_CoreAudio_GetPacer();
@@ -0,0 +1,333 @@
+#include "output_jack.h"
+
+#include "audio_kernel.h"
+#include <bit>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <jack/jack.h>
+#include <string>
+
+// one per instance
+const size_t MAX_STREAMS = 16;
+
+struct JACKOutput
+{
+    jack_client_t* client = nullptr;
+
+    // The mixed layout only uses the first pair
+    jack_port_t* ports[2 * MAX_STREAMS]{};
+    size_t       port_count = 0;
+
+    RingbufferView*   views[MAX_STREAMS]{};
+    AudioSourceStats* stats[MAX_STREAMS]{};
+    size_t            stream_count = 0;
+
+    // Interleaved mix of every source for the mixed layout
+    GenericBuffer mix_buffer;
+
+    uint32_t frequency   = 0;
+    uint32_t buffer_size = 0;
+
+    JACK_OutputParameters create_params;
+
+    std::atomic<bool> shut_down = false;
+
+    AudioPacer pacer;
+};
+
+static JACKOutput g_output;
+
+static void Deinterleave(const AudioFrame<float>* in, float* left, float* right, size_t frame_count)
+{
+    for (size_t i = 0; i < frame_count; ++i)
+    {
+        left[i]  = in[i].left;
+        right[i] = in[i].right;
+    }
+}
+
+// Mixes one period from each source into `mix_buffer`. Sources that don't have a full period ready are left out.
+static void MixSources(size_t frame_count)
+{
+    using Frame = AudioFrame<float>;
+
+    const float* srcs[MAX_STREAMS];
+    size_t       src_count = 0;
+    bool         ready[MAX_STREAMS]{};
+
+    for (size_t i = 0; i < g_output.stream_count; ++i)
+    {
+        const size_t readable = g_output.views[i]->GetReadableElements<Frame>();
+        if (readable >= frame_count)
+        {
+            srcs[src_count++] = (const float*)g_output.views[i]->UncheckedPrepareRead<Frame>(frame_count).data();
+            ready[i]          = true;
+        }
+
+        if (g_output.stats[i])
+        {
+            g_output.stats[i]->Record(readable, !ready[i]);
+        }
+    }
+
+    AUDIO_Mix((float*)g_output.mix_buffer.DataFirst(), srcs, src_count, frame_count * Frame::channel_count);
+
+    for (size_t i = 0; i < g_output.stream_count; ++i)
+    {
+        if (ready[i])
+        {
+            g_output.views[i]->UncheckedFinishRead<Frame>(frame_count);
+        }
+    }
+}
+
+// Copies one period from each source straight to its own ports. Sources that don't have a full period ready are
+// silent for this period.
+static void CopySources(size_t frame_count)
+{
+    using Frame = AudioFrame<float>;
+
+    for (size_t i = 0; i < g_output.stream_count; ++i)
+    {
+        float* left  = (float*)jack_port_get_buffer(g_output.ports[2 * i], (jack_nframes_t)frame_count);
+        float* right = (float*)jack_port_get_buffer(g_output.ports[2 * i + 1], (jack_nframes_t)frame_count);
+
+        const size_t readable = g_output.views[i]->GetReadableElements<Frame>();
+        const bool   ready    = readable >= frame_count;
+        if (ready)
+        {
+            Deinterleave(g_output.views[i]->UncheckedPrepareRead<Frame>(frame_count).data(), left, right, frame_count);
+            g_output.views[i]->UncheckedFinishRead<Frame>(frame_count);
+        }
+        else
+        {
+            memset(left, 0, frame_count * sizeof(float));
+            memset(right, 0, frame_count * sizeof(float));
+        }
+
+        if (g_output.stats[i])
+        {
+            g_output.stats[i]->Record(readable, !ready);
+        }
+    }
+}
+
+static int ProcessCallback(jack_nframes_t frame_count, void* userdata)
+{
+    (void)userdata;
+
+    // Sources are written a period at a time, so a new period can't be read until the frontend is restarted
+    if (frame_count != g_output.buffer_size)
+    {
+        for (size_t i = 0; i < g_output.port_count; ++i)
+        {
+            memset(jack_port_get_buffer(g_output.ports[i], frame_count), 0, frame_count * sizeof(float));
+        }
+    }
+    else if (g_output.create_params.layout == JACK_PortLayout::Mixed)
+    {
+        MixSources(frame_count);
+        Deinterleave((const AudioFrame<float>*)g_output.mix_buffer.DataFirst(),
+                     (float*)jack_port_get_buffer(g_output.ports[0], frame_count),
+                     (float*)jack_port_get_buffer(g_output.ports[1], frame_count),
+                     frame_count);
+    }
+    else
+    {
+        CopySources(frame_count);
+    }
+
+    g_output.pacer.Signal();
+
+    return 0;
+}
+
+static void ShutdownCallback(void* userdata)
+{
+    (void)userdata;
+    g_output.shut_down = true;
+    // Workers waiting for a period would never wake up otherwise
+    g_output.pacer.Signal();
+}
+
+static bool RegisterPortPair(const std::string& prefix)
+{
+    for (const char* side : {"left", "right"})
+    {
+        const std::string name = prefix + side;
+
+        jack_port_t* port =
+            jack_port_register(g_output.client, name.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (!port)
+        {
+            fprintf(stderr, "JACK: failed to register port %s\n", name.c_str());
+            return false;
+        }
+
+        g_output.ports[g_output.port_count++] = port;
+    }
+
+    return true;
+}
+
+// Connects every pair of ports to the first two physical playback ports. Failing to connect isn't fatal; the ports
+// can still be connected by hand.
+static void ConnectPorts()
+{
+    const char** playback =
+        jack_get_ports(g_output.client, nullptr, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
+    if (!playback || !playback[0] || !playback[1])
+    {
+        fprintf(stderr, "JACK: no system playback ports to connect to\n");
+        jack_free(playback);
+        return;
+    }
+
+    for (size_t i = 0; i < g_output.port_count; ++i)
+    {
+        const char* source = jack_port_name(g_output.ports[i]);
+        const char* target = playback[i % 2];
+        if (jack_connect(g_output.client, source, target) != 0)
+        {
+            fprintf(stderr, "JACK: failed to connect %s to %s\n", source, target);
+        }
+    }
+
+    jack_free(playback);
+}
+
+bool Out_JACK_QueryOutputs(AudioOutputList& list)
+{
+    list.push_back({.name = "JACK", .kind = AudioOutputKind::JACK});
+    return true;
+}
+
+bool Out_JACK_Create(const JACK_OutputParameters& params)
+{
+    jack_status_t status{};
+    g_output.client = jack_client_open("nuked-sc55", JackNoStartServer, &status);
+    if (!g_output.client)
+    {
+        fprintf(stderr, "JACK: failed to connect to the server (status 0x%x)\n", (unsigned)status);
+        return false;
+    }
+
+    g_output.frequency   = jack_get_sample_rate(g_output.client);
+    g_output.buffer_size = jack_get_buffer_size(g_output.client);
+
+    // Ringbuffer sizes are powers of 2, so unless they're mirrored a period has to be one to always read it in one
+    // piece
+    if (!std::has_single_bit(g_output.buffer_size) && !GenericBuffer::IsMirroringSupported())
+    {
+        fprintf(stderr, "JACK: period of %u frames isn't a power of 2\n", g_output.buffer_size);
+        Out_JACK_Destroy();
+        return false;
+    }
+
+    if (jack_set_process_callback(g_output.client, ProcessCallback, nullptr) != 0)
+    {
+        fprintf(stderr, "JACK: failed to set process callback\n");
+        Out_JACK_Destroy();
+        return false;
+    }
+    jack_on_shutdown(g_output.client, ShutdownCallback, nullptr);
+
+    g_output.mix_buffer.Init(g_output.buffer_size * sizeof(AudioFrame<float>));
+    g_output.create_params = params;
+    g_output.shut_down     = false;
+
+    fprintf(stderr, "Audio device: %s (JACK)\n", jack_get_client_name(g_output.client));
+    fprintf(stderr, "Audio device: frequency=%u, frames=%u\n", g_output.frequency, g_output.buffer_size);
+
+    return true;
+}
+
+void Out_JACK_Destroy()
+{
+    if (!g_output.client)
+    {
+        return;
+    }
+
+    Out_JACK_Stop();
+    jack_client_close(g_output.client);
+    g_output.client     = nullptr;
+    g_output.port_count = 0;
+}
+
+bool Out_JACK_Start()
+{
+    if (g_output.create_params.layout == JACK_PortLayout::Mixed)
+    {
+        if (!RegisterPortPair(""))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < g_output.stream_count; ++i)
+        {
+            char prefix[16];
+            snprintf(prefix, sizeof(prefix), "%02zu_", i);
+            if (!RegisterPortPair(prefix))
+            {
+                return false;
+            }
+        }
+    }
+
+    if (jack_activate(g_output.client) != 0)
+    {
+        fprintf(stderr, "JACK: failed to activate client\n");
+        return false;
+    }
+
+    // Ports can only be connected once the client is active
+    if (g_output.create_params.connect)
+    {
+        ConnectPorts();
+    }
+
+    return true;
+}
+
+void Out_JACK_Stop()
+{
+    jack_deactivate(g_output.client);
+}
+
+void Out_JACK_AddSource(RingbufferView& view, AudioSourceStats* stats)
+{
+    if (g_output.stream_count == MAX_STREAMS)
+    {
+        fprintf(stderr, "PANIC: attempted to add more than %zu JACK streams\n", MAX_STREAMS);
+        exit(1);
+    }
+
+    g_output.views[g_output.stream_count] = &view;
+    g_output.stats[g_output.stream_count] = stats;
+
+    ++g_output.stream_count;
+}
+
+AudioPacer& Out_JACK_GetPacer()
+{
+    return g_output.pacer;
+}
+
+bool Out_JACK_IsShutDown()
+{
+    return g_output.shut_down;
+}
+
+uint32_t Out_JACK_GetFrequency()
+{
+    return g_output.frequency;
+}
+
+uint32_t Out_JACK_GetBufferSize()
+{
+    return g_output.buffer_size;
+}
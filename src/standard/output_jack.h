@@ -0,0 +1,49 @@
+#pragma once
+
+#include "output_common.h"
+
+#include "ringbuffer.h"
+
+enum class JACK_PortLayout
+{
+    // Every instance is mixed into one pair of ports
+    Mixed,
+    // Each instance gets its own pair of ports
+    PerInstance,
+};
+
+struct JACK_OutputParameters
+{
+    JACK_PortLayout layout = JACK_PortLayout::Mixed;
+
+    // Connect the ports to the system playback ports once the client is running
+    bool connect = true;
+};
+
+// Lists the JACK server as a single output. It isn't contacted until Out_JACK_Create.
+bool Out_JACK_QueryOutputs(AudioOutputList& list);
+
+// Connects to a running JACK server, which includes PipeWire's JACK implementation. The server decides the frequency
+// and period, see Out_JACK_GetFrequency and Out_JACK_GetBufferSize.
+bool Out_JACK_Create(const JACK_OutputParameters& params);
+// Implies Out_JACK_Stop()
+void Out_JACK_Destroy();
+
+// Registers the ports for every source added so far and activates the client.
+bool Out_JACK_Start();
+void Out_JACK_Stop();
+
+// `view` must hold AudioFrame<float> at the server's frequency, written a period at a time. `stats` is optional and
+// must outlive the output.
+void Out_JACK_AddSource(RingbufferView& view, AudioSourceStats* stats = nullptr);
+
+// Signaled every time the server runs a period.
+AudioPacer& Out_JACK_GetPacer();
+
+// Set when the server stops or kicks the client out; the output is silent from then on.
+bool Out_JACK_IsShutDown();
+
+uint32_t Out_JACK_GetFrequency();
+
+// Frames in a period.
+uint32_t Out_JACK_GetBufferSize();
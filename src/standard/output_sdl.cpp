@@ -1,12 +1,42 @@
 #include "output_sdl.h"
 
+#include "audio_kernel.h"
 #include "audio_sdl.h"
 #include "cast.h"
 #include <SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
 
 // one per instance
 const size_t MAX_STREAMS = 16;
 
+// A stream that's behind is caught up on by reading at most one frame more per this many frames the device takes,
+// about 1.7 cents of pitch.
+const size_t MAX_CORRECTION_DIVISOR = 1024;
+
+// Frames over which the last frame of a stream that ran dry is faded to silence, instead of cutting it off.
+const size_t CONCEAL_FADE_FRAMES = 64;
+
+struct SDLStream
+{
+    RingbufferView*   view  = nullptr;
+    AudioSourceStats* stats = nullptr;
+
+    // Holds this period's frames of the stream, since they may wrap around the ringbuffer or need correcting
+    GenericBuffer scratch;
+    size_t        scratch_frames = 0;
+
+    // Frames the stream is behind the device from periods it couldn't fill. They're played late, so they're caught up
+    // on by reading slightly faster than the device until this is 0 again.
+    size_t lag = 0;
+
+    // Last frame played, to fade out from when the stream runs dry
+    float last_left  = 0;
+    float last_right = 0;
+};
+
 struct SDLOutput
 {
     SDL_AudioSpec requested_spec{};
@@ -14,15 +44,91 @@ struct SDLOutput
 
     SDL_AudioDeviceID device = 0;
 
-    RingbufferView* views[MAX_STREAMS]{};
-    size_t          stream_count = 0;
+    SDLStream streams[MAX_STREAMS];
+    size_t    stream_count = 0;
 
     // Parameters requested by the user
     AudioOutputParameters create_params;
+
+    AudioPacer pacer;
 };
 
 static SDLOutput g_output;
 
+template <typename SampleT>
+static SampleT Lerp(SampleT a, SampleT b, double t)
+{
+    const double value = (double)a + ((double)b - (double)a) * t;
+    if constexpr (std::is_floating_point_v<SampleT>)
+    {
+        return (SampleT)value;
+    }
+    else
+    {
+        return (SampleT)std::lround(value);
+    }
+}
+
+// Fills `frames` with `frame_count` frames of the stream. Reads up to `frame_count` plus a small correction while the
+// stream is behind, squeezing them into `frame_count` frames. If the stream runs dry, whatever it had is played and the
+// rest is faded out from its last frame. `frame_count` must be at least 2.
+template <typename SampleT>
+static void PullStream(SDLStream& stream, AudioFrame<SampleT>* frames, size_t frame_count)
+{
+    using Frame = AudioFrame<SampleT>;
+
+    const size_t readable   = stream.view->GetReadableElements<Frame>();
+    const size_t correction = Min(stream.lag, std::max<size_t>(1, frame_count / MAX_CORRECTION_DIVISOR));
+    const size_t got        = stream.view->Read(std::span<Frame>(frames, frame_count + correction));
+
+    if (got > frame_count)
+    {
+        // Resample the frames read down to `frame_count`. Each output frame only reads frames at or after its own
+        // position, so this can be done in place.
+        const double step = (double)(got - 1) / (double)(frame_count - 1);
+        for (size_t i = 0; i < frame_count; ++i)
+        {
+            const double pos = (double)i * step;
+            const size_t j   = Min((size_t)pos, got - 2);
+            const double t   = pos - (double)j;
+            const Frame  a   = frames[j];
+            const Frame  b   = frames[j + 1];
+            frames[i].left   = Lerp(a.left, b.left, t);
+            frames[i].right  = Lerp(a.right, b.right, t);
+        }
+        stream.lag -= got - frame_count;
+    }
+    else if (got < frame_count)
+    {
+        if (got != 0)
+        {
+            stream.last_left  = (float)frames[got - 1].left;
+            stream.last_right = (float)frames[got - 1].right;
+        }
+
+        const size_t fade = Min(frame_count - got, CONCEAL_FADE_FRAMES);
+        for (size_t i = 0; i < fade; ++i)
+        {
+            const float gain = 1.0f - (float)(i + 1) / (float)fade;
+            frames[got + i].left  = (SampleT)(stream.last_left * gain);
+            frames[got + i].right = (SampleT)(stream.last_right * gain);
+        }
+        memset((void*)(frames + got + fade), 0, (frame_count - got - fade) * sizeof(Frame));
+
+        // Past a full ringbuffer of lag the stream can never catch up, so it's given up on
+        stream.lag = Min(stream.lag + frame_count - got, stream.view->GetByteLength() / sizeof(Frame));
+    }
+
+    stream.last_left  = (float)frames[frame_count - 1].left;
+    stream.last_right = (float)frames[frame_count - 1].right;
+
+    if (stream.stats)
+    {
+        stream.stats->Record(readable, got < frame_count);
+        stream.stats->lag_frames.store((uint32_t)stream.lag, std::memory_order_relaxed);
+    }
+}
+
 template <typename SampleT>
 void AudioCallback(void* userdata, Uint8* stream, int len)
 {
@@ -30,20 +136,33 @@ void AudioCallback(void* userdata, Uint8* stream, int len)
 
     using Frame = AudioFrame<SampleT>;
 
-    memset(stream, 0, (size_t)len);
+    // Streams are read by however much the device asks for, which may differ from the buffer size they're written in
+    const size_t stream_frames = (size_t)len / sizeof(Frame);
 
+    const SampleT* srcs[MAX_STREAMS];
+    size_t         frame_count = stream_frames;
     for (size_t i = 0; i < g_output.stream_count; ++i)
     {
-        if (g_output.views[i]->GetReadableElements<Frame>() >= g_output.create_params.buffer_size)
-        {
-            auto span = g_output.views[i]->UncheckedPrepareRead<Frame>(g_output.create_params.buffer_size);
-            for (size_t samp = 0; samp < span.size(); ++samp)
-            {
-                MixFrame(*((Frame*)stream + samp), span[samp]);
-            }
-            g_output.views[i]->UncheckedFinishRead<Frame>(g_output.create_params.buffer_size);
-        }
+        frame_count = Min(frame_count, g_output.streams[i].scratch_frames);
+    }
+    if (frame_count < 2)
+    {
+        // Too short to correct; devices don't ask for this little in practice
+        frame_count = 0;
+    }
+
+    size_t src_count = 0;
+    for (size_t i = 0; i < g_output.stream_count && frame_count != 0; ++i)
+    {
+        SDLStream& source = g_output.streams[i];
+        PullStream(source, (Frame*)source.scratch.DataFirst(), frame_count);
+        srcs[src_count++] = (const SampleT*)source.scratch.DataFirst();
     }
+
+    AUDIO_Mix((SampleT*)stream, srcs, src_count, frame_count * Frame::channel_count);
+    memset((Frame*)stream + frame_count, 0, (stream_frames - frame_count) * sizeof(Frame));
+
+    g_output.pacer.Signal();
 }
 
 bool Out_SDL_QueryOutputs(AudioOutputList& list)
@@ -147,7 +266,7 @@ void Out_SDL_Stop()
     SDL_PauseAudioDevice(g_output.device, 1);
 }
 
-void Out_SDL_AddSource(RingbufferView& view)
+void Out_SDL_AddSource(RingbufferView& view, AudioSourceStats* stats)
 {
     if (g_output.stream_count == MAX_STREAMS)
     {
@@ -155,7 +274,20 @@ void Out_SDL_AddSource(RingbufferView& view)
         exit(1);
     }
 
-    g_output.views[g_output.stream_count] = &view;
+    SDLStream& stream = g_output.streams[g_output.stream_count];
+    stream.view       = &view;
+    stream.stats      = stats;
+
+    // Room for the largest period the device asked for plus the most a correction can add. AudioFrame<int32_t> is the
+    // largest frame of any format.
+    const size_t period_frames = std::max<size_t>(g_output.actual_spec.samples, g_output.create_params.buffer_size);
+    stream.scratch_frames      = period_frames;
+    stream.scratch.Init((period_frames + period_frames / MAX_CORRECTION_DIVISOR + 1) * sizeof(AudioFrame<int32_t>));
 
     ++g_output.stream_count;
 }
+
+AudioPacer& Out_SDL_GetPacer()
+{
+    return g_output.pacer;
+}
@@ -13,4 +13,8 @@ void Out_SDL_Destroy();
 bool Out_SDL_Start();
 void Out_SDL_Stop();
 
-void Out_SDL_AddSource(RingbufferView& view);
+// `stats` is optional and must outlive the output.
+void Out_SDL_AddSource(RingbufferView& view, AudioSourceStats* stats = nullptr);
+
+// Signaled every time the device takes a buffer from the sources.
+AudioPacer& Out_SDL_GetPacer();
@@ -1,13 +1,86 @@
 import subprocess
 import argparse
-import hashlib
+import json
+import os
 import sys
+import tempfile
 
 parser = argparse.ArgumentParser(
     epilog="Arguments after the first '--' will be forwarded to the render executable."
 )
 parser.add_argument("--render-exe", type=str, required=True)
 parser.add_argument("--sha256", type=str, required=True)
+parser.add_argument(
+    "--instances",
+    type=int,
+    default=1,
+    help="Number of instances to render with. Above 1, the track is also rendered on a single instance to measure "
+    "scaling efficiency.",
+)
+parser.add_argument("--perf-name", type=str, help="Name of the render speed baseline for this test.")
+parser.add_argument(
+    "--perf-baseline-dir",
+    type=str,
+    help="Directory holding render speed baselines. A missing baseline is recorded from this run.",
+)
+parser.add_argument(
+    "--perf-tolerance",
+    type=float,
+    default=0.1,
+    help="How much slower than the baseline a render may be, as a fraction of the baseline.",
+)
+parser.add_argument(
+    "--perf-gate",
+    action="store_true",
+    help="Fail when slower than the baseline. Otherwise only a warning is printed.",
+)
+
+
+def render(cmd, report_path, stdout):
+    """Runs the renderer and returns the process and its perf report. `stdout` receives the printed digests."""
+    with subprocess.Popen(cmd + ["--perf-report", report_path], stdout=subprocess.PIPE) as proc:
+        result = stdout(proc.stdout)
+    status = proc.wait()
+    if status != 0:
+        return status, result, None
+
+    with open(report_path) as f:
+        return status, result, json.load(f)
+
+
+def read_mix_digest(stream):
+    """Returns the digest from the first line printed by --hash, which is the mixed output."""
+    fields = stream.read().decode().split()
+    # A failed render prints nothing
+    return fields[0] if fields else ""
+
+
+def check_baseline(args, metrics):
+    """Compares `metrics` with the stored baseline. Returns false if one of them regressed."""
+    path = os.path.join(args.perf_baseline_dir, args.perf_name + ".json")
+    if not os.path.exists(path):
+        os.makedirs(args.perf_baseline_dir, exist_ok=True)
+        with open(path, "w") as f:
+            json.dump(metrics, f, indent=2, sort_keys=True)
+        print(f"recorded baseline {path}")
+        return True
+
+    with open(path) as f:
+        baseline = json.load(f)
+
+    ok = True
+    for name, value in metrics.items():
+        if name not in baseline:
+            continue
+        minimum = baseline[name] * (1 - args.perf_tolerance)
+        if value < minimum:
+            kind = "error" if args.perf_gate else "warning"
+            print(
+                f"{kind}: {name} regressed: {value:.3f}, baseline {baseline[name]:.3f} "
+                f"(tolerance {args.perf_tolerance:.0%})"
+            )
+            ok = False
+    return ok
 
 
 def main():
@@ -23,22 +96,48 @@ def main():
 
     cmd = [
         args.render_exe,
-        "--stdout",
+        "--hash",
     ] + extra_args
 
-    with subprocess.Popen(cmd, stdout=subprocess.PIPE) as proc:
-        digest = hashlib.file_digest(proc.stdout, "sha256")
+    with tempfile.TemporaryDirectory() as tmp:
+        report_path = os.path.join(tmp, "perf.json")
+
+        status, digest, report = render(
+            cmd + ["--instances", str(args.instances)],
+            report_path,
+            read_mix_digest,
+        )
+
+        expected = args.sha256.casefold()
+        actual = digest.casefold()
+
+        if expected != actual:
+            print("hash mismatch:")
+            print(f"expected: {expected}")
+            print(f"actual:   {actual}")
+            sys.exit(1)
+
+        if status != 0:
+            sys.exit(status)
+
+        metrics = {"speed": report["speed"]}
+        print(f"speed: {report['speed']:.2f}x realtime")
+
+        if args.instances > 1:
+            status, _, single_report = render(cmd, report_path, read_mix_digest)
+            if status != 0:
+                sys.exit(status)
 
-    expected = args.sha256.casefold()
-    actual = digest.hexdigest().casefold()
+            # 1.0 means N instances render N times as fast as one
+            efficiency = single_report["render_seconds"] / (args.instances * report["render_seconds"])
+            metrics["scaling_efficiency"] = efficiency
+            print(f"scaling efficiency: {efficiency:.0%} over {args.instances} instances")
 
-    if expected != actual:
-        print("hash mismatch:")
-        print(f"expected: {expected}")
-        print(f"actual:   {actual}")
-        sys.exit(1)
+    if args.perf_name and args.perf_baseline_dir:
+        if not check_baseline(args, metrics) and args.perf_gate:
+            sys.exit(1)
 
-    sys.exit(proc.wait())
+    sys.exit(0)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,158 @@
+#include <catch2/catch_test_macros.hpp>
+#include "audio_kernel.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Random samples, biased towards the limits of the type so that saturation gets exercised.
+template <typename T>
+static std::vector<T> RandomSamples(std::mt19937& rng, size_t count, T lo, T hi)
+{
+    std::vector<T> samples(count);
+    for (T& sample : samples)
+    {
+        switch (rng() % 4)
+        {
+        case 0:
+            sample = lo;
+            break;
+        case 1:
+            sample = hi;
+            break;
+        default:
+            if constexpr (std::is_floating_point_v<T>)
+                sample = std::uniform_real_distribution<T>(lo, hi)(rng);
+            else
+                sample = (T)std::uniform_int_distribution<int64_t>(lo, hi)(rng);
+            break;
+        }
+    }
+    return samples;
+}
+
+template <typename T>
+static bool SameBits(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+template <typename T, typename Kernel>
+static void CheckMix(Kernel expected, Kernel actual, std::mt19937& rng, T lo, T hi)
+{
+    const size_t src_count = rng() % (AUDIO_MAX_MIX_SOURCES + 1);
+    const size_t count = rng() % 100;
+
+    std::vector<std::vector<T>> srcs;
+    std::vector<const T*> src_ptrs;
+    for (size_t k = 0; k < src_count; ++k)
+        srcs.push_back(RandomSamples<T>(rng, count, lo, hi));
+    for (const auto& src : srcs)
+        src_ptrs.push_back(src.data());
+
+    std::vector<T> expected_out(count), actual_out(count);
+    expected(expected_out.data(), src_ptrs.data(), src_count, count);
+    actual(actual_out.data(), src_ptrs.data(), src_count, count);
+    REQUIRE(SameBits(expected_out, actual_out));
+}
+
+TEST_CASE("Audio kernels agree with the scalar kernels")
+{
+    const audio_kernels_t* scalar = AUDIO_GetKernels(AudioKernel::Scalar);
+    REQUIRE(scalar);
+    REQUIRE(AUDIO_GetKernels(AUDIO_DetectKernel()));
+
+    const AudioKernel kernels[] = {AudioKernel::SSE2, AudioKernel::AVX2, AudioKernel::NEON};
+
+    std::mt19937 rng(55);
+
+    for (AudioKernel kernel : kernels)
+    {
+        const audio_kernels_t* vector = AUDIO_GetKernels(kernel);
+        if (!vector)
+            continue;
+
+        INFO(AUDIO_KernelName(kernel));
+
+        for (int iteration = 0; iteration < 500; ++iteration)
+        {
+            // Odd lengths exercise the scalar tails
+            const size_t count = rng() % 100;
+            const std::vector<int32_t> raw = RandomSamples<int32_t>(rng, count, INT32_MIN, INT32_MAX);
+
+            std::vector<int16_t> expected_s16(count), actual_s16(count);
+            scalar->normalize_s16(expected_s16.data(), raw.data(), count);
+            vector->normalize_s16(actual_s16.data(), raw.data(), count);
+            REQUIRE(SameBits(expected_s16, actual_s16));
+
+            std::vector<int32_t> expected_s32(count), actual_s32(count);
+            scalar->normalize_s32(expected_s32.data(), raw.data(), count);
+            vector->normalize_s32(actual_s32.data(), raw.data(), count);
+            REQUIRE(SameBits(expected_s32, actual_s32));
+
+            std::vector<float> expected_f32(count), actual_f32(count);
+            scalar->normalize_f32(expected_f32.data(), raw.data(), count);
+            vector->normalize_f32(actual_f32.data(), raw.data(), count);
+            REQUIRE(SameBits(expected_f32, actual_f32));
+
+            const float gain = std::uniform_real_distribution<float>(0.0f, 4.0f)(rng);
+            scalar->gain_s16(expected_s16.data(), count, gain);
+            vector->gain_s16(actual_s16.data(), count, gain);
+            REQUIRE(SameBits(expected_s16, actual_s16));
+
+            scalar->gain_s32(expected_s32.data(), count, gain);
+            vector->gain_s32(actual_s32.data(), count, gain);
+            REQUIRE(SameBits(expected_s32, actual_s32));
+
+            scalar->gain_f32(expected_f32.data(), count, gain);
+            vector->gain_f32(actual_f32.data(), count, gain);
+            REQUIRE(SameBits(expected_f32, actual_f32));
+
+            CheckMix<int16_t>(scalar->mix_s16, vector->mix_s16, rng, INT16_MIN, INT16_MAX);
+            CheckMix<int32_t>(scalar->mix_s32, vector->mix_s32, rng, INT32_MIN, INT32_MAX);
+            CheckMix<float>(scalar->mix_f32, vector->mix_f32, rng, -1.0f, 1.0f);
+
+            const size_t taps = AUDIO_RESAMPLE_TAP_ALIGN * (1 + rng() % 16);
+            const std::vector<float> left        = RandomSamples<float>(rng, taps, -32768.0f, 32767.0f);
+            const std::vector<float> right       = RandomSamples<float>(rng, taps, -32768.0f, 32767.0f);
+            const std::vector<float> filter      = RandomSamples<float>(rng, taps, -1.0f, 1.0f);
+            const std::vector<float> next_filter = RandomSamples<float>(rng, taps, -1.0f, 1.0f);
+            const float              frac        = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+
+            std::vector<float> expected_frame(2), actual_frame(2);
+            scalar->resample(
+                expected_frame.data(), left.data(), right.data(), filter.data(), next_filter.data(), frac, taps);
+            vector->resample(
+                actual_frame.data(), left.data(), right.data(), filter.data(), next_filter.data(), frac, taps);
+            REQUIRE(SameBits(expected_frame, actual_frame));
+        }
+    }
+}
+
+TEST_CASE("Mixing clips the sum once")
+{
+    const audio_kernels_t* scalar = AUDIO_GetKernels(AudioKernel::Scalar);
+
+    // Adding one source at a time with saturation would clip the first two to 32767 and end up at 2767
+    const int16_t a[] = {30000};
+    const int16_t b[] = {30000};
+    const int16_t c[] = {-30000};
+    const int16_t* s16_srcs[] = {a, b, c};
+
+    int16_t s16_out = 0;
+    scalar->mix_s16(&s16_out, s16_srcs, 3, 1);
+    REQUIRE(s16_out == 30000);
+
+    const int32_t d[] = {INT32_MAX};
+    const int32_t e[] = {INT32_MAX};
+    const int32_t f[] = {INT32_MIN};
+    const int32_t* s32_srcs[] = {d, e, f};
+
+    int32_t s32_out = 0;
+    scalar->mix_s32(&s32_out, s32_srcs, 3, 1);
+    REQUIRE(s32_out == INT32_MAX - 1);
+
+    // No sources is silence
+    s16_out = 1;
+    scalar->mix_s16(&s16_out, s16_srcs, 0, 1);
+    REQUIRE(s16_out == 0);
+}
@@ -0,0 +1,334 @@
+#include <catch2/catch_test_macros.hpp>
+#include "flac.h"
+#include "wav.h"
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+// Reads a FLAC stream back, for checking that the encoder is lossless. Only understands what FLAC_Encoder writes.
+struct FlacReader
+{
+    const std::vector<uint8_t>& bytes;
+    size_t                      bit = 0;
+
+    uint32_t Read(uint32_t bits)
+    {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < bits; ++i, ++bit)
+        {
+            value = (value << 1) | ((bytes[bit / 8] >> (7 - bit % 8)) & 1);
+        }
+        return value;
+    }
+
+    int32_t ReadSigned(uint32_t bits)
+    {
+        const uint32_t value = Read(bits);
+        return (int32_t)(value << (32 - bits)) >> (32 - bits);
+    }
+
+    uint32_t ReadUnary()
+    {
+        uint32_t value = 0;
+        while (Read(1) == 0)
+        {
+            ++value;
+        }
+        return value;
+    }
+
+    void Align()
+    {
+        bit = (bit + 7) / 8 * 8;
+    }
+};
+
+struct DecodedFlac
+{
+    uint32_t                          sample_rate     = 0;
+    uint32_t                          bits_per_sample = 0;
+    uint64_t                          total_frames    = 0;
+    std::vector<AudioFrame<int32_t>> frames;
+};
+
+static uint16_t Crc16(const uint8_t* data, size_t len)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (int b = 0; b < 8; ++b)
+        {
+            crc = (uint16_t)((crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void DecodeSubframe(FlacReader& r, uint32_t bps, size_t n, std::vector<int32_t>& out)
+{
+    out.resize(n);
+    REQUIRE(r.Read(1) == 0);
+    const uint32_t type = r.Read(6);
+    REQUIRE(r.Read(1) == 0);
+
+    if (type == 0)
+    {
+        const int32_t value = r.ReadSigned(bps);
+        std::fill(out.begin(), out.end(), value);
+        return;
+    }
+    if (type == 1)
+    {
+        for (int32_t& s : out)
+        {
+            s = r.ReadSigned(bps);
+        }
+        return;
+    }
+
+    REQUIRE((type & 0b111000) == 0b001000);
+    const uint32_t order = type & 7;
+    for (uint32_t i = 0; i < order; ++i)
+    {
+        out[i] = r.ReadSigned(bps);
+    }
+
+    const uint32_t method          = r.Read(2);
+    const uint32_t partition_order = r.Read(4);
+    const size_t   partition_size  = n >> partition_order;
+    size_t         i               = order;
+    for (size_t p = 0; p < (size_t(1) << partition_order); ++p)
+    {
+        const uint32_t param = r.Read(method == 0 ? 4 : 5);
+        const size_t   count = p == 0 ? partition_size - order : partition_size;
+        for (size_t j = 0; j < count; ++j, ++i)
+        {
+            const uint32_t u        = (r.ReadUnary() << param) | r.Read(param);
+            const int64_t  residual = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+
+            int64_t prediction = 0;
+            switch (order)
+            {
+            case 1:
+                prediction = out[i - 1];
+                break;
+            case 2:
+                prediction = 2 * (int64_t)out[i - 1] - out[i - 2];
+                break;
+            case 3:
+                prediction = 3 * (int64_t)out[i - 1] - 3 * (int64_t)out[i - 2] + out[i - 3];
+                break;
+            case 4:
+                prediction = 4 * (int64_t)out[i - 1] - 6 * (int64_t)out[i - 2] + 4 * (int64_t)out[i - 3] - out[i - 4];
+                break;
+            }
+            out[i] = (int32_t)(prediction + residual);
+        }
+    }
+}
+
+static DecodedFlac DecodeFlac(const std::vector<uint8_t>& bytes)
+{
+    DecodedFlac result;
+    FlacReader  r{bytes};
+
+    REQUIRE(r.Read(32) == 0x664c6143);
+    REQUIRE(r.Read(1) == 1);
+    REQUIRE(r.Read(7) == 0);
+    REQUIRE(r.Read(24) == 34);
+    REQUIRE(r.Read(16) == FLAC_BLOCK_SIZE);
+    REQUIRE(r.Read(16) == FLAC_BLOCK_SIZE);
+    r.Read(24);
+    r.Read(24);
+    result.sample_rate = r.Read(20);
+    REQUIRE(r.Read(3) == 1);
+    result.bits_per_sample = r.Read(5) + 1;
+    result.total_frames    = (uint64_t)r.Read(4) << 32;
+    result.total_frames |= r.Read(32);
+    r.bit += 128;
+
+    uint32_t expected_number = 0;
+    while (r.bit / 8 < bytes.size())
+    {
+        const size_t frame_start = r.bit / 8;
+        REQUIRE(r.Read(16) == 0xfff8);
+        const uint32_t size_code   = r.Read(4);
+        REQUIRE(r.Read(4) == 0);
+        const uint32_t assignment  = r.Read(4);
+        const uint32_t sample_code = r.Read(3);
+        REQUIRE(sample_code == (result.bits_per_sample == 16 ? 0b100u : 0b110u));
+        REQUIRE(r.Read(1) == 0);
+
+        uint32_t number = r.Read(8);
+        if (number >= 0x80)
+        {
+            const int extra = std::countl_one((uint8_t)number) - 1;
+            number &= 0x3f >> extra;
+            for (int i = 0; i < extra; ++i)
+            {
+                number = (number << 6) | (r.Read(8) & 0x3f);
+            }
+        }
+        REQUIRE(number == expected_number++);
+
+        size_t n = FLAC_BLOCK_SIZE;
+        if (size_code == 0b0111)
+        {
+            n = r.Read(16) + 1;
+        }
+        else
+        {
+            REQUIRE(size_code == 0b1100);
+        }
+        r.Read(8);
+
+        const uint32_t     bps        = result.bits_per_sample;
+        std::vector<int32_t> ch[2];
+        DecodeSubframe(r, bps + (assignment == 0b1001 ? 1 : 0), n, ch[0]);
+        DecodeSubframe(r, bps + (assignment == 0b1000 || assignment == 0b1010 ? 1 : 0), n, ch[1]);
+        r.Align();
+        const uint16_t crc = Crc16(bytes.data() + frame_start, r.bit / 8 - frame_start);
+        REQUIRE(r.Read(16) == crc);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            int32_t left  = ch[0][i];
+            int32_t right = ch[1][i];
+            switch (assignment)
+            {
+            case 0b1000:
+                right = left - right;
+                break;
+            case 0b1001:
+                left = right + left;
+                break;
+            case 0b1010: {
+                const int64_t mid = ((int64_t)left << 1) | (right & 1);
+                left              = (int32_t)((mid + right) >> 1);
+                right             = (int32_t)((mid - right) >> 1);
+                break;
+            }
+            default:
+                REQUIRE(assignment == 0b0001);
+            }
+            result.frames.push_back({left, right});
+        }
+    }
+
+    return result;
+}
+
+template <typename T>
+static std::vector<AudioFrame<T>> MakeTestSignal(size_t count)
+{
+    std::mt19937                       rng(55);
+    std::uniform_int_distribution<int> noise(-64, 64);
+
+    constexpr double scale = sizeof(T) == 2 ? 20000.0 : 1.5e9;
+
+    std::vector<AudioFrame<T>> frames(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Silence, then tones with a little noise, then full scale noise that doesn't compress at all
+        const double t = (double)i / 32000.0;
+        if (i < 5000)
+        {
+            continue;
+        }
+        else if (i < 20000)
+        {
+            frames[i].left  = (T)(scale * std::sin(2 * 3.14159 * 440 * t) + noise(rng));
+            frames[i].right = (T)(scale * 0.5 * std::sin(2 * 3.14159 * 660 * t) + noise(rng));
+        }
+        else
+        {
+            frames[i].left  = (T)std::uniform_int_distribution<int64_t>(-(int64_t)scale, (int64_t)scale)(rng);
+            frames[i].right = (T)std::uniform_int_distribution<int64_t>(-(int64_t)scale, (int64_t)scale)(rng);
+        }
+    }
+    return frames;
+}
+
+TEST_CASE("FLAC encoding is lossless for 16-bit samples")
+{
+    // Not a multiple of the block size, so the stream ends in a short block
+    const std::vector<AudioFrame<int16_t>> input = MakeTestSignal<int16_t>(3 * FLAC_BLOCK_SIZE * 2 + 123);
+
+    FLAC_Encoder         encoder(16);
+    std::vector<uint8_t> bytes(FLAC_HEADER_SIZE);
+    encoder.Encode(std::span(input).first(2 * FLAC_BLOCK_SIZE), bytes);
+    encoder.Encode(std::span(input).subspan(2 * FLAC_BLOCK_SIZE), bytes);
+    encoder.WriteHeader(32000, std::span(bytes).first<FLAC_HEADER_SIZE>());
+
+    const DecodedFlac decoded = DecodeFlac(bytes);
+    REQUIRE(decoded.sample_rate == 32000);
+    REQUIRE(decoded.bits_per_sample == 16);
+    REQUIRE(decoded.total_frames == input.size());
+    REQUIRE(decoded.frames.size() == input.size());
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        REQUIRE(decoded.frames[i].left == input[i].left);
+        REQUIRE(decoded.frames[i].right == input[i].right);
+    }
+
+    // Silence and tones make up most of the signal, so it has to come out well under the size of the samples
+    REQUIRE(bytes.size() < input.size() * sizeof(AudioFrame<int16_t>) * 3 / 4);
+}
+
+TEST_CASE("FLAC keeps the top 24 bits of 32-bit samples")
+{
+    const std::vector<AudioFrame<int32_t>> input = MakeTestSignal<int32_t>(5 * FLAC_BLOCK_SIZE + 1);
+
+    FLAC_Encoder         encoder(24);
+    std::vector<uint8_t> bytes(FLAC_HEADER_SIZE);
+    encoder.Encode(std::span(input), bytes);
+    encoder.WriteHeader(66207, std::span(bytes).first<FLAC_HEADER_SIZE>());
+
+    const DecodedFlac decoded = DecodeFlac(bytes);
+    REQUIRE(decoded.bits_per_sample == 24);
+    REQUIRE(decoded.frames.size() == input.size());
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        REQUIRE(decoded.frames[i].left == input[i].left >> 8);
+        REQUIRE(decoded.frames[i].right == input[i].right >> 8);
+    }
+}
+
+TEST_CASE("WAV_Handle writes FLAC for .flac filenames")
+{
+    REQUIRE(WAV_IsFLACPath("out.FLAC"));
+    REQUIRE_FALSE(WAV_IsFLACPath("out.wav"));
+
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "nuked_sc55_test_flac.flac";
+
+    // Large enough to go through the writer thread more than once
+    const std::vector<AudioFrame<int16_t>> input = MakeTestSignal<int16_t>(300'000);
+
+    WAV_Handle output;
+    REQUIRE(output.Open(path, AudioFormat::S16, {.writer_thread = true}));
+    output.SetSampleRate(32000);
+    output.Write(std::span(input));
+    REQUIRE(output.Finish());
+
+    std::ifstream        file(path, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::filesystem::remove(path);
+
+    const DecodedFlac decoded = DecodeFlac(bytes);
+    REQUIRE(decoded.total_frames == input.size());
+    REQUIRE(decoded.frames.size() == input.size());
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        REQUIRE(decoded.frames[i].left == input[i].left);
+        REQUIRE(decoded.frames[i].right == input[i].right);
+    }
+
+    WAV_Handle f32_output;
+    REQUIRE_FALSE(f32_output.Open(path, AudioFormat::F32));
+}
@@ -0,0 +1,123 @@
+#include <catch2/catch_test_macros.hpp>
+#include "emu.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+class CountingBackend : public LCD_Backend
+{
+public:
+    bool Start(const lcd_t&) override { return true; }
+    void Stop() override {}
+    void Render(std::span<const lcd_rect_t> rects) override
+    {
+        ++frames;
+        dirty.assign(rects.begin(), rects.end());
+    }
+
+    bool IsDirty(int row, int column) const
+    {
+        for (const lcd_rect_t& rect : dirty)
+        {
+            if (column >= rect.left && column < rect.left + rect.width && row >= rect.top && row < rect.top + rect.height)
+                return true;
+        }
+        return false;
+    }
+
+    int frames = 0;
+    std::vector<lcd_rect_t> dirty;
+};
+
+TEST_CASE("Headless emulators don't allocate an LCD framebuffer")
+{
+    auto image = std::make_shared<SharedRomImage>();
+    Emulator emu;
+    REQUIRE(emu.Init({}));
+    REQUIRE(emu.LoadRoms(image));
+    REQUIRE(emu.StartLCD());
+    REQUIRE(emu.GetLCD().buffer == nullptr);
+}
+
+TEST_CASE("Partial LCD redraws match a full redraw")
+{
+    const Romset romsets[] = {Romset::MK2, Romset::JV880};
+
+    std::mt19937 rng(880);
+
+    for (Romset romset : romsets)
+    {
+        auto image = std::make_shared<SharedRomImage>();
+        image->romset = romset;
+
+        CountingBackend backend;
+        EMU_Options options{};
+        options.lcd_backend = &backend;
+
+        Emulator emu;
+        REQUIRE(emu.Init(options));
+        REQUIRE(emu.LoadRoms(image));
+        REQUIRE(emu.StartLCD());
+
+        lcd_t& lcd = emu.GetLCD();
+        REQUIRE(lcd.buffer != nullptr);
+
+        // two line mode, like the firmware sets up
+        LCD_Write(lcd, 0, 0x38);
+        LCD_Enable(lcd, 1);
+
+        LCD_Render(lcd);
+        REQUIRE(backend.frames == 1);
+
+        // nothing was written, so there is nothing to present
+        LCD_Render(lcd);
+        REQUIRE(backend.frames == 1);
+
+        const size_t pixels = lcd.width * lcd.height;
+        std::vector<uint32_t> previous(pixels), partial(pixels);
+
+        for (int frame = 0; frame < 200; ++frame)
+        {
+            for (int write = (int)(rng() % 8); write > 0; --write)
+            {
+                switch (rng() % 8)
+                {
+                case 0:
+                    // set cg address
+                    LCD_Write(lcd, 0, (uint8_t)(0x40 | (rng() & 0x3f)));
+                    break;
+                case 1:
+                    // display control, toggles the cursor
+                    LCD_Write(lcd, 0, (uint8_t)(0x08 | (rng() & 7)));
+                    break;
+                case 2:
+                    if (rng() % 16 == 0)
+                        LCD_Enable(lcd, rng() & 1);
+                    break;
+                default:
+                    if (rng() & 1)
+                        LCD_Write(lcd, 0, (uint8_t)(0x80 | (rng() & 0x7f)));
+                    LCD_Write(lcd, 1, (uint8_t)rng());
+                    break;
+                }
+            }
+
+            memcpy(previous.data(), lcd.buffer.get(), pixels * sizeof(uint32_t));
+            backend.dirty.clear();
+            LCD_Render(lcd);
+            memcpy(partial.data(), lcd.buffer.get(), pixels * sizeof(uint32_t));
+
+            // the backend has to be told about every pixel that changed
+            for (size_t i = 0; i < pixels; ++i)
+            {
+                if (previous[i] != partial[i] && !backend.IsDirty((int)(i / lcd.width), (int)(i % lcd.width)))
+                    FAIL("pixel " << i << " changed outside of the dirty rects");
+            }
+
+            lcd.rendered = false;
+            LCD_Render(lcd);
+
+            REQUIRE(memcmp(partial.data(), lcd.buffer.get(), pixels * sizeof(uint32_t)) == 0);
+        }
+    }
+}
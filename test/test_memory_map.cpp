@@ -0,0 +1,84 @@
+#include <catch2/catch_test_macros.hpp>
+#include "emu.h"
+
+// Fills every memory region the map can point at with distinct contents so that a wrong mapping shows up as a
+// mismatch.
+static void FillRoms(SharedRomImage& image)
+{
+    for (size_t i = 0; i < ROM1_SIZE; ++i)
+        image.rom1[i] = (uint8_t)(i * 7 + 1);
+    for (size_t i = 0; i < ROM2_SIZE; ++i)
+        image.rom2[i] = (uint8_t)((i >> 8) ^ i ^ 0x5a);
+}
+
+static void FillMemory(mcu_t& mcu)
+{
+    for (size_t i = 0; i < SRAM_SIZE; ++i)
+        mcu.sram[i] = (uint8_t)(i * 3 + 2);
+    for (size_t i = 0; mcu.nvram && i < NVRAM_SIZE; ++i)
+        mcu.nvram[i] = (uint8_t)(i * 5 + 3);
+    for (size_t i = 0; mcu.cardram && i < CARDRAM_SIZE; ++i)
+        mcu.cardram[i] = (uint8_t)(i * 11 + 4);
+}
+
+TEST_CASE("Memory map agrees with the unmapped path")
+{
+    const int rom2_masks[] = {ROM2_SIZE - 1, 0x3ffff, 0xffff};
+
+    auto image = std::make_shared<SharedRomImage>();
+    FillRoms(*image);
+
+    for (size_t romset_index = 0; romset_index < ROMSET_COUNT; ++romset_index)
+    {
+        for (int rom2_mask : rom2_masks)
+        {
+            auto emu = std::make_unique<Emulator>();
+            REQUIRE(emu->Init({}));
+
+            // Never shared, so it's fine to change it between iterations
+            image->romset = (Romset)romset_index;
+            image->rom2_mask = rom2_mask;
+            REQUIRE(emu->LoadRoms(image));
+
+            mcu_t& mcu = emu->GetMCU();
+            FillMemory(mcu);
+
+            for (uint32_t address = 0; address < 0x100000; ++address)
+            {
+                if (mcu.read_map[address >> MCU_MAP_BLOCK_BITS])
+                {
+                    REQUIRE(MCU_Read(mcu, address) == MCU_ReadUnmapped(mcu, address));
+                }
+
+                if (mcu.write_map[address >> MCU_MAP_BLOCK_BITS])
+                {
+                    const uint8_t value = (uint8_t)~MCU_ReadUnmapped(mcu, address);
+                    MCU_Write(mcu, address, value);
+                    REQUIRE(MCU_ReadUnmapped(mcu, address) == value);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Only the JV-880 allocates nvram and card ram")
+{
+    auto image = std::make_shared<SharedRomImage>();
+
+    auto emu = std::make_unique<Emulator>();
+    REQUIRE(emu->Init({}));
+
+    image->romset = Romset::MK2;
+    REQUIRE(emu->LoadRoms(image));
+    REQUIRE_FALSE(emu->GetMCU().nvram);
+    REQUIRE_FALSE(emu->GetMCU().cardram);
+    const size_t mk2_usage = emu->GetMemoryUsage();
+
+    // Loading a different romset into the same emulator allocates what it needs
+    auto jv880_image    = std::make_shared<SharedRomImage>();
+    jv880_image->romset = Romset::JV880;
+    REQUIRE(emu->LoadRoms(jv880_image));
+    REQUIRE(emu->GetMCU().nvram);
+    REQUIRE(emu->GetMCU().cardram);
+    REQUIRE(emu->GetMemoryUsage() == mk2_usage + NVRAM_SIZE + CARDRAM_SIZE);
+}
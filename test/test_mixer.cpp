@@ -0,0 +1,56 @@
+#include <catch2/catch_test_macros.hpp>
+#include "render_engine.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Mixer queues hold back producers at the maximum depth")
+{
+    constexpr size_t DEPTH  = 2;
+    constexpr size_t CHUNKS = 8;
+
+    R_Mixer mixer;
+    mixer.SetQueueCount<int16_t>(1);
+    mixer.SetMaxQueueDepth(DEPTH);
+
+    const size_t                     chunk_size = mixer.GetChunkSize();
+    std::vector<AudioFrame<int16_t>> chunk(chunk_size);
+    std::atomic<size_t>              chunks_submitted = 0;
+
+    std::thread producer([&] {
+        for (size_t i = 0; i < CHUNKS; ++i)
+        {
+            chunk[0].left = (int16_t)i;
+            mixer.SubmitFrames<int16_t>(0, chunk);
+            ++chunks_submitted;
+        }
+        mixer.MarkComplete(0);
+    });
+
+    // Nothing is mixed yet, so the producer has to stop once its queue is full
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(chunks_submitted <= DEPTH);
+
+    std::vector<AudioFrame<int16_t>> output;
+    size_t                           frames_mixed = 0;
+    int16_t                          expected     = 0;
+    while (!mixer.IsFinished())
+    {
+        mixer.WaitForWork();
+        const size_t frames = mixer.MixFrames(output);
+        if (frames != 0)
+        {
+            REQUIRE(output[0].left == expected);
+            ++expected;
+        }
+        frames_mixed += frames;
+    }
+    producer.join();
+
+    REQUIRE(chunks_submitted == CHUNKS);
+    REQUIRE(frames_mixed == CHUNKS * chunk_size);
+
+    // The last chunk goes in with the queue's completion, which doesn't wait for space
+    REQUIRE(mixer.GetMaxQueueDepthReached(0) >= DEPTH);
+    REQUIRE(mixer.GetMaxQueueDepthReached(0) <= DEPTH + 1);
+}
@@ -0,0 +1,154 @@
+#include <catch2/catch_test_macros.hpp>
+#include "mcu.h"
+#include "pcm.h"
+#include "pcm_voice.h"
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Fills the inputs of `batch` with values in the ranges PCM_Update produces, except for the filter state which can
+// be anything on the non-MK1 path.
+static void FillBatch(pcm_voice_batch_t& batch, std::mt19937& rng)
+{
+    auto int8 = [&] { return (int32_t)(int8_t)rng(); };
+
+    for (int i = 0; i < PCM_VOICE_BATCH_SIZE; ++i)
+    {
+        batch.test[i] = (int32_t)rng();
+        for (int k = 0; k < 3; ++k)
+        {
+            batch.samp[k][i] = int8();
+            batch.coef[k][i] = (int32_t)(rng() % 4096) << 6;
+            batch.shift[k][i] = (int32_t)(rng() & 15);
+        }
+        batch.reg1[i] = (int32_t)rng();
+        batch.reg3[i] = (int32_t)rng();
+        batch.filter_hi[i] = int8();
+        batch.filter_lo[i] = (int32_t)(rng() & 127);
+        batch.resonance[i] = (int32_t)(rng() & 127);
+        batch.use_v3[i] = (int32_t)(rng() & 2);
+        batch.vol1_hi[i] = int8();
+        batch.vol1_lo[i] = (int32_t)(rng() & 127);
+        batch.vol2_hi[i] = int8();
+        batch.vol2_lo[i] = (int32_t)(rng() & 127);
+        batch.pan_l[i] = int8();
+        batch.pan_r[i] = int8();
+        batch.reverb[i] = int8();
+        batch.chorus[i] = int8();
+        batch.clear[i] = (int32_t)(rng() & 1);
+    }
+}
+
+TEST_CASE("Voice kernels agree with the scalar kernel")
+{
+    const pcm_voice_kernel scalar = PCM_GetVoiceKernel(PCM_VoiceKernel::Scalar);
+    REQUIRE(scalar);
+    REQUIRE(PCM_GetVoiceKernel(PCM_DetectVoiceKernel()));
+
+    const PCM_VoiceKernel kernels[] = {PCM_VoiceKernel::AVX2, PCM_VoiceKernel::NEON};
+
+    std::mt19937 rng(55);
+
+    for (PCM_VoiceKernel kernel : kernels)
+    {
+        const pcm_voice_kernel vector = PCM_GetVoiceKernel(kernel);
+        if (!vector)
+            continue;
+
+        INFO(PCM_VoiceKernelName(kernel));
+
+        for (int iteration = 0; iteration < 2000; ++iteration)
+        {
+            auto expected = std::make_unique<pcm_voice_batch_t>();
+            FillBatch(*expected, rng);
+            auto actual = std::make_unique<pcm_voice_batch_t>(*expected);
+
+            // Partial ranges exercise the scalar tail
+            const int begin = (int)(rng() % 4);
+            const int end = begin + (int)(rng() % (PCM_VOICE_BATCH_SIZE - begin + 1));
+            const bool mk1 = (iteration & 1) != 0;
+
+            scalar(*expected, begin, end, mk1);
+            vector(*actual, begin, end, mk1);
+
+            REQUIRE(memcmp(expected.get(), actual.get(), sizeof(pcm_voice_batch_t)) == 0);
+        }
+    }
+}
+
+static void RecordFrame(void* userdata, const AudioFrame<int32_t>& frame)
+{
+    ((std::vector<AudioFrame<int32_t>>*)userdata)->push_back(frame);
+}
+
+// A pcm_t running on its own with random voice state, recording the frames it produces.
+struct PCMHarness
+{
+    std::unique_ptr<mcu_t>           mcu = std::make_unique<mcu_t>();
+    std::unique_ptr<pcm_t>           pcm = std::make_unique<pcm_t>();
+    std::vector<AudioFrame<int32_t>> frames;
+
+    PCMHarness(const std::vector<uint8_t>& waverom, uint32_t seed)
+    {
+        mcu->family            = RomsetFamily::MK2;
+        mcu->sample_callback   = RecordFrame;
+        mcu->callback_userdata = &frames;
+
+        pcm->mcu      = mcu.get();
+        pcm->waverom1 = waverom.data();
+        pcm->waverom2 = waverom.data();
+        pcm->waverom3 = waverom.data();
+        PCM_UpdateWaveBanks(*pcm, RomsetFamily::MK2);
+        PCM_GetConfig(pcm->config, 0xb1);
+        pcm->config.reg_slots = 32;
+
+        std::mt19937 rng(seed);
+        for (auto& slot : pcm->ram1)
+        {
+            for (uint32_t& reg : slot)
+                reg = rng() & 0xfffff;
+        }
+        for (auto& slot : pcm->ram2)
+        {
+            for (uint16_t& reg : slot)
+                reg = (uint16_t)rng();
+        }
+        pcm->nfs = 1;
+    }
+};
+
+TEST_CASE("Idle voices skipping the voice arithmetic match the full path")
+{
+    std::mt19937         rng(8);
+    std::vector<uint8_t> waverom(PCM_WAVEROM1_SIZE);
+    for (uint8_t& byte : waverom)
+        byte = (uint8_t)rng();
+
+    // Slot 31 holds the running mix, so leaving it unkeyed catches the short path discarding it
+    const uint32_t voice_masks[] = {0x55aa55aa, 0x0000ffff, 0x00000000, 0x7fffffff, 0xffff0000};
+
+    for (uint32_t voice_mask : voice_masks)
+    {
+        INFO("voice_mask = " << voice_mask);
+
+        PCMHarness full(waverom, voice_mask);
+        PCMHarness skip(waverom, voice_mask);
+        for (PCMHarness* h : {&full, &skip})
+        {
+            h->pcm->voice_mask         = voice_mask;
+            h->pcm->voice_mask_pending = voice_mask;
+        }
+        full.pcm->skip_idle_voices = false;
+
+        const uint64_t cycles = 500 * 33 * 25;
+        PCM_Update<RomsetFamily::MK2>(*full.pcm, cycles);
+        PCM_Update<RomsetFamily::MK2>(*skip.pcm, cycles);
+
+        REQUIRE(full.frames.size() == skip.frames.size());
+        REQUIRE(memcmp(full.frames.data(), skip.frames.data(), full.frames.size() * sizeof(AudioFrame<int32_t>)) == 0);
+        REQUIRE(memcmp(full.pcm->ram1, skip.pcm->ram1, sizeof(full.pcm->ram1)) == 0);
+        REQUIRE(memcmp(full.pcm->ram2, skip.pcm->ram2, sizeof(full.pcm->ram2)) == 0);
+        REQUIRE(memcmp(full.pcm->eram, skip.pcm->eram, sizeof(full.pcm->eram)) == 0);
+    }
+}
@@ -0,0 +1,93 @@
+#include <catch2/catch_test_macros.hpp>
+#include "resampler.h"
+#include <cmath>
+#include <numbers>
+#include <vector>
+
+template <typename T>
+static std::vector<AudioFrame<T>> ResampleAll(AudioResampler& resampler, const std::vector<AudioFrame<T>>& in)
+{
+    std::vector<AudioFrame<T>> out;
+
+    // Uneven blocks, so that output frames get split across calls
+    std::span<const AudioFrame<T>> rest(in);
+    size_t                         block = 1;
+    while (!rest.empty())
+    {
+        const size_t count = Min(block, rest.size());
+        const auto   part  = resampler.Process(rest.subspan(0, count));
+        out.insert(out.end(), part.begin(), part.end());
+        rest  = rest.subspan(count);
+        block = block * 3 + 1;
+    }
+
+    const auto tail = resampler.Flush<T>();
+    out.insert(out.end(), tail.begin(), tail.end());
+    return out;
+}
+
+TEST_CASE("Resampling keeps the duration")
+{
+    const std::vector<AudioFrame<int16_t>> in(66207);
+
+    for (uint32_t out_rate : {44100u, 48000u, 96000u})
+    {
+        AudioResampler resampler;
+        REQUIRE(resampler.Init(66207, out_rate));
+        REQUIRE(ResampleAll(resampler, in).size() == out_rate);
+        // Flush readies the resampler for another stream of the same length
+        REQUIRE(ResampleAll(resampler, in).size() == out_rate);
+    }
+
+    AudioResampler resampler;
+    REQUIRE(!resampler.Init(0, 48000));
+    REQUIRE(!resampler.Init(66207, 1000000));
+}
+
+TEST_CASE("Equal rates pass audio through")
+{
+    AudioResampler resampler;
+    REQUIRE(resampler.Init(64000, 64000));
+
+    const AudioFrame<int32_t> frames[] = {{1, 2}, {3, 4}};
+    const auto                out      = resampler.Process(std::span<const AudioFrame<int32_t>>(frames));
+    REQUIRE(out.data() == frames);
+    REQUIRE(out.size() == 2);
+    REQUIRE(resampler.Flush<int32_t>().empty());
+}
+
+TEST_CASE("Resampling keeps the passband and removes what doesn't fit")
+{
+    constexpr uint32_t in_rate  = 66207;
+    constexpr uint32_t out_rate = 44100;
+
+    const auto rms_of_tone = [](double frequency) {
+        std::vector<AudioFrame<float>> in(in_rate / 4);
+        for (size_t i = 0; i < in.size(); ++i)
+        {
+            in[i].left  = (float)std::sin(2.0 * std::numbers::pi * frequency * (double)i / in_rate);
+            in[i].right = -in[i].left;
+        }
+
+        AudioResampler resampler;
+        REQUIRE(resampler.Init(in_rate, out_rate));
+        const std::vector<AudioFrame<float>> out = ResampleAll(resampler, in);
+
+        // Skip the edges, where the filter reaches past the tone
+        double sum = 0;
+        size_t n   = 0;
+        for (size_t i = 1000; i + 1000 < out.size(); ++i)
+        {
+            sum += (double)out[i].left * (double)out[i].left;
+            REQUIRE(out[i].right == -out[i].left);
+            ++n;
+        }
+        return std::sqrt(sum / (double)n);
+    };
+
+    // A full scale sine has an rms of 1/sqrt(2), give or take the partial period at the end
+    REQUIRE(std::abs(rms_of_tone(1000.0) - std::numbers::sqrt2 / 2) < 1e-3);
+    REQUIRE(std::abs(rms_of_tone(18000.0) - std::numbers::sqrt2 / 2) < 1e-3);
+    // Above the output's nyquist frequency
+    REQUIRE(rms_of_tone(30000.0) < 1e-4);
+}
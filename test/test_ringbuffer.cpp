@@ -50,3 +50,64 @@ TEST_CASE("RingbufferView")
 
     storage.Free();
 }
+
+TEST_CASE("RingbufferView bulk operations wrap around")
+{
+    GenericBuffer storage;
+    REQUIRE(storage.Init(8 * sizeof(uint16_t)));
+    RingbufferView ringbuffer(storage);
+
+    // Moves the heads to the middle of the buffer so the next write wraps
+    const uint16_t filler[5] = {};
+    uint16_t       out[8]    = {};
+    REQUIRE(ringbuffer.Write<uint16_t>(filler) == 5);
+    REQUIRE(ringbuffer.Read<uint16_t>(std::span(out, 5)) == 5);
+
+    const uint16_t values[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    REQUIRE(ringbuffer.Write<uint16_t>(values) == 8);
+    REQUIRE(ringbuffer.GetWritableElements<uint16_t>() == 0);
+    REQUIRE(ringbuffer.Write<uint16_t>(values) == 0);
+
+    REQUIRE(ringbuffer.Read<uint16_t>(std::span(out, 3)) == 3);
+    REQUIRE(out[0] == 1);
+    REQUIRE(out[2] == 3);
+    REQUIRE(ringbuffer.Read<uint16_t>(out) == 5);
+    REQUIRE(out[0] == 4);
+    REQUIRE(out[4] == 8);
+    REQUIRE(ringbuffer.GetReadableBytes() == 0);
+}
+
+TEST_CASE("Mirrored buffers hand out spans across the end")
+{
+    // Nothing to test where the OS can't mirror memory
+    if (!GenericBuffer::IsMirroringSupported())
+    {
+        return;
+    }
+
+    GenericBuffer storage;
+    REQUIRE(storage.InitMirrored(4096));
+    REQUIRE(storage.IsMirrored());
+
+    const size_t   capacity = storage.GetByteLength() / sizeof(uint32_t);
+    RingbufferView ringbuffer(storage);
+    REQUIRE(ringbuffer.IsMirrored());
+
+    // A count that doesn't divide the buffer eventually straddles the end
+    constexpr size_t CHUNK = 3;
+    uint32_t         next  = 0;
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        std::span<uint32_t> write = ringbuffer.UncheckedPrepareWrite<uint32_t>(CHUNK);
+        for (uint32_t& value : write)
+        {
+            value = next++;
+        }
+        ringbuffer.UncheckedFinishWrite<uint32_t>(CHUNK);
+
+        std::span<uint32_t> read = ringbuffer.UncheckedPrepareRead<uint32_t>(CHUNK);
+        REQUIRE(read[0] == next - 3);
+        REQUIRE(read[2] == next - 1);
+        ringbuffer.UncheckedFinishRead<uint32_t>(CHUNK);
+    }
+}
@@ -0,0 +1,159 @@
+#include <catch2/catch_test_macros.hpp>
+#include "emu.h"
+#include "rom_bundle.h"
+#include "rom_io.h"
+#include <fstream>
+#include <string>
+
+extern "C"
+{
+#include "sha/sha.h"
+}
+
+static void WriteFile(const std::filesystem::path& path, size_t size, uint8_t value)
+{
+    std::ofstream out(path, std::ios::binary);
+    const std::string bytes(size, (char)value);
+    out.write(bytes.data(), (std::streamsize)bytes.size());
+}
+
+static std::vector<std::string> ReadLines(const std::filesystem::path& path)
+{
+    std::vector<std::string> lines;
+    std::ifstream            in(path);
+    std::string              line;
+    while (std::getline(in, line))
+    {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static std::string HexDigest(size_t size, uint8_t value)
+{
+    const std::string bytes(size, (char)value);
+
+    uint8_t       digest[SHA256HashSize];
+    SHA256Context ctx;
+    SHA256Reset(&ctx);
+    SHA256Input(&ctx, (const uint8_t*)bytes.data(), (unsigned int)bytes.size());
+    SHA256Result(&ctx, digest);
+
+    std::string hex;
+    for (uint8_t byte : digest)
+    {
+        constexpr const char* digits = "0123456789abcdef";
+        hex += digits[byte >> 4];
+        hex += digits[byte & 0xf];
+    }
+    return hex;
+}
+
+TEST_CASE("Rom hash cache")
+{
+    const std::filesystem::path dir   = std::filesystem::temp_directory_path() / "nuked-sc55-test-rom-io";
+    const std::filesystem::path cache = std::filesystem::temp_directory_path() / "nuked-sc55-test-rom-cache.txt";
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove(cache);
+    std::filesystem::create_directories(dir);
+
+    const std::filesystem::path rom = dir / "rom.bin";
+    WriteFile(rom, 4096, 0x5a);
+    // Not the size of any rom, so it's never read
+    WriteFile(dir / "notes.txt", 1000, 0x20);
+
+    const std::string rom_path = std::filesystem::canonical(rom).generic_string();
+    const std::string digest   = HexDigest(4096, 0x5a);
+
+    AllRomsetInfo info;
+    REQUIRE(DetectRomsetsByHash(dir, info, nullptr, cache));
+
+    std::vector<std::string> lines = ReadLines(cache);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0].starts_with(digest + " 4096 "));
+    REQUIRE(lines[0].ends_with(" " + rom_path));
+
+    // A cached digest is trusted as long as the size and modification time match, so a wrong one sticks
+    const std::string wrong_digest(digest.size(), '0');
+    {
+        std::ofstream out(cache);
+        out << wrong_digest << lines[0].substr(digest.size()) << "\n";
+    }
+    REQUIRE(DetectRomsetsByHash(dir, info, nullptr, cache));
+    lines = ReadLines(cache);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0].starts_with(wrong_digest));
+
+    // Touching the file makes the entry stale
+    std::filesystem::last_write_time(rom, std::filesystem::last_write_time(rom) + std::chrono::hours(1));
+    REQUIRE(DetectRomsetsByHash(dir, info, nullptr, cache));
+    lines = ReadLines(cache);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0].starts_with(digest + " 4096 "));
+
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove(cache);
+}
+
+TEST_CASE("Program roms are mapped")
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "nuked-sc55-test-rom-map";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    WriteFile(dir / "rom1.bin", ROM1_SIZE, 0x11);
+    // Smaller than ROM2_SIZE, which is fine because reads are masked
+    WriteFile(dir / "rom2.bin", 0x40000, 0x22);
+    // Too small for the emulator to read directly, so it's copied into the image
+    WriteFile(dir / "smrom.bin", ROMSM_SIZE / 2, 0x33);
+
+    AllRomsetInfo all_info;
+    RomsetInfo&   info = all_info.romsets[(size_t)Romset::MK2];
+
+    info.rom_paths[(size_t)RomLocation::ROM1]  = dir / "rom1.bin";
+    info.rom_paths[(size_t)RomLocation::ROM2]  = dir / "rom2.bin";
+    info.rom_paths[(size_t)RomLocation::SMROM] = dir / "smrom.bin";
+
+    RomLoadStatusSet loaded;
+    REQUIRE(LoadRomset(Romset::MK2, all_info, &loaded));
+    REQUIRE(loaded[(size_t)RomLocation::ROM1] == RomLoadStatus::Loaded);
+    REQUIRE(info.rom_data[(size_t)RomLocation::ROM1].empty());
+    REQUIRE(info.rom_maps[(size_t)RomLocation::ROM1].file);
+    REQUIRE(info.GetRomData(RomLocation::ROM2).size() == 0x40000);
+
+    std::shared_ptr<SharedRomImage> image = EMU_CreateRomImage(Romset::MK2, all_info);
+    REQUIRE(image);
+    REQUIRE(EMU_GetRomData(*image, RomLocation::ROM1).data() == info.GetRomData(RomLocation::ROM1).data());
+    REQUIRE(EMU_GetRomData(*image, RomLocation::ROM2).data() == info.GetRomData(RomLocation::ROM2).data());
+    REQUIRE(image->rom2_mask == 0x3ffff);
+    REQUIRE(EMU_GetRomData(*image, RomLocation::SMROM).data() == image->smrom);
+    REQUIRE(image->smrom[0] == 0x33);
+    REQUIRE(image->smrom[ROMSM_SIZE - 1] == 0);
+
+    // The image keeps the mapping alive on its own
+    all_info.PurgeRomData();
+    REQUIRE(EMU_GetRomData(*image, RomLocation::ROM1)[ROM1_SIZE - 1] == 0x11);
+
+    image.reset();
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Invalid rom bundles are rejected")
+{
+    const std::filesystem::path bundle = std::filesystem::temp_directory_path() / "nuked-sc55-test-rom-bundle";
+
+    AllRomsetInfo info;
+    Romset        romset;
+
+    // Too short to hold a header
+    WriteFile(bundle, 16, 0);
+    REQUIRE(!LoadRomBundle(bundle, info, romset));
+
+    // Large enough, but no magic
+    WriteFile(bundle, 0x10000, 0);
+    REQUIRE(!LoadRomBundle(bundle, info, romset));
+
+    REQUIRE(!LoadRomBundle(bundle.string() + ".missing", info, romset));
+
+    std::filesystem::remove(bundle);
+}
@@ -0,0 +1,112 @@
+#include <catch2/catch_test_macros.hpp>
+#include "emu.h"
+#include "mcu_timer.h"
+#include "submcu.h"
+#include "test_util.h"
+#include <algorithm>
+
+static void WriteDevice(mcu_t& mcu, uint8_t reg, uint8_t value)
+{
+    MCU_Write(mcu, 0xff80 + reg, value);
+}
+
+// Sets up a program that sleeps in a loop and is woken by a free running timer compare match. The interrupt handler
+// acknowledges the match and returns.
+static void SetupSleepProgram(Emulator& emu, Romset romset)
+{
+    auto image = std::make_shared<SharedRomImage>();
+    image->romset = romset;
+
+    // main: sleep; bra main
+    const uint8_t main[] = {0x1a, 0x20, 0xfd};
+    // handler: tst.b @0xff91; mov:g.b #0x01, @0xff91; rte
+    const uint8_t handler[] = {0x15, 0xff, 0x91, 0x16, 0x15, 0xff, 0x91, 0x06, 0x01, 0x0a};
+    std::copy(std::begin(main), std::end(main), image->rom1 + 0x1000);
+    std::copy(std::begin(handler), std::end(handler), image->rom1 + 0x2000);
+    const uint32_t vector = VECTOR_INTERNAL_INTERRUPT_94 * 4;
+    image->rom1[vector + 2] = 0x20;
+    image->rom1[vector + 3] = 0x00;
+
+    // Park the sub mcu: every vector points into rom, which is filled with STP
+    std::fill(std::begin(image->smrom), std::end(image->smrom), 0x42);
+    for (size_t i = 0xfec; i < 0x1000; i += 2)
+        image->smrom[i + 1] = 0x10;
+
+    REQUIRE(emu.LoadRoms(image));
+
+    mcu_t& mcu = emu.GetMCU();
+    emu.Reset();
+    mcu.cp = 0;
+    mcu.pc = 0x1000;
+    mcu.sr = 0;
+    mcu.r[7] = 0xd000;
+
+    WriteDevice(mcu, DEV_IPRB, 0x10);
+    WriteDevice(mcu, DEV_FRT1_OCRAH, 0x04);
+    WriteDevice(mcu, DEV_FRT1_OCRAL, 0x00);
+    WriteDevice(mcu, DEV_FRT1_TCSR, 0x01);
+    WriteDevice(mcu, DEV_FRT1_TCR, 0x20);
+}
+
+static void RequireSameState(Emulator& a, Emulator& b, const SampleHash& ha, const SampleHash& hb)
+{
+    const mcu_t& ma = a.GetMCU();
+    const mcu_t& mb = b.GetMCU();
+
+    REQUIRE(ma.cycles == mb.cycles);
+    REQUIRE(ma.pc == mb.pc);
+    REQUIRE(ma.sr == mb.sr);
+    REQUIRE(ma.sleep == mb.sleep);
+    REQUIRE(ma.interrupt_raise_count == mb.interrupt_raise_count);
+    REQUIRE(ma.frames_posted == mb.frames_posted);
+    REQUIRE(ma.timer->cycles == mb.timer->cycles);
+    REQUIRE(ma.timer->frt[0].frc == mb.timer->frt[0].frc);
+    REQUIRE(ma.timer->frt[0].tcsr == mb.timer->frt[0].tcsr);
+    REQUIRE(ha.count == hb.count);
+    REQUIRE(ha.hash == hb.hash);
+}
+
+TEST_CASE("Sleep fast-forward matches single stepping")
+{
+    const Romset romsets[] = {Romset::MK2, Romset::MK1, Romset::JV880, Romset::SCB55};
+
+    for (Romset romset : romsets)
+    {
+        auto stepped = std::make_unique<Emulator>();
+        auto batched = std::make_unique<Emulator>();
+        REQUIRE(stepped->Init({}));
+        REQUIRE(batched->Init({}));
+
+        SampleHash stepped_hash, batched_hash;
+        stepped->SetSampleCallback(HashSample, &stepped_hash);
+        batched->SetSampleCallback(HashSample, &batched_hash);
+
+        SetupSleepProgram(*stepped, romset);
+        SetupSleepProgram(*batched, romset);
+
+        const uint32_t wakes_before = stepped->GetMCU().interrupt_raise_count;
+
+        // Uneven chunks so that the targets land both inside and outside of sleeping periods
+        for (uint64_t chunk = 1; chunk < 400; chunk += 37)
+        {
+            const uint64_t target = stepped->GetMCU().cycles + chunk * 1001;
+
+            while (stepped->GetMCU().cycles < target)
+                stepped->Step();
+            batched->StepUntilCycles(target);
+
+            RequireSameState(*stepped, *batched, stepped_hash, batched_hash);
+
+            const uint64_t target_frames = stepped->GetMCU().frames_posted + chunk;
+
+            while (stepped->GetMCU().frames_posted < target_frames)
+                stepped->Step();
+            batched->StepUntilFrames(chunk);
+
+            RequireSameState(*stepped, *batched, stepped_hash, batched_hash);
+        }
+
+        // Make sure the program actually slept and woke up
+        REQUIRE(stepped->GetMCU().interrupt_raise_count - wakes_before > 10);
+    }
+}
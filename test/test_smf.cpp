@@ -0,0 +1,78 @@
+#include <catch2/catch_test_macros.hpp>
+#include "render.h"
+#include "smf.h"
+#include <vector>
+
+// One track with a single note, 96 ticks per quarter note.
+static std::vector<uint8_t> MakeSMF()
+{
+    return {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 12,
+        0x00, 0x90, 0x3c, 0x64,
+        0x60, 0x80, 0x3c, 0x00,
+        0x00, 0xff, 0x2f, 0x00,
+    };
+}
+
+class NullSink : public R_AudioSink
+{
+public:
+    bool Start(uint32_t) override
+    {
+        return true;
+    }
+
+    bool Write(std::span<const uint8_t>) override
+    {
+        return true;
+    }
+
+    bool Finish() override
+    {
+        return true;
+    }
+};
+
+TEST_CASE("SMF parsing from memory")
+{
+    const std::vector<uint8_t> bytes = MakeSMF();
+
+    SMF_Data data;
+    REQUIRE(SMF_ParseEvents(bytes, data));
+    REQUIRE(data.header.division == 96);
+    REQUIRE(data.tracks.size() == 1);
+    REQUIRE(data.tracks[0].events.size() == 3);
+    REQUIRE(data.tracks[0].events[0].IsNoteOn(data.bytes));
+    REQUIRE(data.tracks[0].events[1].IsNoteOff(data.bytes));
+    REQUIRE(data.tracks[0].events[1].timestamp == 96);
+}
+
+TEST_CASE("Malformed SMF data is rejected")
+{
+    SMF_Data empty;
+    REQUIRE(!SMF_ParseEvents({}, empty));
+
+    std::vector<uint8_t> bad_magic = MakeSMF();
+    bad_magic[0]                   = 'X';
+    SMF_Data bad_magic_data;
+    REQUIRE(!SMF_ParseEvents(bad_magic, bad_magic_data));
+
+    // Cut off in the middle of the track
+    std::vector<uint8_t> truncated = MakeSMF();
+    truncated.resize(truncated.size() - 6);
+    SMF_Data truncated_data;
+    REQUIRE(!SMF_ParseEvents(truncated, truncated_data));
+}
+
+TEST_CASE("Render options are validated")
+{
+    const std::vector<uint8_t> bytes = MakeSMF();
+    NullSink                   sink;
+
+    R_RenderOptions options;
+    REQUIRE(R_RenderSMF(nullptr, bytes, options, sink) == R_RenderError::InvalidOptions);
+
+    options.instances = 0;
+    REQUIRE(R_RenderSMF(nullptr, bytes, options, sink) == R_RenderError::InvalidOptions);
+}
@@ -0,0 +1,171 @@
+#include <catch2/catch_test_macros.hpp>
+#include "emu.h"
+#include "test_util.h"
+#include <algorithm>
+
+static std::unique_ptr<Emulator> CreateEmulator(const std::shared_ptr<const SharedRomImage>& image)
+{
+    auto emu = std::make_unique<Emulator>();
+    REQUIRE(emu->Init({}));
+    REQUIRE(emu->LoadRoms(image));
+    emu->Reset();
+    return emu;
+}
+
+// A rom image with an idle loop for the main mcu and a parked sub mcu.
+static std::shared_ptr<SharedRomImage> CreateIdleImage(Romset romset)
+{
+    auto image = std::make_shared<SharedRomImage>();
+    image->romset = romset;
+    // reset vector points at 0x1000: bra 0x1000
+    image->rom1[1] = 0x10;
+    image->rom1[0x1000] = 0x20;
+    image->rom1[0x1001] = 0xfe;
+    // sub mcu: every vector points into rom, which is filled with STP
+    std::fill(std::begin(image->smrom), std::end(image->smrom), 0x42);
+    for (size_t i = 0xfec; i < 0x1000; i += 2)
+        image->smrom[i + 1] = 0x10;
+    return image;
+}
+
+TEST_CASE("Loading a saved state resumes emulation exactly")
+{
+    const Romset romsets[] = {Romset::MK2, Romset::MK1, Romset::JV880, Romset::SCB55};
+
+    for (Romset romset : romsets)
+    {
+        auto image = CreateIdleImage(romset);
+
+        auto original = CreateEmulator(image);
+        const uint8_t note_on[] = {0x90, 0x40, 0x7f};
+        original->PostMIDI(note_on);
+        original->StepCycles(100'000);
+
+        std::vector<uint8_t> state;
+        REQUIRE(original->SaveState(state));
+
+        auto restored = CreateEmulator(image);
+        REQUIRE(restored->LoadState(state));
+
+        SampleHash original_hash, restored_hash;
+        original->SetSampleCallback(HashSample, &original_hash);
+        restored->SetSampleCallback(HashSample, &restored_hash);
+
+        original->StepCycles(100'000);
+        restored->StepCycles(100'000);
+
+        REQUIRE(original_hash.count == restored_hash.count);
+        REQUIRE(original_hash.hash == restored_hash.hash);
+
+        std::vector<uint8_t> original_state, restored_state;
+        REQUIRE(original->SaveState(original_state));
+        REQUIRE(restored->SaveState(restored_state));
+        REQUIRE(original_state == restored_state);
+    }
+}
+
+TEST_CASE("Cloned emulators run identically to the original")
+{
+    auto image = CreateIdleImage(Romset::JV880);
+
+    auto original = CreateEmulator(image);
+    original->StepCycles(100'000);
+
+    // Starts out with a different romset so the clone has to switch over
+    auto clone = CreateEmulator(CreateIdleImage(Romset::MK2));
+    REQUIRE(clone->CloneFrom(*original));
+    REQUIRE(clone->GetMCU().romset == Romset::JV880);
+    REQUIRE(clone->GetMCU().rom1 == original->GetMCU().rom1);
+
+    SampleHash original_hash, clone_hash;
+    original->SetSampleCallback(HashSample, &original_hash);
+    clone->SetSampleCallback(HashSample, &clone_hash);
+
+    original->StepCycles(100'000);
+    clone->StepCycles(100'000);
+
+    REQUIRE(original_hash.count == clone_hash.count);
+    REQUIRE(original_hash.hash == clone_hash.hash);
+}
+
+TEST_CASE("Fast-forwarding emulates the same as running normally")
+{
+    auto image = CreateIdleImage(Romset::MK2);
+
+    auto normal = CreateEmulator(image);
+    auto fast   = CreateEmulator(image);
+
+    SampleHash normal_hash, fast_hash;
+    normal->SetSampleCallback(HashSample, &normal_hash);
+    fast->SetSampleCallback(HashSample, &fast_hash);
+
+    const uint8_t note_on[] = {0x90, 0x40, 0x7f};
+    normal->PostMIDI(note_on);
+    fast->PostMIDI(note_on);
+
+    fast->SetFastForward(true);
+    normal->StepCycles(100'000);
+    fast->StepCycles(100'000);
+    fast->SetFastForward(false);
+
+    REQUIRE(normal_hash.count != 0);
+    REQUIRE(fast_hash.count == 0);
+    REQUIRE(fast->GetMCU().frames_posted == normal->GetMCU().frames_posted);
+
+    std::vector<uint8_t> normal_state, fast_state;
+    REQUIRE(normal->SaveState(normal_state));
+    REQUIRE(fast->SaveState(fast_state));
+    REQUIRE(normal_state == fast_state);
+
+    // Output picks up where it would have been
+    normal_hash = {};
+    normal->StepCycles(100'000);
+    fast->StepCycles(100'000);
+    REQUIRE(normal_hash.count == fast_hash.count);
+    REQUIRE(normal_hash.hash == fast_hash.hash);
+}
+
+TEST_CASE("Invalid states are rejected")
+{
+    auto image = std::make_shared<SharedRomImage>();
+    image->romset = Romset::MK2;
+    auto emu = CreateEmulator(image);
+
+    std::vector<uint8_t> state;
+    REQUIRE(emu->SaveState(state));
+
+    std::vector<uint8_t> truncated(state.begin(), state.end() - 1);
+    REQUIRE_FALSE(emu->LoadState(truncated));
+
+    std::vector<uint8_t> bad_magic = state;
+    bad_magic[0] ^= 0xff;
+    REQUIRE_FALSE(emu->LoadState(bad_magic));
+
+    auto other_image = std::make_shared<SharedRomImage>();
+    other_image->romset = Romset::JV880;
+    auto other = CreateEmulator(other_image);
+    REQUIRE_FALSE(other->LoadState(state));
+}
+
+TEST_CASE("State hashes follow the emulator state")
+{
+    auto image = CreateIdleImage(Romset::MK2);
+
+    auto original = CreateEmulator(image);
+    original->StepCycles(100'000);
+
+    auto clone = CreateEmulator(image);
+    REQUIRE(clone->CloneFrom(*original));
+    REQUIRE(clone->HashState() == original->HashState());
+
+    // Hashing doesn't change the state, so it can be taken in the middle of a render
+    const uint64_t before = original->HashState();
+    REQUIRE(original->HashState() == before);
+
+    const uint8_t note_on[] = {0x90, 0x40, 0x7f};
+    clone->PostMIDI(note_on);
+    REQUIRE(clone->HashState() != original->HashState());
+
+    original->StepCycles(1'000);
+    REQUIRE(original->HashState() != before);
+}
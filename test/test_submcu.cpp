@@ -0,0 +1,101 @@
+#include <catch2/catch_test_macros.hpp>
+#include "mcu.h"
+#include "submcu.h"
+#include <memory>
+#include <vector>
+
+// A sub mcu program that keeps touching everything the mcu can see: shared ram, port 1 and the midi input.
+static std::vector<uint8_t> MakeProgram()
+{
+    std::vector<uint8_t> rom(ROMSM_SIZE, 0xea);
+    const uint8_t program[] = {
+        0xa9, 0x04,       // 1000: lda #$04
+        0x8d, 0xe6, 0x00, // 1002: sta $00e6 ; enable uart rx
+        0xe6, 0x10,       // 1005: inc $10
+        0xad, 0x00, 0x02, // 1007: lda $0200 ; shared ram
+        0x85, 0x11,       // 100a: sta $11
+        0xa5, 0x10,       // 100c: lda $10
+        0x8d, 0x01, 0x02, // 100e: sta $0201
+        0x29, 0x3f,       // 1011: and #$3f
+        0xd0, 0x09,       // 1013: bne $101e
+        0x8d, 0xe0, 0x00, // 1015: sta $00e0 ; port 1
+        0xad, 0xe0, 0x00, // 1018: lda $00e0
+        0xad, 0xe8, 0x00, // 101b: lda $00e8 ; midi byte
+        0x4c, 0x05, 0x10, // 101e: jmp $1005
+    };
+    std::copy(std::begin(program), std::end(program), rom.begin());
+
+    // Reset vector
+    rom[0xffe] = 0x00;
+    rom[0xfff] = 0x10;
+    return rom;
+}
+
+struct SubMCURun
+{
+    std::unique_ptr<mcu_t>    mcu = std::make_unique<mcu_t>();
+    std::unique_ptr<submcu_t> sm  = std::make_unique<submcu_t>();
+
+    // Everything the mcu read from the sub mcu
+    std::vector<uint8_t> reads;
+    bool                 ran_ahead = false;
+};
+
+// Drives the sub mcu the way MCU_Step does, with the mcu accessing it and midi arriving between steps.
+static void RunSubMCU(SubMCURun& run, const std::vector<uint8_t>& rom, bool run_ahead)
+{
+    SM_Init(*run.sm, *run.mcu);
+    run.sm->rom       = rom.data();
+    run.sm->run_ahead = run_ahead;
+    SM_Reset(*run.sm);
+
+    for (uint64_t step = 1; step <= 200'000; ++step)
+    {
+        if (step % 997 == 0)
+            SM_SysWrite(*run.sm, 0x00, (uint8_t)step);
+        if (step % 1499 == 0)
+            run.reads.push_back(SM_SysRead(*run.sm, 0x01));
+        if (step % 5003 == 0)
+            MCU_PostUART(*run.mcu, (uint8_t)step);
+
+        SM_Update(*run.sm, step * MCU_CYCLES_PER_STEP);
+        run.ran_ahead |= run.sm->ahead;
+    }
+
+    SM_Sync(*run.sm);
+}
+
+TEST_CASE("Sub mcu running ahead matches running in step")
+{
+    const std::vector<uint8_t> rom = MakeProgram();
+
+    SubMCURun lockstep;
+    RunSubMCU(lockstep, rom, false);
+    REQUIRE(!lockstep.ran_ahead);
+
+    SubMCURun ahead;
+    RunSubMCU(ahead, rom, true);
+    REQUIRE(ahead.ran_ahead);
+
+    REQUIRE(ahead.reads == lockstep.reads);
+
+    const submcu_t& a = *ahead.sm;
+    const submcu_t& b = *lockstep.sm;
+    REQUIRE(a.pc == b.pc);
+    REQUIRE(a.a == b.a);
+    REQUIRE(a.x == b.x);
+    REQUIRE(a.y == b.y);
+    REQUIRE(a.s == b.s);
+    REQUIRE(a.sr == b.sr);
+    REQUIRE(a.cycles == b.cycles);
+    REQUIRE(a.timer_cycles == b.timer_cycles);
+    REQUIRE(a.uart_rx_gotbyte == b.uart_rx_gotbyte);
+    REQUIRE(std::equal(std::begin(a.ram), std::end(a.ram), std::begin(b.ram)));
+    REQUIRE(std::equal(std::begin(a.shared_ram), std::end(a.shared_ram), std::begin(b.shared_ram)));
+    REQUIRE(std::equal(std::begin(a.device_mode), std::end(a.device_mode), std::begin(b.device_mode)));
+
+    REQUIRE(ahead.mcu->p1_data == lockstep.mcu->p1_data);
+    REQUIRE(ahead.mcu->uart_rx_byte == lockstep.mcu->uart_rx_byte);
+    REQUIRE(ahead.mcu->uart_rx_delay == lockstep.mcu->uart_rx_delay);
+    REQUIRE(ahead.mcu->uart_read_ptr == lockstep.mcu->uart_read_ptr);
+}
@@ -0,0 +1,139 @@
+#include <catch2/catch_test_macros.hpp>
+#include "render_engine.h"
+#include <vector>
+
+// One track at 96 ticks per quarter note and the default 120bpm, so a tick is 5.2ms.
+static std::vector<uint8_t> MakeSMF(std::initializer_list<uint8_t> events)
+{
+    std::vector<uint8_t> bytes = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96, 'M', 'T', 'r', 'k', 0, 0, 0, 0};
+    bytes.insert(bytes.end(), events);
+    bytes.insert(bytes.end(), {0x00, 0xff, 0x2f, 0x00});
+
+    const size_t length = bytes.size() - 22;
+    bytes[18]           = (uint8_t)(length >> 24);
+    bytes[19]           = (uint8_t)(length >> 16);
+    bytes[20]           = (uint8_t)(length >> 8);
+    bytes[21]           = (uint8_t)length;
+    return bytes;
+}
+
+TEST_CASE("Times are parsed")
+{
+    uint64_t ns = 0;
+    REQUIRE(R_ParseTimeString("90", ns));
+    REQUIRE(ns == 90'000'000'000);
+    REQUIRE(R_ParseTimeString("1:30", ns));
+    REQUIRE(ns == 90'000'000'000);
+    REQUIRE(R_ParseTimeString("1:30.25", ns));
+    REQUIRE(ns == 90'250'000'000);
+    REQUIRE(R_ParseTimeString("1:02:03.000000001", ns));
+    REQUIRE(ns == 3'723'000'000'001);
+    REQUIRE(R_ParseTimeString("0.5", ns));
+    REQUIRE(ns == 500'000'000);
+
+    REQUIRE_FALSE(R_ParseTimeString("", ns));
+    REQUIRE_FALSE(R_ParseTimeString("1:60", ns));
+    REQUIRE_FALSE(R_ParseTimeString("1:2:3:4", ns));
+    REQUIRE_FALSE(R_ParseTimeString("1.5:30", ns));
+    REQUIRE_FALSE(R_ParseTimeString("1:", ns));
+    REQUIRE_FALSE(R_ParseTimeString(".5", ns));
+    REQUIRE_FALSE(R_ParseTimeString("1.", ns));
+    REQUIRE_FALSE(R_ParseTimeString("1.0000000001", ns));
+    REQUIRE_FALSE(R_ParseTimeString("-1", ns));
+    REQUIRE_FALSE(R_ParseTimeString("99999999999999999999", ns));
+}
+
+TEST_CASE("Time ranges cover the events inside them")
+{
+    const std::vector<uint8_t> bytes = MakeSMF({
+        0x00, 0x90, 0x3c, 0x64, // 0: note on at tick 0
+        0x60, 0x80, 0x3c, 0x00, // 1: note off at tick 96
+        0x60, 0x90, 0x3e, 0x64, // 2: note on at tick 192
+        0x60, 0x80, 0x3e, 0x00, // 3: note off at tick 288
+    });
+
+    SMF_Data data;
+    REQUIRE(SMF_ParseEvents(bytes, data));
+    const SMF_Track             merged      = SMF_MergeTracks(data);
+    const SMF_TrackView         view        = SMF_ViewTrack(merged);
+    const uint64_t              ns_per_step = R_NSPerStep(Romset::MK2);
+    const std::vector<uint64_t> times       = R_ComputeEventTimes(data, merged, ns_per_step);
+
+    const uint64_t quarter_ns = times[view.indices[1]];
+    REQUIRE(quarter_ns != 0);
+
+    // Starting on an event includes it
+    R_Segment range = R_SegmentFromTimeRange(view, times, ns_per_step, quarter_ns, 0);
+    REQUIRE(range.first_event == 1);
+    REQUIRE(range.last_event == view.Size());
+    REQUIRE(range.start_ns == quarter_ns);
+    REQUIRE(range.end_ns == 0);
+
+    // Starts are rounded down to a step
+    range = R_SegmentFromTimeRange(view, times, ns_per_step, quarter_ns + 1, 0);
+    REQUIRE(range.first_event == 1);
+    REQUIRE(range.start_ns == quarter_ns);
+
+    // Ending on an event leaves it out
+    range = R_SegmentFromTimeRange(view, times, ns_per_step, quarter_ns + ns_per_step, quarter_ns * 3);
+    REQUIRE(range.first_event == 2);
+    REQUIRE(range.last_event == 3);
+    REQUIRE(range.end_ns == quarter_ns * 3);
+
+    // Past the end of the track
+    range = R_SegmentFromTimeRange(view, times, ns_per_step, quarter_ns * 100, 0);
+    REQUIRE(range.first_event == view.Size());
+    REQUIRE(range.last_event == view.Size());
+}
+
+TEST_CASE("Messages overridden before a segment aren't replayed")
+{
+    const std::vector<uint8_t> bytes = MakeSMF({
+        0x00, 0xf0, 0x04, 0x41, 0x10, 0x42, 0xf7, // 0: sysex
+        0x00, 0xb0, 0x07, 0x10,                   // 1: ch1 volume, overridden by 6
+        0x00, 0xb0, 0x00, 0x01,                   // 2: ch1 bank select, overridden by 4
+        0x00, 0xc0, 0x05,                         // 3: ch1 program change, overridden by 7
+        0x00, 0xb0, 0x00, 0x02,                   // 4: ch1 bank select, applies to 7
+        0x00, 0x90, 0x3c, 0x64,                   // 5: note on
+        0x00, 0xb0, 0x07, 0x30,                   // 6: ch1 volume
+        0x00, 0xc0, 0x06,                         // 7: ch1 program change
+        0x00, 0xe0, 0x00, 0x40,                   // 8: ch1 pitch bend, kept for the data entry after it
+        0x00, 0xb0, 0x65, 0x00,                   // 9: ch1 rpn msb
+        0x00, 0xb0, 0x64, 0x00,                   // 10: ch1 rpn lsb
+        0x00, 0xb0, 0x06, 0x02,                   // 11: ch1 data entry
+        0x00, 0xe0, 0x00, 0x50,                   // 12: ch1 pitch bend
+        0x00, 0xb1, 0x07, 0x20,                   // 13: ch2 volume, overridden by 14
+        0x00, 0xb1, 0x07, 0x40,                   // 14: ch2 volume
+        0x00, 0x80, 0x3c, 0x00,                   // 15: note off
+        0x00, 0xb1, 0x0a, 0x40,                   // 16: first event of the segment
+    });
+
+    SMF_Data data;
+    REQUIRE(SMF_ParseEvents(bytes, data));
+    const SMF_Track     merged = SMF_MergeTracks(data);
+    const SMF_TrackView view   = SMF_ViewTrack(merged);
+
+    const std::vector<size_t> expected = {0, 4, 6, 7, 8, 9, 10, 11, 12, 14};
+    REQUIRE(R_SelectPrimeEvents(data, view, 16) == expected);
+
+    // The bank select before a program change that's kept applies to it
+    const std::vector<size_t> expected_before_bank = {0, 1, 2, 3};
+    REQUIRE(R_SelectPrimeEvents(data, view, 4) == expected_before_bank);
+}
+
+TEST_CASE("Messages aren't overridden across system exclusive messages")
+{
+    const std::vector<uint8_t> bytes = MakeSMF({
+        0x00, 0xb0, 0x07, 0x10,                   // 0: ch1 volume
+        0x00, 0xf0, 0x04, 0x41, 0x10, 0x42, 0xf7, // 1: sysex, which might reset the part
+        0x00, 0xb0, 0x07, 0x30,                   // 2: ch1 volume
+    });
+
+    SMF_Data data;
+    REQUIRE(SMF_ParseEvents(bytes, data));
+    const SMF_Track     merged = SMF_MergeTracks(data);
+    const SMF_TrackView view   = SMF_ViewTrack(merged);
+
+    const std::vector<size_t> expected = {0, 1, 2};
+    REQUIRE(R_SelectPrimeEvents(data, view, 3) == expected);
+}
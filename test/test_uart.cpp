@@ -0,0 +1,95 @@
+#include <catch2/catch_test_macros.hpp>
+#include "mcu.h"
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST_CASE("A full midi queue drops whole messages")
+{
+    auto mcu = std::make_unique<mcu_t>();
+
+    REQUIRE(MCU_GetUARTSpace(*mcu) == uart_buffer_size - 1);
+
+    std::vector<uint8_t> fill(uart_buffer_size - 2, 0x42);
+    REQUIRE(MCU_PostUART(*mcu, fill));
+    REQUIRE(MCU_GetUARTSpace(*mcu) == 1);
+
+    const uint8_t note_on[] = {0x90, 0x40, 0x7f};
+    REQUIRE_FALSE(MCU_PostUART(*mcu, note_on));
+    REQUIRE(mcu->uart_dropped == 3);
+    REQUIRE(MCU_GetUARTSpace(*mcu) == 1);
+
+    REQUIRE(MCU_PostUART(*mcu, 0xf8));
+    REQUIRE_FALSE(MCU_PostUART(*mcu, 0xf8));
+    REQUIRE(mcu->uart_dropped == 4);
+
+    // Nothing from the dropped messages made it in
+    for (size_t i = 0; i < fill.size(); ++i)
+    {
+        REQUIRE(MCU_HasUART(*mcu));
+        REQUIRE(MCU_PopUART(*mcu) == 0x42);
+    }
+    REQUIRE(MCU_HasUART(*mcu));
+    REQUIRE(MCU_PopUART(*mcu) == 0xf8);
+    REQUIRE_FALSE(MCU_HasUART(*mcu));
+}
+
+TEST_CASE("Midi bytes posted from another thread arrive in order")
+{
+    auto mcu = std::make_unique<mcu_t>();
+
+    // Messages of varying length so that they wrap around the end of the buffer at different offsets
+    constexpr uint32_t total = 1'000'000;
+
+    std::thread producer([&] {
+        uint8_t message[37];
+        uint32_t next = 0;
+        while (next < total)
+        {
+            const uint32_t length = std::min<uint32_t>(1 + next % sizeof(message), total - next);
+            for (uint32_t i = 0; i < length; ++i)
+                message[i] = (uint8_t)(next + i);
+
+            if (MCU_PostUART(*mcu, std::span<const uint8_t>(message, length)))
+                next += length;
+            else
+                std::this_thread::yield();
+        }
+    });
+
+    uint32_t received = 0;
+    bool in_order = true;
+    while (received < total)
+    {
+        if (!MCU_HasUART(*mcu))
+            continue;
+        in_order &= MCU_PopUART(*mcu) == (uint8_t)received;
+        ++received;
+    }
+
+    producer.join();
+
+    REQUIRE(in_order);
+    REQUIRE_FALSE(MCU_HasUART(*mcu));
+}
+
+TEST_CASE("The uart is idle once the firmware has read every byte")
+{
+    auto mcu = std::make_unique<mcu_t>();
+    // Receives on the mcu itself, without a sub mcu
+    mcu->family = RomsetFamily::SCB55;
+
+    REQUIRE(MCU_IsUARTIdle(*mcu));
+
+    REQUIRE(MCU_PostUART(*mcu, 0xfe));
+    REQUIRE_FALSE(MCU_IsUARTIdle(*mcu));
+
+    // Received but not yet read out of the register
+    mcu->uart_rx_byte = MCU_PopUART(*mcu);
+    mcu->dev_register[DEV_SSR] |= 0x40;
+    REQUIRE_FALSE(MCU_IsUARTIdle(*mcu));
+
+    mcu->dev_register[DEV_SSR] &= ~0x40;
+    REQUIRE(MCU_IsUARTIdle(*mcu));
+}
@@ -0,0 +1,22 @@
+// Helpers shared by the tests.
+
+#pragma once
+
+#include "audio.h"
+#include <cstdint>
+
+// FNV-1a hash of every sample an emulator produces, for comparing two runs without keeping their output.
+struct SampleHash
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    uint64_t count = 0;
+};
+
+// Sample callback that adds each frame to the SampleHash passed as `userdata`.
+inline void HashSample(void* userdata, const AudioFrame<int32_t>& frame)
+{
+    SampleHash& h = *(SampleHash*)userdata;
+    h.hash = (h.hash ^ (uint32_t)frame.left) * 0x100000001b3;
+    h.hash = (h.hash ^ (uint32_t)frame.right) * 0x100000001b3;
+    ++h.count;
+}
@@ -0,0 +1,78 @@
+#include <catch2/catch_test_macros.hpp>
+#include "emu.h"
+
+static void FillWaveRoms(SharedRomImage& image)
+{
+    for (size_t i = 0; i < PCM_WAVEROM1_SIZE; ++i)
+        image.waverom1[i] = (uint8_t)(i * 7 + 1);
+    for (size_t i = 0; i < PCM_WAVEROM2_SIZE; ++i)
+        image.waverom2[i] = (uint8_t)(i * 5 + 2);
+    for (size_t i = 0; i < PCM_WAVEROM3_SIZE; ++i)
+        image.waverom3[i] = (uint8_t)(i * 3 + 3);
+    for (size_t i = 0; i < PCM_WAVEROM_CARD_SIZE; ++i)
+        image.waverom_card[i] = (uint8_t)(i * 11 + 4);
+    for (size_t i = 0; i < PCM_WAVEROM_EXP_SIZE; ++i)
+        image.waverom_exp[i] = (uint8_t)((i >> 8) ^ i ^ 0x5a);
+}
+
+// How the pcm chip decoded wave rom addresses before the bank table
+static uint8_t ReferenceReadROM(const SharedRomImage& image,
+                                RomsetFamily          family,
+                                uint8_t               config_reg_3d,
+                                uint32_t              address)
+{
+    const uint32_t bank = (config_reg_3d & 0x20) ? (address >> 21) & 7 : (address >> 19) & 7;
+    switch (bank)
+    {
+    case 0:
+        return image.waverom1[address & (family == RomsetFamily::MK1 ? 0xfffff : 0x1fffff)];
+    case 1:
+        return image.waverom2[address & (family == RomsetFamily::JV880 ? 0x1fffff : 0xfffff)];
+    case 2:
+        if (family == RomsetFamily::JV880)
+            return image.waverom_card[address & 0x1fffff];
+        return image.waverom3[address & 0xfffff];
+    case 3:
+    case 4:
+    case 5:
+    case 6:
+        if (family == RomsetFamily::JV880)
+            return image.waverom_exp[(address & 0x1fffff) + (bank - 3) * 0x200000];
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+TEST_CASE("Wave rom banks agree with the address decoding")
+{
+    auto image = std::make_shared<SharedRomImage>();
+    FillWaveRoms(*image);
+
+    for (size_t romset_index = 0; romset_index < ROMSET_COUNT; ++romset_index)
+    {
+        auto emu = std::make_unique<Emulator>();
+        REQUIRE(emu->Init({}));
+
+        // Never shared, so it's fine to change it between iterations
+        image->romset = (Romset)romset_index;
+        REQUIRE(emu->LoadRoms(image));
+
+        pcm_t&             pcm    = emu->GetPCM();
+        const RomsetFamily family = emu->GetMCU().family;
+
+        for (uint8_t config_reg_3d : {0x00, 0x20})
+        {
+            PCM_Write(pcm, 0x3d, config_reg_3d);
+
+            // Every bank with both bank bit layouts, plus addresses near the bank edges
+            for (uint32_t address = 0; address < 0x1000000; address += 0x7ff3)
+            {
+                PCM_Write(pcm, 0x21, (uint8_t)(address >> 16));
+                PCM_Write(pcm, 0x22, (uint8_t)(address >> 8));
+                PCM_Write(pcm, 0x23, (uint8_t)address);
+                REQUIRE(PCM_Read(pcm, 0x3f) == ReferenceReadROM(*image, family, config_reg_3d, address));
+            }
+        }
+    }
+}